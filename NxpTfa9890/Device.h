@@ -1,173 +1,1051 @@
-//Copyright (C) Microsoft Corporation, All Rights Reserved
-//
-//Abstract:
-//
-//    This module contains the type definitions for the client
-//    driver's device callback class.
-//
-//Environment:
-//
-//    Windows User-Mode Driver Framework (UMDF)
-
-#pragma once
-
-#include <windows.h>
-#include <wdf.h>
-#include <reshub.h>
-#include <strsafe.h>
-
-#include <SensorsDef.h>
-#include <SensorsCx.h>
-#include <sensorsutils.h>
-#include <SensorsDriversUtils.h>
-
-#include "TFA9890.h"
-#include "SensorsTrace.h"
-
-
-
-#define PA_POOL_TAG_ACCELEROMETER 'NXPA'
-
-
-// Sensor Common Properties
-typedef enum
-{
-    SENSOR_PROPERTY_STATE = 0,
-    SENSOR_PROPERTIES_COUNT
-} SENSOR_PROPERTIES_INDEX;
-
-// Sensor Enumeration Properties
-typedef enum
-{
-    SENSOR_ENUMERATION_PROPERTY_TYPE = 0,
-	SENSOR_ENUMERATION_PROPERTY_CATEGORY,
-    SENSOR_ENUMERATION_PROPERTY_MANUFACTURER,
-    SENSOR_ENUMERATION_PROPERTY_MODEL,
-    SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID,
-	SENSOR_ENUMERATION_PROPERTY_SUBTYPE,
-    SENSOR_ENUMERATION_PROPERTIES_COUNT
-} SENSOR_ENUMERATION_PROPERTIES_INDEX;
-
-// Data-field Properties
-typedef enum
-{
-    SENSOR_DATA_ACCELERATION_X_G = 0,
-    SENSOR_DATA_ACCELERATION_Y_G,
-    SENSOR_DATA_ACCELERATION_Z_G,
-    SENSOR_DATA_TIMESTAMP,
-    SENSOR_DATA_COUNT
-} SENSOR_DATA_INDEX;
-
-typedef enum
-{
-    SENSOR_DATA_FIELD_PROPERTY_RESOLUTION = 0,
-    SENSOR_DATA_FIELD_PROPERTY_RANGE_MIN,
-    SENSOR_DATA_FIELD_PROPERTY_RANGE_MAX,
-    SENSOR_DATA_FIELD_PROPERTIES_COUNT
-} SENSOR_DATA_FIELD_PROPERTIES_INDEX;
-
-typedef struct _REGISTER_SETTING
-{
-    BYTE Register;
-    BYTE Value;
-} REGISTER_SETTING, *PREGISTER_SETTING;
-
-
-//inline DATA_RATE _GetDataRateFromReportInterval(_In_ ULONG ReportInterval);
-
-// Array of settings that describe the initial device configuration.
-//const REGISTER_SETTING g_ConfigurationSettings[] =
-//{
-//    // Standby mode
-//    { TFA9890_POWER_CTL, TFA9890_POWER_CTL_STANDBY },
-//    // +-16g, 13-bit resolution
-//    { TFA9890_DATA_FORMAT, 
-//      TFA9890_DATA_FORMAT_FULL_RES | TFA9890_DATA_FORMAT_JUSTIFY_RIGHT | TFA9890_DATA_FORMAT_RANGE_16G },
-//    // No FIFO
-//    { TFA9890_FIFO_CTL, TFA9890_FIFO_CTL_MODE_BYPASS },
-//    // Data rate set to default
-//    { TFA9890_BW_RATE, _GetDataRateFromReportInterval(DEFAULT_ACCELEROMETER_REPORT_INTERVAL).RateCode },
-//    // Activity threshold set to default change sensitivity
-//    { TFA9890_THRESH_ACT,
-//      static_cast<BYTE>(DEFAULT_ACCELEROMETER_CHANGE_SENSITIVITY / ACCELEROMETER_CHANGE_SENSITIVITY_RESOLUTION) },
-//    // Activity detection enabled, AC coupled
-//    { TFA9890_ACT_INACT_CTL, 
-//      TFA9890_ACT_INACT_CTL_ACT_ACDC | TFA9890_ACT_INACT_CTL_ACT_X | TFA9890_ACT_INACT_CTL_ACT_Y | TFA9890_ACT_INACT_CTL_ACT_Z },
-//    // Activity interrupt mapped to pin 1
-//    { TFA9890_INT_MAP, TFA9890_INT_ACTIVITY ^ TFA9890_INT_MASK},
-//};
-
-
-
-typedef class _NxpTfa9890Device
-{
-private:
-    // WDF
-    WDFDEVICE                   m_Device;
-    WDFIOTARGET                 m_I2CIoTarget1;
-	WDFIOTARGET                 m_I2CIoTarget2;
-    WDFWAITLOCK                 m_I2CWaitLock;
-    WDFINTERRUPT                m_Interrupt;
-
-    // Sensor Operation
-    bool                        m_PoweredOn;
-    bool                        m_Started;
-    ULONG                       m_Interval;
-
-    bool                        m_FirstSample;
-    VEC3D                       m_CachedThresholds;
-    VEC3D                       m_LastSample;
-
-    SENSOROBJECT                m_SensorInstance;
-
-    //// Sensor Specific Properties
-    //PSENSOR_PROPERTY_LIST       m_pSupportedDataFields;
-    PSENSOR_COLLECTION_LIST     m_pEnumerationProperties;
-    PSENSOR_COLLECTION_LIST     m_pSensorProperties;
-    //PSENSOR_COLLECTION_LIST     m_pSensorData;
-    //PSENSOR_COLLECTION_LIST     m_pDataFieldProperties;
-    //PSENSOR_COLLECTION_LIST     m_pThresholds;
-
-public:
-    // WDF callbacks
-    static EVT_WDF_DRIVER_DEVICE_ADD                OnDeviceAdd;
-    static EVT_WDF_DEVICE_PREPARE_HARDWARE          OnPrepareHardware;
-    static EVT_WDF_DEVICE_RELEASE_HARDWARE          OnReleaseHardware;
-    static EVT_WDF_DEVICE_D0_ENTRY                  OnD0Entry;
-    static EVT_WDF_DEVICE_D0_EXIT                   OnD0Exit;
-
-    // CLX callbacks
-    static EVT_SENSOR_DRIVER_START_SENSOR               OnStart;
-    static EVT_SENSOR_DRIVER_STOP_SENSOR                OnStop;
-    static EVT_SENSOR_DRIVER_GET_SUPPORTED_DATA_FIELDS  OnGetSupportedDataFields;
-    static EVT_SENSOR_DRIVER_GET_PROPERTIES             OnGetProperties;
-    static EVT_SENSOR_DRIVER_GET_DATA_FIELD_PROPERTIES  OnGetDataFieldProperties;
-    static EVT_SENSOR_DRIVER_GET_DATA_INTERVAL          OnGetDataInterval;
-    static EVT_SENSOR_DRIVER_SET_DATA_INTERVAL          OnSetDataInterval;
-    static EVT_SENSOR_DRIVER_GET_DATA_THRESHOLDS        OnGetDataThresholds;
-    static EVT_SENSOR_DRIVER_SET_DATA_THRESHOLDS        OnSetDataThresholds;
-    static EVT_SENSOR_DRIVER_DEVICE_IO_CONTROL          OnIoControl;
-
-    // Interrupt callbacks
-    //static EVT_WDF_INTERRUPT_ISR       OnInterruptIsr;
-    //static EVT_WDF_INTERRUPT_WORKITEM  OnInterruptWorkItem;
-
-private:
-    NTSTATUS                    GetData();
-
-    // Helper function for OnPrepareHardware to initialize sensor to default properties
-    NTSTATUS                    Initialize(_In_ WDFDEVICE Device, _In_ SENSOROBJECT SensorInstance);
-    VOID                        DeInit();
-
-    // Helper function for OnPrepareHardware to get resources from ACPI and configure the I/O target
-    NTSTATUS                    ConfigureIoTarget(_In_ WDFCMRESLIST ResourceList,
-                                                  _In_ WDFCMRESLIST ResourceListTranslated);
-
-    // Helper function for OnD0Entry which sets up device to default configuration
-    NTSTATUS                    PowerOn();
-    NTSTATUS                    PowerOff();
-
-} NxpTfa9890Device, *PNxpTfa9890Device;
-
-// Set up accessor function to retrieve device context
-WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(NxpTfa9890Device, GetNxpTfa9890ContextFromSensorInstance);
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the client
+//    driver's device callback class.
+//
+//Environment:
+//
+//    Windows User-Mode Driver Framework (UMDF)
+
+#pragma once
+
+#include <windows.h>
+#include <wdf.h>
+#include <reshub.h>
+#include <strsafe.h>
+
+#include <SensorsDef.h>
+#include <SensorsCx.h>
+#include <sensorsutils.h>
+#include <SensorsDriversUtils.h>
+
+#include "TFA9890.h"
+#include "SensorsTrace.h"
+#include "Scheduler.h"
+#include "Diag.h"
+#include "Tfa9890Ioctl.h"
+#include "Tfa9890Trace.h"
+#include "Tfa9890History.h"
+
+
+
+#define PA_POOL_TAG_ACCELEROMETER 'NXPA'
+
+
+// Sensor Common Properties
+typedef enum
+{
+    SENSOR_PROPERTY_STATE = 0,
+    SENSOR_PROPERTIES_COUNT
+} SENSOR_PROPERTIES_INDEX;
+
+// Sensor Enumeration Properties
+typedef enum
+{
+    SENSOR_ENUMERATION_PROPERTY_TYPE = 0,
+	SENSOR_ENUMERATION_PROPERTY_CATEGORY,
+    SENSOR_ENUMERATION_PROPERTY_MANUFACTURER,
+    SENSOR_ENUMERATION_PROPERTY_MODEL,
+    SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID,
+	SENSOR_ENUMERATION_PROPERTY_SUBTYPE,
+    SENSOR_ENUMERATION_PROPERTIES_COUNT
+} SENSOR_ENUMERATION_PROPERTIES_INDEX;
+
+// Data-field Properties
+typedef enum
+{
+    SENSOR_DATA_TIMESTAMP = 0,
+    SENSOR_DATA_TEMPERATURE_C,      // Of the sensor's amp
+    SENSOR_DATA_BATTERY_V,
+    SENSOR_DATA_FAULTS,             // Fault status bits
+    SENSOR_DATA_INTERVAL_MS,        // Sampling interval in effect
+    SENSOR_DATA_WINDOW_SAMPLES,     // Telemetry samples in the window, 0 without aggregation
+    SENSOR_DATA_TEMPERATURE_MIN,    // Window statistics of the sensor's amp
+    SENSOR_DATA_TEMPERATURE_MAX,
+    SENSOR_DATA_TEMPERATURE_MEAN,
+    SENSOR_DATA_TEMPERATURE_RMS,
+    SENSOR_DATA_IMPEDANCE_MIN,      // DSP full scale = 1.0
+    SENSOR_DATA_IMPEDANCE_MAX,
+    SENSOR_DATA_IMPEDANCE_MEAN,
+    SENSOR_DATA_IMPEDANCE_RMS,
+    SENSOR_DATA_EXCURSION_MIN,      // DSP full scale = 1.0
+    SENSOR_DATA_EXCURSION_MAX,
+    SENSOR_DATA_EXCURSION_MEAN,
+    SENSOR_DATA_EXCURSION_RMS,
+    SENSOR_DATA_COUNT
+} SENSOR_DATA_INDEX;
+
+// Data thresholds, per amp sensor, keyed like the data fields they apply to
+typedef enum
+{
+    SENSOR_THRESHOLD_TEMPERATURE_C = 0,
+    SENSOR_THRESHOLD_BATTERY_V,
+    SENSOR_THRESHOLDS_COUNT
+} SENSOR_THRESHOLDS_INDEX;
+
+typedef enum
+{
+    SENSOR_DATA_FIELD_PROPERTY_RESOLUTION = 0,
+    SENSOR_DATA_FIELD_PROPERTY_RANGE_MIN,
+    SENSOR_DATA_FIELD_PROPERTY_RANGE_MAX,
+    SENSOR_DATA_FIELD_PROPERTIES_COUNT
+} SENSOR_DATA_FIELD_PROPERTIES_INDEX;
+
+typedef struct _REGISTER_SETTING
+{
+    BYTE Register;
+    WORD Value;
+    BYTE Flags;         // TFA9890_STEP_*
+} REGISTER_SETTING, *PREGISTER_SETTING;
+
+// Bus error accounting for one amplifier. These are cumulative for the
+// lifetime of the device so they can be correlated with bus noise.
+typedef struct _TFA9890_RECOVERY_STATS
+{
+    ULONG Transactions;     // I2C transactions issued, including retries
+    ULONG Retries;          // Transactions re-issued after a failure
+    ULONG Recovered;        // Transactions that succeeded after at least one retry
+    ULONG Failures;         // Transactions that exhausted their retries
+    ULONG Resumes;          // Sequences resumed from a previously failed step
+    ULONG DeadlineHits;     // Retries abandoned because of the latency cap
+} TFA9890_RECOVERY_STATS, *PTFA9890_RECOVERY_STATS;
+
+// Power sequencing state of one amplifier. Every step is either a write
+// in flight or a timer wait, so no thread waits for the hardware.
+typedef enum _TFA9890_SEQ_STATE
+{
+    Tfa9890SeqIdle = 0,
+    Tfa9890SeqWrite,                // Step write in flight
+    Tfa9890SeqBackoff,              // Waiting to re-issue a failed write
+    Tfa9890SeqSlot,                 // Waiting for a power slot, or for the second pass
+    Tfa9890SeqSettle,               // Waiting out a settle step
+    Tfa9890SeqDone,                 // Sequence fully written
+    Tfa9890SeqFailed,               // Stopped at NextStep in this pass
+    Tfa9890SeqStateCount
+} TFA9890_SEQ_STATE;
+
+// What a run of the sequencer writes, and what completes it
+typedef enum _TFA9890_SEQ_RUN
+{
+    Tfa9890RunPowerUp = 0,          // Every amp, from the init sequence or its hibernate image; FinishPowerUp
+    Tfa9890RunRestore,              // Amps the watchdog found reset, from an image of their shadow; FinishRestore
+    Tfa9890RunPowerStage,           // System control of the online amps, to gate or power their output stage; FinishPowerStage
+} TFA9890_SEQ_RUN;
+
+// A stream hint waiting for a power-stage run, or behind one
+typedef struct _TFA9890_PENDING_HINT
+{
+    WDFREQUEST              Request;
+    TFA9890_STREAM_HINT     Hint;
+    LONGLONG                Received;       // QPC time the hint arrived
+    bool                    PoweredUp;      // The amps were powered up for it; Status tells how that went
+    NTSTATUS                Status;
+} TFA9890_PENDING_HINT, *PTFA9890_PENDING_HINT;
+
+// Read-back verification of one amplifier's sequences
+typedef struct _TFA9890_VERIFY_STATS
+{
+    ULONG       Passes;             // Sequences verified
+    ULONG       Checked;            // Registers compared
+    ULONG       Mismatches;         // Registers that did not read back as written
+    ULONG       Rewrites;           // Mismatches rewritten and read back correctly
+    ULONG       Failures;           // Read-backs or rewrites that failed
+    ULONGLONG   BusUs;              // Bus time spent verifying and rewriting
+} TFA9890_VERIFY_STATS, *PTFA9890_VERIFY_STATS;
+
+// One write of a hibernate image: a burst of consecutive registers, or a
+// step of the init sequence's power-up
+typedef struct _TFA9890_HIBERNATE_BURST
+{
+    BYTE    Register;           // First register
+    BYTE    Count;              // Registers written, 0 for a settle step
+    BYTE    Flags;              // TFA9890_STEP_*
+    WORD    Word;               // First value in Words, or ms to wait for a settle step
+} TFA9890_HIBERNATE_BURST, *PTFA9890_HIBERNATE_BURST;
+
+// State of one amplifier captured on D0 exit, in the order it is written
+// back: the configuration registers, then the power steps. Kept with the
+// amp's learned state, by connection.
+typedef struct _TFA9890_HIBERNATE_IMAGE
+{
+    ULONG                   Checksum;       // FNV-1a of the rest of the image, 0 if there is none
+    ULONG                   ProfileHash;    // Init sequence the image was captured under
+    ULONG                   BurstCount;
+    ULONG                   WordCount;
+    TFA9890_HIBERNATE_BURST Bursts[TFA9890_HIBERNATE_MAX_BURSTS];
+    WORD                    Words[TFA9890_HIBERNATE_MAX_WORDS];     // Bus byte order
+    ULONG                   Written[TFA9890_REGISTER_COUNT / 32];   // Registers the image writes
+    LONG                    EqCoeffs[TFA9890_EQ_BANDS][TFA9890_EQ_COEFFS];  // Active bank
+    ULONG                   EqValid;
+    ULONG                   EqBank;
+} TFA9890_HIBERNATE_IMAGE, *PTFA9890_HIBERNATE_IMAGE;
+
+// Bus limits and costs measured by the autotuning probe. Kept with the
+// amp's learned state, by connection.
+typedef struct _TFA9890_BUS_TUNING
+{
+    bool    Valid;                  // Probed successfully
+    bool    Stale;                  // Error rate rose; probed again on the next power-up
+    bool    Limited;                // A read longer than MaxBurstBytes failed
+    ULONG   MaxBurstBytes;          // Longest read that always succeeded
+    ULONG   OverheadUs;             // Fixed cost of one transaction
+    ULONG   ByteNs;                 // Cost of each byte transferred
+    ULONG   ChunkBytes;             // Bulk chunk used by the batching paths
+    ULONG   Probes;
+    ULONG   Transactions;           // In the current error-rate window
+    ULONG   Errors;
+} TFA9890_BUS_TUNING, *PTFA9890_BUS_TUNING;
+
+// Per-amplifier state. Each amplifier sits behind its own I2C connection
+// and is brought up independently so a bad amp cannot take down the others.
+typedef struct _TFA9890_AMP
+{
+    WDFIOTARGET             IoTarget;
+    LARGE_INTEGER           ConnectionId;
+    bool                    Online;         // Sequence fully written
+    bool                    Failed;         // Sequence stopped in the current pass
+    ULONG                   NextStep;       // First step not yet written, of the init sequence or the hibernate image
+    LONGLONG                EnableStart;    // QPC time of the first power step, 0 if not started
+    NTSTATUS                LastStatus;
+    TFA9890_RECOVERY_STATS  Recovery;
+    TFA9890_BUS_TUNING      Tuning;
+    Tfa9890BusScheduler     Scheduler;      // Grants this amp's bus by priority class
+
+    // Values last written successfully, in bus byte order
+    WORD                    Shadow[TFA9890_REGISTER_COUNT];
+    ULONG                   ShadowValid[TFA9890_REGISTER_COUNT / 32];
+
+    // Changes waiting for the next synchronized commit, sorted by register
+    REGISTER_SETTING        Staged[TFA9890_MAX_STAGED];
+    ULONG                   StagedCount;
+
+    // DSP parameter banks. EQ coefficients last uploaded to each bank, 1.23
+    // fixed point; bit n of EqValid is set if EqCoeffs[][n] matches the DSP.
+    LONG                    EqCoeffs[TFA9890_DSP_BANKS][TFA9890_EQ_BANDS][TFA9890_EQ_COEFFS];
+    ULONG                   EqValid[TFA9890_DSP_BANKS];
+    ULONG                   ActiveBank;     // Bank the DSP is running from
+    bool                    BankPending;    // Idle bank holds a set not yet switched to
+    bool                    EqLoading;      // LoadEqBank is writing the idle bank; a restore clears it
+
+    // Speaker model stream
+    ULONG                   ModelSequence;  // Last DSP model frame fetched
+    bool                    ModelPrimed;    // ModelSequence is valid
+
+    // Speaker health diagnostics. The baseline fields hold sums until
+    // DiagBaselineWindows reaches TFA9890_DIAG_BASELINE_WINDOWS.
+    float                   DiagExcursion[TFA9890_DIAG_WINDOW];
+    float                   DiagImpedance[TFA9890_DIAG_WINDOW];
+    ULONG                   DiagCount;
+    ULONG                   DiagBaselineWindows;
+    float                   DiagBaselineRe;
+    float                   DiagBaselineResonanceHz;
+    TFA9890_HEALTH          Health;         // Published summary, guarded by m_HealthLock
+
+    // Reset watchdog, guarded by m_I2CWaitLock
+    TFA9890_WATCHDOG_AMP    Watchdog;
+
+    // Asynchronous power sequencing. The state is guarded by
+    // m_SequenceLock; the request, its buffer and the timer are used by one
+    // step at a time.
+    TFA9890_SEQ_STATE       SeqState;
+    LONGLONG                SeqStateStart;  // QPC time SeqState was entered
+    ULONG                   SeqStateUs[Tfa9890SeqStateCount];   // Time spent per state in this power-up
+    ULONG                   SeqAttempt;     // Failed attempts of the current step
+    LONGLONG                SeqSendStart;   // QPC time the write in flight was sent
+    WDFREQUEST              SeqRequest;
+    ULONG                   SeqOffset;      // Registers of the current step already written
+    ULONG                   SeqLength;      // Bytes of SeqBuffer in the write in flight
+    WDFMEMORY               SeqMemory;      // Describes SeqBuffer
+    BYTE                    SeqBuffer[1 + TFA9890_TUNE_MAX_BYTES];  // Register address, values
+    WDFTIMER                SeqTimer;
+    WORD                    SeqPowerStage;  // System control a power-stage run writes, bus byte order
+
+    // Write verification, guarded by m_I2CWaitLock
+    TFA9890_VERIFY_STATS    Verify;
+    ULONG                   VerifyCursor;   // Next candidate checked by a sampled pass
+
+    // State captured on the last D0 exit, guarded by m_I2CWaitLock
+    TFA9890_HIBERNATE_IMAGE Hibernate;
+} TFA9890_AMP, *PTFA9890_AMP;
+
+// Learned amp state saved in the driver's store when the hardware is
+// released, and reattached when the same connection is prepared again
+typedef struct _TFA9890_AMP_STATE
+{
+    LONGLONG                ConnectionId;   // 0 if the entry is free
+    ULONGLONG               Saved;          // Save order; the oldest entry is reused first
+    TFA9890_RECOVERY_STATS  Recovery;
+    TFA9890_BUS_TUNING      Tuning;
+    WORD                    Shadow[TFA9890_REGISTER_COUNT];
+    ULONG                   ShadowValid[TFA9890_REGISTER_COUNT / 32];
+    LONG                    EqCoeffs[TFA9890_DSP_BANKS][TFA9890_EQ_BANDS][TFA9890_EQ_COEFFS];
+    ULONG                   EqValid[TFA9890_DSP_BANKS];
+    ULONG                   ActiveBank;
+    bool                    BankPending;
+    ULONG                   DiagBaselineWindows;
+    float                   DiagBaselineRe;
+    float                   DiagBaselineResonanceHz;
+    TFA9890_HIBERNATE_IMAGE Hibernate;
+} TFA9890_AMP_STATE, *PTFA9890_AMP_STATE;
+
+// One telemetry sample, combined over the online amps
+typedef struct _TFA9890_TELEMETRY
+{
+    float   TemperatureC;
+    float   BatteryV;
+    ULONG   Faults;                 // TFA9890_STATUS_FAULTS bits, numeric
+} TFA9890_TELEMETRY, *PTFA9890_TELEMETRY;
+
+// Adaptive sampling rate of one telemetry consumer: the sensor of one amp,
+// or the subscriptions and the history, which share the reads of every amp
+typedef struct _TFA9890_SAMPLE_RATE
+{
+    ULONG               Demand;             // Fastest interval needed, 0 if none
+    ULONG               Effective;          // Interval in effect
+    ULONG               StableSamples;
+    LONGLONG            NextReadQpc;
+    bool                FirstSample;        // The next sample is reported whatever it reads
+    TFA9890_TELEMETRY   Last;               // Last reported
+    ULONG               Count;
+    ULONG               Backoffs;
+    ULONG               RampUps;
+    ULONGLONG           IntervalTotal;
+} TFA9890_SAMPLE_RATE, *PTFA9890_SAMPLE_RATE;
+
+// Sensor instance of one amplifier. Each has its own interval, thresholds
+// and start state, and only its own amp is read for it.
+typedef struct _TFA9890_AMP_SENSOR
+{
+    SENSOROBJECT            SensorInstance; // NULL if not created
+    bool                    Started;
+    ULONG                   Interval;       // Client's interval
+    float                   TemperatureStepC;   // Client's thresholds
+    float                   BatteryStepV;
+    TFA9890_SAMPLE_RATE     Rate;
+    PSENSOR_COLLECTION_LIST pEnumerationProperties;
+    PSENSOR_COLLECTION_LIST pSensorData;
+    PSENSOR_COLLECTION_LIST pThresholds;
+} TFA9890_AMP_SENSOR, *PTFA9890_AMP_SENSOR;
+
+// Statistics of one channel over an aggregation window
+typedef struct _TFA9890_WINDOW_STATS
+{
+    float   Min;
+    float   Max;
+    float   Mean;
+    float   Rms;
+} TFA9890_WINDOW_STATS, *PTFA9890_WINDOW_STATS;
+
+// One closed aggregation window, combined over the amps. Channels with no
+// samples in the window are all 0.
+typedef struct _TFA9890_AGGREGATES
+{
+    ULONG                   Samples;        // Telemetry samples in the window
+    TFA9890_WINDOW_STATS    Temperature;
+    TFA9890_WINDOW_STATS    Impedance;
+    TFA9890_WINDOW_STATS    Excursion;
+} TFA9890_AGGREGATES, *PTFA9890_AGGREGATES;
+
+// Start of one timed run of a flow
+typedef struct _TFA9890_PERF_MARK
+{
+    LONGLONG    Qpc;
+    ULONG       Transactions;   // Bus transactions of all amps so far
+} TFA9890_PERF_MARK, *PTFA9890_PERF_MARK;
+
+// Telemetry subscription of one handle. Owner is NULL if the slot is free.
+typedef struct _TFA9890_SUBSCRIPTION
+{
+    WDFFILEOBJECT   Owner;
+    ULONG           IntervalMs;
+    ULONG           Fields;
+    LONGLONG        DueQpc;         // Next delivery
+    LONGLONG        IdleQpc;        // Last time a read was pending
+    ULONG           Skipped;
+    WDFREQUEST      Pending;        // Read waiting for the next delivery
+} TFA9890_SUBSCRIPTION, *PTFA9890_SUBSCRIPTION;
+
+// Chunk size for bulk transfers: the tuned one, or the conservative default
+// while the amp is untuned or its tuning is in doubt
+inline ULONG BulkChunkBytes(
+    _In_ const TFA9890_AMP* pAmp)
+{
+    return (pAmp->Tuning.Valid && !pAmp->Tuning.Stale) ? pAmp->Tuning.ChunkBytes : TFA9890_BULK_CHUNK_BYTES;
+}
+
+// Limit a requested chunk to what the probe found the amp can take
+inline ULONG ClampChunkBytes(
+    _In_ const TFA9890_AMP* pAmp,
+    _In_ ULONG ChunkBytes)
+{
+    return (pAmp->Tuning.Valid && pAmp->Tuning.Limited) ? min(ChunkBytes, pAmp->Tuning.MaxBurstBytes) : ChunkBytes;
+}
+
+inline bool IsRegisterShadowed(
+    _In_ const TFA9890_AMP* pAmp,
+    _In_ ULONG Register)
+{
+    return 0 != (pAmp->ShadowValid[Register / 32] & (1UL << (Register % 32)));
+}
+
+// Registers written back by a restore. Writes to the DSP window stream
+// into DSP memory; the DSP is restored from the images and the EQ bank.
+inline bool IsRestorable(
+    _In_ ULONG Register)
+{
+    return Register < TFA9890_CF_CONTROLS || Register > TFA9890_CF_STATUS;
+}
+
+// Helpers for measuring bus latencies with the performance counter
+inline LONGLONG QpcNow()
+{
+    LARGE_INTEGER Counter;
+    QueryPerformanceCounter(&Counter);
+    return Counter.QuadPart;
+}
+
+inline LONGLONG QpcFromMs(_In_ ULONG Milliseconds)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    return (Frequency.QuadPart * Milliseconds) / 1000;
+}
+
+inline ULONG QpcToUs(_In_ LONGLONG Ticks)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    return static_cast<ULONG>((Ticks * 1000000) / Frequency.QuadPart);
+}
+
+// Sign-extend one 24-bit DSP word, most significant byte first
+inline LONG DspWordToLong(_In_reads_bytes_(TFA9890_DSP_WORD_BYTES) const BYTE* pWord)
+{
+    return static_cast<LONG>((static_cast<ULONG>(pWord[0]) << 24) |
+                             (static_cast<ULONG>(pWord[1]) << 16) |
+                             (static_cast<ULONG>(pWord[2]) << 8)) >> 8;
+}
+
+
+//inline DATA_RATE _GetDataRateFromReportInterval(_In_ ULONG ReportInterval);
+
+// Array of settings that describe the initial device configuration.
+//const REGISTER_SETTING g_ConfigurationSettings[] =
+//{
+//    // Standby mode
+//    { TFA9890_POWER_CTL, TFA9890_POWER_CTL_STANDBY },
+//    // +-16g, 13-bit resolution
+//    { TFA9890_DATA_FORMAT, 
+//      TFA9890_DATA_FORMAT_FULL_RES | TFA9890_DATA_FORMAT_JUSTIFY_RIGHT | TFA9890_DATA_FORMAT_RANGE_16G },
+//    // No FIFO
+//    { TFA9890_FIFO_CTL, TFA9890_FIFO_CTL_MODE_BYPASS },
+//    // Data rate set to default
+//    { TFA9890_BW_RATE, _GetDataRateFromReportInterval(DEFAULT_ACCELEROMETER_REPORT_INTERVAL).RateCode },
+//    // Activity threshold set to default change sensitivity
+//    { TFA9890_THRESH_ACT,
+//      static_cast<BYTE>(DEFAULT_ACCELEROMETER_CHANGE_SENSITIVITY / ACCELEROMETER_CHANGE_SENSITIVITY_RESOLUTION) },
+//    // Activity detection enabled, AC coupled
+//    { TFA9890_ACT_INACT_CTL, 
+//      TFA9890_ACT_INACT_CTL_ACT_ACDC | TFA9890_ACT_INACT_CTL_ACT_X | TFA9890_ACT_INACT_CTL_ACT_Y | TFA9890_ACT_INACT_CTL_ACT_Z },
+//    // Activity interrupt mapped to pin 1
+//    { TFA9890_INT_MAP, TFA9890_INT_ACTIVITY ^ TFA9890_INT_MASK},
+//};
+
+// Built-in init sequence, compiled as profile "Bypass" alongside the registry ones
+const REGISTER_SETTING g_BypassSequence[] =
+{
+    { TFA9890_I2S_CONTROL,      TFA9890_I2S_CONTROL_BYPASS,         0 },
+    { TFA9890_SYSTEM_CONTROL,   TFA9890_SYSTEM_CONTROL_BYPASS_1,    TFA9890_STEP_POWER },
+    { TFA9890_SYSTEM_CONTROL,   TFA9890_SYSTEM_CONTROL_BYPASS_2,    TFA9890_STEP_POWER },
+};
+
+// Init sequence written to an amplifier on D0 entry. Profiles are compiled
+// once per driver load and shared read-only by all devices.
+typedef struct _TFA9890_INIT_PROFILE
+{
+    WCHAR               Name[TFA9890_PROFILE_NAME_CHARS];
+    ULONG               StepCount;
+    REGISTER_SETTING    Steps[TFA9890_MAX_INIT_STEPS];  // Values in bus byte order
+} TFA9890_INIT_PROFILE, *PTFA9890_INIT_PROFILE;
+
+typedef struct _TFA9890_PROFILE_SET
+{
+    ULONG                   Count;
+    ULONG                   Default;                    // Used by devices that name no profile
+    TFA9890_INIT_PROFILE    Profiles[TFA9890_MAX_PROFILES];
+} TFA9890_PROFILE_SET, *PTFA9890_PROFILE_SET;
+
+// One cached DSP image, shared read-only by every device that references it
+typedef struct _TFA9890_IMAGE
+{
+    ULONGLONG                       Hash;       // FNV-1a of the file contents
+    ULONG                           Bytes;      // 0 if the entry is free
+    ULONG                           References;
+    WDFMEMORY                       Memory;
+    const TFA9890_DSP_IMAGE_HEADER* pHeader;    // Followed by the packed words
+    WCHAR                           Path[MAX_PATH]; // File the image was first loaded from
+} TFA9890_IMAGE, *PTFA9890_IMAGE;
+
+typedef struct _TFA9890_IMAGE_CACHE
+{
+    SRWLOCK                     Lock;
+    TFA9890_IMAGE               Images[TFA9890_IMAGE_CACHE_ENTRIES];
+    TFA9890_IMAGE_CACHE_OUTPUT  Stats;
+} TFA9890_IMAGE_CACHE, *PTFA9890_IMAGE_CACHE;
+
+NTSTATUS ImageCacheAcquire(_In_ PCWSTR Path, _Out_ const TFA9890_IMAGE** ppImage);
+VOID ImageCacheRelease(_In_ const TFA9890_IMAGE* pImage);
+VOID ImageCacheQuery(_Out_ PTFA9890_IMAGE_CACHE_OUTPUT pOutput);
+
+VOID ProfileCompileAll(_In_ WDFDRIVER Driver, _Out_ PTFA9890_PROFILE_SET pSet);
+const TFA9890_INIT_PROFILE* ProfileFind(_In_ const TFA9890_PROFILE_SET* pSet, _In_opt_ PCWSTR Name);
+
+
+// Size of the speaker model stream section
+#define TFA9890_STREAM_VIEW_BYTES           (sizeof(TFA9890_STREAM_HEADER) + TFA9890_STREAM_CAPACITY * sizeof(TFA9890_STREAM_SAMPLE))
+
+typedef class _NxpTfa9890Device
+{
+private:
+    // WDF
+    WDFDEVICE                   m_Device;
+    WDFWAITLOCK                 m_I2CWaitLock;      // Serializes multi-amp sequences; bus access
+                                                    // itself is granted by each amp's scheduler
+    WDFINTERRUPT                m_Interrupt;
+
+    // Sensor Operation
+    bool                        m_PoweredOn;
+
+    // Amplifiers, one per I2C connection resource
+    TFA9890_AMP                 m_Amps[TFA9890_MAX_AMPS];
+    ULONG                       m_AmpCount;
+    bool                        m_AmpStatesRestored; // Amps are ready to be saved back to the store
+
+    // Power-up sequencing
+    const TFA9890_INIT_PROFILE* m_pInitProfile;     // Owned by the driver context
+    ULONG                       m_PowerUpMaxConcurrent;
+    ULONG                       m_PowerUpStaggerMs;
+    ULONG                       m_LastBringUpUs;
+
+    // Asynchronous sequencer, guarded by m_SequenceLock. A power-up runs
+    // from D0 entry until FinishPowerUp has brought the device up, a
+    // restore until FinishRestore has; one run at a time.
+    bool                        m_SequenceRunning;
+    bool                        m_SequenceAbort;    // D0 exit stopped the sequencer; no restore may start
+    TFA9890_SEQ_RUN             m_SequenceRun;      // Run in progress, or the last one
+    ULONG                       m_SequenceAmpMask;  // Amps taking part in it
+    bool                        m_SequenceFromImages; // The run writes the amps' hibernate images
+    ULONG                       m_SequencePass;     // Failed amps get a second pass
+    ULONG                       m_SequencePending;  // Amps not yet done or failed in this pass
+    LONGLONG                    m_SequenceStart;
+    LONGLONG                    m_SequenceDeadline; // QPC time after which no retry may be started
+    LONGLONG                    m_SequenceLastEnable;
+    TFA9890_PERF_MARK           m_SequenceMark;
+    SRWLOCK                     m_SequenceLock;
+    CONDITION_VARIABLE          m_SequenceIdle;
+    WDFWORKITEM                 m_SequenceWorkItem; // Completes a run off the timer and completion callbacks
+
+    // Synchronized commit
+    ULONG                       m_CommitSkewBudgetUs;
+    ULONG                       m_CommitCount;
+    ULONG                       m_MaxCommitSkewUs;
+    ULONG                       m_CommitBudgetExceeded;
+
+    // DSP parameter bank switches
+    ULONG                       m_BankSwitchCount;
+    ULONG                       m_MaxBankSwitchUs;
+    SRWLOCK                     m_EqLoadLock;       // One EQ load at a time; taken before m_I2CWaitLock
+
+    // Speaker model stream shared with user mode
+    HANDLE                      m_StreamSection;
+    PTFA9890_STREAM_HEADER      m_pStream;          // Driver's view of the section
+    PTFA9890_STREAM_SAMPLE      m_pStreamSamples;
+    LONGLONG                    m_StreamWriteIndex; // Private copy; the shared one is never read back
+    ULONG                       m_StreamAmpMask;    // 0 while the stream is stopped
+
+    // Speaker model polling and health diagnostics
+    WDFTIMER                    m_ModelTimer;
+    bool                        m_DiagnosticsEnabled;
+    DIAG_FFT                    m_DiagFft;          // Used by the model timer only
+    SRWLOCK                     m_HealthLock;
+
+    // Power gating on audio stream hints, guarded by m_I2CWaitLock
+    WDFTIMER                    m_GateTimer;
+    ULONG                       m_GateHysteresisMs; // 0 disables gating
+    bool                        m_HintsActive;      // Set by the first hint
+    TFA9890_AMP_POWER           m_AmpPower;
+    ULONG                       m_ActiveStreams;
+    ULONG                       m_WarmStarts;
+    ULONG                       m_ColdStarts;
+    ULONGLONG                   m_WarmStartUsTotal;
+    ULONGLONG                   m_ColdStartUsTotal;
+    ULONG                       m_MaxWarmStartUs;
+    ULONG                       m_MaxColdStartUs;
+    ULONG                       m_PreWarms;
+    ULONG                       m_Gates;
+    bool                        m_PowerStaging;     // A power-stage run is in flight
+    bool                        m_PowerStageOn;     // It powers the amps up rather than gating them
+    bool                        m_PowerUpDue;       // Power the amps up once the sequencer is free
+    TFA9890_PENDING_HINT        m_PendingHints[TFA9890_MAX_PENDING_HINTS];  // Completed in order
+    ULONG                       m_PendingHintCount;
+
+    // Reset watchdog
+    WDFTIMER                    m_WatchdogTimer;
+    ULONG                       m_WatchdogIntervalMs; // 0 disables the watchdog
+
+    // Write verification, TFA9890_VERIFY_*
+    ULONG                       m_VerifyPolicy;
+
+    // Hibernate images, guarded by m_I2CWaitLock
+    bool                        m_HibernateEnabled;
+    bool                        m_PowerUpRestored;  // The power-up in progress runs the images; set under m_SequenceLock
+    ULONG                       m_HibernateRestores;
+    ULONG                       m_HibernateFallbacks;  // Power-ups that found no usable images
+    ULONG                       m_LastRestoreUs;
+
+    // Performance counters, guarded by m_PerfLock
+    TFA9890_PERF_FLOW           m_PerfFlows[TFA9890_PERF_FLOWS];
+    SRWLOCK                     m_PerfLock;
+    volatile LONG               m_PerfTransactions; // Bus transactions of all amps, less the background ones
+    bool                        m_BusBackground;    // The model poll or the watchdog holds m_I2CWaitLock
+
+    // DSP images named in DspImages, referenced from the driver's cache on
+    // the first power-up
+    WCHAR                       m_ImageList[TFA9890_IMAGE_LIST_CHARS];
+    const TFA9890_IMAGE*        m_Images[TFA9890_MAX_IMAGES];
+    ULONG                       m_ImageCount;
+    bool                        m_ImagesAcquired;
+
+    // I2C transaction recorder, idle unless BusRecordFile is set
+    WCHAR                       m_RecordPath[MAX_PATH];
+    bool                        m_RecordAll;        // Also record outside power transitions
+    volatile bool               m_Recording;
+    HANDLE                      m_RecordFile;
+    WDFMEMORY                   m_RecordMemory;
+    BYTE*                       m_pRecordBuffer;
+    ULONG                       m_RecordUsed;
+    LONGLONG                    m_RecordStartQpc;
+    ULONG                       m_RecordDropped;
+    SRWLOCK                     m_RecordLock;
+
+    // Telemetry history, idle unless HistoryFile is set. Guarded by
+    // m_HistoryLock.
+    WCHAR                       m_HistoryPath[MAX_PATH];
+    ULONG                       m_HistorySlots;
+    HANDLE                      m_HistoryFile;
+    BYTE                        m_HistoryBlock[TFA9890_HISTORY_BLOCK_BYTES];
+    ULONG                       m_HistoryUsed;      // Record bytes in the current block
+    ULONG                       m_HistorySlot;      // Slot the current block goes to
+    ULONG                       m_HistorySequence;
+    LONGLONG                    m_HistoryBlockQpc;  // QPC time of the block's StartTime
+    ULONGLONG                   m_HistoryLastMs;    // Time of the block's last record
+    LONG                        m_HistoryTemperature[TFA9890_MAX_AMPS];
+    LONG                        m_HistoryBattery[TFA9890_MAX_AMPS];
+    ULONG                       m_HistoryFaults[TFA9890_MAX_AMPS];
+    LONGLONG                    m_HistoryFlushQpc;
+    bool                        m_HistoryDirty;
+    SRWLOCK                     m_HistoryLock;
+
+    // Telemetry sampling. Each started amp sensor has its amp read at its
+    // own rate. The history and the subscriptions share one read of every
+    // amp at the fastest interval either needs. Stable readings back off
+    // from each rate, and a tick that finds several reads due does them in
+    // one pass. The timer also ticks at the fastest subscription interval
+    // to hand out the last sample. The timer runs beside the sensor
+    // callbacks: the rates, the tick and the amp sensors' start state,
+    // intervals and thresholds are guarded by m_SampleLock, which is never
+    // held across a bus read.
+    WDFTIMER                    m_SampleTimer;
+    TFA9890_SAMPLE_RATE         m_SampleRate;       // History and subscriptions
+    ULONG                       m_SampleFields;     // Fields they need
+    ULONG                       m_DeliveryInterval; // Fastest subscription, 0 if none
+    ULONG                       m_SampleTick;
+    SRWLOCK                     m_SampleLock;
+
+    // One sensor instance per amp. The first one carries this context.
+    TFA9890_AMP_SENSOR          m_AmpSensors[TFA9890_MAX_AMPS];
+
+    // Windowed aggregation, off unless AggregateWindow is set. Each started
+    // amp sensor gets its own window. Temperatures are buffered and reduced
+    // when the window closes; model frames arrive far faster and are folded
+    // in as they are polled. Guarded by m_AggregateLock.
+    ULONG                       m_AggregateWindow;  // Samples per window, 0 publishes every sample
+    ULONG                       m_AggregateSamples[TFA9890_MAX_AMPS]; // Samples in the current window
+    float                       m_AggregateTemperature[TFA9890_MAX_AMPS][TFA9890_AGGREGATE_MAX_WINDOW];
+    ULONG                       m_AggregateTemperatureCount[TFA9890_MAX_AMPS];
+    DIAG_AGGREGATE              m_AggregateImpedance[TFA9890_MAX_AMPS];
+    DIAG_AGGREGATE              m_AggregateExcursion[TFA9890_MAX_AMPS];
+    SRWLOCK                     m_AggregateLock;
+
+    // Telemetry subscriptions and the sample handed out to them
+    TFA9890_SUBSCRIPTION        m_Subscriptions[TFA9890_MAX_SUBSCRIPTIONS];
+    TFA9890_TELEMETRY           m_Telemetry;
+    ULONG                       m_TelemetryFields;
+    ULONG                       m_TelemetrySequence; // 0 until the first read
+    LONGLONG                    m_TelemetryTime;
+    SRWLOCK                     m_SubscriptionLock;
+
+    VEC3D                       m_CachedThresholds;
+    VEC3D                       m_LastSample;
+
+    SENSOROBJECT                m_SensorInstance;   // Sensor of the first amp
+
+    //// Sensor Specific Properties
+    //PSENSOR_PROPERTY_LIST       m_pSupportedDataFields;
+    PSENSOR_COLLECTION_LIST     m_pSensorProperties;
+    //PSENSOR_COLLECTION_LIST     m_pDataFieldProperties;
+    //PSENSOR_COLLECTION_LIST     m_pThresholds;
+
+public:
+    // WDF callbacks
+    static EVT_WDF_DRIVER_DEVICE_ADD                OnDeviceAdd;
+    static EVT_WDF_DEVICE_PREPARE_HARDWARE          OnPrepareHardware;
+    static EVT_WDF_DEVICE_RELEASE_HARDWARE          OnReleaseHardware;
+    static EVT_WDF_DEVICE_D0_ENTRY                  OnD0Entry;
+    static EVT_WDF_DEVICE_D0_EXIT                   OnD0Exit;
+
+    // CLX callbacks
+    static EVT_SENSOR_DRIVER_START_SENSOR               OnStart;
+    static EVT_SENSOR_DRIVER_STOP_SENSOR                OnStop;
+    static EVT_SENSOR_DRIVER_GET_SUPPORTED_DATA_FIELDS  OnGetSupportedDataFields;
+    static EVT_SENSOR_DRIVER_GET_PROPERTIES             OnGetProperties;
+    static EVT_SENSOR_DRIVER_GET_DATA_FIELD_PROPERTIES  OnGetDataFieldProperties;
+    static EVT_SENSOR_DRIVER_GET_DATA_INTERVAL          OnGetDataInterval;
+    static EVT_SENSOR_DRIVER_SET_DATA_INTERVAL          OnSetDataInterval;
+    static EVT_SENSOR_DRIVER_GET_DATA_THRESHOLDS        OnGetDataThresholds;
+    static EVT_SENSOR_DRIVER_SET_DATA_THRESHOLDS        OnSetDataThresholds;
+    static EVT_SENSOR_DRIVER_DEVICE_IO_CONTROL          OnIoControl;
+
+    // Timer callbacks
+    static EVT_WDF_TIMER                            OnModelTimer;
+    static EVT_WDF_TIMER                            OnGateTimer;
+    static EVT_WDF_TIMER                            OnSampleTimer;
+    static EVT_WDF_TIMER                            OnWatchdogTimer;
+    static EVT_WDF_TIMER                            OnSequenceTimer;
+    static EVT_WDF_REQUEST_COMPLETION_ROUTINE       OnSequenceWriteComplete;
+    static EVT_WDF_WORKITEM                         OnSequenceWorkItem;
+    static EVT_WDF_REQUEST_CANCEL                   OnTelemetryReadCancel;
+
+    // Interrupt callbacks
+    //static EVT_WDF_INTERRUPT_ISR       OnInterruptIsr;
+    //static EVT_WDF_INTERRUPT_WORKITEM  OnInterruptWorkItem;
+
+private:
+    NTSTATUS                    GetData();
+    VOID                        ReportAmpSample(_In_ ULONG Amp,
+                                                _In_ const TFA9890_TELEMETRY* pTelemetry,
+                                                _In_ const FILETIME* pTimestamp,
+                                                _In_ LONGLONG Now);
+
+    // Helper function for OnPrepareHardware to initialize sensor to default properties
+    NTSTATUS                    Initialize(_In_ WDFDEVICE Device, _In_ SENSOROBJECT SensorInstance);
+    VOID                        DeInit();
+
+    // Sensor instances of the amps after the first, once they are known
+    NTSTATUS                    InitializeAmpSensor(_In_ ULONG Amp, _In_ SENSOROBJECT SensorInstance);
+    NTSTATUS                    CreateAmpSensors();
+
+    // Helper function for OnPrepareHardware to get resources from ACPI and configure the I/O target
+    NTSTATUS                    ConfigureIoTarget(_In_ WDFCMRESLIST ResourceList,
+                                                  _In_ WDFCMRESLIST ResourceListTranslated);
+
+    // Helper function for OnPrepareHardware to read tunables from the device hardware key
+    VOID                        ReadConfiguration();
+
+    // Helper function for OnD0Entry which sets up device to default configuration
+    NTSTATUS                    PowerOn();
+    NTSTATUS                    PowerOff();
+
+    VOID                        FinishPowerUp();
+
+    // Asynchronous power sequencing, one state machine per amp. Steps of
+    // different amps interleave; a failed amp resumes from its failed step
+    // in a second pass.
+    NTSTATUS                    CreateSequencer();
+    bool                        StartSequence(_In_ TFA9890_SEQ_RUN Run, _In_ bool FromImages, _In_ ULONG AmpMask);
+    VOID                        ResetSequence(_In_ bool FromImages, _In_ ULONG AmpMask);
+    VOID                        EndSequence();
+    bool                        SequenceFallBack();
+    VOID                        CancelSequence();
+    VOID                        SequenceStep(_In_ PTFA9890_AMP pAmp);
+    bool                        SequenceAdvance(_In_ PTFA9890_AMP pAmp);
+    VOID                        SequenceSend(_In_ PTFA9890_AMP pAmp);
+    VOID                        SequenceWriteDone(_In_ PTFA9890_AMP pAmp, _In_ NTSTATUS Status);
+    VOID                        SequenceEnter(_In_ PTFA9890_AMP pAmp, _In_ TFA9890_SEQ_STATE State);
+    bool                        SequenceSettled();
+
+    // Write one register, retrying failed transactions with backoff
+    NTSTATUS                    WriteRegisterWithRetry(_In_ PTFA9890_AMP pAmp,
+                                                       _In_ TFA9890_CMD_CLASS Class,
+                                                       _In_ BYTE Register,
+                                                       _In_ WORD Value,
+                                                       _In_ LONGLONG Deadline);
+
+    // Long transfer split into chunks; the bus is yielded to more urgent
+    // classes at every chunk boundary
+    NTSTATUS                    WriteBurst(_In_ PTFA9890_AMP pAmp,
+                                           _In_ TFA9890_CMD_CLASS Class,
+                                           _In_ BYTE Register,
+                                           _In_reads_bytes_(Length) const BYTE* pData,
+                                           _In_ ULONG Length,
+                                           _In_ bool AutoIncrement);
+    NTSTATUS                    ReadBurst(_In_ PTFA9890_AMP pAmp,
+                                          _In_ TFA9890_CMD_CLASS Class,
+                                          _In_ BYTE Register,
+                                          _Out_writes_bytes_(Length) BYTE* pData,
+                                          _In_ ULONG Length,
+                                          _In_ bool AutoIncrement,
+                                          _In_ ULONG ChunkBytes);
+
+    VOID                        TraceBusStatistics();
+
+    // Bus autotuning
+    VOID                        TuneBus(_In_ bool StaleOnly);
+    bool                        ProbeBus(_In_ PTFA9890_AMP pAmp);
+    VOID                        AccountTransaction(_In_ PTFA9890_AMP pAmp, _In_ NTSTATUS Status);
+
+    // Amp state kept by the driver across PnP stop/start
+    VOID                        SaveAmpStates();
+    VOID                        RestoreAmpStates();
+    VOID                        RevalidateAmpState(_In_ PTFA9890_AMP pAmp);
+
+    // Single I2C transactions. Every bus access goes through these so it is
+    // counted and, while recording, captured.
+    NTSTATUS                    BusWrite(_In_ PTFA9890_AMP pAmp,
+                                         _In_ BYTE Register,
+                                         _In_reads_bytes_(Length) const BYTE* pData,
+                                         _In_ ULONG Length);
+    NTSTATUS                    BusRead(_In_ PTFA9890_AMP pAmp,
+                                        _In_ BYTE Register,
+                                        _Out_writes_bytes_(Length) BYTE* pData,
+                                        _In_ ULONG Length);
+
+    // I2C transaction recorder
+    VOID                        OpenRecorder();
+    VOID                        CloseRecorder();
+    VOID                        RecordTransaction(_In_ ULONG Amp,
+                                                  _In_ BYTE Flags,
+                                                  _In_ BYTE Register,
+                                                  _In_reads_bytes_opt_(Length) const BYTE* pData,
+                                                  _In_ ULONG Length,
+                                                  _In_ LONGLONG Start,
+                                                  _In_ LONGLONG End,
+                                                  _In_ NTSTATUS Status);
+    VOID                        RecordMarker(_In_ BYTE Marker);
+    VOID                        FlushRecorder();
+
+    // Register shadow and two-phase commit across all amplifiers
+    VOID                        UpdateShadow(_In_ PTFA9890_AMP pAmp,
+                                             _In_ BYTE Register,
+                                             _In_reads_bytes_(Length) const BYTE* pData,
+                                             _In_ ULONG Length);
+    NTSTATUS                    StageRegister(_In_ ULONG AmpMask, _In_ BYTE Register, _In_ WORD Value);
+    VOID                        DiscardStaged();
+    NTSTATUS                    CommitStaged(_In_ ULONG SkewBudgetUs, _Out_ PTFA9890_COMMIT_OUTPUT pResult);
+
+    // DSP memory access and parametric EQ
+    NTSTATUS                    SetDspAddress(_In_ PTFA9890_AMP pAmp, _In_ BYTE MemoryType, _In_ WORD Address);
+    NTSTATUS                    WriteDspMemory(_In_ PTFA9890_AMP pAmp,
+                                               _In_ TFA9890_CMD_CLASS Class,
+                                               _In_ BYTE MemoryType,
+                                               _In_ WORD Address,
+                                               _In_reads_bytes_(Length) const BYTE* pData,
+                                               _In_ ULONG Length);
+    NTSTATUS                    ReadDspMemory(_In_ PTFA9890_AMP pAmp,
+                                              _In_ TFA9890_CMD_CLASS Class,
+                                              _In_ BYTE MemoryType,
+                                              _In_ WORD Address,
+                                              _Out_writes_bytes_(Length) BYTE* pData,
+                                              _In_ ULONG Length,
+                                              _In_ ULONG ChunkBytes);
+    NTSTATUS                    WriteDspWord(_In_ PTFA9890_AMP pAmp,
+                                             _In_ TFA9890_CMD_CLASS Class,
+                                             _In_ BYTE MemoryType,
+                                             _In_ WORD Address,
+                                             _In_ LONG Value);
+    NTSTATUS                    SetEqBands(_In_ ULONG AmpMask,
+                                           _In_reads_(Count) const TFA9890_EQ_BAND* pBands,
+                                           _In_ ULONG Count,
+                                           _In_ ULONG Flags,
+                                           _Out_ PTFA9890_EQ_OUTPUT pResult);
+    NTSTATUS                    LoadEqBank(_In_ PTFA9890_AMP pAmp,
+                                           _In_ ULONG RequestedMask,
+                                           _In_ LONG (*pRequested)[TFA9890_EQ_COEFFS],
+                                           _Inout_ PTFA9890_EQ_OUTPUT pResult);
+    NTSTATUS                    SwitchBanks(_In_ ULONG AmpMask, _Out_ PTFA9890_BANK_SWITCH_OUTPUT pResult);
+
+    // Speaker model polling, stream and health diagnostics
+    NTSTATUS                    CreateModelTimer();
+    ULONG                       ModelAmpMask();
+    VOID                        SuspendModelPolling();
+    VOID                        ResumeModelPolling();
+    VOID                        PollModel();
+    NTSTATUS                    CreateStream();
+    VOID                        DestroyStream();
+    NTSTATUS                    StartStream(_In_ ULONG AmpMask);
+    VOID                        StopStream();
+    VOID                        PublishStream(_In_ LONGLONG WriteIndex);
+    bool                        DiagAppend(_In_ PTFA9890_AMP pAmp, _In_ LONG Excursion, _In_ LONG Impedance);
+    VOID                        DiagAnalyze(_In_ ULONG Amp);
+
+    // Adaptive telemetry sampling
+    NTSTATUS                    CreateSampleTimer();
+    VOID                        ScheduleSample();
+    VOID                        SuspendSampling();
+    VOID                        UpdateSampleDemand();
+    VOID                        RestartAmpSensor(_In_ ULONG Amp);
+    ULONG                       StartedAmpMask();
+    NTSTATUS                    ReadTelemetry(_In_ ULONG Fields,
+                                              _In_ ULONG AmpMask,
+                                              _Out_ PTFA9890_TELEMETRY pTelemetry,
+                                              _Out_writes_(TFA9890_MAX_AMPS) PTFA9890_TELEMETRY pAmpTelemetry,
+                                              _Out_ PULONG pReadMask);
+    bool                        IsTelemetryEvent(_In_ const TFA9890_SAMPLE_RATE* pRate,
+                                                 _In_ const TFA9890_TELEMETRY* pTelemetry,
+                                                 _In_ float TemperatureStepC,
+                                                 _In_ float BatteryStepV);
+    VOID                        AdaptInterval(_Inout_ PTFA9890_SAMPLE_RATE pRate, _In_ bool Event);
+
+    // Windowed aggregation
+    VOID                        AggregateTemperature(_In_ ULONG Amp, _In_ float TemperatureC);
+    VOID                        AggregateModel(_In_ ULONG Amp,
+                                               _In_reads_(Count) const float* pExcursion,
+                                               _In_reads_(Count) const float* pImpedance,
+                                               _In_ ULONG Count);
+    bool                        CloseAggregateWindow(_In_ ULONG Amp, _Out_ PTFA9890_AGGREGATES pAggregates);
+    VOID                        ResetAggregateWindow(_In_ ULONG Amp);
+
+    // Telemetry history
+    VOID                        OpenHistory();
+    VOID                        CloseHistory();
+    VOID                        FlushHistory(_In_ bool Force);
+    VOID                        HistoryAppendSample(_In_ ULONG Amp, _In_ LONG TemperatureC, _In_ ULONG BatteryLsb, _In_ ULONG Faults);
+    VOID                        HistoryAppendPower(_In_ bool Powered);
+    VOID                        StartHistoryBlock();
+    VOID                        WriteHistoryBlock();
+    VOID                        ReserveHistoryRecord();
+    VOID                        AppendHistoryRecord(_In_ ULONG Kind, _In_ ULONG Amp, _In_reads_(Count) const ULONG* pValues, _In_ ULONG Count);
+
+    // Telemetry subscriptions
+    VOID                        DeliverTelemetry();
+    NTSTATUS                    Subscribe(_In_ WDFFILEOBJECT Owner, _In_ ULONG IntervalMs, _In_ ULONG Fields);
+    NTSTATUS                    QueueTelemetryRead(_In_ WDFREQUEST Request);
+    VOID                        CancelSubscriptions();
+
+    // DSP images shared through the driver's cache
+    VOID                        AcquireImages();
+    VOID                        ReleaseImages();
+    NTSTATUS                    UploadImages(_In_ PTFA9890_AMP pAmp);
+
+    // Power gating on audio stream hints
+    NTSTATUS                    CreateGateTimer();
+    NTSTATUS                    StartPowerStage(_In_ bool Powered);
+    VOID                        FinishPowerStage();
+    VOID                        PowerStageDone(_In_ bool Powered, _In_ NTSTATUS Status);
+    NTSTATUS                    QueueStreamHint(_In_ WDFREQUEST Request, _In_ TFA9890_STREAM_HINT Hint, _Out_ PTFA9890_STREAM_HINT_OUTPUT pOutput);
+    VOID                        RunStreamHints();
+    NTSTATUS                    ApplyStreamHint(_In_ const TFA9890_PENDING_HINT* pHint, _Out_ PTFA9890_STREAM_HINT_OUTPUT pOutput);
+    VOID                        GateIdleAmps();
+    VOID                        SuspendPowerGating();
+    VOID                        ResumePowerGating();
+
+    // Reset watchdog
+    NTSTATUS                    CreateWatchdogTimer();
+    VOID                        SuspendWatchdog();
+    VOID                        ResumeWatchdog();
+    VOID                        CheckAmpResets();
+    VOID                        FinishRestore();
+    NTSTATUS                    RestoreEqBank(_In_ PTFA9890_AMP pAmp);
+
+    // Hibernate images
+    VOID                        CaptureHibernateImages();
+    bool                        CaptureHibernateImage(_In_ PTFA9890_AMP pAmp, _Out_ PTFA9890_HIBERNATE_IMAGE pImage);
+    bool                        CaptureRestoreImage(_In_ PTFA9890_AMP pAmp, _Out_ PTFA9890_HIBERNATE_IMAGE pImage);
+    bool                        HibernateImagesValid();
+    VOID                        AdoptHibernateImages();
+    ULONG                       HibernateProfileHash();
+
+    // Write verification
+    VOID                        VerifyAmp(_In_ PTFA9890_AMP pAmp,
+                                          _In_ TFA9890_CMD_CLASS Class,
+                                          _In_reads_(TFA9890_REGISTER_COUNT / 32) const ULONG* pWritten,
+                                          _In_ LONGLONG Deadline);
+
+    // Performance counters
+    VOID                        PerfBegin(_Out_ PTFA9890_PERF_MARK pMark);
+    VOID                        PerfEnd(_In_ ULONG Flow, _In_ const TFA9890_PERF_MARK* pMark);
+    VOID                        PerfCountTransaction();
+
+    // Post-mortem dump of registers and DSP memories
+    NTSTATUS                    ReadDumpRegion(_In_ PTFA9890_AMP pAmp,
+                                               _In_ const TFA9890_DUMP_REGION* pRegion,
+                                               _In_ ULONG Skip,
+                                               _Out_writes_bytes_(Length) BYTE* pData,
+                                               _In_ ULONG Length);
+    NTSTATUS                    DumpAmp(_In_ const TFA9890_DUMP_INPUT* pInput,
+                                        _Out_ PTFA9890_DUMP_OUTPUT pOutput,
+                                        _In_ ULONG Space);
+
+    // Private IOCTL handlers
+    NTSTATUS                    IoctlStageRegisters(_In_ WDFREQUEST Request);
+    NTSTATUS                    IoctlCommitStaged(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlDiscardStaged();
+    NTSTATUS                    IoctlSetEq(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlSwitchBank(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlMapStream(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlStopStream();
+    NTSTATUS                    IoctlDump(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlGetHealth(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlStreamHint(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlGetImageCache(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlSubscribeTelemetry(_In_ WDFREQUEST Request);
+    NTSTATUS                    IoctlReadTelemetry(_In_ WDFREQUEST Request);
+    NTSTATUS                    IoctlGetWatchdog(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+    NTSTATUS                    IoctlGetPerf(_In_ WDFREQUEST Request, _Out_ size_t* pInformation);
+
+} NxpTfa9890Device, *PNxpTfa9890Device;
+
+// Set up accessor function to retrieve device context
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(NxpTfa9890Device, GetNxpTfa9890ContextFromSensorInstance);
+
+// Context of the sensor instances of the amps after the first
+typedef struct _TFA9890_SENSOR_CONTEXT
+{
+    PNxpTfa9890Device   pDevice;
+    ULONG               Amp;
+} TFA9890_SENSOR_CONTEXT, *PTFA9890_SENSOR_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(TFA9890_SENSOR_CONTEXT, GetTfa9890SensorContext);
+
+// Find the device and the amp a sensor instance reports for
+inline PNxpTfa9890Device GetNxpTfa9890ContextFromAmpSensor(
+    _In_ SENSOROBJECT SensorInstance,
+    _Out_ PULONG pAmp)
+{
+    PTFA9890_SENSOR_CONTEXT pContext = GetTfa9890SensorContext(SensorInstance);
+
+    *pAmp = (nullptr != pContext) ? pContext->Amp : 0;
+    return (nullptr != pContext) ? pContext->pDevice : GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
+}
+
+// Find the device context among the device's sensor instances
+inline PNxpTfa9890Device GetNxpTfa9890ContextFromDevice(
+    _In_ WDFDEVICE Device)
+{
+    SENSOROBJECT SensorInstances[TFA9890_MAX_AMPS] = {};
+    ULONG SensorInstanceCount = TFA9890_MAX_AMPS;
+
+    NTSTATUS Status = SensorsCxDeviceGetSensorList(Device, SensorInstances, &SensorInstanceCount);
+    for (ULONG i = 0; NT_SUCCESS(Status) && i < SensorInstanceCount; i++)
+    {
+        PNxpTfa9890Device pDevice = (NULL != SensorInstances[i]) ? GetNxpTfa9890ContextFromSensorInstance(SensorInstances[i]) : nullptr;
+        if (nullptr != pDevice)
+        {
+            return pDevice;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,64 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the speaker health
+//    analysis kernels: window statistics and the power spectrum of a
+//    diagnostics window, vectorized where the target supports it. The
+//    telemetry aggregation stage shares the statistics kernels.
+//
+//Environment:
+//
+//    Windows User-Mode Driver Framework (UMDF)
+
+#pragma once
+
+#include <windows.h>
+
+#include "TFA9890.h"
+
+#define DIAG_FIXED_SCALE        (1.0f / 8388608.0f)     // DSP full scale, 2^23
+
+// FFT tables and scratch. Twiddles are stored per stage so the butterflies
+// of a stage read them contiguously; the stage with half size h starts at
+// index h - 1.
+typedef struct _DIAG_FFT
+{
+    float   Re[TFA9890_DIAG_WINDOW];
+    float   Im[TFA9890_DIAG_WINDOW];
+    float   Power[TFA9890_DIAG_WINDOW / 2];
+    float   Hann[TFA9890_DIAG_WINDOW];
+    float   TwiddleRe[TFA9890_DIAG_WINDOW];
+    float   TwiddleIm[TFA9890_DIAG_WINDOW];
+    USHORT  BitReverse[TFA9890_DIAG_WINDOW];
+} DIAG_FFT, *PDIAG_FFT;
+
+typedef struct _DIAG_STATS
+{
+    float   Mean;
+    float   Variance;
+    float   Peak;               // Largest magnitude
+} DIAG_STATS, *PDIAG_STATS;
+
+VOID DiagInitializeFft(_Out_ PDIAG_FFT pFft);
+
+VOID DiagStatistics(_In_reads_(Count) const float* pData, _In_ ULONG Count, _Out_ PDIAG_STATS pStats);
+
+// Running extremes and sums of one channel over an aggregation window.
+// Buffers are reduced in float; the sums are carried in double so long
+// windows of model data keep their precision.
+typedef struct _DIAG_AGGREGATE
+{
+    float   Min;
+    float   Max;
+    double  Sum;
+    double  SumSquares;
+    ULONG   Count;
+} DIAG_AGGREGATE, *PDIAG_AGGREGATE;
+
+// Fold a buffer of samples into the aggregate. Start from a zeroed one.
+VOID DiagAggregate(_In_reads_(Count) const float* pData, _In_ ULONG Count, _Inout_ PDIAG_AGGREGATE pAggregate);
+
+// Hann-windowed power spectrum of one window with its mean removed, into
+// pFft->Power
+VOID DiagPowerSpectrum(_Inout_ PDIAG_FFT pFft, _In_reads_(TFA9890_DIAG_WINDOW) const float* pSignal, _In_ float Mean);
@@ -1,19 +1,35 @@
-//Copyright (C) Microsoft Corporation, All Rights Reserved
-//
-//Abstract:
-//
-//    This module contains the type definitions for the NxpTfa9890
-//    driver callback class.
-//
-//Environment:
-//
-//    Windows User-Mode Driver Framework (UMDF)
-
-#pragma once
-
-WDF_EXTERN_C_START
-
-DRIVER_INITIALIZE           DriverEntry;
-EVT_WDF_DRIVER_UNLOAD       OnDriverUnload;
-
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the NxpTfa9890
+//    driver callback class.
+//
+//Environment:
+//
+//    Windows User-Mode Driver Framework (UMDF)
+
+#pragma once
+
+// Driver-wide state. Profiles are built at DriverEntry and read-only
+// afterwards; the DSP image cache and the amp state store outlive the
+// devices that fill them.
+typedef struct _NXPTFA9890_DRIVER_CONTEXT
+{
+    TFA9890_PROFILE_SET     Profiles;
+
+    TFA9890_IMAGE_CACHE     ImageCache;
+
+    SRWLOCK                 StoreLock;
+    ULONGLONG               StoreSaves;
+    TFA9890_AMP_STATE       Store[TFA9890_STORE_ENTRIES];
+} NXPTFA9890_DRIVER_CONTEXT, *PNXPTFA9890_DRIVER_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(NXPTFA9890_DRIVER_CONTEXT, GetNxpTfa9890DriverContext);
+
+WDF_EXTERN_C_START
+
+DRIVER_INITIALIZE           DriverEntry;
+EVT_WDF_DRIVER_UNLOAD       OnDriverUnload;
+
 WDF_EXTERN_C_END
\ No newline at end of file
@@ -0,0 +1,46 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the parametric EQ
+//    coefficient engine. Bands are designed in floating point and then
+//    normalized and converted to the DSP's 24-bit fixed-point format in
+//    batches with a vector kernel.
+//
+//Environment:
+//
+//    Windows User-Mode Driver Framework (UMDF)
+
+#pragma once
+
+#include <windows.h>
+
+#include "TFA9890.h"
+#include "Tfa9890Ioctl.h"
+
+// Number of bands processed per vector operation
+#define EQ_VECTOR_WIDTH         4
+#define EQ_BATCH_SIZE           (((TFA9890_EQ_BANDS) + EQ_VECTOR_WIDTH - 1) & ~(EQ_VECTOR_WIDTH - 1))
+
+// Unnormalized biquad coefficients of a batch of bands, structure-of-arrays
+// so the kernel can load one coefficient of EQ_VECTOR_WIDTH bands at once
+typedef struct _EQ_BATCH
+{
+    DECLSPEC_ALIGN(16) float B0[EQ_BATCH_SIZE];
+    DECLSPEC_ALIGN(16) float B1[EQ_BATCH_SIZE];
+    DECLSPEC_ALIGN(16) float B2[EQ_BATCH_SIZE];
+    DECLSPEC_ALIGN(16) float A0[EQ_BATCH_SIZE];
+    DECLSPEC_ALIGN(16) float A1[EQ_BATCH_SIZE];
+    DECLSPEC_ALIGN(16) float A2[EQ_BATCH_SIZE];
+    ULONG Count;
+} EQ_BATCH, *PEQ_BATCH;
+
+// Validate a band and append its design to the batch
+NTSTATUS EqDesignBand(_In_ const TFA9890_EQ_BAND* pBand, _Inout_ PEQ_BATCH pBatch);
+
+// Normalize every band of the batch by a0 and convert it to 1.23 fixed
+// point, { b0, b1, b2, -a1, -a2 } per band
+VOID EqQuantizeBatch(_Inout_ PEQ_BATCH pBatch, _Out_writes_(pBatch->Count) LONG (*pCoeffs)[TFA9890_EQ_COEFFS]);
+
+// Serialize fixed-point words into the DSP's big-endian 24-bit layout
+VOID EqPackDspWords(_In_reads_(Count) const LONG* pWords, _In_ ULONG Count, _Out_writes_bytes_(Count * TFA9890_DSP_WORD_BYTES) BYTE* pBuffer);
@@ -0,0 +1,67 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the per-amplifier
+//    I2C bus scheduler. Every transaction to an amplifier is granted
+//    through its scheduler so that urgent commands (mute, gain) are never
+//    queued behind long configuration or DSP transfers.
+//
+//Environment:
+//
+//    Windows User-Mode Driver Framework (UMDF)
+
+#pragma once
+
+#include <windows.h>
+
+// Priority classes for I2C traffic, most urgent first
+typedef enum
+{
+    TFA9890_CMD_CLASS_MUTE = 0,     // Mute and safety shutdown
+    TFA9890_CMD_CLASS_GAIN,         // Volume and gain changes
+    TFA9890_CMD_CLASS_CONFIG,       // Configuration sequences
+    TFA9890_CMD_CLASS_TELEMETRY,    // Status and sample reads
+    TFA9890_CMD_CLASS_BULK,         // DSP uploads and memory dumps
+    TFA9890_CMD_CLASS_COUNT
+} TFA9890_CMD_CLASS;
+
+// Queueing statistics for one priority class
+typedef struct _TFA9890_QUEUE_STATS
+{
+    ULONG       Grants;             // Number of times the bus was granted
+    ULONGLONG   TotalDelayUs;       // Sum of the time spent waiting for the bus
+    ULONG       MaxDelayUs;         // Longest single wait for the bus
+    ULONG       Preemptions;        // Times a transfer yielded at a chunk boundary
+} TFA9890_QUEUE_STATS, *PTFA9890_QUEUE_STATS;
+
+// Priority arbiter for one amplifier's I2C connection. The bus is granted
+// to the most urgent waiting class; within a class, waiters are served in
+// arrival order by ticket. Bulk transfers are expected to poll ShouldYield() between
+// chunks and release the bus when a more urgent class is waiting, which
+// bounds the latency of urgent commands to one chunk transfer.
+//
+// The object is zero-initialized as part of the device context and has no
+// constructor; Initialize() must be called before first use.
+typedef class _Tfa9890BusScheduler
+{
+private:
+    SRWLOCK                     m_Lock;
+    CONDITION_VARIABLE          m_Released;
+    bool                        m_Busy;
+    ULONG                       m_Waiting[TFA9890_CMD_CLASS_COUNT];
+    ULONG                       m_NextTicket[TFA9890_CMD_CLASS_COUNT];  // Handed to the next waiter of the class
+    ULONG                       m_Serving[TFA9890_CMD_CLASS_COUNT];     // Ticket granted next within the class
+    TFA9890_QUEUE_STATS         m_Stats[TFA9890_CMD_CLASS_COUNT];
+
+    bool                        IsMoreUrgentWaiting(_In_ TFA9890_CMD_CLASS Class);
+
+public:
+    VOID                        Initialize();
+    VOID                        Acquire(_In_ TFA9890_CMD_CLASS Class);
+    VOID                        Release();
+    bool                        ShouldYield(_In_ TFA9890_CMD_CLASS Class);
+    VOID                        CountPreemption(_In_ TFA9890_CMD_CLASS Class);
+    VOID                        GetStats(_In_ TFA9890_CMD_CLASS Class, _Out_ PTFA9890_QUEUE_STATS pStats);
+
+} Tfa9890BusScheduler, *PTfa9890BusScheduler;
@@ -0,0 +1,199 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the layout of the telemetry history the driver
+//    keeps when the HistoryFile value is set in the device hardware key,
+//    and the routines to encode and decode it. It is shared with host-side
+//    analysis tools and must not depend on any driver-only header.
+//
+//    The file is one TFA9890_HISTORY_HEADER followed by SlotCount slots of
+//    BlockBytes each. Blocks are written to the slots in ring order, and a
+//    block is rewritten in place as it fills, so the file never grows past
+//    its configured size. Order the blocks by Sequence to read the history;
+//    every block decodes on its own.
+//
+//    A block is a TFA9890_HISTORY_BLOCK followed by UsedBytes of records.
+//    Each record is a tag byte, TFA9890_HISTORY_KIND_* in the high bits and
+//    the amp index in the low bits, then the milliseconds since the previous
+//    record of the block (since StartTime for the first) as a varint, then
+//    its payload:
+//
+//      SAMPLE  Temperature (degrees C) and battery (register LSBs) as zigzag
+//              varint deltas from the amp's previous sample in the block
+//      FAULTS  The amp's new fault status bits as a varint
+//      POWER   1 when the amps were powered up, 0 when powered down
+//
+//    Varints are little-endian base 128: seven bits per byte, the high bit
+//    set on every byte but the last. All fields are little endian.
+//
+//Environment:
+//
+//    User mode
+
+#pragma once
+
+#pragma pack(push, 1)
+
+#define TFA9890_HISTORY_MAGIC               0x53483954  // 'T9HS'
+#define TFA9890_HISTORY_BLOCK_MAGIC         0x42483954  // 'T9HB'
+#define TFA9890_HISTORY_VERSION             1
+#define TFA9890_HISTORY_BLOCK_BYTES         4096
+#define TFA9890_HISTORY_MAX_AMPS            8
+#define TFA9890_HISTORY_RECORD_MAX_BYTES    16          // Tag and three 5-byte varints
+
+#define TFA9890_HISTORY_KIND_SAMPLE         0
+#define TFA9890_HISTORY_KIND_FAULTS         1
+#define TFA9890_HISTORY_KIND_POWER          2
+#define TFA9890_HISTORY_KIND_SHIFT          5
+#define TFA9890_HISTORY_AMP_MASK            0x1F
+
+#define TFA9890_HISTORY_VOLTS_PER_LSB       (5.5f / 1024.0f)
+
+typedef struct _TFA9890_HISTORY_HEADER
+{
+    ULONG       Magic;                  // TFA9890_HISTORY_MAGIC
+    USHORT      Version;                // TFA9890_HISTORY_VERSION
+    USHORT      HeaderBytes;            // Offset of the first slot
+    ULONG       BlockBytes;             // Size of a slot
+    ULONG       SlotCount;
+    ULONG       AmpCount;
+    ULONG       Reserved;
+    LONGLONG    ConnectionIds[TFA9890_HISTORY_MAX_AMPS];    // Resource hub connection per amp
+} TFA9890_HISTORY_HEADER, *PTFA9890_HISTORY_HEADER;
+
+typedef struct _TFA9890_HISTORY_BLOCK
+{
+    ULONG       Magic;                  // TFA9890_HISTORY_BLOCK_MAGIC; anything else is an unused slot
+    ULONG       Sequence;               // Write order of the blocks
+    LONGLONG    StartTime;              // UTC FILETIME record times are relative to
+    USHORT      UsedBytes;              // Record bytes following the block header
+    USHORT      Reserved;
+    ULONG       Reserved2;
+} TFA9890_HISTORY_BLOCK, *PTFA9890_HISTORY_BLOCK;
+
+#pragma pack(pop)
+
+// One decoded record
+typedef struct _TFA9890_HISTORY_EVENT
+{
+    LONGLONG    Time;                   // UTC FILETIME
+    ULONG       Kind;                   // TFA9890_HISTORY_KIND_*
+    ULONG       Amp;
+    LONG        TemperatureC;           // SAMPLE
+    ULONG       BatteryLsb;             // SAMPLE, TFA9890_HISTORY_VOLTS_PER_LSB each
+    ULONG       Value;                  // FAULTS bits, or POWER state
+} TFA9890_HISTORY_EVENT, *PTFA9890_HISTORY_EVENT;
+
+// Append Value as a varint. Returns the bytes written, at most 5.
+inline ULONG Tfa9890HistoryPutVarint(
+    _Out_writes_(5) BYTE* pData,
+    _In_ ULONG Value)
+{
+    ULONG Length = 0;
+
+    while (Value >= 0x80)
+    {
+        pData[Length++] = static_cast<BYTE>(Value | 0x80);
+        Value >>= 7;
+    }
+    pData[Length++] = static_cast<BYTE>(Value);
+    return Length;
+}
+
+// Read a varint at *pOffset, advancing it. Returns false if the data ends
+// inside the varint.
+inline bool Tfa9890HistoryGetVarint(
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length,
+    _Inout_ ULONG* pOffset,
+    _Out_ ULONG* pValue)
+{
+    *pValue = 0;
+
+    for (ULONG Shift = 0; Shift < 35; Shift += 7)
+    {
+        if (*pOffset >= Length)
+        {
+            return false;
+        }
+
+        BYTE Byte = pData[(*pOffset)++];
+        *pValue |= static_cast<ULONG>(Byte & 0x7F) << Shift;
+        if (0 == (Byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline ULONG Tfa9890HistoryZigzag(_In_ LONG Value)
+{
+    return (static_cast<ULONG>(Value) << 1) ^ static_cast<ULONG>(Value >> 31);
+}
+
+inline LONG Tfa9890HistoryUnzigzag(_In_ ULONG Value)
+{
+    return static_cast<LONG>(Value >> 1) ^ -static_cast<LONG>(Value & 1);
+}
+
+// Decode every record of one block, calling pCallback for each. Returns the
+// number of records decoded, stopping at the first malformed one.
+inline ULONG Tfa9890HistoryDecodeBlock(
+    _In_ const TFA9890_HISTORY_BLOCK* pBlock,
+    _In_ ULONG BlockBytes,
+    _In_ void (*pCallback)(const TFA9890_HISTORY_EVENT* pEvent, void* pContext),
+    _In_opt_ void* pContext)
+{
+    const BYTE* pData = reinterpret_cast<const BYTE*>(pBlock + 1);
+    ULONG Length = pBlock->UsedBytes;
+    ULONG Offset = 0;
+    ULONG Count = 0;
+    LONG Temperature[TFA9890_HISTORY_MAX_AMPS] = {};
+    LONG Battery[TFA9890_HISTORY_MAX_AMPS] = {};
+    TFA9890_HISTORY_EVENT Event = {};
+
+    if (TFA9890_HISTORY_BLOCK_MAGIC != pBlock->Magic || Length > BlockBytes - sizeof(*pBlock))
+    {
+        return 0;
+    }
+
+    Event.Time = pBlock->StartTime;
+    while (Offset < Length)
+    {
+        BYTE Tag = pData[Offset++];
+        ULONG DeltaMs, First, Second;
+
+        Event.Kind = Tag >> TFA9890_HISTORY_KIND_SHIFT;
+        Event.Amp = Tag & TFA9890_HISTORY_AMP_MASK;
+        if (Event.Amp >= TFA9890_HISTORY_MAX_AMPS || !Tfa9890HistoryGetVarint(pData, Length, &Offset, &DeltaMs))
+        {
+            break;
+        }
+        Event.Time += static_cast<LONGLONG>(DeltaMs) * 10000;
+
+        if (TFA9890_HISTORY_KIND_SAMPLE == Event.Kind)
+        {
+            if (!Tfa9890HistoryGetVarint(pData, Length, &Offset, &First) ||
+                !Tfa9890HistoryGetVarint(pData, Length, &Offset, &Second))
+            {
+                break;
+            }
+            Temperature[Event.Amp] += Tfa9890HistoryUnzigzag(First);
+            Battery[Event.Amp] += Tfa9890HistoryUnzigzag(Second);
+            Event.TemperatureC = Temperature[Event.Amp];
+            Event.BatteryLsb = static_cast<ULONG>(Battery[Event.Amp]);
+            Event.Value = 0;
+        }
+        else if (!Tfa9890HistoryGetVarint(pData, Length, &Offset, &Event.Value))
+        {
+            break;
+        }
+
+        pCallback(&Event, pContext);
+        Count++;
+    }
+
+    return Count;
+}
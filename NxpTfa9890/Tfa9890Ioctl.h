@@ -0,0 +1,487 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the private IOCTL interface of the NxpTfa9890
+//    driver. It is shared with user-mode tuning and diagnostic tools and
+//    must not depend on any driver-only header.
+//
+//Environment:
+//
+//    User mode
+
+#pragma once
+
+#include <winioctl.h>
+
+#pragma pack(push, 1)
+
+//
+// Two-phase register commit. Changes are staged per amplifier with
+// IOCTL_TFA9890_STAGE_REGISTERS and land on all amplifiers in one tightly
+// clustered burst on IOCTL_TFA9890_COMMIT_STAGED.
+//
+#define IOCTL_TFA9890_STAGE_REGISTERS       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TFA9890_COMMIT_STAGED         CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TFA9890_DISCARD_STAGED        CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+typedef struct _TFA9890_STAGE_ENTRY
+{
+    ULONG   AmpMask;            // Bit n selects amplifier n
+    BYTE    Register;
+    BYTE    Reserved;
+    WORD    Value;
+} TFA9890_STAGE_ENTRY, *PTFA9890_STAGE_ENTRY;
+
+typedef struct _TFA9890_STAGE_INPUT
+{
+    ULONG               Count;
+    TFA9890_STAGE_ENTRY Entries[1];
+} TFA9890_STAGE_INPUT, *PTFA9890_STAGE_INPUT;
+
+typedef struct _TFA9890_COMMIT_INPUT
+{
+    ULONG   SkewBudgetUs;       // 0 selects the driver's configured budget
+} TFA9890_COMMIT_INPUT, *PTFA9890_COMMIT_INPUT;
+
+typedef struct _TFA9890_COMMIT_OUTPUT
+{
+    LONG    Status;             // NTSTATUS of the first failed write, if any
+    ULONG   WritesApplied;      // Bus transactions issued by this commit
+    ULONG   SkewUs;             // Inter-amp apply skew of this commit
+    ULONG   SkewBudgetUs;       // Budget the skew was checked against
+    ULONG   MaxSkewUs;          // Largest skew since the device started
+    ULONG   Commits;            // Commits since the device started
+    ULONG   BudgetExceeded;     // Commits whose skew exceeded the budget
+} TFA9890_COMMIT_OUTPUT, *PTFA9890_COMMIT_OUTPUT;
+
+//
+// Parametric EQ. Bands not listed keep their current setting. The new set
+// is loaded into the DSP's idle parameter bank while audio keeps playing
+// from the active one, then the banks are switched unless
+// TFA9890_EQ_FLAG_DEFER_SWITCH is set, in which case the switch waits for
+// IOCTL_TFA9890_SWITCH_BANK. Only bands whose fixed-point coefficients
+// differ from the idle bank are uploaded.
+//
+#define IOCTL_TFA9890_SET_EQ                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_TFA9890_SWITCH_BANK           CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+#define TFA9890_EQ_FLAG_DEFER_SWITCH        0x00000001
+
+typedef enum _TFA9890_EQ_TYPE
+{
+    Tfa9890EqBypass = 0,
+    Tfa9890EqPeaking,
+    Tfa9890EqLowShelf,
+    Tfa9890EqHighShelf,
+    Tfa9890EqLowPass,
+    Tfa9890EqHighPass,
+    Tfa9890EqNotch,
+    Tfa9890EqTypeCount
+} TFA9890_EQ_TYPE;
+
+typedef struct _TFA9890_EQ_BAND
+{
+    ULONG   Index;              // Band number, 0 to TFA9890_EQ_BANDS - 1
+    ULONG   Type;               // TFA9890_EQ_TYPE
+    float   FrequencyHz;
+    float   Q;
+    float   GainDb;             // Ignored by the pass and notch types
+} TFA9890_EQ_BAND, *PTFA9890_EQ_BAND;
+
+typedef struct _TFA9890_EQ_INPUT
+{
+    ULONG           AmpMask;    // Bit n selects amplifier n
+    ULONG           Flags;      // TFA9890_EQ_FLAG_*
+    ULONG           Count;
+    TFA9890_EQ_BAND Bands[1];
+} TFA9890_EQ_INPUT, *PTFA9890_EQ_INPUT;
+
+typedef struct _TFA9890_EQ_OUTPUT
+{
+    LONG    Status;             // NTSTATUS of the first failed upload, if any
+    ULONG   BandsUploaded;      // Bands written to the DSP, summed over amps
+    ULONG   BandsUnchanged;     // Bands skipped because nothing changed
+    ULONG   ComputeUs;          // Coefficient design and conversion time
+    ULONG   UploadUs;           // Bus time spent uploading
+    ULONG   AmpsSwitched;       // Amps now running the new set
+    ULONG   SwitchUs;           // Longest bank switch, the only audible transition
+} TFA9890_EQ_OUTPUT, *PTFA9890_EQ_OUTPUT;
+
+typedef struct _TFA9890_BANK_SWITCH_INPUT
+{
+    ULONG   AmpMask;            // Bit n selects amplifier n
+} TFA9890_BANK_SWITCH_INPUT, *PTFA9890_BANK_SWITCH_INPUT;
+
+typedef struct _TFA9890_BANK_SWITCH_OUTPUT
+{
+    LONG    Status;             // NTSTATUS of the first failed switch, if any
+    ULONG   AmpsSwitched;       // Amps that had a loaded bank to switch to
+    ULONG   SwitchUs;           // Longest bank switch of this request
+    ULONG   MaxSwitchUs;        // Longest bank switch since the device started
+    ULONG   Switches;           // Bank switches since the device started
+} TFA9890_BANK_SWITCH_OUTPUT, *PTFA9890_BANK_SWITCH_OUTPUT;
+
+//
+// Speaker model stream. IOCTL_TFA9890_MAP_STREAM starts sampling the
+// selected amplifiers and returns a handle, valid in the calling process,
+// to a section holding a TFA9890_STREAM_HEADER followed by Capacity
+// samples. The driver is the only producer and the caller the only
+// consumer:
+//
+//  - sample i lives in slot (i & (Capacity - 1))
+//  - the driver fills slots, then publishes them by advancing WriteIndex
+//  - the consumer copies samples [ReadIndex, WriteIndex), then re-reads
+//    WriteIndex; samples older than the new WriteIndex - Capacity may have
+//    been overwritten while being copied and must be dropped
+//  - the consumer stores its new ReadIndex; the driver only uses it to
+//    count overruns
+//
+// Close the section handle and send IOCTL_TFA9890_STOP_STREAM when done.
+//
+#define IOCTL_TFA9890_MAP_STREAM            CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TFA9890_STOP_STREAM           CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define TFA9890_STREAM_VERSION              1
+
+typedef struct _TFA9890_STREAM_INPUT
+{
+    ULONG   AmpMask;            // Bit n selects amplifier n
+} TFA9890_STREAM_INPUT, *PTFA9890_STREAM_INPUT;
+
+typedef struct _TFA9890_STREAM_OUTPUT
+{
+    ULONGLONG   Section;        // Section handle in the caller's process
+    ULONG       ViewBytes;      // Size to pass to MapViewOfFile
+    ULONG       Reserved;
+} TFA9890_STREAM_OUTPUT, *PTFA9890_STREAM_OUTPUT;
+
+typedef struct _TFA9890_STREAM_SAMPLE
+{
+    LONGLONG    Timestamp;      // QPC time of the burst read that fetched the sample
+    ULONG       Sequence;       // DSP model frame number, 24 bits
+    USHORT      Amp;
+    USHORT      Reserved;
+    LONG        Excursion;      // DSP fixed point, as reported by the patch
+    LONG        Impedance;      // DSP fixed point, as reported by the patch
+} TFA9890_STREAM_SAMPLE, *PTFA9890_STREAM_SAMPLE;
+
+// Producer and consumer fields live on separate cache lines
+typedef struct _TFA9890_STREAM_HEADER
+{
+    // Written once by the driver
+    ULONG               Version;        // TFA9890_STREAM_VERSION
+    ULONG               HeaderBytes;    // Offset of the first sample
+    ULONG               SampleBytes;    // sizeof(TFA9890_STREAM_SAMPLE)
+    ULONG               Capacity;       // Number of slots, a power of two
+    LONGLONG            QpcFrequency;   // Timestamp ticks per second
+    BYTE                Reserved0[40];
+
+    // Written by the driver
+    volatile LONGLONG   WriteIndex;     // Samples produced
+    volatile ULONG      Overruns;       // Samples overwritten before the consumer read them
+    volatile ULONG      DspLost;        // Samples the DSP history wrapped over between polls
+    volatile ULONG      Polls;          // Burst reads issued
+    volatile ULONG      FailedPolls;    // Burst reads that failed or found the bus busy
+    BYTE                Reserved1[40];
+
+    // Written by the consumer
+    volatile LONGLONG   ReadIndex;      // Samples consumed
+    BYTE                Reserved2[56];
+} TFA9890_STREAM_HEADER, *PTFA9890_STREAM_HEADER;
+
+//
+// Post-mortem dump. The regions of one amplifier are concatenated into a
+// dump image: registers as two bytes each in bus order, DSP memories as
+// three bytes per word, most significant byte first. Each request fills as
+// much of the output buffer as fits, starting at Offset into the image;
+// resend with Offset += BytesWritten until it reaches TotalBytes.
+//
+#define IOCTL_TFA9890_DUMP                  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+typedef enum _TFA9890_DUMP_SOURCE
+{
+    Tfa9890DumpRegisters = 0,
+    Tfa9890DumpPmem,
+    Tfa9890DumpXmem,
+    Tfa9890DumpYmem,
+    Tfa9890DumpIomem,
+    Tfa9890DumpSourceCount
+} TFA9890_DUMP_SOURCE;
+
+typedef struct _TFA9890_DUMP_REGION
+{
+    ULONG   Source;             // TFA9890_DUMP_SOURCE
+    ULONG   Address;            // First register or word address
+    ULONG   Count;              // Number of registers or words
+} TFA9890_DUMP_REGION, *PTFA9890_DUMP_REGION;
+
+typedef struct _TFA9890_DUMP_INPUT
+{
+    ULONG               Amp;            // Amplifier index
+    ULONG               Offset;         // Image offset to resume at, from the previous BytesWritten
+    ULONG               RegionCount;
+    TFA9890_DUMP_REGION Regions[1];
+} TFA9890_DUMP_INPUT, *PTFA9890_DUMP_INPUT;
+
+typedef struct _TFA9890_DUMP_OUTPUT
+{
+    LONG    Status;             // NTSTATUS of the failed read, if any
+    ULONG   Offset;             // Image offset of Data[0]
+    ULONG   BytesWritten;       // Valid bytes in Data
+    ULONG   TotalBytes;         // Size of the whole image
+    BYTE    Data[1];
+} TFA9890_DUMP_OUTPUT, *PTFA9890_DUMP_OUTPUT;
+
+//
+// Speaker health. While diagnostics are enabled the driver analyzes the
+// speaker model data of every amplifier continuously and keeps one compact
+// summary per amp. IOCTL_TFA9890_GET_HEALTH returns as many of them as fit.
+//
+#define IOCTL_TFA9890_GET_HEALTH            CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define TFA9890_HEALTH_RE_DRIFT             0x00000001  // Re moved past its limit from the baseline
+#define TFA9890_HEALTH_RESONANCE_SHIFT      0x00000002  // Resonance moved past its limit from the baseline
+#define TFA9890_HEALTH_DISTORTION           0x00000004  // Harmonic content above its limit
+
+typedef struct _TFA9890_HEALTH
+{
+    LONGLONG    Timestamp;              // QPC time of the last analyzed window, 0 if none
+    ULONG       Flags;                  // TFA9890_HEALTH_*
+    ULONG       Windows;                // Windows analyzed
+    ULONG       QuietWindows;           // Windows with too little excursion for a spectrum
+    float       ResonanceHz;            // From the last window with a spectrum
+    float       BaselineResonanceHz;    // 0 until the baseline is established
+    float       Re;                     // Mean impedance of the last window, DSP full scale = 1.0
+    float       BaselineRe;             // 0 until the baseline is established
+    float       ReDrift;                // (Re - BaselineRe) / BaselineRe
+    float       Distortion;             // 2nd and 3rd harmonic amplitude relative to the resonance
+    float       ExcursionRms;           // DSP full scale = 1.0
+    float       ExcursionPeak;          // DSP full scale = 1.0
+} TFA9890_HEALTH, *PTFA9890_HEALTH;
+
+typedef struct _TFA9890_HEALTH_OUTPUT
+{
+    ULONG           AmpCount;           // Summaries returned
+    ULONG           Reserved;
+    TFA9890_HEALTH  Amps[1];
+} TFA9890_HEALTH_OUTPUT, *PTFA9890_HEALTH_OUTPUT;
+
+//
+// Audio stream hints. Once the audio stack sends hints, the amps are gated
+// to low power PowerGateHysteresisMs after the last stream stops, and
+// pre-warmed on an imminent hint so the next start finds them powered. A
+// hint that finds the amps gated, or arrives while their power stage is
+// being written, completes once that write is done.
+//
+#define IOCTL_TFA9890_STREAM_HINT           CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+typedef enum _TFA9890_STREAM_HINT
+{
+    Tfa9890HintImminent = 0,            // A stream is about to start; pre-warm
+    Tfa9890HintStart,                   // A stream started; the amps must be powered
+    Tfa9890HintStop,                    // A stream stopped; gate after the hysteresis
+    Tfa9890HintCount
+} TFA9890_STREAM_HINT;
+
+typedef enum _TFA9890_AMP_POWER
+{
+    Tfa9890PowerActive = 0,             // Powered with a stream running
+    Tfa9890PowerWarm,                   // Powered, gated when the hysteresis expires
+    Tfa9890PowerGated                   // Power stage down
+} TFA9890_AMP_POWER;
+
+typedef struct _TFA9890_STREAM_HINT_INPUT
+{
+    ULONG   Hint;                       // TFA9890_STREAM_HINT
+    ULONG   Reserved;
+} TFA9890_STREAM_HINT_INPUT, *PTFA9890_STREAM_HINT_INPUT;
+
+typedef struct _TFA9890_STREAM_HINT_OUTPUT
+{
+    ULONG   Power;                      // TFA9890_AMP_POWER after the hint
+    ULONG   StartUs;                    // Start hint: time until the amps were powered
+    ULONG   WarmStarts;                 // Starts that found the amps powered
+    ULONG   ColdStarts;                 // Starts that had to power the amps up
+    ULONG   MeanWarmStartUs;
+    ULONG   MaxWarmStartUs;
+    ULONG   MeanColdStartUs;
+    ULONG   MaxColdStartUs;
+    ULONG   PreWarms;                   // Imminent hints that powered the amps up
+    ULONG   Gates;                      // Times the amps were gated
+} TFA9890_STREAM_HINT_OUTPUT, *PTFA9890_STREAM_HINT_OUTPUT;
+
+//
+// Driver-wide DSP image cache statistics. Images are cached by content and
+// shared by every device and amp that uses them.
+//
+#define IOCTL_TFA9890_GET_IMAGE_CACHE       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80A, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _TFA9890_IMAGE_CACHE_OUTPUT
+{
+    ULONG       Entries;                // Distinct images resident
+    ULONG       References;             // Device references to them
+    ULONG       ResidentBytes;          // Memory held by the cache
+    ULONG       Reserved;
+    ULONGLONG   SharedBytes;            // Bytes not duplicated thanks to sharing
+    ULONG       PathHits;               // Lookups resolved by file path
+    ULONG       ContentHits;            // Files read but found by content
+    ULONG       Misses;                 // Images loaded into the cache
+    ULONG       Failures;               // Images that could not be loaded
+} TFA9890_IMAGE_CACHE_OUTPUT, *PTFA9890_IMAGE_CACHE_OUTPUT;
+
+//
+// Telemetry subscriptions. Each handle subscribes with its own interval and
+// fields and pends IOCTL_TFA9890_READ_TELEMETRY, which completes with the
+// next sample once the handle's interval has passed. The amps are read once
+// for all subscribers, at the fastest interval any of them needs, so the
+// bus cost does not grow with the number of subscribers. A subscription
+// ends with an interval of 0, when its pending read is cancelled (as on
+// closing the handle), or after TFA9890_SUBSCRIPTION_IDLE_MS without a read
+// pending.
+//
+#define IOCTL_TFA9890_SUBSCRIBE_TELEMETRY   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80B, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_TFA9890_READ_TELEMETRY        CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80C, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define TFA9890_TELEMETRY_FIELD_TEMPERATURE 0x00000001
+#define TFA9890_TELEMETRY_FIELD_BATTERY     0x00000002
+#define TFA9890_TELEMETRY_FIELD_FAULTS      0x00000004
+#define TFA9890_TELEMETRY_FIELDS_ALL        0x00000007
+
+#define TFA9890_SUBSCRIPTION_IDLE_MS        5000
+
+typedef struct _TFA9890_SUBSCRIBE_INPUT
+{
+    ULONG   IntervalMs;                 // 0 ends the subscription
+    ULONG   Fields;                     // TFA9890_TELEMETRY_FIELD_* bits
+} TFA9890_SUBSCRIBE_INPUT, *PTFA9890_SUBSCRIBE_INPUT;
+
+typedef struct _TFA9890_TELEMETRY_SAMPLE
+{
+    LONGLONG    Timestamp;              // FILETIME the amps were read
+    ULONG       Sequence;               // Bus sample number; repeats if the bus has backed off
+    ULONG       Fields;                 // Fields valid below
+    float       TemperatureC;           // Hottest amp
+    float       BatteryV;               // Lowest battery reading of any amp
+    ULONG       Faults;                 // Fault status bits of any amp
+    ULONG       IntervalMs;             // Bus sampling interval in effect
+    ULONG       Skipped;                // Deliveries missed for want of a pending read
+    ULONG       Reserved;
+} TFA9890_TELEMETRY_SAMPLE, *PTFA9890_TELEMETRY_SAMPLE;
+
+//
+// Reset watchdog. An amp reset by a supply dip while the device stays in D0
+// is found by polling its signature register and restored from the
+// driver's state. IOCTL_TFA9890_GET_WATCHDOG returns the statistics of as
+// many amps as fit. A reset is found at most IntervalMs after it happened;
+// RestoreUs is measured from detection to the amp being fully restored.
+//
+#define IOCTL_TFA9890_GET_WATCHDOG          CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80D, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _TFA9890_WATCHDOG_AMP
+{
+    LONGLONG    LastReset;              // QPC time the last reset was detected, 0 if none
+    ULONG       Checks;                 // Signature reads
+    ULONG       Resets;                 // Resets detected
+    ULONG       Restores;               // Resets fully restored
+    ULONG       RestoreFailures;        // Restores that stopped on a bus error
+    ULONG       Registers;              // Registers written by the last restore
+    ULONG       LastRestoreUs;
+    ULONG       MaxRestoreUs;
+    ULONG       Reserved;
+} TFA9890_WATCHDOG_AMP, *PTFA9890_WATCHDOG_AMP;
+
+typedef struct _TFA9890_WATCHDOG_OUTPUT
+{
+    ULONG                   IntervalMs; // 0 if the watchdog is disabled
+    ULONG                   AmpCount;   // Amps returned
+    TFA9890_WATCHDOG_AMP    Amps[1];
+} TFA9890_WATCHDOG_OUTPUT, *PTFA9890_WATCHDOG_OUTPUT;
+
+//
+// Performance counters. The driver times its core flows from the start of
+// the device: D0 entry through the init sequence or from the hibernate
+// images, the telemetry bus read, the private IOCTLs it completes inline
+// and the verification of the init sequence. A benchmark run takes one snapshot with
+// IOCTL_TFA9890_GET_PERF before and one after, and Tfa9890PerfDelta and
+// Tfa9890PerfRegressions compare the run with a stored baseline run.
+//
+#define IOCTL_TFA9890_GET_PERF              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80E, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define TFA9890_PERF_VERSION                2
+
+#define TFA9890_PERF_D0_ENTRY               0   // Power-up of all amps by the init sequence through resuming the background work
+#define TFA9890_PERF_TELEMETRY              1   // One telemetry read of all amps
+#define TFA9890_PERF_IOCTL                  2   // One private IOCTL, dispatch to completion
+#define TFA9890_PERF_VERIFY                 3   // Read-back of the init sequence of all amps
+#define TFA9890_PERF_RESUME                 4   // Power-up of all amps from their hibernate images, likewise
+#define TFA9890_PERF_FLOWS                  5
+
+typedef struct _TFA9890_PERF_FLOW
+{
+    ULONG       Count;                  // Runs of the flow
+    ULONG       Transactions;           // I2C transactions issued by all runs, including retries
+    ULONGLONG   TotalUs;                // Time spent in all runs
+    ULONG       LastUs;
+    ULONG       MaxUs;
+} TFA9890_PERF_FLOW, *PTFA9890_PERF_FLOW;
+
+typedef struct _TFA9890_PERF_OUTPUT
+{
+    ULONG               Version;        // TFA9890_PERF_VERSION
+    ULONG               AmpCount;
+    TFA9890_PERF_FLOW   Flows[TFA9890_PERF_FLOWS];
+} TFA9890_PERF_OUTPUT, *PTFA9890_PERF_OUTPUT;
+
+#pragma pack(pop)
+
+// The counters of the flows run between two snapshots. LastUs is taken
+// from the later snapshot; MaxUs is only meaningful if the earlier one was
+// taken before the flow ever ran.
+inline void Tfa9890PerfDelta(
+    _In_ const TFA9890_PERF_OUTPUT* pBefore,
+    _In_ const TFA9890_PERF_OUTPUT* pAfter,
+    _Out_ PTFA9890_PERF_OUTPUT pRun)
+{
+    *pRun = *pAfter;
+
+    for (ULONG Flow = 0; Flow < TFA9890_PERF_FLOWS; Flow++)
+    {
+        pRun->Flows[Flow].Count -= pBefore->Flows[Flow].Count;
+        pRun->Flows[Flow].Transactions -= pBefore->Flows[Flow].Transactions;
+        pRun->Flows[Flow].TotalUs -= pBefore->Flows[Flow].TotalUs;
+    }
+}
+
+// Compare the mean time and the mean transactions per run of every flow
+// with a baseline. Returns a bit per flow, 1 << TFA9890_PERF_*, that is
+// more than ThresholdPercent worse; flows that did not run in both are
+// not compared.
+inline ULONG Tfa9890PerfRegressions(
+    _In_ const TFA9890_PERF_OUTPUT* pBaseline,
+    _In_ const TFA9890_PERF_OUTPUT* pRun,
+    _In_ ULONG ThresholdPercent)
+{
+    ULONG Regressions = 0;
+
+    for (ULONG Flow = 0; Flow < TFA9890_PERF_FLOWS; Flow++)
+    {
+        const TFA9890_PERF_FLOW* pBase = &pBaseline->Flows[Flow];
+        const TFA9890_PERF_FLOW* pNew = &pRun->Flows[Flow];
+
+        if (0 == pBase->Count || 0 == pNew->Count)
+        {
+            continue;
+        }
+
+        // a / n > b / m * (100 + t) / 100, cross-multiplied
+        ULONGLONG Limit = 100 + ThresholdPercent;
+        if (pNew->TotalUs * pBase->Count * 100 > pBase->TotalUs * pNew->Count * Limit ||
+            static_cast<ULONGLONG>(pNew->Transactions) * pBase->Count * 100 > static_cast<ULONGLONG>(pBase->Transactions) * pNew->Count * Limit)
+        {
+            Regressions |= 1UL << Flow;
+        }
+    }
+
+    return Regressions;
+}
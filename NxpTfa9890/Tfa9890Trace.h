@@ -0,0 +1,65 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the layout of the I2C transaction trace the driver
+//    records when the BusRecordFile value is set in the device hardware key.
+//    It is shared with offline replay and analysis tools and must not depend
+//    on any driver-only header.
+//
+//    The file is one TFA9890_TRACE_HEADER followed by TFA9890_TRACE_RECORDs
+//    until end of file. Every record is followed by Length payload bytes:
+//    the bytes written for a write, the bytes returned for a successful read.
+//    All fields are little endian; payloads are in bus byte order.
+//
+//Environment:
+//
+//    User mode
+
+#pragma once
+
+#pragma pack(push, 1)
+
+#define TFA9890_TRACE_MAGIC                 0x52543954  // 'T9TR'
+#define TFA9890_TRACE_VERSION               1
+#define TFA9890_TRACE_MAX_AMPS              8
+
+typedef struct _TFA9890_TRACE_HEADER
+{
+    ULONG       Magic;                  // TFA9890_TRACE_MAGIC
+    USHORT      Version;                // TFA9890_TRACE_VERSION
+    USHORT      HeaderBytes;            // Offset of the first record
+    LONGLONG    StartTime;              // UTC FILETIME the recording began
+    ULONG       AmpCount;
+    ULONG       Reserved;
+    LONGLONG    ConnectionIds[TFA9890_TRACE_MAX_AMPS];  // Resource hub connection per amp
+} TFA9890_TRACE_HEADER, *PTFA9890_TRACE_HEADER;
+
+#define TFA9890_TRACE_FLAG_READ             0x01    // Register read; otherwise a write
+#define TFA9890_TRACE_FLAG_MARKER           0x02    // Flow marker; Register holds TFA9890_TRACE_MARKER_*
+
+#define TFA9890_TRACE_AMP_NONE              0xFF    // Amp of a marker record
+
+// Flow markers bracket the power transitions and the restores after an amp
+// reset so a replay can select one flow
+#define TFA9890_TRACE_MARKER_D0_ENTRY       0x01
+#define TFA9890_TRACE_MARKER_D0_ENTRY_DONE  0x02
+#define TFA9890_TRACE_MARKER_D0_EXIT        0x03
+#define TFA9890_TRACE_MARKER_D0_EXIT_DONE   0x04
+#define TFA9890_TRACE_MARKER_RESTORE        0x05
+#define TFA9890_TRACE_MARKER_RESTORE_DONE   0x06
+
+typedef struct _TFA9890_TRACE_RECORD
+{
+    ULONGLONG   TimeUs;                 // Start of the transaction relative to StartTime. Records
+                                        // of different amps may overlap and appear out of order.
+    ULONG       DurationUs;             // Time spent in the I2C request
+    LONG        Status;                 // NTSTATUS of the request
+    USHORT      Length;                 // Payload bytes following the record
+    BYTE        Amp;                    // Index into ConnectionIds, TFA9890_TRACE_AMP_NONE for markers
+    BYTE        Register;
+    BYTE        Flags;                  // TFA9890_TRACE_FLAG_*
+    BYTE        Reserved;
+} TFA9890_TRACE_RECORD, *PTFA9890_TRACE_RECORD;
+
+#pragma pack(pop)
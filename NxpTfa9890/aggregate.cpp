@@ -0,0 +1,121 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the telemetry aggregation stage. With a window
+//    configured, a started amp sensor keeps its amp sampled at the full
+//    telemetry rate but is sent only the minimum, maximum, mean and RMS of
+//    temperature, impedance and excursion over each window. The samples are
+//    kept one buffer per amp and channel and reduced with the vectorized
+//    diagnostics kernels.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include <math.h>
+
+#include "Device.h"
+
+#include "Aggregate.tmh"
+
+
+inline VOID WindowStats(
+    _In_ const DIAG_AGGREGATE* pAggregate,
+    _Out_ PTFA9890_WINDOW_STATS pStats)
+{
+    if (0 == pAggregate->Count)
+    {
+        RtlZeroMemory(pStats, sizeof(*pStats));
+        return;
+    }
+
+    pStats->Min = pAggregate->Min;
+    pStats->Max = pAggregate->Max;
+    pStats->Mean = static_cast<float>(pAggregate->Sum / pAggregate->Count);
+    pStats->Rms = static_cast<float>(sqrt(pAggregate->SumSquares / pAggregate->Count));
+}
+
+// Buffer one temperature reading of an amp for the current window
+VOID NxpTfa9890Device::AggregateTemperature(
+    _In_ ULONG Amp,
+    _In_ float TemperatureC)
+{
+    AcquireSRWLockExclusive(&m_AggregateLock);
+
+    ULONG Count = m_AggregateTemperatureCount[Amp];
+    if (Count < TFA9890_AGGREGATE_MAX_WINDOW)
+    {
+        m_AggregateTemperature[Amp][Count] = TemperatureC;
+        m_AggregateTemperatureCount[Amp] = Count + 1;
+    }
+
+    ReleaseSRWLockExclusive(&m_AggregateLock);
+}
+
+// Fold a batch of model frames of an amp into the current window. Model
+// frames arrive many times per telemetry sample, so they are reduced as
+// they come instead of being buffered.
+VOID NxpTfa9890Device::AggregateModel(
+    _In_ ULONG Amp,
+    _In_reads_(Count) const float* pExcursion,
+    _In_reads_(Count) const float* pImpedance,
+    _In_ ULONG Count)
+{
+    AcquireSRWLockExclusive(&m_AggregateLock);
+    DiagAggregate(pExcursion, Count, &m_AggregateExcursion[Amp]);
+    DiagAggregate(pImpedance, Count, &m_AggregateImpedance[Amp]);
+    ReleaseSRWLockExclusive(&m_AggregateLock);
+}
+
+// Count one telemetry sample of an amp into its window. When it completes
+// the window, reduce the window into pAggregates, start the next one and
+// return true.
+bool NxpTfa9890Device::CloseAggregateWindow(
+    _In_ ULONG Amp,
+    _Out_ PTFA9890_AGGREGATES pAggregates)
+{
+    DIAG_AGGREGATE Temperature = {};
+    DIAG_AGGREGATE Impedance = {};
+    DIAG_AGGREGATE Excursion = {};
+
+    RtlZeroMemory(pAggregates, sizeof(*pAggregates));
+
+    AcquireSRWLockExclusive(&m_AggregateLock);
+
+    if (++m_AggregateSamples[Amp] < m_AggregateWindow)
+    {
+        ReleaseSRWLockExclusive(&m_AggregateLock);
+        return false;
+    }
+
+    DiagAggregate(m_AggregateTemperature[Amp], m_AggregateTemperatureCount[Amp], &Temperature);
+    Impedance = m_AggregateImpedance[Amp];
+    Excursion = m_AggregateExcursion[Amp];
+    pAggregates->Samples = m_AggregateSamples[Amp];
+
+    m_AggregateSamples[Amp] = 0;
+    m_AggregateTemperatureCount[Amp] = 0;
+    RtlZeroMemory(&m_AggregateImpedance[Amp], sizeof(m_AggregateImpedance[Amp]));
+    RtlZeroMemory(&m_AggregateExcursion[Amp], sizeof(m_AggregateExcursion[Amp]));
+
+    ReleaseSRWLockExclusive(&m_AggregateLock);
+
+    WindowStats(&Temperature, &pAggregates->Temperature);
+    WindowStats(&Impedance, &pAggregates->Impedance);
+    WindowStats(&Excursion, &pAggregates->Excursion);
+
+    return true;
+}
+
+// Drop an amp's partial window, e.g. when its sensor is started over
+VOID NxpTfa9890Device::ResetAggregateWindow(
+    _In_ ULONG Amp)
+{
+    AcquireSRWLockExclusive(&m_AggregateLock);
+    m_AggregateSamples[Amp] = 0;
+    m_AggregateTemperatureCount[Amp] = 0;
+    RtlZeroMemory(&m_AggregateImpedance[Amp], sizeof(m_AggregateImpedance[Amp]));
+    RtlZeroMemory(&m_AggregateExcursion[Amp], sizeof(m_AggregateExcursion[Amp]));
+    ReleaseSRWLockExclusive(&m_AggregateLock);
+}
@@ -0,0 +1,199 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the simulated TFA9890 of the host benchmark.
+//    Registers read back what was last written, except the telemetry
+//    registers, which report a fixed battery, a temperature stepping by a
+//    degree every few seconds and no faults, and the soft reset bit of
+//    system control, which clears itself. The speaker model sequence word
+//    counts frames at TFA9890_MODEL_FRAME_RATE_HZ of the virtual clock and
+//    every history slot holds the newest frame stored in it.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#include <map>
+
+#include "amp.h"
+#include "tfa9890.h"
+
+
+// Telemetry the amp reports, as numeric register values
+#define SIM_STATUS                  TFA9890_STATUS_FAULTS_CLEAR
+#define SIM_BATTERY_LSB             689         // 3.70 V
+#define SIM_TEMPERATURE_C           30
+#define SIM_TEMPERATURE_STEPS       4
+#define SIM_TEMPERATURE_PERIOD      (3 * 10000000LL)
+
+// Model frames, as the patch stores them in 24-bit fixed point
+#define SIM_EXCURSION_AMPLITUDE     0x00020000
+#define SIM_EXCURSION_PERIOD        13          // Frames per cycle of the synthetic excursion
+#define SIM_IMPEDANCE               0x00400000
+
+_SimTfa9890::_SimTfa9890()
+{
+    RtlZeroMemory(m_Registers, sizeof(m_Registers));
+    m_Writes = 0;
+    m_Reads = 0;
+}
+
+VOID _SimTfa9890::Reset()
+{
+    RtlZeroMemory(m_Registers, sizeof(m_Registers));
+
+    for (ULONG Memory = 0; Memory < _countof(m_Memories); Memory++)
+    {
+        m_Memories[Memory].clear();
+    }
+}
+
+// Memory selected by CF_CONTROLS
+ULONG _SimTfa9890::Memory() const
+{
+    return (m_Registers[TFA9890_CF_CONTROLS][1] >> 1) & 0x3;
+}
+
+// A 24-bit word of the selected memory. The model sequence and history
+// follow the virtual clock; every other word reads back what was written.
+ULONG _SimTfa9890::ReadDspWord(
+    _In_ ULONG Address,
+    _In_ LONGLONG Now) const
+{
+    ULONG Memory = this->Memory();
+    ULONG Sequence = static_cast<ULONG>(Now * TFA9890_MODEL_FRAME_RATE_HZ / 10000000);
+    ULONG HistoryWords = TFA9890_MODEL_HISTORY_LENGTH * TFA9890_MODEL_WORDS_PER_SAMPLE;
+
+    if (TFA9890_DMEM_XMEM == Memory && TFA9890_XMEM_MODEL_SEQUENCE == Address)
+    {
+        return Sequence & TFA9890_MODEL_SEQUENCE_MASK;
+    }
+
+    if (TFA9890_DMEM_XMEM == Memory && Address >= TFA9890_XMEM_MODEL_HISTORY && Address < TFA9890_XMEM_MODEL_HISTORY + HistoryWords)
+    {
+        ULONG Slot = (Address - TFA9890_XMEM_MODEL_HISTORY) / TFA9890_MODEL_WORDS_PER_SAMPLE;
+        ULONG Frame = Sequence - (Sequence - Slot) % TFA9890_MODEL_HISTORY_LENGTH;
+
+        if (0 != (Address - TFA9890_XMEM_MODEL_HISTORY) % TFA9890_MODEL_WORDS_PER_SAMPLE)
+        {
+            return SIM_IMPEDANCE;
+        }
+
+        double Phase = 2.0 * 3.14159265358979 * (Frame % SIM_EXCURSION_PERIOD) / SIM_EXCURSION_PERIOD;
+        return static_cast<ULONG>(static_cast<LONG>(SIM_EXCURSION_AMPLITUDE * sin(Phase))) & 0x00FFFFFF;
+    }
+
+    std::map<ULONG, ULONG>::const_iterator Word = m_Memories[Memory].find(Address);
+    return (m_Memories[Memory].end() != Word) ? Word->second : 0;
+}
+
+VOID _SimTfa9890::ReadRegister(
+    _In_ ULONG Register,
+    _Out_writes_(2) BYTE* pData,
+    _In_ LONGLONG Now) const
+{
+    ULONG Value = (m_Registers[Register][0] << 8) | m_Registers[Register][1];
+
+    switch (Register)
+    {
+        case TFA9890_STATUS:
+            Value = SIM_STATUS;
+            break;
+
+        case TFA9890_BATTERY_VOLTAGE:
+            Value = SIM_BATTERY_LSB;
+            break;
+
+        case TFA9890_TEMPERATURE:
+            Value = SIM_TEMPERATURE_C + static_cast<ULONG>(Now / SIM_TEMPERATURE_PERIOD % SIM_TEMPERATURE_STEPS);
+            break;
+
+        case TFA9890_SYSTEM_CONTROL:
+            Value &= ~TFA9890_SYSTEM_CONTROL_I2CR;
+            break;
+
+        default:
+            break;
+    }
+
+    pData[0] = static_cast<BYTE>(Value >> 8);
+    pData[1] = static_cast<BYTE>(Value);
+}
+
+// Registers take two bytes each from the addressed one on. Bytes reaching
+// CF_MEM are streamed into the selected memory as 24-bit words from CF_MAD
+// on, which advances with every word.
+VOID _SimTfa9890::Write(
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length,
+    _In_ LONGLONG /*Now*/)
+{
+    ULONG Register = pData[0];
+    ULONG Offset = 1;
+
+    m_Writes++;
+
+    while (Offset < Length)
+    {
+        if (TFA9890_CF_MEM == Register)
+        {
+            ULONG Address = (m_Registers[TFA9890_CF_MAD][0] << 8) | m_Registers[TFA9890_CF_MAD][1];
+
+            for (; Offset + TFA9890_DSP_WORD_BYTES <= Length; Offset += TFA9890_DSP_WORD_BYTES, Address++)
+            {
+                m_Memories[Memory()][Address & 0xFFFF] = (pData[Offset] << 16) | (pData[Offset + 1] << 8) | pData[Offset + 2];
+            }
+
+            m_Registers[TFA9890_CF_MAD][0] = static_cast<BYTE>(Address >> 8);
+            m_Registers[TFA9890_CF_MAD][1] = static_cast<BYTE>(Address);
+            break;
+        }
+
+        m_Registers[Register][0] = pData[Offset];
+        m_Registers[Register][1] = (Offset + 1 < Length) ? pData[Offset + 1] : m_Registers[Register][1];
+        Offset += 2;
+        Register = (Register + 1) & 0xFF;
+    }
+}
+
+// The counterpart of Write. A read of CF_MEM streams words from CF_MAD on.
+VOID _SimTfa9890::Read(
+    _In_ BYTE Register,
+    _Out_writes_bytes_(Length) BYTE* pData,
+    _In_ ULONG Length,
+    _In_ LONGLONG Now)
+{
+    m_Reads++;
+
+    if (TFA9890_CF_MEM == Register)
+    {
+        ULONG Address = (m_Registers[TFA9890_CF_MAD][0] << 8) | m_Registers[TFA9890_CF_MAD][1];
+        ULONG Offset = 0;
+
+        for (; Offset + TFA9890_DSP_WORD_BYTES <= Length; Offset += TFA9890_DSP_WORD_BYTES, Address++)
+        {
+            ULONG Word = ReadDspWord(Address & 0xFFFF, Now);
+            pData[Offset] = static_cast<BYTE>(Word >> 16);
+            pData[Offset + 1] = static_cast<BYTE>(Word >> 8);
+            pData[Offset + 2] = static_cast<BYTE>(Word);
+        }
+        RtlZeroMemory(pData + Offset, Length - Offset);
+
+        m_Registers[TFA9890_CF_MAD][0] = static_cast<BYTE>(Address >> 8);
+        m_Registers[TFA9890_CF_MAD][1] = static_cast<BYTE>(Address);
+        return;
+    }
+
+    for (ULONG Offset = 0; Offset < Length; Offset += 2, Register++)
+    {
+        BYTE Value[2];
+
+        ReadRegister(Register, Value, Now);
+        pData[Offset] = Value[0];
+        if (Offset + 1 < Length)
+        {
+            pData[Offset + 1] = Value[1];
+        }
+    }
+}
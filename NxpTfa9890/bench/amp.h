@@ -0,0 +1,44 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the type definitions for the simulated TFA9890
+//    behind each I2C connection of the host benchmark. It models what the
+//    driver relies on: the 16-bit register file with auto-increment, the
+//    telemetry registers, and the CoolFlux memories behind the CF_* window
+//    with the speaker model history the patch keeps in XMEM.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#pragma once
+
+#include <map>
+
+#include "hostsdk.h"
+
+typedef class _SimTfa9890
+{
+private:
+    BYTE                        m_Registers[256][2];    // Bus byte order, most significant byte first
+    std::map<ULONG, ULONG>      m_Memories[4];          // 24-bit words written, per TFA9890_DMEM_*
+
+    ULONG                       Memory() const;
+    ULONG                       ReadDspWord(_In_ ULONG Address, _In_ LONGLONG Now) const;
+    VOID                        ReadRegister(_In_ ULONG Register, _Out_writes_(2) BYTE* pData, _In_ LONGLONG Now) const;
+
+public:
+    ULONG                       m_Writes;
+    ULONG                       m_Reads;
+
+    _SimTfa9890();
+
+    // Back to the power-on defaults, as after a supply dip
+    VOID                        Reset();
+
+    // pData[0] is the register address, as on the bus. Now is in 100 ns.
+    VOID                        Write(_In_reads_bytes_(Length) const BYTE* pData, _In_ ULONG Length, _In_ LONGLONG Now);
+    VOID                        Read(_In_ BYTE Register, _Out_writes_bytes_(Length) BYTE* pData, _In_ ULONG Length, _In_ LONGLONG Now);
+
+} SimTfa9890, *PSimTfa9890;
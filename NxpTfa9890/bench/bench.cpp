@@ -0,0 +1,696 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the driver benchmark. It loads the driver on the
+//    host framework with four simulated amps and runs its core flows in
+//    phases, taking an IOCTL_TFA9890_GET_PERF snapshot around each:
+//
+//      power_up    D0 entry through the init sequence and its read-back
+//      idle        Diagnostics polling and the watchdog only; no flow may
+//                  be charged a transaction
+//      telemetry   All sensors started, reading the amps at their interval
+//      ioctl       Staged commits, EQ updates and health queries
+//      restore     One amp reset behind the driver's back, found and
+//                  restored by the watchdog in the background
+//      resume      D0 exit and D0 entry from the hibernate images
+//      hints       Stream hints: the amps gated after the hysteresis and
+//                  a cold start that waits for the power-up
+//
+//    The counters of every phase are written as JSON, one line per flow,
+//    and compared with a baseline of the same form: a flow whose mean time
+//    or mean transactions per run is more than the threshold worse fails
+//    the run. The snapshots are IOCTLs themselves and are left out of the
+//    IOCTL flow.
+//
+//    Usage: bench [--baseline <file>] [--out <file>] [--threshold <percent>]
+//                 [--write-baseline <file>] [--trace <file>]
+//                 [--history <file>]
+//
+//    With --trace the driver records the bus transactions of its power
+//    transitions to the file, for the replay tool. With --history it keeps
+//    its telemetry history in the file, for the CSV exporter; the history
+//    samples telemetry in every phase, so such a run is not comparable with
+//    a baseline taken without it.
+//
+//    Returns 0 if the run matches the baseline, 1 on a regression and 2 if
+//    the driver failed a flow or the run could not be made.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "tfa9890.h"
+#include "Tfa9890Ioctl.h"
+
+
+#define BENCH_AMPS                  4
+#define BENCH_AMP_MASK              ((1UL << BENCH_AMPS) - 1)
+#define BENCH_THRESHOLD_PERCENT     10
+#define BENCH_POWER_UP_MS           250
+#define BENCH_IDLE_MS               2000
+#define BENCH_TELEMETRY_MS          10000
+#define BENCH_IOCTL_ROUNDS          50
+#define BENCH_IOCTL_GAP_MS          20
+#define BENCH_RESET_AMP             1
+
+static const PCSTR g_FlowNames[TFA9890_PERF_FLOWS] =
+{
+    "d0_entry",
+    "telemetry",
+    "ioctl",
+    "verify",
+    "resume",
+};
+
+// Init sequence of the benchmark board: the bypass sequence with the
+// settle times a real board needs before it powers the amp
+static const PCSTR g_BenchProfile[] =
+{
+    "04=0B88",
+    "settle=2",
+    "09=8209,power",
+    "settle=5",
+    "09=0608,power",
+};
+
+typedef struct _BENCH_PHASE
+{
+    std::string             Name;
+    TFA9890_PERF_OUTPUT     Perf;                   // Counters of the flows run in the phase
+    ULONGLONG               DurationUs;             // Virtual time
+    ULONGLONG               BusTransactions;        // Every transaction on the bus
+    ULONGLONG               OtherTransactions;      // Not charged to a flow: polling, watchdog, D0 exit
+    ULONG                   Samples;                // Samples pushed to the sensors
+} BENCH_PHASE, *PBENCH_PHASE;
+
+typedef struct _BENCH_BASELINE_FLOW
+{
+    std::string             Phase;
+    ULONG                   Flow;
+    TFA9890_PERF_FLOW       Counters;
+} BENCH_BASELINE_FLOW;
+
+// Stop the run on a failed flow
+static void BenchFail(
+    _In_ PCSTR pMessage,
+    _In_ NTSTATUS Status)
+{
+    fprintf(stderr, "bench: %s failed 0x%08X\n", pMessage, static_cast<unsigned int>(Status));
+    exit(2);
+}
+
+static VOID BenchGetPerf(
+    _Out_ PTFA9890_PERF_OUTPUT pPerf)
+{
+    size_t Information = 0;
+    NTSTATUS Status = HostIoControl(0, IOCTL_TFA9890_GET_PERF, nullptr, 0, pPerf, sizeof(*pPerf), &Information);
+
+    if (!NT_SUCCESS(Status) || sizeof(*pPerf) != Information || TFA9890_PERF_VERSION != pPerf->Version)
+    {
+        BenchFail("IOCTL_TFA9890_GET_PERF", NT_SUCCESS(Status) ? STATUS_UNSUCCESSFUL : Status);
+    }
+}
+
+static VOID BenchBeginPhase(
+    _In_ PCSTR pName,
+    _Out_ PBENCH_PHASE pPhase,
+    _Out_ PTFA9890_PERF_OUTPUT pBefore,
+    _Out_ PHOST_BUS_STATISTICS pBus,
+    _Out_ LONGLONG* pStart)
+{
+    pPhase->Name = pName;
+    BenchGetPerf(pBefore);
+    HostGetBusStatistics(pBus);
+    *pStart = HostNow();
+}
+
+static VOID BenchEndPhase(
+    _Inout_ PBENCH_PHASE pPhase,
+    _In_ const TFA9890_PERF_OUTPUT* pBefore,
+    _In_ const HOST_BUS_STATISTICS* pBus,
+    _In_ LONGLONG Start)
+{
+    TFA9890_PERF_OUTPUT After;
+    HOST_BUS_STATISTICS Bus;
+    ULONGLONG Charged = 0;
+
+    HostGetBusStatistics(&Bus);
+    pPhase->DurationUs = static_cast<ULONGLONG>(HostNow() - Start) / 10;
+    BenchGetPerf(&After);
+    Tfa9890PerfDelta(pBefore, &After, &pPhase->Perf);
+
+    // The snapshot that opened the phase; it is not a flow of the phase and
+    // takes no virtual time, as it does not touch the bus
+    pPhase->Perf.Flows[TFA9890_PERF_IOCTL].Count--;
+
+    for (ULONG Flow = 0; Flow < TFA9890_PERF_FLOWS; Flow++)
+    {
+        Charged += pPhase->Perf.Flows[Flow].Transactions;
+    }
+
+    pPhase->BusTransactions = Bus.Transactions - pBus->Transactions;
+    pPhase->OtherTransactions = pPhase->BusTransactions - Charged;
+    pPhase->Samples = Bus.DataReady - pBus->DataReady;
+}
+
+static VOID BenchIoControl(
+    _In_ PCSTR pName,
+    _In_ ULONG IoControlCode,
+    _In_reads_bytes_(InputLength) const VOID* pInput,
+    _In_ size_t InputLength,
+    _Out_writes_bytes_(OutputLength) VOID* pOutput,
+    _In_ size_t OutputLength)
+{
+    NTSTATUS Status = HostIoControl(0, IoControlCode, pInput, InputLength, pOutput, OutputLength, nullptr);
+
+    if (!NT_SUCCESS(Status) || STATUS_PENDING == Status)
+    {
+        BenchFail(pName, Status);
+    }
+}
+
+// One round of the IOCTL phase: stage a register on every amp and commit
+// it, move one EQ band and read the health summaries
+static VOID BenchIoctlRound(
+    _In_ ULONG Round)
+{
+    BYTE Stage[FIELD_OFFSET(TFA9890_STAGE_INPUT, Entries) + 2 * sizeof(TFA9890_STAGE_ENTRY)] = {};
+    PTFA9890_STAGE_INPUT pStage = reinterpret_cast<PTFA9890_STAGE_INPUT>(Stage);
+    TFA9890_COMMIT_INPUT Commit = {};
+    TFA9890_COMMIT_OUTPUT Committed = {};
+    TFA9890_EQ_INPUT Eq = {};
+    TFA9890_EQ_OUTPUT EqResult = {};
+    BYTE Health[FIELD_OFFSET(TFA9890_HEALTH_OUTPUT, Amps) + BENCH_AMPS * sizeof(TFA9890_HEALTH)] = {};
+
+    pStage->Count = 2;
+    pStage->Entries[0].AmpMask = BENCH_AMP_MASK;
+    pStage->Entries[0].Register = TFA9890_I2S_CONTROL;
+    pStage->Entries[0].Value = TFA9890_BUS_WORD(0x0B88 | ((Round & 1) << 4));
+    pStage->Entries[1].AmpMask = BENCH_AMP_MASK;
+    pStage->Entries[1].Register = TFA9890_SYSTEM_CONTROL;
+    pStage->Entries[1].Value = TFA9890_BUS_WORD(0x0608);
+    BenchIoControl("IOCTL_TFA9890_STAGE_REGISTERS", IOCTL_TFA9890_STAGE_REGISTERS, Stage, sizeof(Stage), nullptr, 0);
+    BenchIoControl("IOCTL_TFA9890_COMMIT_STAGED", IOCTL_TFA9890_COMMIT_STAGED, &Commit, sizeof(Commit), &Committed, sizeof(Committed));
+
+    Eq.AmpMask = BENCH_AMP_MASK;
+    Eq.Count = 1;
+    Eq.Bands[0].Index = Round % TFA9890_EQ_BANDS;
+    Eq.Bands[0].Type = Tfa9890EqPeaking;
+    Eq.Bands[0].FrequencyHz = 1000.0f;
+    Eq.Bands[0].Q = 0.7f;
+    Eq.Bands[0].GainDb = (Round & 1) ? 3.0f : -3.0f;
+    BenchIoControl("IOCTL_TFA9890_SET_EQ", IOCTL_TFA9890_SET_EQ, &Eq, sizeof(Eq), &EqResult, sizeof(EqResult));
+
+    BenchIoControl("IOCTL_TFA9890_GET_HEALTH", IOCTL_TFA9890_GET_HEALTH, nullptr, 0, Health, sizeof(Health));
+}
+
+// Check that the watchdog restored the reset amp, and only that one
+static VOID BenchCheckRestore()
+{
+    BYTE Output[FIELD_OFFSET(TFA9890_WATCHDOG_OUTPUT, Amps) + BENCH_AMPS * sizeof(TFA9890_WATCHDOG_AMP)] = {};
+    PTFA9890_WATCHDOG_OUTPUT pWatchdog = reinterpret_cast<PTFA9890_WATCHDOG_OUTPUT>(Output);
+
+    BenchIoControl("IOCTL_TFA9890_GET_WATCHDOG", IOCTL_TFA9890_GET_WATCHDOG, nullptr, 0, Output, sizeof(Output));
+    if (BENCH_AMPS != pWatchdog->AmpCount)
+    {
+        BenchFail("IOCTL_TFA9890_GET_WATCHDOG", STATUS_UNSUCCESSFUL);
+    }
+
+    for (ULONG Amp = 0; Amp < pWatchdog->AmpCount; Amp++)
+    {
+        ULONG Expected = (BENCH_RESET_AMP == Amp) ? 1 : 0;
+
+        if (Expected != pWatchdog->Amps[Amp].Resets ||
+            Expected != pWatchdog->Amps[Amp].Restores ||
+            0 != pWatchdog->Amps[Amp].RestoreFailures)
+        {
+            BenchFail("Restore", STATUS_UNSUCCESSFUL);
+        }
+    }
+}
+
+// Send a stream hint and wait for it, as a cold start pends until the
+// sequencer has powered the amps
+static VOID BenchStreamHint(
+    _In_ TFA9890_STREAM_HINT Hint,
+    _Out_ PTFA9890_STREAM_HINT_OUTPUT pOutput)
+{
+    TFA9890_STREAM_HINT_INPUT Input = {};
+
+    Input.Hint = Hint;
+    NTSTATUS Status = HostIoControlWait(0, IOCTL_TFA9890_STREAM_HINT, &Input, sizeof(Input), pOutput, sizeof(*pOutput),
+                                        nullptr, BENCH_POWER_UP_MS);
+    if (!NT_SUCCESS(Status) || STATUS_PENDING == Status)
+    {
+        BenchFail("IOCTL_TFA9890_STREAM_HINT", Status);
+    }
+}
+
+static VOID BenchConfigure(
+    _In_opt_ PCSTR pTrace,
+    _In_opt_ PCSTR pHistory)
+{
+    static const PCSTR Profiles[] = { "Bench" };
+
+    HostSetParametersMultiSz("Profiles", Profiles, _countof(Profiles));
+    HostSetParametersMultiSz("Bench", g_BenchProfile, _countof(g_BenchProfile));
+    HostSetParametersString("DefaultProfile", "Bypass");
+
+    HostSetDeviceString("InitProfile", "Bench");
+    HostSetDeviceULong("DiagnosticsEnabled", 1);
+
+    if (nullptr != pTrace)
+    {
+        HostSetDeviceString("BusRecordFile", pTrace);
+    }
+
+    if (nullptr != pHistory)
+    {
+        HostSetDeviceString("HistoryFile", pHistory);
+    }
+}
+
+static VOID BenchRun(
+    _In_opt_ PCSTR pTrace,
+    _In_opt_ PCSTR pHistory,
+    _Out_ std::vector<BENCH_PHASE>* pPhases)
+{
+    BENCH_PHASE Phase;
+    TFA9890_PERF_OUTPUT Before;
+    HOST_BUS_STATISTICS Bus;
+    LONGLONG Start;
+    NTSTATUS Status;
+
+    BenchConfigure(pTrace, pHistory);
+
+    Status = HostLoadDriver();
+    if (!NT_SUCCESS(Status))
+    {
+        BenchFail("DriverEntry", Status);
+    }
+
+    Status = HostAddDevice(BENCH_AMPS);
+    if (!NT_SUCCESS(Status))
+    {
+        BenchFail("Device start", Status);
+    }
+
+    BenchBeginPhase("power_up", &Phase, &Before, &Bus, &Start);
+    Status = HostD0Entry();
+    if (!NT_SUCCESS(Status))
+    {
+        BenchFail("D0 entry", Status);
+    }
+    HostRunFor(BENCH_POWER_UP_MS);
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    if (1 != Phase.Perf.Flows[TFA9890_PERF_D0_ENTRY].Count)
+    {
+        BenchFail("Power-up", STATUS_UNSUCCESSFUL);
+    }
+    pPhases->push_back(Phase);
+
+    // Only background work runs; none of it may be charged to a flow. A
+    // history samples telemetry on its own, which is charged to it.
+    BenchBeginPhase("idle", &Phase, &Before, &Bus, &Start);
+    HostRunFor(BENCH_IDLE_MS);
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    if (nullptr == pHistory &&
+        (0 == Phase.OtherTransactions || Phase.OtherTransactions != Phase.BusTransactions))
+    {
+        BenchFail("Background exclusion", STATUS_UNSUCCESSFUL);
+    }
+    pPhases->push_back(Phase);
+
+    BenchBeginPhase("telemetry", &Phase, &Before, &Bus, &Start);
+    for (ULONG Sensor = 0; Sensor < HostSensorCount(); Sensor++)
+    {
+        Status = HostStartSensor(Sensor);
+        if (!NT_SUCCESS(Status))
+        {
+            BenchFail("Sensor start", Status);
+        }
+    }
+    HostRunFor(BENCH_TELEMETRY_MS);
+    for (ULONG Sensor = 0; Sensor < HostSensorCount(); Sensor++)
+    {
+        HostStopSensor(Sensor);
+    }
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    if (0 == Phase.Perf.Flows[TFA9890_PERF_TELEMETRY].Count || 0 == Phase.Samples)
+    {
+        BenchFail("Telemetry", STATUS_UNSUCCESSFUL);
+    }
+    pPhases->push_back(Phase);
+
+    BenchBeginPhase("ioctl", &Phase, &Before, &Bus, &Start);
+    for (ULONG Round = 0; Round < BENCH_IOCTL_ROUNDS; Round++)
+    {
+        BenchIoctlRound(Round);
+        HostRunFor(BENCH_IOCTL_GAP_MS);
+    }
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    pPhases->push_back(Phase);
+
+    // The watchdog finds the reset within one interval and restores the amp
+    // through the sequencer; none of it is charged to a flow
+    BenchBeginPhase("restore", &Phase, &Before, &Bus, &Start);
+    HostResetAmp(BENCH_RESET_AMP);
+    HostRunFor(TFA9890_WATCHDOG_INTERVAL_MS + BENCH_POWER_UP_MS);
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    BenchCheckRestore();
+    pPhases->push_back(Phase);
+
+    // D0 exit keeps the hibernate images the next D0 entry restores
+    BenchBeginPhase("resume", &Phase, &Before, &Bus, &Start);
+    Status = HostD0Exit();
+    if (!NT_SUCCESS(Status))
+    {
+        BenchFail("D0 exit", Status);
+    }
+    Status = HostD0Entry();
+    if (!NT_SUCCESS(Status))
+    {
+        BenchFail("D0 entry", Status);
+    }
+    HostRunFor(BENCH_POWER_UP_MS);
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    if (1 != Phase.Perf.Flows[TFA9890_PERF_RESUME].Count)
+    {
+        BenchFail("Resume", STATUS_UNSUCCESSFUL);
+    }
+    pPhases->push_back(Phase);
+
+    // The first hint turns gating on; the start after the hysteresis finds
+    // the amps gated
+    TFA9890_STREAM_HINT_OUTPUT Hint;
+    BenchBeginPhase("hints", &Phase, &Before, &Bus, &Start);
+    BenchStreamHint(Tfa9890HintStop, &Hint);
+    HostRunFor(TFA9890_POWER_GATE_HYSTERESIS_MS + BENCH_POWER_UP_MS);
+    BenchStreamHint(Tfa9890HintStart, &Hint);
+    if (Tfa9890PowerActive != Hint.Power || 1 != Hint.Gates || 1 != Hint.ColdStarts)
+    {
+        BenchFail("Cold start", STATUS_UNSUCCESSFUL);
+    }
+    BenchStreamHint(Tfa9890HintStop, &Hint);
+    BenchEndPhase(&Phase, &Before, &Bus, Start);
+    pPhases->push_back(Phase);
+
+    HostD0Exit();
+    HostReleaseDevice();
+}
+
+// One object per line, so the baseline reader needs no JSON parser
+static bool BenchWriteJson(
+    _In_ PCSTR pPath,
+    _In_ const std::vector<BENCH_PHASE>& Phases)
+{
+    FILE* pFile = fopen(pPath, "w");
+    if (nullptr == pFile)
+    {
+        fprintf(stderr, "bench: cannot write %s\n", pPath);
+        return false;
+    }
+
+    fprintf(pFile, "{\n");
+    fprintf(pFile, "  \"version\": %u,\n", TFA9890_PERF_VERSION);
+    fprintf(pFile, "  \"amps\": %u,\n", BENCH_AMPS);
+
+    fprintf(pFile, "  \"phases\": [\n");
+    for (size_t i = 0; i < Phases.size(); i++)
+    {
+        const BENCH_PHASE& Phase = Phases[i];
+        fprintf(pFile, "    { \"phase\": \"%s\", \"duration_us\": %llu, \"bus_transactions\": %llu, \"other_transactions\": %llu, \"samples\": %u }%s\n",
+                Phase.Name.c_str(), Phase.DurationUs, Phase.BusTransactions, Phase.OtherTransactions, Phase.Samples,
+                (i + 1 < Phases.size()) ? "," : "");
+    }
+    fprintf(pFile, "  ],\n");
+
+    fprintf(pFile, "  \"flows\": [\n");
+    bool First = true;
+    for (size_t i = 0; i < Phases.size(); i++)
+    {
+        for (ULONG Flow = 0; Flow < TFA9890_PERF_FLOWS; Flow++)
+        {
+            const TFA9890_PERF_FLOW* pFlow = &Phases[i].Perf.Flows[Flow];
+            if (0 == pFlow->Count)
+            {
+                continue;
+            }
+
+            double PerSecond = (0 != Phases[i].DurationUs) ? pFlow->Count * 1e6 / Phases[i].DurationUs : 0.0;
+            fprintf(pFile, "%s    { \"phase\": \"%s\", \"flow\": \"%s\", \"count\": %u, \"transactions\": %u, \"total_us\": %llu, \"max_us\": %u, "
+                    "\"mean_us\": %.1f, \"transactions_per_run\": %.2f, \"runs_per_second\": %.1f }",
+                    First ? "" : ",\n", Phases[i].Name.c_str(), g_FlowNames[Flow], pFlow->Count, pFlow->Transactions,
+                    pFlow->TotalUs, pFlow->MaxUs, static_cast<double>(pFlow->TotalUs) / pFlow->Count,
+                    static_cast<double>(pFlow->Transactions) / pFlow->Count, PerSecond);
+            First = false;
+        }
+    }
+    fprintf(pFile, "\n  ]\n");
+    fprintf(pFile, "}\n");
+
+    return 0 == fclose(pFile);
+}
+
+// The value of "Key": in one line of the output, as text
+static bool BenchFindField(
+    _In_ const std::string& Line,
+    _In_ PCSTR pKey,
+    _Out_ std::string* pValue)
+{
+    std::string Quoted = std::string("\"") + pKey + "\":";
+    size_t Position = Line.find(Quoted);
+
+    if (std::string::npos == Position)
+    {
+        return false;
+    }
+
+    Position = Line.find_first_not_of(' ', Position + Quoted.size());
+    if (std::string::npos == Position)
+    {
+        return false;
+    }
+
+    size_t End;
+    if ('"' == Line[Position])
+    {
+        End = Line.find('"', ++Position);
+    }
+    else
+    {
+        End = Line.find_first_of(",} ", Position);
+    }
+    if (std::string::npos == End)
+    {
+        return false;
+    }
+
+    pValue->assign(Line, Position, End - Position);
+    return true;
+}
+
+static bool BenchReadBaseline(
+    _In_ PCSTR pPath,
+    _Out_ std::vector<BENCH_BASELINE_FLOW>* pFlows)
+{
+    FILE* pFile = fopen(pPath, "r");
+    char Buffer[1024];
+
+    if (nullptr == pFile)
+    {
+        fprintf(stderr, "bench: cannot read %s\n", pPath);
+        return false;
+    }
+
+    while (nullptr != fgets(Buffer, sizeof(Buffer), pFile))
+    {
+        std::string Line(Buffer);
+        std::string Phase, Flow, Count, Transactions, TotalUs;
+        BENCH_BASELINE_FLOW Entry = {};
+
+        if (!BenchFindField(Line, "flow", &Flow))
+        {
+            continue;
+        }
+        if (!BenchFindField(Line, "phase", &Phase) ||
+            !BenchFindField(Line, "count", &Count) ||
+            !BenchFindField(Line, "transactions", &Transactions) ||
+            !BenchFindField(Line, "total_us", &TotalUs))
+        {
+            fprintf(stderr, "bench: malformed baseline line: %s", Buffer);
+            fclose(pFile);
+            return false;
+        }
+
+        Entry.Phase = Phase;
+        Entry.Flow = TFA9890_PERF_FLOWS;
+        for (ULONG i = 0; i < TFA9890_PERF_FLOWS; i++)
+        {
+            if (Flow == g_FlowNames[i])
+            {
+                Entry.Flow = i;
+            }
+        }
+        if (TFA9890_PERF_FLOWS == Entry.Flow)
+        {
+            fprintf(stderr, "bench: unknown flow %s in the baseline\n", Flow.c_str());
+            fclose(pFile);
+            return false;
+        }
+
+        Entry.Counters.Count = static_cast<ULONG>(strtoul(Count.c_str(), nullptr, 10));
+        Entry.Counters.Transactions = static_cast<ULONG>(strtoul(Transactions.c_str(), nullptr, 10));
+        Entry.Counters.TotalUs = strtoull(TotalUs.c_str(), nullptr, 10);
+        pFlows->push_back(Entry);
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+// Compare every phase with its baseline. Returns the number of flows that
+// regressed.
+static ULONG BenchCompare(
+    _In_ const std::vector<BENCH_PHASE>& Phases,
+    _In_ const std::vector<BENCH_BASELINE_FLOW>& Baseline,
+    _In_ ULONG ThresholdPercent)
+{
+    ULONG Regressed = 0;
+
+    for (size_t i = 0; i < Phases.size(); i++)
+    {
+        TFA9890_PERF_OUTPUT Base = {};
+
+        Base.Version = TFA9890_PERF_VERSION;
+        Base.AmpCount = BENCH_AMPS;
+        for (size_t j = 0; j < Baseline.size(); j++)
+        {
+            if (Baseline[j].Phase == Phases[i].Name)
+            {
+                Base.Flows[Baseline[j].Flow] = Baseline[j].Counters;
+            }
+        }
+
+        ULONG Regressions = Tfa9890PerfRegressions(&Base, &Phases[i].Perf, ThresholdPercent);
+
+        for (ULONG Flow = 0; Flow < TFA9890_PERF_FLOWS; Flow++)
+        {
+            const TFA9890_PERF_FLOW* pBase = &Base.Flows[Flow];
+            const TFA9890_PERF_FLOW* pRun = &Phases[i].Perf.Flows[Flow];
+
+            if (0 == pBase->Count && 0 == pRun->Count)
+            {
+                continue;
+            }
+            if (0 == pBase->Count || 0 == pRun->Count)
+            {
+                printf("%-10s %-10s not in both runs (baseline %u, run %u)\n",
+                       Phases[i].Name.c_str(), g_FlowNames[Flow], pBase->Count, pRun->Count);
+                continue;
+            }
+
+            bool Regression = 0 != (Regressions & (1UL << Flow));
+            printf("%-10s %-10s %9.1f us %7.2f transactions  baseline %9.1f us %7.2f transactions%s\n",
+                   Phases[i].Name.c_str(), g_FlowNames[Flow],
+                   static_cast<double>(pRun->TotalUs) / pRun->Count, static_cast<double>(pRun->Transactions) / pRun->Count,
+                   static_cast<double>(pBase->TotalUs) / pBase->Count, static_cast<double>(pBase->Transactions) / pBase->Count,
+                   Regression ? "  REGRESSION" : "");
+            if (Regression)
+            {
+                Regressed++;
+            }
+        }
+    }
+
+    return Regressed;
+}
+
+int main(
+    int argc,
+    char** argv)
+{
+    PCSTR pBaseline = nullptr;
+    PCSTR pOut = nullptr;
+    PCSTR pWriteBaseline = nullptr;
+    PCSTR pTrace = nullptr;
+    PCSTR pHistory = nullptr;
+    ULONG ThresholdPercent = BENCH_THRESHOLD_PERCENT;
+    std::vector<BENCH_PHASE> Phases;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string Option(argv[i]);
+
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "usage: bench [--baseline <file>] [--out <file>] [--threshold <percent>] [--write-baseline <file>] [--trace <file>] [--history <file>]\n");
+            return 2;
+        }
+
+        if ("--baseline" == Option)
+        {
+            pBaseline = argv[++i];
+        }
+        else if ("--out" == Option)
+        {
+            pOut = argv[++i];
+        }
+        else if ("--threshold" == Option)
+        {
+            ThresholdPercent = static_cast<ULONG>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if ("--write-baseline" == Option)
+        {
+            pWriteBaseline = argv[++i];
+        }
+        else if ("--trace" == Option)
+        {
+            pTrace = argv[++i];
+        }
+        else if ("--history" == Option)
+        {
+            pHistory = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "bench: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    BenchRun(pTrace, pHistory, &Phases);
+
+    if ((nullptr != pOut && !BenchWriteJson(pOut, Phases)) ||
+        (nullptr != pWriteBaseline && !BenchWriteJson(pWriteBaseline, Phases)))
+    {
+        return 2;
+    }
+
+    if (nullptr == pBaseline)
+    {
+        return 0;
+    }
+
+    std::vector<BENCH_BASELINE_FLOW> Baseline;
+    if (!BenchReadBaseline(pBaseline, &Baseline))
+    {
+        return 2;
+    }
+
+    ULONG Regressed = BenchCompare(Phases, Baseline, ThresholdPercent);
+    if (0 != Regressed)
+    {
+        printf("%u flows regressed by more than %u%%\n", Regressed, ThresholdPercent);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the history exporter. It reads a telemetry
+//    history in the format of Tfa9890History.h, as the driver keeps it
+//    with the HistoryFile value or the benchmark with --history, orders its
+//    blocks by Sequence and writes every record decoded by
+//    Tfa9890HistoryDecodeBlock as one CSV line:
+//
+//      time_utc,amp,kind,temperature_c,battery_v,value
+//
+//    The temperature and battery columns are empty but for samples, and
+//    value holds the fault bits of a faults record or the state of a power
+//    record.
+//
+//    Usage: history_csv <history> [--out <file>]
+//
+//    Returns 0 if the history held at least one record, 1 if it held none
+//    and 2 if it could not be read.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "hostsdk.h"
+#include "Tfa9890History.h"
+
+
+// 100 ns intervals from 1601-01-01 to 1970-01-01
+#define HISTORY_FILETIME_UNIX_EPOCH     116444736000000000LL
+
+static const PCSTR g_KindNames[] =
+{
+    "sample",
+    "faults",
+    "power",
+};
+
+typedef struct _HISTORY_CSV_CONTEXT
+{
+    FILE*       pOut;
+    ULONG       Records;
+} HISTORY_CSV_CONTEXT, *PHISTORY_CSV_CONTEXT;
+
+static void HistoryCsvWriteEvent(
+    _In_ const TFA9890_HISTORY_EVENT* pEvent,
+    _In_opt_ void* pContext)
+{
+    PHISTORY_CSV_CONTEXT pCsv = static_cast<PHISTORY_CSV_CONTEXT>(pContext);
+    LONGLONG Unix = pEvent->Time - HISTORY_FILETIME_UNIX_EPOCH;
+    time_t Seconds = static_cast<time_t>(Unix / 10000000);
+    struct tm Utc = {};
+    char Time[32] = "";
+
+    if (Unix >= 0 && nullptr != gmtime_r(&Seconds, &Utc))
+    {
+        strftime(Time, sizeof(Time), "%Y-%m-%dT%H:%M:%S", &Utc);
+    }
+
+    fprintf(pCsv->pOut, "%s.%03uZ,%u,", Time, static_cast<ULONG>((Unix / 10000) % 1000), pEvent->Amp);
+
+    if (TFA9890_HISTORY_KIND_SAMPLE == pEvent->Kind)
+    {
+        fprintf(pCsv->pOut, "%s,%d,%.3f,\n", g_KindNames[pEvent->Kind], pEvent->TemperatureC,
+                pEvent->BatteryLsb * TFA9890_HISTORY_VOLTS_PER_LSB);
+    }
+    else if (pEvent->Kind < _countof(g_KindNames))
+    {
+        fprintf(pCsv->pOut, "%s,,,0x%x\n", g_KindNames[pEvent->Kind], pEvent->Value);
+    }
+    else
+    {
+        fprintf(pCsv->pOut, "%u,,,0x%x\n", pEvent->Kind, pEvent->Value);
+    }
+
+    pCsv->Records++;
+}
+
+int main(
+    int argc,
+    char** argv)
+{
+    PCSTR pPath = nullptr;
+    PCSTR pOutPath = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--out") && i + 1 < argc)
+        {
+            pOutPath = argv[++i];
+        }
+        else if ('-' != argv[i][0] && nullptr == pPath)
+        {
+            pPath = argv[i];
+        }
+        else
+        {
+            pPath = nullptr;
+            break;
+        }
+    }
+
+    if (nullptr == pPath)
+    {
+        fprintf(stderr, "usage: history_csv <history> [--out <file>]\n");
+        return 2;
+    }
+
+    FILE* pFile = fopen(pPath, "rb");
+    if (nullptr == pFile)
+    {
+        fprintf(stderr, "history_csv: cannot open %s\n", pPath);
+        return 2;
+    }
+
+    std::vector<BYTE> History;
+    BYTE Buffer[TFA9890_HISTORY_BLOCK_BYTES];
+    size_t Read;
+    while (0 != (Read = fread(Buffer, 1, sizeof(Buffer), pFile)))
+    {
+        History.insert(History.end(), Buffer, Buffer + Read);
+    }
+    fclose(pFile);
+
+    TFA9890_HISTORY_HEADER Header = {};
+    if (History.size() >= sizeof(Header))
+    {
+        memcpy(&Header, History.data(), sizeof(Header));
+    }
+
+    if (TFA9890_HISTORY_MAGIC != Header.Magic ||
+        TFA9890_HISTORY_VERSION != Header.Version ||
+        Header.HeaderBytes < sizeof(Header) ||
+        Header.HeaderBytes > History.size() ||
+        Header.BlockBytes <= sizeof(TFA9890_HISTORY_BLOCK) ||
+        Header.BlockBytes > 0x10000 ||
+        Header.SlotCount > (History.size() - Header.HeaderBytes) / Header.BlockBytes)
+    {
+        fprintf(stderr, "history_csv: %s is not a complete version %u history\n", pPath, TFA9890_HISTORY_VERSION);
+        return 2;
+    }
+
+    // Blocks are written to the slots in ring order; the sequence restores
+    // the order they were written in. Each block is copied out so that its
+    // header is aligned.
+    std::vector<std::vector<BYTE>> Blocks;
+    for (ULONG Slot = 0; Slot < Header.SlotCount; Slot++)
+    {
+        const BYTE* pSlot = &History[Header.HeaderBytes + static_cast<size_t>(Slot) * Header.BlockBytes];
+        TFA9890_HISTORY_BLOCK Block;
+
+        memcpy(&Block, pSlot, sizeof(Block));
+        if (TFA9890_HISTORY_BLOCK_MAGIC == Block.Magic)
+        {
+            Blocks.push_back(std::vector<BYTE>(pSlot, pSlot + Header.BlockBytes));
+        }
+    }
+
+    std::sort(Blocks.begin(), Blocks.end(), [](const std::vector<BYTE>& Left, const std::vector<BYTE>& Right)
+    {
+        return reinterpret_cast<const TFA9890_HISTORY_BLOCK*>(Left.data())->Sequence <
+               reinterpret_cast<const TFA9890_HISTORY_BLOCK*>(Right.data())->Sequence;
+    });
+
+    HISTORY_CSV_CONTEXT Csv = {};
+    Csv.pOut = stdout;
+    if (nullptr != pOutPath)
+    {
+        Csv.pOut = fopen(pOutPath, "w");
+        if (nullptr == Csv.pOut)
+        {
+            fprintf(stderr, "history_csv: cannot create %s\n", pOutPath);
+            return 2;
+        }
+    }
+
+    fprintf(Csv.pOut, "time_utc,amp,kind,temperature_c,battery_v,value\n");
+    for (const std::vector<BYTE>& Block : Blocks)
+    {
+        Tfa9890HistoryDecodeBlock(reinterpret_cast<const TFA9890_HISTORY_BLOCK*>(Block.data()), Header.BlockBytes,
+                                  HistoryCsvWriteEvent, &Csv);
+    }
+
+    if (stdout != Csv.pOut)
+    {
+        fclose(Csv.pOut);
+    }
+
+    fprintf(stderr, "history_csv: %u records from %u blocks of %u amps\n",
+            Csv.Records, static_cast<ULONG>(Blocks.size()), Header.AmpCount);
+    return (0 != Csv.Records) ? 0 : 1;
+}
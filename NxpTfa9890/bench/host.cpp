@@ -0,0 +1,2286 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the host framework the benchmark runs the driver
+//    on: the UMDF objects, SensorsCx and Win32 calls the driver makes,
+//    implemented on one thread and a virtual clock.
+//
+//    Timers, work items and I/O completions are events ordered by their
+//    due time and dispatched by HostRunFor, or by a thread that waits on a
+//    condition variable, which is the only way another callback could make
+//    progress in the real framework. A wait lock or a slim lock found held
+//    would never be released on this thread and ends the run, unless it was
+//    tried without waiting.
+//
+//    The I2C connections are served by the simulated amps of amp.cpp over
+//    one shared bus. A synchronous transaction moves the clock to its end;
+//    an asynchronous write completes when the bus has sent it.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host.h"
+#include "amp.h"
+
+extern "C" DRIVER_INITIALIZE DriverEntry;
+
+
+// Stop the run on a condition the driver would deadlock or crash on
+static void HostFatal(
+    _In_ PCSTR pFormat,
+    ...)
+{
+    va_list Arguments;
+
+    va_start(Arguments, pFormat);
+    fprintf(stderr, "host: ");
+    vfprintf(stderr, pFormat, Arguments);
+    fprintf(stderr, "\n");
+    va_end(Arguments);
+
+    exit(2);
+}
+
+//
+// Objects
+//
+
+typedef enum
+{
+    HostKindDriver = 0,
+    HostKindDeviceInit,
+    HostKindDevice,
+    HostKindSensor,
+    HostKindResourceList,
+    HostKindIoTarget,
+    HostKindRequest,
+    HostKindMemory,
+    HostKindTimer,
+    HostKindWorkItem,
+    HostKindWaitLock,
+    HostKindKey,
+    HostKindQueue,
+    HostKindFileObject
+} HOST_KIND;
+
+struct HostObject;
+
+// A timer, work item or I/O completion due at Due. Seq keeps events that
+// are due at the same time in the order they were queued.
+struct HostEvent
+{
+    LONGLONG    Due;
+    ULONGLONG   Seq;
+    HostObject* pObject;
+
+    bool operator<(const HostEvent& Other) const
+    {
+        return (Due != Other.Due) ? (Due < Other.Due) : (Seq < Other.Seq);
+    }
+};
+
+struct HostObject
+{
+    HOST_KIND                               Kind;
+    HostObject*                             pParent;
+    std::vector<HostObject*>                Children;
+    const WDF_OBJECT_CONTEXT_TYPE_INFO*     pContextType;
+    PVOID                                   pContext;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP          EvtCleanup;
+    bool                                    Queued;
+    HostEvent                               Event;
+
+    explicit HostObject(HOST_KIND ObjectKind) :
+        Kind(ObjectKind), pParent(nullptr), pContextType(nullptr), pContext(nullptr), EvtCleanup(nullptr), Queued(false), Event()
+    {
+    }
+
+    virtual ~HostObject()
+    {
+        free(pContext);
+    }
+};
+
+struct HostDriver : HostObject
+{
+    WDF_DRIVER_CONFIG           Config;
+
+    HostDriver() : HostObject(HostKindDriver), Config() {}
+};
+
+struct HostDeviceInit : HostObject
+{
+    WDF_PNPPOWER_EVENT_CALLBACKS    PnpPower;
+
+    HostDeviceInit() : HostObject(HostKindDeviceInit), PnpPower() {}
+};
+
+struct HostSensor;
+
+struct HostDevice : HostObject
+{
+    WDF_PNPPOWER_EVENT_CALLBACKS    PnpPower;
+    SENSOR_CONTROLLER_CONFIG        Controller;
+    std::vector<HostSensor*>        Sensors;
+
+    HostDevice() : HostObject(HostKindDevice), PnpPower(), Controller() {}
+};
+
+struct HostSensor : HostObject
+{
+    ULONG                       DataReady;
+
+    HostSensor() : HostObject(HostKindSensor), DataReady(0) {}
+};
+
+struct HostResourceList : HostObject
+{
+    std::vector<CM_PARTIAL_RESOURCE_DESCRIPTOR> Descriptors;
+
+    HostResourceList() : HostObject(HostKindResourceList) {}
+};
+
+struct HostIoTarget : HostObject
+{
+    PSimTfa9890                 pAmp;       // Once opened
+
+    HostIoTarget() : HostObject(HostKindIoTarget), pAmp(nullptr) {}
+};
+
+struct HostRequest : HostObject
+{
+    HostIoTarget*                       pTarget;
+    BYTE*                               pWrite;         // Formatted write
+    size_t                              WriteLength;
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE  Completion;
+    WDFCONTEXT                          CompletionContext;
+    const VOID*                         pInput;         // IOCTL buffers
+    size_t                              InputLength;
+    VOID*                               pOutput;
+    size_t                              OutputLength;
+    NTSTATUS                            Status;
+    ULONG_PTR                           Information;
+    bool                                Completed;
+
+    HostRequest() :
+        HostObject(HostKindRequest), pTarget(nullptr), pWrite(nullptr), WriteLength(0), Completion(nullptr),
+        CompletionContext(nullptr), pInput(nullptr), InputLength(0), pOutput(nullptr), OutputLength(0),
+        Status(STATUS_SUCCESS), Information(0), Completed(false)
+    {
+    }
+};
+
+struct HostMemory : HostObject
+{
+    PVOID                       pBuffer;
+    size_t                      Size;
+    bool                        Owned;
+
+    HostMemory() : HostObject(HostKindMemory), pBuffer(nullptr), Size(0), Owned(false) {}
+
+    ~HostMemory()
+    {
+        if (Owned)
+        {
+            free(pBuffer);
+        }
+    }
+};
+
+struct HostTimer : HostObject
+{
+    WDF_TIMER_CONFIG            Config;
+
+    HostTimer() : HostObject(HostKindTimer), Config() {}
+};
+
+struct HostWorkItem : HostObject
+{
+    WDF_WORKITEM_CONFIG         Config;
+
+    HostWorkItem() : HostObject(HostKindWorkItem), Config() {}
+};
+
+struct HostWaitLock : HostObject
+{
+    bool                        Held;
+
+    HostWaitLock() : HostObject(HostKindWaitLock), Held(false) {}
+};
+
+struct HostValue
+{
+    ULONG                       Type;
+    std::vector<BYTE>           Data;
+};
+
+typedef std::map<std::string, HostValue> HostHive;
+
+struct HostKey : HostObject
+{
+    HostHive*                   pHive;
+
+    HostKey() : HostObject(HostKindKey), pHive(nullptr) {}
+};
+
+struct HostQueue : HostObject
+{
+    HostDevice*                 pDevice;
+
+    HostQueue() : HostObject(HostKindQueue), pDevice(nullptr) {}
+};
+
+struct HostFileObject : HostObject
+{
+    HostFileObject() : HostObject(HostKindFileObject) {}
+};
+
+// Framework state
+static LONGLONG             g_Now = 0;
+static ULONGLONG            g_NextSeq = 0;
+static std::set<HostEvent>  g_Events;
+static LONGLONG             g_BusFreeAt = 0;
+static HOST_BUS_STATISTICS  g_Bus = {};
+static DWORD                g_LastError = 0;
+static HostHive             g_DeviceHive;
+static HostHive             g_ParametersHive;
+static HostDriver*          g_pDriver = nullptr;
+static HostDevice*          g_pDevice = nullptr;
+static HostResourceList*    g_pResources = nullptr;
+static HostQueue*           g_pQueue = nullptr;
+static HostFileObject*      g_pFile = nullptr;
+static std::vector<PSimTfa9890> g_Amps;
+static std::map<HANDLE, int>    g_Files;        // Open host files by handle
+
+// FILETIME of virtual time 0
+#define HOST_FILETIME_BASE          0x01DC000000000000LL
+
+template <typename T>
+static T* HostFrom(
+    _In_opt_ const VOID* Handle,
+    _In_ HOST_KIND Kind)
+{
+    HostObject* pObject = static_cast<HostObject*>(const_cast<VOID*>(Handle));
+
+    if (nullptr == pObject || pObject->Kind != Kind)
+    {
+        HostFatal("handle %p is not of kind %u", Handle, Kind);
+    }
+
+    return static_cast<T*>(pObject);
+}
+
+template <typename H>
+static H HostHandle(
+    _In_ HostObject* pObject)
+{
+    return reinterpret_cast<H>(pObject);
+}
+
+// Attach the context and the parent the attributes ask for. Contexts are
+// zeroed, like the framework's.
+static VOID HostInitializeObject(
+    _In_ HostObject* pObject,
+    _In_opt_ PWDF_OBJECT_ATTRIBUTES pAttributes,
+    _In_opt_ HostObject* pDefaultParent)
+{
+    HostObject* pParent = pDefaultParent;
+
+    if (nullptr != pAttributes)
+    {
+        if (nullptr != pAttributes->ParentObject)
+        {
+            pParent = static_cast<HostObject*>(pAttributes->ParentObject);
+        }
+
+        if (nullptr != pAttributes->ContextTypeInfo)
+        {
+            size_t Size = max(pAttributes->ContextTypeInfo->ContextSize, pAttributes->ContextSizeOverride);
+            Size = (Size + 63) / 64 * 64;
+
+            pObject->pContextType = pAttributes->ContextTypeInfo;
+            pObject->pContext = aligned_alloc(64, Size);
+            if (nullptr == pObject->pContext)
+            {
+                HostFatal("out of memory for a %s context", pAttributes->ContextTypeInfo->ContextName);
+            }
+            memset(pObject->pContext, 0, Size);
+        }
+
+        pObject->EvtCleanup = pAttributes->EvtCleanupCallback;
+    }
+
+    pObject->pParent = pParent;
+    if (nullptr != pParent)
+    {
+        pParent->Children.push_back(pObject);
+    }
+}
+
+static VOID HostQueueEvent(
+    _In_ HostObject* pObject,
+    _In_ LONGLONG Due)
+{
+    if (pObject->Queued)
+    {
+        g_Events.erase(pObject->Event);
+    }
+
+    pObject->Event.Due = Due;
+    pObject->Event.Seq = g_NextSeq++;
+    pObject->Event.pObject = pObject;
+    pObject->Queued = true;
+    g_Events.insert(pObject->Event);
+}
+
+static bool HostDequeue(
+    _In_ HostObject* pObject)
+{
+    if (!pObject->Queued)
+    {
+        return false;
+    }
+
+    g_Events.erase(pObject->Event);
+    pObject->Queued = false;
+    return true;
+}
+
+// Delete an object and its children, children first
+static VOID HostDeleteObject(
+    _In_ HostObject* pObject)
+{
+    while (!pObject->Children.empty())
+    {
+        HostDeleteObject(pObject->Children.back());
+    }
+
+    if (nullptr != pObject->EvtCleanup)
+    {
+        pObject->EvtCleanup(pObject);
+    }
+
+    HostDequeue(pObject);
+
+    if (nullptr != pObject->pParent)
+    {
+        std::vector<HostObject*>& Siblings = pObject->pParent->Children;
+        for (size_t i = 0; i < Siblings.size(); i++)
+        {
+            if (Siblings[i] == pObject)
+            {
+                Siblings.erase(Siblings.begin() + i);
+                break;
+            }
+        }
+    }
+
+    if (HostKindSensor == pObject->Kind && nullptr != g_pDevice)
+    {
+        std::vector<HostSensor*>& Sensors = g_pDevice->Sensors;
+        for (size_t i = 0; i < Sensors.size(); i++)
+        {
+            if (Sensors[i] == pObject)
+            {
+                Sensors.erase(Sensors.begin() + i);
+                break;
+            }
+        }
+    }
+
+    delete pObject;
+}
+
+PVOID HostObjectGetTypedContext(
+    WDFOBJECT Handle,
+    const WDF_OBJECT_CONTEXT_TYPE_INFO* pTypeInfo)
+{
+    HostObject* pObject = static_cast<HostObject*>(Handle);
+
+    return (nullptr != pObject && pTypeInfo == pObject->pContextType) ? pObject->pContext : nullptr;
+}
+
+VOID WdfObjectDelete(
+    WDFOBJECT Object)
+{
+    HostDeleteObject(static_cast<HostObject*>(Object));
+}
+
+//
+// Virtual clock and event dispatch
+//
+
+static VOID HostDispatch(
+    _In_ const HostEvent& Event)
+{
+    HostObject* pObject = Event.pObject;
+
+    g_Events.erase(Event);
+    pObject->Queued = false;
+    g_Now = max(g_Now, Event.Due);
+
+    switch (pObject->Kind)
+    {
+        case HostKindTimer:
+        {
+            // Periods missed while the thread was busy are not made up
+            HostTimer* pTimer = static_cast<HostTimer*>(pObject);
+            if (0 != pTimer->Config.Period)
+            {
+                LONGLONG Period = static_cast<LONGLONG>(pTimer->Config.Period) * 10000;
+                HostQueueEvent(pTimer, Event.Due + ((g_Now - Event.Due) / Period + 1) * Period);
+            }
+            pTimer->Config.EvtTimerFunc(HostHandle<WDFTIMER>(pTimer));
+            break;
+        }
+
+        case HostKindWorkItem:
+        {
+            HostWorkItem* pWorkItem = static_cast<HostWorkItem*>(pObject);
+            pWorkItem->Config.EvtWorkItemFunc(HostHandle<WDFWORKITEM>(pWorkItem));
+            break;
+        }
+
+        case HostKindRequest:
+        {
+            HostRequest* pRequest = static_cast<HostRequest*>(pObject);
+            WDF_REQUEST_COMPLETION_PARAMS Params = {};
+
+            // The amp sees the write once the bus has sent it
+            if (NT_SUCCESS(pRequest->Status))
+            {
+                pRequest->pTarget->pAmp->Write(pRequest->pWrite, static_cast<ULONG>(pRequest->WriteLength), g_Now);
+                pRequest->Information = pRequest->WriteLength;
+            }
+
+            pRequest->Completed = true;
+            Params.Size = sizeof(Params);
+            Params.IoStatus.Status = pRequest->Status;
+            Params.IoStatus.Information = pRequest->Information;
+            pRequest->Completion(HostHandle<WDFREQUEST>(pRequest), HostHandle<WDFIOTARGET>(pRequest->pTarget),
+                                 &Params, pRequest->CompletionContext);
+            break;
+        }
+
+        default:
+            HostFatal("object kind %u cannot be queued", pObject->Kind);
+    }
+}
+
+LONGLONG HostNow()
+{
+    return g_Now;
+}
+
+VOID HostRunFor(
+    ULONG Milliseconds)
+{
+    LONGLONG End = g_Now + static_cast<LONGLONG>(Milliseconds) * 10000;
+
+    while (!g_Events.empty() && g_Events.begin()->Due <= End)
+    {
+        HostDispatch(*g_Events.begin());
+    }
+
+    g_Now = max(g_Now, End);
+}
+
+VOID HostGetBusStatistics(
+    PHOST_BUS_STATISTICS pStatistics)
+{
+    *pStatistics = g_Bus;
+    pStatistics->DataReady = 0;
+
+    for (size_t i = 0; nullptr != g_pDevice && i < g_pDevice->Sensors.size(); i++)
+    {
+        pStatistics->DataReady += g_pDevice->Sensors[i]->DataReady;
+    }
+}
+
+// Take the shared bus for one transaction of Bytes bytes, after whatever
+// it is still sending. Returns the time the transaction ends.
+static LONGLONG HostBusTransfer(
+    _In_ ULONG Bytes)
+{
+    LONGLONG Start = max(g_Now, g_BusFreeAt);
+    LONGLONG Duration = HOST_BUS_OVERHEAD + static_cast<LONGLONG>(Bytes) * HOST_BUS_BYTE;
+
+    g_BusFreeAt = Start + Duration;
+    g_Bus.Transactions++;
+    g_Bus.Bytes += Bytes;
+    g_Bus.BusyTime += Duration;
+
+    return g_BusFreeAt;
+}
+
+BOOL QueryPerformanceCounter(
+    LARGE_INTEGER* pCounter)
+{
+    pCounter->QuadPart = g_Now;
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(
+    LARGE_INTEGER* pFrequency)
+{
+    pFrequency->QuadPart = 10000000;
+    return TRUE;
+}
+
+VOID Sleep(
+    DWORD Milliseconds)
+{
+    g_Now += static_cast<LONGLONG>(Milliseconds) * 10000;
+}
+
+VOID GetSystemTimePreciseAsFileTime(
+    FILETIME* pTime)
+{
+    ULONGLONG Time = static_cast<ULONGLONG>(HOST_FILETIME_BASE + g_Now);
+
+    pTime->dwLowDateTime = static_cast<DWORD>(Time);
+    pTime->dwHighDateTime = static_cast<DWORD>(Time >> 32);
+}
+
+//
+// Slim locks and condition variables
+//
+
+VOID InitializeSRWLock(
+    PSRWLOCK pLock)
+{
+    pLock->Readers = 0;
+    pLock->Writer = 0;
+}
+
+VOID AcquireSRWLockExclusive(
+    PSRWLOCK pLock)
+{
+    if (0 != pLock->Writer || 0 != pLock->Readers)
+    {
+        HostFatal("slim lock %p acquired exclusive while held", pLock);
+    }
+    pLock->Writer = 1;
+}
+
+VOID ReleaseSRWLockExclusive(
+    PSRWLOCK pLock)
+{
+    pLock->Writer = 0;
+}
+
+VOID AcquireSRWLockShared(
+    PSRWLOCK pLock)
+{
+    if (0 != pLock->Writer)
+    {
+        HostFatal("slim lock %p acquired shared while held exclusive", pLock);
+    }
+    pLock->Readers++;
+}
+
+VOID ReleaseSRWLockShared(
+    PSRWLOCK pLock)
+{
+    pLock->Readers--;
+}
+
+VOID InitializeConditionVariable(
+    PCONDITION_VARIABLE pCondition)
+{
+    pCondition->Reserved = nullptr;
+}
+
+// The waiter's condition can only change by another callback running, so
+// the next event is run with the lock released
+BOOL SleepConditionVariableSRW(
+    PCONDITION_VARIABLE /*pCondition*/,
+    PSRWLOCK pLock,
+    DWORD Milliseconds,
+    ULONG /*Flags*/)
+{
+    if (g_Events.empty())
+    {
+        if (INFINITE == Milliseconds)
+        {
+            HostFatal("wait on a condition nothing can signal");
+        }
+
+        g_Now += static_cast<LONGLONG>(Milliseconds) * 10000;
+        g_LastError = ERROR_TIMEOUT;
+        return FALSE;
+    }
+
+    ReleaseSRWLockExclusive(pLock);
+    HostDispatch(*g_Events.begin());
+    AcquireSRWLockExclusive(pLock);
+
+    return TRUE;
+}
+
+VOID WakeAllConditionVariable(
+    PCONDITION_VARIABLE /*pCondition*/)
+{
+}
+
+//
+// Strings
+//
+
+size_t HostWcslen(
+    const WCHAR* s)
+{
+    size_t Length = 0;
+
+    while (L'\0' != s[Length])
+    {
+        Length++;
+    }
+
+    return Length;
+}
+
+static WCHAR HostFold(
+    _In_ WCHAR c)
+{
+    return (c >= L'a' && c <= L'z') ? static_cast<WCHAR>(c - L'a' + L'A') : c;
+}
+
+int HostWcsnicmp(
+    const WCHAR* a,
+    const WCHAR* b,
+    size_t Count)
+{
+    for (size_t i = 0; i < Count; i++)
+    {
+        WCHAR ca = HostFold(a[i]);
+        WCHAR cb = HostFold(b[i]);
+
+        if (ca != cb || L'\0' == ca)
+        {
+            return static_cast<int>(ca) - static_cast<int>(cb);
+        }
+    }
+
+    return 0;
+}
+
+int CompareStringOrdinal(
+    PCWSTR a,
+    int aLength,
+    PCWSTR b,
+    int bLength,
+    BOOL IgnoreCase)
+{
+    size_t aChars = (aLength < 0) ? wcslen(a) : static_cast<size_t>(aLength);
+    size_t bChars = (bLength < 0) ? wcslen(b) : static_cast<size_t>(bLength);
+
+    for (size_t i = 0; i < aChars && i < bChars; i++)
+    {
+        WCHAR ca = IgnoreCase ? HostFold(a[i]) : a[i];
+        WCHAR cb = IgnoreCase ? HostFold(b[i]) : b[i];
+
+        if (ca != cb)
+        {
+            return (ca < cb) ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+        }
+    }
+
+    return (aChars == bChars) ? CSTR_EQUAL : (aChars < bChars) ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+}
+
+VOID RtlInitUnicodeString(
+    PUNICODE_STRING pString,
+    PCWSTR Source)
+{
+    size_t Length = (nullptr != Source) ? wcslen(Source) * sizeof(WCHAR) : 0;
+
+    pString->Buffer = const_cast<PWSTR>(Source);
+    pString->Length = static_cast<USHORT>(Length);
+    pString->MaximumLength = static_cast<USHORT>((nullptr != Source) ? Length + sizeof(WCHAR) : 0);
+}
+
+NTSTATUS StringCchCopyW(
+    PWSTR pDest,
+    size_t DestChars,
+    PCWSTR pSource)
+{
+    size_t i = 0;
+
+    if (0 == DestChars)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (; i + 1 < DestChars && L'\0' != pSource[i]; i++)
+    {
+        pDest[i] = pSource[i];
+    }
+    pDest[i] = L'\0';
+
+    return (L'\0' == pSource[i]) ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+}
+
+// The conversions the driver formats: %s of a wide string and hex numbers,
+// with an optional zero fill, * width and I64 size
+NTSTATUS StringCbPrintfW(
+    PWSTR pDest,
+    size_t DestBytes,
+    PCWSTR pFormat,
+    ...)
+{
+    size_t Chars = DestBytes / sizeof(WCHAR);
+    size_t Out = 0;
+    bool Overflow = false;
+    va_list Arguments;
+
+    va_start(Arguments, pFormat);
+
+    for (PCWSTR p = pFormat; L'\0' != *p; p++)
+    {
+        WCHAR Text[64];
+        PCWSTR pText = Text;
+        size_t TextLength = 0;
+
+        if (L'%' != *p)
+        {
+            Text[0] = *p;
+            TextLength = 1;
+        }
+        else
+        {
+            bool Zero = false;
+            int Width = 0;
+            bool Long = false;
+
+            p++;
+            if (L'0' == *p)
+            {
+                Zero = true;
+                p++;
+            }
+            if (L'*' == *p)
+            {
+                Width = va_arg(Arguments, int);
+                p++;
+            }
+            while (*p >= L'0' && *p <= L'9')
+            {
+                Width = Width * 10 + (*p++ - L'0');
+            }
+            if (L'I' == p[0] && L'6' == p[1] && L'4' == p[2])
+            {
+                Long = true;
+                p += 3;
+            }
+
+            switch (*p)
+            {
+                case L's':
+                    pText = va_arg(Arguments, PCWSTR);
+                    TextLength = wcslen(pText);
+                    break;
+
+                case L'x':
+                case L'u':
+                {
+                    ULONGLONG Value = Long ? va_arg(Arguments, ULONGLONG) : va_arg(Arguments, ULONG);
+                    ULONG Base = (L'x' == *p) ? 16 : 10;
+                    WCHAR Digits[32];
+                    size_t Count = 0;
+
+                    do
+                    {
+                        Digits[Count++] = L"0123456789abcdef"[Value % Base];
+                        Value /= Base;
+                    } while (0 != Value);
+
+                    while (static_cast<int>(Count) < Width && Count < _countof(Digits))
+                    {
+                        Digits[Count++] = Zero ? L'0' : L' ';
+                    }
+                    for (size_t i = 0; i < Count; i++)
+                    {
+                        Text[i] = Digits[Count - 1 - i];
+                    }
+                    TextLength = Count;
+                    break;
+                }
+
+                case L'%':
+                    Text[0] = L'%';
+                    TextLength = 1;
+                    break;
+
+                default:
+                    HostFatal("format conversion %c is not supported", static_cast<char>(*p));
+            }
+        }
+
+        for (size_t i = 0; i < TextLength; i++)
+        {
+            if (Out + 1 < Chars)
+            {
+                pDest[Out++] = pText[i];
+            }
+            else
+            {
+                Overflow = true;
+            }
+        }
+    }
+
+    va_end(Arguments);
+
+    if (0 == Chars)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+    pDest[Out] = L'\0';
+
+    return Overflow ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+//
+// Files and processes. Files are host files, so the recorder and the
+// history write real traces; the shared stream is not available.
+//
+
+DWORD GetLastError()
+{
+    return g_LastError;
+}
+
+HANDLE GetCurrentProcess()
+{
+    return reinterpret_cast<HANDLE>(static_cast<LONG_PTR>(-1));
+}
+
+HANDLE OpenProcess(
+    DWORD /*Access*/,
+    BOOL /*Inherit*/,
+    DWORD /*ProcessId*/)
+{
+    g_LastError = ERROR_FILE_NOT_FOUND;
+    return nullptr;
+}
+
+BOOL DuplicateHandle(
+    HANDLE /*SourceProcess*/,
+    HANDLE /*Source*/,
+    HANDLE /*TargetProcess*/,
+    HANDLE* pTarget,
+    DWORD /*Access*/,
+    BOOL /*Inherit*/,
+    DWORD /*Options*/)
+{
+    *pTarget = nullptr;
+    g_LastError = ERROR_FILE_NOT_FOUND;
+    return FALSE;
+}
+
+BOOL CloseHandle(
+    HANDLE Handle)
+{
+    std::map<HANDLE, int>::iterator File = g_Files.find(Handle);
+
+    if (g_Files.end() != File)
+    {
+        close(File->second);
+        delete static_cast<BYTE*>(Handle);
+        g_Files.erase(File);
+    }
+    return TRUE;
+}
+
+// Host files. Paths are ASCII; the dispositions the driver uses map onto
+// open(2) flags.
+HANDLE CreateFileW(
+    PCWSTR Path,
+    DWORD Access,
+    DWORD /*Share*/,
+    PVOID /*Security*/,
+    DWORD Disposition,
+    DWORD /*Flags*/,
+    HANDLE /*Template*/)
+{
+    std::string Name;
+    int OpenFlags = 0;
+
+    for (size_t i = 0; L'\0' != Path[i]; i++)
+    {
+        Name += static_cast<char>(Path[i]);
+    }
+
+    if (0 != (Access & GENERIC_WRITE))
+    {
+        OpenFlags = (0 != (Access & GENERIC_READ)) ? O_RDWR : O_WRONLY;
+    }
+    else
+    {
+        OpenFlags = O_RDONLY;
+    }
+
+    if (CREATE_ALWAYS == Disposition)
+    {
+        OpenFlags |= O_CREAT | O_TRUNC;
+    }
+    else if (OPEN_ALWAYS == Disposition)
+    {
+        OpenFlags |= O_CREAT;
+    }
+
+    int Fd = open(Name.c_str(), OpenFlags, 0644);
+    if (Fd < 0)
+    {
+        g_LastError = (ENOENT == errno) ? ERROR_FILE_NOT_FOUND : ERROR_ACCESS_DENIED;
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // Any unique address serves as the handle
+    HANDLE Handle = new BYTE;
+    g_Files[Handle] = Fd;
+    return Handle;
+}
+
+static int HostFileFd(
+    _In_ HANDLE File)
+{
+    std::map<HANDLE, int>::iterator Entry = g_Files.find(File);
+
+    if (g_Files.end() == Entry)
+    {
+        HostFatal("handle %p is not a file", File);
+    }
+
+    return Entry->second;
+}
+
+BOOL ReadFile(
+    HANDLE File,
+    LPVOID pBuffer,
+    DWORD Bytes,
+    DWORD* pRead,
+    PVOID /*pOverlapped*/)
+{
+    ssize_t Read = read(HostFileFd(File), pBuffer, Bytes);
+
+    *pRead = (Read > 0) ? static_cast<DWORD>(Read) : 0;
+    if (Read < 0)
+    {
+        g_LastError = ERROR_READ_FAULT;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL WriteFile(
+    HANDLE File,
+    LPCVOID pBuffer,
+    DWORD Bytes,
+    DWORD* pWritten,
+    PVOID /*pOverlapped*/)
+{
+    ssize_t Written = write(HostFileFd(File), pBuffer, Bytes);
+
+    if (nullptr != pWritten)
+    {
+        *pWritten = (Written > 0) ? static_cast<DWORD>(Written) : 0;
+    }
+    if (Written < 0)
+    {
+        g_LastError = ERROR_WRITE_FAULT;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL SetFilePointerEx(
+    HANDLE File,
+    LARGE_INTEGER Distance,
+    PLARGE_INTEGER pNewPosition,
+    DWORD Method)
+{
+    off_t Position = lseek(HostFileFd(File), static_cast<off_t>(Distance.QuadPart), (FILE_END == Method) ? SEEK_END : SEEK_SET);
+
+    if (Position < 0)
+    {
+        g_LastError = ERROR_READ_FAULT;
+        return FALSE;
+    }
+    if (nullptr != pNewPosition)
+    {
+        pNewPosition->QuadPart = Position;
+    }
+    return TRUE;
+}
+
+BOOL GetFileSizeEx(
+    HANDLE File,
+    PLARGE_INTEGER pSize)
+{
+    struct stat Status;
+
+    if (0 != fstat(HostFileFd(File), &Status))
+    {
+        pSize->QuadPart = 0;
+        g_LastError = ERROR_READ_FAULT;
+        return FALSE;
+    }
+    pSize->QuadPart = Status.st_size;
+    return TRUE;
+}
+
+BOOL SetEndOfFile(
+    HANDLE File)
+{
+    int Fd = HostFileFd(File);
+
+    if (0 != ftruncate(Fd, lseek(Fd, 0, SEEK_CUR)))
+    {
+        g_LastError = ERROR_WRITE_FAULT;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+HANDLE CreateFileMappingW(
+    HANDLE /*File*/,
+    PVOID /*Security*/,
+    DWORD /*Protect*/,
+    DWORD /*SizeHigh*/,
+    DWORD /*SizeLow*/,
+    PCWSTR /*Name*/)
+{
+    g_LastError = ERROR_FILE_NOT_FOUND;
+    return nullptr;
+}
+
+PVOID MapViewOfFile(
+    HANDLE /*Mapping*/,
+    DWORD /*Access*/,
+    DWORD /*OffsetHigh*/,
+    DWORD /*OffsetLow*/,
+    SIZE_T /*Bytes*/)
+{
+    g_LastError = ERROR_FILE_NOT_FOUND;
+    return nullptr;
+}
+
+BOOL UnmapViewOfFile(
+    LPCVOID /*pView*/)
+{
+    return TRUE;
+}
+
+//
+// Driver and device
+//
+
+NTSTATUS WdfDriverCreate(
+    PDRIVER_OBJECT /*DriverObject*/,
+    PUNICODE_STRING /*RegistryPath*/,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    PWDF_DRIVER_CONFIG pConfig,
+    WDFDRIVER* pDriver)
+{
+    HostDriver* pNew = new HostDriver();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->Config = *pConfig;
+    g_pDriver = pNew;
+
+    if (nullptr != pDriver)
+    {
+        *pDriver = HostHandle<WDFDRIVER>(pNew);
+    }
+    return STATUS_SUCCESS;
+}
+
+WDFDRIVER WdfGetDriver()
+{
+    return HostHandle<WDFDRIVER>(g_pDriver);
+}
+
+VOID WdfDeviceInitSetPowerPolicyOwnership(
+    PWDFDEVICE_INIT /*pDeviceInit*/,
+    BOOLEAN /*IsPowerPolicyOwner*/)
+{
+}
+
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(
+    PWDFDEVICE_INIT pDeviceInit,
+    PWDF_PNPPOWER_EVENT_CALLBACKS pCallbacks)
+{
+    HostFrom<HostDeviceInit>(pDeviceInit, HostKindDeviceInit)->PnpPower = *pCallbacks;
+}
+
+VOID WdfDeviceInitSetIoTypeEx(
+    PWDFDEVICE_INIT /*pDeviceInit*/,
+    PWDF_IO_TYPE_CONFIG /*pConfig*/)
+{
+}
+
+NTSTATUS WdfDeviceCreate(
+    PWDFDEVICE_INIT* ppDeviceInit,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFDEVICE* pDevice)
+{
+    HostDeviceInit* pInit = HostFrom<HostDeviceInit>(*ppDeviceInit, HostKindDeviceInit);
+    HostDevice* pNew = new HostDevice();
+
+    HostInitializeObject(pNew, pAttributes, g_pDriver);
+    pNew->PnpPower = pInit->PnpPower;
+    g_pDevice = pNew;
+
+    *ppDeviceInit = nullptr;
+    *pDevice = HostHandle<WDFDEVICE>(pNew);
+    return STATUS_SUCCESS;
+}
+
+VOID WdfDeviceSetDeviceState(
+    WDFDEVICE /*Device*/,
+    PWDF_DEVICE_STATE /*pState*/)
+{
+}
+
+ULONG WdfCmResourceListGetCount(
+    WDFCMRESLIST List)
+{
+    return static_cast<ULONG>(HostFrom<HostResourceList>(List, HostKindResourceList)->Descriptors.size());
+}
+
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(
+    WDFCMRESLIST List,
+    ULONG Index)
+{
+    HostResourceList* pList = HostFrom<HostResourceList>(List, HostKindResourceList);
+
+    return (Index < pList->Descriptors.size()) ? &pList->Descriptors[Index] : nullptr;
+}
+
+//
+// Registry
+//
+
+static std::string HostValueName(
+    _In_ PCUNICODE_STRING pName)
+{
+    std::string Name;
+
+    for (size_t i = 0; i < pName->Length / sizeof(WCHAR) && L'\0' != pName->Buffer[i]; i++)
+    {
+        Name.push_back(static_cast<char>(HostFold(pName->Buffer[i])));
+    }
+
+    return Name;
+}
+
+static std::string HostValueName(
+    _In_ PCSTR pName)
+{
+    std::string Name;
+
+    for (; '\0' != *pName; pName++)
+    {
+        Name.push_back(static_cast<char>(HostFold(static_cast<WCHAR>(*pName))));
+    }
+
+    return Name;
+}
+
+// Append an ASCII string as wide characters, with its terminator
+static VOID HostAppendWide(
+    _Inout_ std::vector<BYTE>* pData,
+    _In_ PCSTR pString)
+{
+    do
+    {
+        WCHAR c = static_cast<WCHAR>(*pString);
+        pData->insert(pData->end(), reinterpret_cast<BYTE*>(&c), reinterpret_cast<BYTE*>(&c) + sizeof(c));
+    } while ('\0' != *pString++);
+}
+
+VOID HostSetDeviceULong(
+    PCSTR Name,
+    ULONG Value)
+{
+    HostValue* pValue = &g_DeviceHive[HostValueName(Name)];
+
+    pValue->Type = REG_DWORD;
+    pValue->Data.assign(reinterpret_cast<BYTE*>(&Value), reinterpret_cast<BYTE*>(&Value) + sizeof(Value));
+}
+
+VOID HostSetDeviceString(
+    PCSTR Name,
+    PCSTR Value)
+{
+    HostValue* pValue = &g_DeviceHive[HostValueName(Name)];
+
+    pValue->Type = REG_SZ;
+    pValue->Data.clear();
+    HostAppendWide(&pValue->Data, Value);
+}
+
+VOID HostSetParametersString(
+    PCSTR Name,
+    PCSTR Value)
+{
+    HostValue* pValue = &g_ParametersHive[HostValueName(Name)];
+
+    pValue->Type = REG_SZ;
+    pValue->Data.clear();
+    HostAppendWide(&pValue->Data, Value);
+}
+
+VOID HostSetParametersMultiSz(
+    PCSTR Name,
+    const PCSTR* pStrings,
+    ULONG Count)
+{
+    HostValue* pValue = &g_ParametersHive[HostValueName(Name)];
+
+    pValue->Type = REG_MULTI_SZ;
+    pValue->Data.clear();
+    for (ULONG i = 0; i < Count; i++)
+    {
+        HostAppendWide(&pValue->Data, pStrings[i]);
+    }
+    HostAppendWide(&pValue->Data, "");
+}
+
+static NTSTATUS HostOpenKey(
+    _In_ HostHive* pHive,
+    _Out_ WDFKEY* pKey)
+{
+    HostKey* pNew = new HostKey();
+
+    HostInitializeObject(pNew, nullptr, nullptr);
+    pNew->pHive = pHive;
+
+    *pKey = HostHandle<WDFKEY>(pNew);
+    return STATUS_SUCCESS;
+}
+
+static const HostValue* HostFindValue(
+    _In_ WDFKEY Key,
+    _In_ PCUNICODE_STRING pName)
+{
+    HostHive* pHive = HostFrom<HostKey>(Key, HostKindKey)->pHive;
+    HostHive::const_iterator Value = pHive->find(HostValueName(pName));
+
+    return (pHive->end() != Value) ? &Value->second : nullptr;
+}
+
+NTSTATUS WdfDriverOpenParametersRegistryKey(
+    WDFDRIVER /*Driver*/,
+    ULONG /*Access*/,
+    PWDF_OBJECT_ATTRIBUTES /*pAttributes*/,
+    WDFKEY* pKey)
+{
+    return HostOpenKey(&g_ParametersHive, pKey);
+}
+
+NTSTATUS WdfDeviceOpenRegistryKey(
+    WDFDEVICE /*Device*/,
+    ULONG KeyType,
+    ULONG /*Access*/,
+    PWDF_OBJECT_ATTRIBUTES /*pAttributes*/,
+    WDFKEY* pKey)
+{
+    if (PLUGPLAY_REGKEY_DEVICE != KeyType)
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    return HostOpenKey(&g_DeviceHive, pKey);
+}
+
+NTSTATUS WdfRegistryQueryULong(
+    WDFKEY Key,
+    PCUNICODE_STRING ValueName,
+    PULONG pValue)
+{
+    const HostValue* pFound = HostFindValue(Key, ValueName);
+
+    if (nullptr == pFound || REG_DWORD != pFound->Type)
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    memcpy(pValue, pFound->Data.data(), sizeof(*pValue));
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryValue(
+    WDFKEY Key,
+    PCUNICODE_STRING ValueName,
+    ULONG ValueLength,
+    PVOID pValue,
+    PULONG pValueLengthQueried,
+    PULONG pValueType)
+{
+    const HostValue* pFound = HostFindValue(Key, ValueName);
+
+    if (nullptr == pFound)
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    if (nullptr != pValueLengthQueried)
+    {
+        *pValueLengthQueried = static_cast<ULONG>(pFound->Data.size());
+    }
+    if (nullptr != pValueType)
+    {
+        *pValueType = pFound->Type;
+    }
+    if (ValueLength < pFound->Data.size())
+    {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    memcpy(pValue, pFound->Data.data(), pFound->Data.size());
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryUnicodeString(
+    WDFKEY Key,
+    PCUNICODE_STRING ValueName,
+    PUSHORT pValueByteLength,
+    PUNICODE_STRING pValue)
+{
+    const HostValue* pFound = HostFindValue(Key, ValueName);
+
+    if (nullptr == pFound || REG_SZ != pFound->Type)
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    // Without the terminator
+    USHORT Length = static_cast<USHORT>(pFound->Data.size() - sizeof(WCHAR));
+
+    if (nullptr != pValueByteLength)
+    {
+        *pValueByteLength = Length;
+    }
+    if (nullptr == pValue)
+    {
+        return STATUS_SUCCESS;
+    }
+    if (pValue->MaximumLength < Length)
+    {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    memcpy(pValue->Buffer, pFound->Data.data(), Length);
+    pValue->Length = Length;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRegistryClose(
+    WDFKEY Key)
+{
+    HostDeleteObject(HostFrom<HostKey>(Key, HostKindKey));
+}
+
+//
+// Locks, timers and work items
+//
+
+NTSTATUS WdfWaitLockCreate(
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFWAITLOCK* pLock)
+{
+    HostWaitLock* pNew = new HostWaitLock();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    *pLock = HostHandle<WDFWAITLOCK>(pNew);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfWaitLockAcquire(
+    WDFWAITLOCK Lock,
+    PLONGLONG pTimeout)
+{
+    HostWaitLock* pLock = HostFrom<HostWaitLock>(Lock, HostKindWaitLock);
+
+    if (pLock->Held)
+    {
+        if (nullptr == pTimeout)
+        {
+            HostFatal("wait lock %p acquired while held", Lock);
+        }
+        return STATUS_TIMEOUT;
+    }
+
+    pLock->Held = true;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfWaitLockRelease(
+    WDFWAITLOCK Lock)
+{
+    HostFrom<HostWaitLock>(Lock, HostKindWaitLock)->Held = false;
+}
+
+NTSTATUS WdfTimerCreate(
+    PWDF_TIMER_CONFIG pConfig,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFTIMER* pTimer)
+{
+    HostTimer* pNew = new HostTimer();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->Config = *pConfig;
+    *pTimer = HostHandle<WDFTIMER>(pNew);
+    return STATUS_SUCCESS;
+}
+
+// Negative due times are relative, positive ones system times
+BOOLEAN WdfTimerStart(
+    WDFTIMER Timer,
+    LONGLONG DueTime)
+{
+    HostTimer* pTimer = HostFrom<HostTimer>(Timer, HostKindTimer);
+    bool Queued = pTimer->Queued;
+    LONGLONG Due = (DueTime < 0) ? g_Now - DueTime : max(g_Now, DueTime - HOST_FILETIME_BASE);
+
+    HostQueueEvent(pTimer, Due);
+    return Queued;
+}
+
+BOOLEAN WdfTimerStop(
+    WDFTIMER Timer,
+    BOOLEAN /*Wait*/)
+{
+    return HostDequeue(HostFrom<HostTimer>(Timer, HostKindTimer));
+}
+
+WDFOBJECT WdfTimerGetParentObject(
+    WDFTIMER Timer)
+{
+    return HostFrom<HostTimer>(Timer, HostKindTimer)->pParent;
+}
+
+NTSTATUS WdfWorkItemCreate(
+    PWDF_WORKITEM_CONFIG pConfig,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFWORKITEM* pWorkItem)
+{
+    HostWorkItem* pNew = new HostWorkItem();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->Config = *pConfig;
+    *pWorkItem = HostHandle<WDFWORKITEM>(pNew);
+    return STATUS_SUCCESS;
+}
+
+// A work item already queued is not queued again
+VOID WdfWorkItemEnqueue(
+    WDFWORKITEM WorkItem)
+{
+    HostWorkItem* pWorkItem = HostFrom<HostWorkItem>(WorkItem, HostKindWorkItem);
+
+    if (!pWorkItem->Queued)
+    {
+        HostQueueEvent(pWorkItem, g_Now);
+    }
+}
+
+WDFOBJECT WdfWorkItemGetParentObject(
+    WDFWORKITEM WorkItem)
+{
+    return HostFrom<HostWorkItem>(WorkItem, HostKindWorkItem)->pParent;
+}
+
+//
+// Memory
+//
+
+NTSTATUS WdfMemoryCreate(
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    POOL_TYPE /*PoolType*/,
+    ULONG /*PoolTag*/,
+    size_t BufferSize,
+    WDFMEMORY* pMemory,
+    PVOID* ppBuffer)
+{
+    HostMemory* pNew = new HostMemory();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->pBuffer = calloc(1, max(BufferSize, static_cast<size_t>(1)));
+    pNew->Size = BufferSize;
+    pNew->Owned = true;
+    if (nullptr == pNew->pBuffer)
+    {
+        HostDeleteObject(pNew);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *pMemory = HostHandle<WDFMEMORY>(pNew);
+    if (nullptr != ppBuffer)
+    {
+        *ppBuffer = pNew->pBuffer;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfMemoryCreatePreallocated(
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    PVOID pBuffer,
+    size_t BufferSize,
+    WDFMEMORY* pMemory)
+{
+    HostMemory* pNew = new HostMemory();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->pBuffer = pBuffer;
+    pNew->Size = BufferSize;
+
+    *pMemory = HostHandle<WDFMEMORY>(pNew);
+    return STATUS_SUCCESS;
+}
+
+//
+// I/O targets and requests
+//
+
+NTSTATUS WdfIoTargetCreate(
+    WDFDEVICE Device,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFIOTARGET* pTarget)
+{
+    HostIoTarget* pNew = new HostIoTarget();
+
+    HostInitializeObject(pNew, pAttributes, HostFrom<HostDevice>(Device, HostKindDevice));
+    *pTarget = HostHandle<WDFIOTARGET>(pNew);
+    return STATUS_SUCCESS;
+}
+
+// The name ends in the connection ID, 16 hex digits
+NTSTATUS WdfIoTargetOpen(
+    WDFIOTARGET Target,
+    PWDF_IO_TARGET_OPEN_PARAMS pParams)
+{
+    HostIoTarget* pTarget = HostFrom<HostIoTarget>(Target, HostKindIoTarget);
+    PCWSTR pName = pParams->TargetDeviceName->Buffer;
+    size_t Length = wcslen(pName);
+    size_t Prefix = _countof(RESOURCE_HUB_DEVICE_NAME);
+    ULONGLONG ConnectionId = 0;
+
+    if (Length != Prefix + 16 || 0 != HostWcsnicmp(pName, RESOURCE_HUB_DEVICE_NAME L"\\", Prefix))
+    {
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    for (size_t i = Prefix; i < Length; i++)
+    {
+        WCHAR c = HostFold(pName[i]);
+        ULONG Digit = (c >= L'0' && c <= L'9') ? c - L'0' : (c >= L'A' && c <= L'F') ? c - L'A' + 10 : 16;
+        if (Digit > 15)
+        {
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+        ConnectionId = (ConnectionId << 4) | Digit;
+    }
+
+    for (size_t Amp = 0; Amp < g_Amps.size(); Amp++)
+    {
+        if (HOST_CONNECTION_ID(Amp) == ConnectionId)
+        {
+            pTarget->pAmp = g_Amps[Amp];
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+static PSimTfa9890 HostTargetAmp(
+    _In_ WDFIOTARGET Target)
+{
+    PSimTfa9890 pAmp = HostFrom<HostIoTarget>(Target, HostKindIoTarget)->pAmp;
+
+    if (nullptr == pAmp)
+    {
+        HostFatal("I/O target %p used before it was opened", Target);
+    }
+
+    return pAmp;
+}
+
+// Address and register byte, then the data
+NTSTATUS I2CSensorWriteRegister(
+    WDFIOTARGET Target,
+    BYTE Register,
+    BYTE* pData,
+    ULONG Length)
+{
+    PSimTfa9890 pAmp = HostTargetAmp(Target);
+    std::vector<BYTE> Transfer(1 + Length);
+
+    Transfer[0] = Register;
+    memcpy(&Transfer[1], pData, Length);
+
+    g_Now = HostBusTransfer(2 + Length);
+    pAmp->Write(Transfer.data(), static_cast<ULONG>(Transfer.size()), g_Now);
+    return STATUS_SUCCESS;
+}
+
+// Address and register byte, then the address again and the data
+NTSTATUS I2CSensorReadRegister(
+    WDFIOTARGET Target,
+    BYTE Register,
+    BYTE* pData,
+    ULONG Length)
+{
+    PSimTfa9890 pAmp = HostTargetAmp(Target);
+
+    g_Now = HostBusTransfer(3 + Length);
+    pAmp->Read(Register, pData, Length, g_Now);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestCreate(
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    WDFIOTARGET Target,
+    WDFREQUEST* pRequest)
+{
+    HostRequest* pNew = new HostRequest();
+
+    HostInitializeObject(pNew, pAttributes, nullptr);
+    pNew->pTarget = (nullptr != Target) ? HostFrom<HostIoTarget>(Target, HostKindIoTarget) : nullptr;
+    *pRequest = HostHandle<WDFREQUEST>(pNew);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestReuse(
+    WDFREQUEST Request,
+    PWDF_REQUEST_REUSE_PARAMS pParams)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (pRequest->Queued)
+    {
+        HostFatal("request %p reused while in flight", Request);
+    }
+
+    pRequest->Status = pParams->Status;
+    pRequest->Information = 0;
+    pRequest->Completed = false;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfIoTargetFormatRequestForWrite(
+    WDFIOTARGET Target,
+    WDFREQUEST Request,
+    WDFMEMORY Memory,
+    PWDFMEMORY_OFFSET pOffset,
+    PLONGLONG /*pDeviceOffset*/)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+    HostMemory* pMemory = HostFrom<HostMemory>(Memory, HostKindMemory);
+    size_t Offset = (nullptr != pOffset) ? pOffset->BufferOffset : 0;
+    size_t Length = (nullptr != pOffset) ? pOffset->BufferLength : pMemory->Size;
+
+    if (Offset + Length > pMemory->Size || 0 == Length)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pRequest->pTarget = HostFrom<HostIoTarget>(Target, HostKindIoTarget);
+    pRequest->pWrite = static_cast<BYTE*>(pMemory->pBuffer) + Offset;
+    pRequest->WriteLength = Length;
+    return STATUS_SUCCESS;
+}
+
+VOID WdfRequestSetCompletionRoutine(
+    WDFREQUEST Request,
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine,
+    WDFCONTEXT Context)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    pRequest->Completion = CompletionRoutine;
+    pRequest->CompletionContext = Context;
+}
+
+// The write goes out when the bus is free and completes when it is sent
+BOOLEAN WdfRequestSend(
+    WDFREQUEST Request,
+    WDFIOTARGET Target,
+    PWDF_REQUEST_SEND_OPTIONS /*pOptions*/)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (nullptr == pRequest->pWrite || nullptr == pRequest->Completion || nullptr == HostTargetAmp(Target))
+    {
+        pRequest->Status = STATUS_INVALID_DEVICE_REQUEST;
+        return FALSE;
+    }
+
+    pRequest->Status = STATUS_SUCCESS;
+    HostQueueEvent(pRequest, HostBusTransfer(1 + static_cast<ULONG>(pRequest->WriteLength)));
+    return TRUE;
+}
+
+NTSTATUS WdfRequestGetStatus(
+    WDFREQUEST Request)
+{
+    return HostFrom<HostRequest>(Request, HostKindRequest)->Status;
+}
+
+// A write not yet completed completes at once, cancelled and not applied
+BOOLEAN WdfRequestCancelSentRequest(
+    WDFREQUEST Request)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (!pRequest->Queued)
+    {
+        return FALSE;
+    }
+
+    pRequest->Status = STATUS_CANCELLED;
+    HostQueueEvent(pRequest, g_Now);
+    return TRUE;
+}
+
+VOID WdfRequestCompleteWithInformation(
+    WDFREQUEST Request,
+    NTSTATUS Status,
+    ULONG_PTR Information)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (pRequest->Completed)
+    {
+        HostFatal("request %p completed twice", Request);
+    }
+
+    pRequest->Status = Status;
+    pRequest->Information = Information;
+    pRequest->Completed = true;
+}
+
+VOID WdfRequestComplete(
+    WDFREQUEST Request,
+    NTSTATUS Status)
+{
+    WdfRequestCompleteWithInformation(Request, Status, 0);
+}
+
+NTSTATUS WdfRequestRetrieveInputBuffer(
+    WDFREQUEST Request,
+    size_t MinimumRequiredSize,
+    PVOID* ppBuffer,
+    size_t* pLength)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (nullptr == pRequest->pInput || 0 == pRequest->InputLength)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    if (pRequest->InputLength < MinimumRequiredSize)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *ppBuffer = const_cast<PVOID>(pRequest->pInput);
+    if (nullptr != pLength)
+    {
+        *pLength = pRequest->InputLength;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(
+    WDFREQUEST Request,
+    size_t MinimumRequiredSize,
+    PVOID* ppBuffer,
+    size_t* pLength)
+{
+    HostRequest* pRequest = HostFrom<HostRequest>(Request, HostKindRequest);
+
+    if (nullptr == pRequest->pOutput || 0 == pRequest->OutputLength || pRequest->OutputLength < MinimumRequiredSize)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *ppBuffer = pRequest->pOutput;
+    if (nullptr != pLength)
+    {
+        *pLength = pRequest->OutputLength;
+    }
+    return STATUS_SUCCESS;
+}
+
+ULONG WdfRequestGetRequestorProcessId(
+    WDFREQUEST /*Request*/)
+{
+    return 1;
+}
+
+WDFFILEOBJECT WdfRequestGetFileObject(
+    WDFREQUEST /*Request*/)
+{
+    return HostHandle<WDFFILEOBJECT>(g_pFile);
+}
+
+WDFQUEUE WdfRequestGetIoQueue(
+    WDFREQUEST /*Request*/)
+{
+    return HostHandle<WDFQUEUE>(g_pQueue);
+}
+
+WDFDEVICE WdfIoQueueGetDevice(
+    WDFQUEUE Queue)
+{
+    return HostHandle<WDFDEVICE>(HostFrom<HostQueue>(Queue, HostKindQueue)->pDevice);
+}
+
+NTSTATUS WdfRequestMarkCancelableEx(
+    WDFREQUEST /*Request*/,
+    PFN_WDF_REQUEST_CANCEL /*EvtRequestCancel*/)
+{
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestUnmarkCancelable(
+    WDFREQUEST /*Request*/)
+{
+    return STATUS_SUCCESS;
+}
+
+//
+// Property variants and sensor collections
+//
+
+#define HOST_PROPERTY_KEY(n, id) \
+    const PROPERTYKEY n = { { 0x484F5354, 0x0000, 0x0000, { 0, 0, 0, 0, 0, 0, 0, 0 } }, id }
+
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_Type, 2);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_Category, 3);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_Manufacturer, 4);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_Model, 5);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_PersistentUniqueId, 6);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_VendorDefinedSubType, 7);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_Name, 8);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_ConnectionType, 9);
+HOST_PROPERTY_KEY(DEVPKEY_Sensor_IsPrimary, 10);
+HOST_PROPERTY_KEY(PKEY_Sensor_State, 20);
+HOST_PROPERTY_KEY(PKEY_Sensor_MinimumDataInterval_Ms, 21);
+HOST_PROPERTY_KEY(PKEY_Sensor_MaximumDataFieldSize_Bytes, 22);
+HOST_PROPERTY_KEY(PKEY_Sensor_Type, 23);
+HOST_PROPERTY_KEY(PKEY_Sensor_ChangeSensitivity, 24);
+HOST_PROPERTY_KEY(PKEY_Sensor_ReportingDelay_Ms, 25);
+HOST_PROPERTY_KEY(PKEY_SensorData_Timestamp, 30);
+HOST_PROPERTY_KEY(PKEY_SensorDataField_Resolution, 31);
+HOST_PROPERTY_KEY(PKEY_SensorDataField_RangeMinimum, 32);
+HOST_PROPERTY_KEY(PKEY_SensorDataField_RangeMaximum, 33);
+HOST_PROPERTY_KEY(PKEY_SensorHistory_Interval_Ms, 34);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue1, 101);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue2, 102);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue3, 103);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue4, 104);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue5, 105);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue6, 106);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue7, 107);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue8, 108);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue9, 109);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue10, 110);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue11, 111);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue12, 112);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue13, 113);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue14, 114);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue15, 115);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue16, 116);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue17, 117);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue18, 118);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue19, 119);
+HOST_PROPERTY_KEY(PKEY_SensorData_CustomValue20, 120);
+
+const GUID GUID_SensorType_Custom = { 0xE83AF229, 0x8640, 0x4D18, { 0xA2, 0x13, 0xE2, 0x26, 0x75, 0xEB, 0xB2, 0xC3 } };
+const GUID GUID_SensorCategory_Other = { 0x2C90E7A9, 0xF4C9, 0x4FA2, { 0xAF, 0x37, 0x56, 0xD4, 0x71, 0xFE, 0x5A, 0x3D } };
+
+VOID InitPropVariantFromCLSID(
+    const GUID& Clsid,
+    PROPVARIANT* pVariant)
+{
+    pVariant->vt = VT_CLSID;
+    pVariant->puuid = &Clsid;
+}
+
+// The string is referenced, not copied; the driver's are static
+VOID InitPropVariantFromString(
+    PCWSTR pString,
+    PROPVARIANT* pVariant)
+{
+    pVariant->vt = VT_LPWSTR;
+    pVariant->pwszVal = pString;
+}
+
+VOID InitPropVariantFromUInt32(
+    ULONG Value,
+    PROPVARIANT* pVariant)
+{
+    pVariant->vt = VT_UI4;
+    pVariant->ulVal = Value;
+}
+
+VOID InitPropVariantFromFloat(
+    float Value,
+    PROPVARIANT* pVariant)
+{
+    pVariant->vt = VT_R4;
+    pVariant->fltVal = Value;
+}
+
+VOID InitPropVariantFromFileTime(
+    const FILETIME* pTime,
+    PROPVARIANT* pVariant)
+{
+    pVariant->vt = VT_FILETIME;
+    pVariant->filetime = *pTime;
+}
+
+ULONG CollectionsListGetMarshalledSize(
+    PSENSOR_COLLECTION_LIST pList)
+{
+    return SENSOR_COLLECTION_LIST_SIZE(pList->Count);
+}
+
+NTSTATUS CollectionsListCopyAndMarshall(
+    PSENSOR_COLLECTION_LIST pTarget,
+    PSENSOR_COLLECTION_LIST pSource)
+{
+    ULONG Size = CollectionsListGetMarshalledSize(pSource);
+
+    if (pTarget->AllocatedSizeInBytes < Size)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ULONG Allocated = pTarget->AllocatedSizeInBytes;
+    memcpy(pTarget, pSource, Size);
+    pTarget->AllocatedSizeInBytes = Allocated;
+    return STATUS_SUCCESS;
+}
+
+static PROPVARIANT* HostFindProperty(
+    _In_ PSENSOR_COLLECTION_LIST pList,
+    _In_ const PROPERTYKEY* pKey)
+{
+    for (ULONG i = 0; i < pList->Count; i++)
+    {
+        if (IsEqualPropertyKey(pList->List[i].Key, *pKey))
+        {
+            return &pList->List[i].Value;
+        }
+    }
+
+    return nullptr;
+}
+
+NTSTATUS PropKeyFindKeyGetFloat(
+    PSENSOR_COLLECTION_LIST pList,
+    const PROPERTYKEY* pKey,
+    float* pValue)
+{
+    PROPVARIANT* pVariant = HostFindProperty(pList, pKey);
+
+    if (nullptr == pVariant || VT_R4 != pVariant->vt)
+    {
+        return STATUS_NOT_FOUND;
+    }
+
+    *pValue = pVariant->fltVal;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS PropKeyFindKeySetFloat(
+    PSENSOR_COLLECTION_LIST pList,
+    const PROPERTYKEY* pKey,
+    float Value)
+{
+    PROPVARIANT* pVariant = HostFindProperty(pList, pKey);
+
+    if (nullptr == pVariant)
+    {
+        return STATUS_NOT_FOUND;
+    }
+
+    InitPropVariantFromFloat(Value, pVariant);
+    return STATUS_SUCCESS;
+}
+
+//
+// Sensor class extension
+//
+
+NTSTATUS SensorsCxDeviceInitConfig(
+    PWDFDEVICE_INIT /*pDeviceInit*/,
+    PWDF_OBJECT_ATTRIBUTES /*pAttributes*/,
+    ULONG /*Flags*/)
+{
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SensorsCxDeviceInitialize(
+    WDFDEVICE Device,
+    PSENSOR_CONTROLLER_CONFIG pConfig)
+{
+    HostFrom<HostDevice>(Device, HostKindDevice)->Controller = *pConfig;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SensorsCxSensorCreate(
+    WDFDEVICE Device,
+    PWDF_OBJECT_ATTRIBUTES pAttributes,
+    SENSOROBJECT* pSensor)
+{
+    HostDevice* pDevice = HostFrom<HostDevice>(Device, HostKindDevice);
+    HostSensor* pNew = new HostSensor();
+
+    HostInitializeObject(pNew, pAttributes, pDevice);
+    pDevice->Sensors.push_back(pNew);
+
+    *pSensor = HostHandle<SENSOROBJECT>(pNew);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SensorsCxSensorInitialize(
+    SENSOROBJECT Sensor,
+    PSENSOR_CONFIG pConfig)
+{
+    HostFrom<HostSensor>(Sensor, HostKindSensor);
+    return (nullptr != pConfig->pEnumerationList) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+NTSTATUS SensorsCxDeviceGetSensorList(
+    WDFDEVICE Device,
+    SENSOROBJECT* pSensors,
+    PULONG pCount)
+{
+    HostDevice* pDevice = HostFrom<HostDevice>(Device, HostKindDevice);
+    ULONG Count = 0;
+
+    for (; Count < *pCount && Count < pDevice->Sensors.size(); Count++)
+    {
+        pSensors[Count] = HostHandle<SENSOROBJECT>(pDevice->Sensors[Count]);
+    }
+
+    *pCount = Count;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SensorsCxSensorDataReady(
+    SENSOROBJECT Sensor,
+    PSENSOR_COLLECTION_LIST pData)
+{
+    HostSensor* pSensor = HostFrom<HostSensor>(Sensor, HostKindSensor);
+
+    if (nullptr == pData || 0 == pData->Count)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pSensor->DataReady++;
+    return STATUS_SUCCESS;
+}
+
+//
+// Harness
+//
+
+NTSTATUS HostLoadDriver()
+{
+    UNICODE_STRING RegistryPath;
+
+    RtlInitUnicodeString(&RegistryPath, L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\NxpTfa9890");
+    return DriverEntry(nullptr, &RegistryPath);
+}
+
+// Add the device and start it with one I2C connection per amp, as PnP
+// would: device add, then prepare hardware
+NTSTATUS HostAddDevice(
+    ULONG AmpCount)
+{
+    HostDeviceInit Init;
+
+    if (nullptr == g_pDriver || nullptr != g_pDevice)
+    {
+        HostFatal("a device is added once, after the driver is loaded");
+    }
+
+    NTSTATUS Status = g_pDriver->Config.EvtDriverDeviceAdd(HostHandle<WDFDRIVER>(g_pDriver), reinterpret_cast<PWDFDEVICE_INIT>(&Init));
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+    if (nullptr == g_pDevice)
+    {
+        HostFatal("device add returned without a device");
+    }
+
+    g_pQueue = new HostQueue();
+    HostInitializeObject(g_pQueue, nullptr, g_pDevice);
+    g_pQueue->pDevice = g_pDevice;
+
+    g_pFile = new HostFileObject();
+    HostInitializeObject(g_pFile, nullptr, g_pDevice);
+
+    g_pResources = new HostResourceList();
+    HostInitializeObject(g_pResources, nullptr, g_pDevice);
+
+    for (ULONG Amp = 0; Amp < AmpCount; Amp++)
+    {
+        CM_PARTIAL_RESOURCE_DESCRIPTOR Descriptor = {};
+
+        Descriptor.Type = CmResourceTypeConnection;
+        Descriptor.u.Connection.Class = CM_RESOURCE_CONNECTION_CLASS_SERIAL;
+        Descriptor.u.Connection.Type = CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C;
+        Descriptor.u.Connection.IdLowPart = static_cast<ULONG>(HOST_CONNECTION_ID(Amp));
+        Descriptor.u.Connection.IdHighPart = static_cast<ULONG>(HOST_CONNECTION_ID(Amp) >> 32);
+        g_pResources->Descriptors.push_back(Descriptor);
+
+        g_Amps.push_back(new SimTfa9890());
+    }
+
+    WDFCMRESLIST Resources = HostHandle<WDFCMRESLIST>(g_pResources);
+    return g_pDevice->PnpPower.EvtDevicePrepareHardware(HostHandle<WDFDEVICE>(g_pDevice), Resources, Resources);
+}
+
+NTSTATUS HostD0Entry()
+{
+    return g_pDevice->PnpPower.EvtDeviceD0Entry(HostHandle<WDFDEVICE>(g_pDevice), WdfPowerDeviceD3);
+}
+
+NTSTATUS HostD0Exit()
+{
+    return g_pDevice->PnpPower.EvtDeviceD0Exit(HostHandle<WDFDEVICE>(g_pDevice), WdfPowerDeviceD3);
+}
+
+NTSTATUS HostReleaseDevice()
+{
+    NTSTATUS Status = g_pDevice->PnpPower.EvtDeviceReleaseHardware(HostHandle<WDFDEVICE>(g_pDevice),
+                                                                   HostHandle<WDFCMRESLIST>(g_pResources));
+
+    HostDeleteObject(g_pDevice);
+    g_pDevice = nullptr;
+    g_pQueue = nullptr;
+    g_pFile = nullptr;
+    g_pResources = nullptr;
+
+    for (size_t Amp = 0; Amp < g_Amps.size(); Amp++)
+    {
+        delete g_Amps[Amp];
+    }
+    g_Amps.clear();
+
+    return Status;
+}
+
+ULONG HostSensorCount()
+{
+    return static_cast<ULONG>(g_pDevice->Sensors.size());
+}
+
+static SENSOROBJECT HostSensorHandle(
+    _In_ ULONG Sensor)
+{
+    if (nullptr == g_pDevice || Sensor >= g_pDevice->Sensors.size())
+    {
+        HostFatal("no sensor %u", Sensor);
+    }
+
+    return HostHandle<SENSOROBJECT>(g_pDevice->Sensors[Sensor]);
+}
+
+NTSTATUS HostStartSensor(
+    ULONG Sensor)
+{
+    return g_pDevice->Controller.EvtSensorStart(HostSensorHandle(Sensor));
+}
+
+NTSTATUS HostStopSensor(
+    ULONG Sensor)
+{
+    return g_pDevice->Controller.EvtSensorStop(HostSensorHandle(Sensor));
+}
+
+// Reset one simulated amp behind the driver's back, as a supply dip would
+VOID HostResetAmp(
+    ULONG Amp)
+{
+    g_Amps[Amp]->Reset();
+}
+
+NTSTATUS HostIoControl(
+    ULONG Sensor,
+    ULONG IoControlCode,
+    const VOID* pInput,
+    size_t InputLength,
+    VOID* pOutput,
+    size_t OutputLength,
+    size_t* pInformation)
+{
+    return HostIoControlWait(Sensor, IoControlCode, pInput, InputLength, pOutput, OutputLength, pInformation, 0);
+}
+
+NTSTATUS HostIoControlWait(
+    ULONG Sensor,
+    ULONG IoControlCode,
+    const VOID* pInput,
+    size_t InputLength,
+    VOID* pOutput,
+    size_t OutputLength,
+    size_t* pInformation,
+    ULONG TimeoutMs)
+{
+    HostRequest* pRequest = new HostRequest();
+
+    HostInitializeObject(pRequest, nullptr, nullptr);
+    pRequest->pInput = pInput;
+    pRequest->InputLength = InputLength;
+    pRequest->pOutput = pOutput;
+    pRequest->OutputLength = OutputLength;
+
+    NTSTATUS Status = g_pDevice->Controller.EvtSensorDeviceIoControl(HostSensorHandle(Sensor), HostHandle<WDFREQUEST>(pRequest),
+                                                                     OutputLength, InputLength, IoControlCode);
+    for (ULONG Waited = 0; NT_SUCCESS(Status) && !pRequest->Completed && Waited < TimeoutMs; Waited++)
+    {
+        HostRunFor(1);
+    }
+
+    if (!pRequest->Completed)
+    {
+        // Kept by the driver; it completes the request itself
+        return NT_SUCCESS(Status) ? STATUS_PENDING : Status;
+    }
+
+    Status = pRequest->Status;
+    if (nullptr != pInformation)
+    {
+        *pInformation = pRequest->Information;
+    }
+
+    HostDeleteObject(pRequest);
+    return Status;
+}
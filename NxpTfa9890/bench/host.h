@@ -0,0 +1,81 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the harness side of the host framework: what
+//    the benchmark calls to configure the registry, load the driver, add
+//    a device with simulated amps, move it through its power states, send
+//    it IOCTLs and let virtual time pass.
+//
+//    Time only passes on the bus, in Sleep and while the harness runs the
+//    clock, so every run of the same build gives the same results. The
+//    amps share one 400 kHz bus; a transaction costs a fixed overhead plus
+//    nine clocks per byte, its address bytes included.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#pragma once
+
+#include "hostsdk.h"
+
+// Bus cost of one transaction, in 100 ns units
+#define HOST_BUS_OVERHEAD           600         // Controller and resource hub round trip
+#define HOST_BUS_BYTE               225         // 9 clocks at 400 kHz
+
+// Connection ID of the amp at each index of the device's resources
+#define HOST_CONNECTION_ID(n)       (0x0000000100001000ULL + (n))
+
+typedef struct _HOST_BUS_STATISTICS
+{
+    ULONGLONG   Transactions;       // Every transaction, background ones included
+    ULONGLONG   Bytes;
+    ULONGLONG   BusyTime;           // 100 ns units
+    ULONG       DataReady;          // Samples pushed to the sensors
+} HOST_BUS_STATISTICS, *PHOST_BUS_STATISTICS;
+
+// Registry. Names are ASCII and compared without case.
+VOID HostSetDeviceULong(_In_ PCSTR Name, _In_ ULONG Value);
+VOID HostSetDeviceString(_In_ PCSTR Name, _In_ PCSTR Value);
+VOID HostSetParametersString(_In_ PCSTR Name, _In_ PCSTR Value);
+VOID HostSetParametersMultiSz(_In_ PCSTR Name, _In_reads_(Count) const PCSTR* pStrings, _In_ ULONG Count);
+
+// Driver and device
+NTSTATUS HostLoadDriver();
+NTSTATUS HostAddDevice(_In_ ULONG AmpCount);
+NTSTATUS HostD0Entry();
+NTSTATUS HostD0Exit();
+NTSTATUS HostReleaseDevice();
+ULONG HostSensorCount();
+NTSTATUS HostStartSensor(_In_ ULONG Sensor);
+NTSTATUS HostStopSensor(_In_ ULONG Sensor);
+VOID HostResetAmp(_In_ ULONG Amp);
+
+// Send an IOCTL to a sensor and return its completion status, or
+// STATUS_PENDING if the driver kept the request
+NTSTATUS HostIoControl(
+    _In_ ULONG Sensor,
+    _In_ ULONG IoControlCode,
+    _In_reads_bytes_opt_(InputLength) const VOID* pInput,
+    _In_ size_t InputLength,
+    _Out_writes_bytes_opt_(OutputLength) VOID* pOutput,
+    _In_ size_t OutputLength,
+    _Out_opt_ size_t* pInformation);
+
+// Send an IOCTL and, if the driver keeps it, run the clock for up to
+// TimeoutMs until it is completed. Returns STATUS_PENDING if it was not.
+NTSTATUS HostIoControlWait(
+    _In_ ULONG Sensor,
+    _In_ ULONG IoControlCode,
+    _In_reads_bytes_opt_(InputLength) const VOID* pInput,
+    _In_ size_t InputLength,
+    _Out_writes_bytes_opt_(OutputLength) VOID* pOutput,
+    _In_ size_t OutputLength,
+    _Out_opt_ size_t* pInformation,
+    _In_ ULONG TimeoutMs);
+
+// Virtual time
+LONGLONG HostNow();
+VOID HostRunFor(_In_ ULONG Milliseconds);
+VOID HostGetBusStatistics(_Out_ PHOST_BUS_STATISTICS pStatistics);
@@ -0,0 +1,401 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module contains the replay tool. It reads an I2C transaction
+//    trace in the format of Tfa9890Trace.h, as the driver records it on a
+//    device or the benchmark records it with --trace, and drives the
+//    recorded transactions against simulated amps, one per recorded
+//    connection, in the order they were recorded. Failed writes are not
+//    applied.
+//
+//    For every flow bracketed by markers, and for the whole trace, it
+//    reports what was recorded and what the same traffic costs on the
+//    shared bus of the host framework, sent as recorded and with writes
+//    batched: a write to the register that follows the previous write of
+//    the same amp, started within the gap of its end, is merged into that
+//    write's burst up to the chunk size. Transfers through CF_MEM stream
+//    into DSP memory and are never merged.
+//
+//    With --verify every successful read is compared with what the
+//    simulated amps return. The live registers (status, battery,
+//    temperature) and DSP memory change by themselves and are not
+//    compared, so any difference is a write the trace lost or reordered.
+//
+//    Usage: replay <trace> [--chunk <bytes>] [--gap <us>] [--verify]
+//
+//    Returns 0 if the trace replayed, 1 if --verify found a read that
+//    differs from the recording and 2 if the trace could not be read.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "amp.h"
+#include "tfa9890.h"
+#include "Tfa9890Trace.h"
+
+
+#define REPLAY_GAP_US               100
+#define REPLAY_MISMATCHES_SHOWN     8
+
+// Flows the markers bracket, and the traffic outside any of them
+typedef enum
+{
+    ReplayFlowD0Entry = 0,
+    ReplayFlowD0Exit,
+    ReplayFlowRestore,
+    ReplayFlowOther,
+    ReplayFlowAll,
+    ReplayFlowCount
+} REPLAY_FLOW;
+
+static const PCSTR g_FlowNames[ReplayFlowCount] =
+{
+    "d0_entry",
+    "d0_exit",
+    "restore",
+    "other",
+    "all",
+};
+
+typedef struct _REPLAY_TOTALS
+{
+    ULONG       Runs;               // Times the flow was entered
+    ULONG       Writes;
+    ULONG       Reads;
+    ULONG       Failed;             // Transactions recorded with a failure status
+    ULONGLONG   Bytes;              // Payload bytes
+    ULONGLONG   RecordedUs;         // Sum of the recorded durations
+    ULONGLONG   ModelUs;            // Host bus cost, sent as recorded
+    ULONG       Merged;             // Transactions once writes are batched
+    ULONGLONG   MergedUs;           // Host bus cost once writes are batched
+    ULONG       Mismatches;         // Reads that differ from the simulated amps
+} REPLAY_TOTALS, *PREPLAY_TOTALS;
+
+// The write of one amp that the next one may be merged into
+typedef struct _REPLAY_BURST
+{
+    bool        Open;
+    BYTE        NextRegister;       // Register a continuation starts at
+    ULONG       Length;             // Payload bytes in the burst
+    ULONGLONG   EndUs;              // Recorded end of the last write merged
+    REPLAY_FLOW Flow;
+} REPLAY_BURST, *PREPLAY_BURST;
+
+// Host bus cost of one transaction in microseconds: the address and
+// register bytes, a read's repeated address, and the payload
+inline ULONGLONG ReplayCostUs(
+    _In_ bool Read,
+    _In_ ULONG Length)
+{
+    return (HOST_BUS_OVERHEAD + HOST_BUS_BYTE * ((Read ? 3 : 2) + static_cast<ULONGLONG>(Length))) / 10;
+}
+
+// A read that covers a register the amp changes by itself
+inline bool ReplayIsLive(
+    _In_ BYTE Register)
+{
+    return TFA9890_CF_MEM == Register || Register <= TFA9890_TEMPERATURE;
+}
+
+static bool ReplayLoad(
+    _In_ PCSTR pPath,
+    _Out_ std::vector<BYTE>* pTrace)
+{
+    FILE* pFile = fopen(pPath, "rb");
+    if (nullptr == pFile)
+    {
+        fprintf(stderr, "replay: cannot open %s\n", pPath);
+        return false;
+    }
+
+    BYTE Buffer[4096];
+    size_t Read;
+    while (0 != (Read = fread(Buffer, 1, sizeof(Buffer), pFile)))
+    {
+        pTrace->insert(pTrace->end(), Buffer, Buffer + Read);
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+// Close an amp's burst and charge it to the flow it was started in
+static VOID ReplayCloseBurst(
+    _Inout_ PREPLAY_BURST pBurst,
+    _Inout_updates_(ReplayFlowCount) PREPLAY_TOTALS pTotals)
+{
+    if (!pBurst->Open)
+    {
+        return;
+    }
+
+    ULONGLONG CostUs = ReplayCostUs(false, pBurst->Length);
+
+    pTotals[pBurst->Flow].Merged++;
+    pTotals[pBurst->Flow].MergedUs += CostUs;
+    pTotals[ReplayFlowAll].Merged++;
+    pTotals[ReplayFlowAll].MergedUs += CostUs;
+    pBurst->Open = false;
+}
+
+int main(
+    int argc,
+    char** argv)
+{
+    PCSTR pPath = nullptr;
+    ULONG ChunkBytes = TFA9890_BULK_CHUNK_BYTES;
+    ULONG GapUs = REPLAY_GAP_US;
+    bool Verify = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string Option(argv[i]);
+
+        if ("--verify" == Option)
+        {
+            Verify = true;
+        }
+        else if ("--chunk" == Option && i + 1 < argc)
+        {
+            ChunkBytes = static_cast<ULONG>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if ("--gap" == Option && i + 1 < argc)
+        {
+            GapUs = static_cast<ULONG>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if ('-' != argv[i][0] && nullptr == pPath)
+        {
+            pPath = argv[i];
+        }
+        else
+        {
+            pPath = nullptr;
+            break;
+        }
+    }
+
+    if (nullptr == pPath || 0 == ChunkBytes)
+    {
+        fprintf(stderr, "usage: replay <trace> [--chunk <bytes>] [--gap <us>] [--verify]\n");
+        return 2;
+    }
+
+    std::vector<BYTE> Trace;
+    if (!ReplayLoad(pPath, &Trace))
+    {
+        return 2;
+    }
+
+    TFA9890_TRACE_HEADER Header = {};
+    if (Trace.size() < sizeof(Header))
+    {
+        fprintf(stderr, "replay: %s is too short for a trace\n", pPath);
+        return 2;
+    }
+    memcpy(&Header, Trace.data(), sizeof(Header));
+
+    if (TFA9890_TRACE_MAGIC != Header.Magic ||
+        TFA9890_TRACE_VERSION != Header.Version ||
+        Header.HeaderBytes < sizeof(Header) ||
+        Header.HeaderBytes > Trace.size() ||
+        0 == Header.AmpCount ||
+        Header.AmpCount > TFA9890_TRACE_MAX_AMPS)
+    {
+        fprintf(stderr, "replay: %s is not a version %u trace\n", pPath, TFA9890_TRACE_VERSION);
+        return 2;
+    }
+
+    std::vector<SimTfa9890> Amps(Header.AmpCount);
+    std::vector<REPLAY_BURST> Bursts(Header.AmpCount);
+    REPLAY_TOTALS Totals[ReplayFlowCount] = {};
+    REPLAY_FLOW Flow = ReplayFlowOther;
+    ULONG Records = 0;
+    size_t Offset = Header.HeaderBytes;
+
+    while (Offset < Trace.size())
+    {
+        TFA9890_TRACE_RECORD Record;
+
+        if (Trace.size() - Offset < sizeof(Record))
+        {
+            fprintf(stderr, "replay: record %u is cut off\n", Records);
+            return 2;
+        }
+        memcpy(&Record, &Trace[Offset], sizeof(Record));
+        Offset += sizeof(Record);
+
+        if (Trace.size() - Offset < Record.Length)
+        {
+            fprintf(stderr, "replay: payload of record %u is cut off\n", Records);
+            return 2;
+        }
+        const BYTE* pPayload = &Trace[Offset];
+        Offset += Record.Length;
+        Records++;
+
+        if (0 != (Record.Flags & TFA9890_TRACE_FLAG_MARKER))
+        {
+            switch (Record.Register)
+            {
+                case TFA9890_TRACE_MARKER_D0_ENTRY:
+                    Flow = ReplayFlowD0Entry;
+                    break;
+                case TFA9890_TRACE_MARKER_D0_EXIT:
+                    Flow = ReplayFlowD0Exit;
+                    break;
+                case TFA9890_TRACE_MARKER_RESTORE:
+                    Flow = ReplayFlowRestore;
+                    break;
+                default:
+                    Flow = ReplayFlowOther;
+                    break;
+            }
+
+            if (ReplayFlowOther != Flow)
+            {
+                Totals[Flow].Runs++;
+                Totals[ReplayFlowAll].Runs++;
+            }
+            continue;
+        }
+
+        if (Record.Amp >= Header.AmpCount)
+        {
+            fprintf(stderr, "replay: record %u names amp %u of %u\n", Records, Record.Amp, Header.AmpCount);
+            return 2;
+        }
+
+        bool Read = (0 != (Record.Flags & TFA9890_TRACE_FLAG_READ));
+        bool Succeeded = NT_SUCCESS(Record.Status);
+        LONGLONG Now = static_cast<LONGLONG>(Record.TimeUs) * 10;
+        PREPLAY_BURST pBurst = &Bursts[Record.Amp];
+        PREPLAY_TOTALS pFlows[2] = { &Totals[Flow], &Totals[ReplayFlowAll] };
+        bool Mismatch = false;
+
+        if (Read && Succeeded && 0 != Record.Length)
+        {
+            std::vector<BYTE> Data(Record.Length);
+
+            Amps[Record.Amp].Read(Record.Register, Data.data(), Record.Length, Now);
+            if (!ReplayIsLive(Record.Register) && 0 != memcmp(Data.data(), pPayload, Record.Length))
+            {
+                Mismatch = true;
+                if (Totals[ReplayFlowAll].Mismatches < REPLAY_MISMATCHES_SHOWN)
+                {
+                    printf("record %u: amp %u read of %u bytes from 0x%02x at %llu us differs from the recording\n",
+                           Records, Record.Amp, Record.Length, Record.Register, static_cast<unsigned long long>(Record.TimeUs));
+                }
+            }
+        }
+        else if (!Read && Succeeded)
+        {
+            std::vector<BYTE> Transfer(1 + Record.Length);
+
+            Transfer[0] = Record.Register;
+            memcpy(&Transfer[1], pPayload, Record.Length);
+            Amps[Record.Amp].Write(Transfer.data(), static_cast<ULONG>(Transfer.size()), Now);
+        }
+
+        for (ULONG i = 0; i < _countof(pFlows); i++)
+        {
+            PREPLAY_TOTALS pTotals = pFlows[i];
+
+            if (Read)
+            {
+                pTotals->Reads++;
+            }
+            else
+            {
+                pTotals->Writes++;
+            }
+            pTotals->Failed += Succeeded ? 0 : 1;
+            pTotals->Mismatches += Mismatch ? 1 : 0;
+            pTotals->Bytes += Record.Length;
+            pTotals->RecordedUs += Record.DurationUs;
+            pTotals->ModelUs += ReplayCostUs(Read, Record.Length);
+        }
+
+        // Batched writes: a read, a failure, a stream or a gap ends the
+        // amp's burst; a continuation that fits extends it
+        bool Mergeable = !Read && Succeeded && TFA9890_CF_MEM != Record.Register && 0 == Record.Length % sizeof(WORD);
+
+        if (pBurst->Open && Mergeable &&
+            Flow == pBurst->Flow &&
+            Record.Register == pBurst->NextRegister &&
+            Record.TimeUs <= pBurst->EndUs + GapUs &&
+            pBurst->Length + Record.Length <= ChunkBytes &&
+            !(Record.Register <= TFA9890_CF_CONTROLS && Record.Register + Record.Length / sizeof(WORD) > TFA9890_CF_MEM))
+        {
+            pBurst->NextRegister = static_cast<BYTE>(Record.Register + Record.Length / sizeof(WORD));
+            pBurst->Length += Record.Length;
+            pBurst->EndUs = Record.TimeUs + Record.DurationUs;
+            continue;
+        }
+
+        ReplayCloseBurst(pBurst, Totals);
+
+        if (Mergeable)
+        {
+            pBurst->Open = true;
+            pBurst->NextRegister = static_cast<BYTE>(Record.Register + Record.Length / sizeof(WORD));
+            pBurst->Length = Record.Length;
+            pBurst->EndUs = Record.TimeUs + Record.DurationUs;
+            pBurst->Flow = Flow;
+        }
+        else
+        {
+            ULONGLONG CostUs = ReplayCostUs(Read, Record.Length);
+
+            for (ULONG i = 0; i < _countof(pFlows); i++)
+            {
+                pFlows[i]->Merged++;
+                pFlows[i]->MergedUs += CostUs;
+            }
+        }
+    }
+
+    for (ULONG Amp = 0; Amp < Header.AmpCount; Amp++)
+    {
+        ReplayCloseBurst(&Bursts[Amp], Totals);
+    }
+
+    printf("%u records of %u amps, chunk %u bytes, gap %u us\n", Records, Header.AmpCount, ChunkBytes, GapUs);
+    printf("%-10s %5s %7s %7s %7s %9s %12s %10s %9s %10s %10s\n",
+           "flow", "runs", "writes", "reads", "failed", "bytes", "recorded_us", "model_us", "batched", "batch_us", "mismatches");
+
+    for (ULONG i = 0; i < ReplayFlowCount; i++)
+    {
+        const REPLAY_TOTALS* pTotals = &Totals[i];
+
+        if (0 == pTotals->Runs + pTotals->Writes + pTotals->Reads && ReplayFlowAll != i)
+        {
+            continue;
+        }
+
+        printf("%-10s %5u %7u %7u %7u %9llu %12llu %10llu %9u %10llu %10u\n",
+               g_FlowNames[i], pTotals->Runs, pTotals->Writes, pTotals->Reads, pTotals->Failed,
+               static_cast<unsigned long long>(pTotals->Bytes),
+               static_cast<unsigned long long>(pTotals->RecordedUs),
+               static_cast<unsigned long long>(pTotals->ModelUs),
+               pTotals->Merged,
+               static_cast<unsigned long long>(pTotals->MergedUs),
+               pTotals->Mismatches);
+    }
+
+    if (Verify && 0 != Totals[ReplayFlowAll].Mismatches)
+    {
+        printf("%u reads differ from the recording\n", Totals[ReplayFlowAll].Mismatches);
+        return 1;
+    }
+
+    return 0;
+}
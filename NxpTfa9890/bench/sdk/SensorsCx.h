@@ -0,0 +1,3 @@
+// Host build stand-in for the SDK header of the same name; see hostsdk.h
+#pragma once
+#include "hostsdk.h"
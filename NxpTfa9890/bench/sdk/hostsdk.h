@@ -0,0 +1,954 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//    This module declares the subset of the Windows, UMDF, SensorsCx and
+//    resource hub interfaces the driver uses, for building the driver on a
+//    host without the WDK. The framework behind them is host.cpp: a single
+//    thread on a virtual clock, with timers, work items and I/O completions
+//    dispatched from an event queue, and the amps' I2C connections served
+//    by the simulated TFA9890s of amp.cpp.
+//
+//    The build must use 16-bit wchar_t (-fshort-wchar), as the driver's
+//    wide strings and structures assume it.
+//
+//Environment:
+//
+//    Host benchmark build
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+static_assert(sizeof(wchar_t) == 2, "the driver needs a 16-bit wchar_t, build with -fshort-wchar");
+
+// SAL annotations
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+#define _Out_opt_
+#define _Inout_opt_
+#define _Outptr_
+#define _In_reads_(x)
+#define _In_reads_opt_(x)
+#define _In_reads_bytes_(x)
+#define _In_reads_bytes_opt_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_opt_(x)
+#define _Out_writes_bytes_to_(x, y)
+#define _Out_writes_to_(x, y)
+#define _Inout_updates_(x)
+#define _Inout_updates_bytes_(x)
+#define _Must_inspect_result_
+#define _IRQL_requires_max_(x)
+#define _Use_decl_annotations_
+#define _Analysis_assume_(x)
+
+#define UNREFERENCED_PARAMETER(x)           (void)(x)
+#define WDF_EXTERN_C_START                  extern "C" {
+#define WDF_EXTERN_C_END                    }
+#define CALLBACK
+#define FORCEINLINE                         inline
+#define DECLSPEC_ALIGN(x)                   alignas(x)
+
+// Basic types, with the sizes of the Windows LLP64 model
+typedef unsigned char       BYTE, UCHAR, *PUCHAR, BOOLEAN, *PBYTE;
+typedef unsigned short      WORD, USHORT, *PUSHORT;
+typedef wchar_t             WCHAR, *PWCHAR, *PWSTR;
+typedef const WCHAR*        PCWSTR;
+typedef unsigned int        ULONG, DWORD, UINT, UINT32, *PULONG, *PDWORD;
+typedef int                 LONG, INT, BOOL, INT32;
+typedef long long           LONGLONG, LONG64, INT64, *PLONGLONG;
+typedef unsigned long long  ULONGLONG, ULONG64, UINT64, DWORD64;
+typedef size_t              SIZE_T, ULONG_PTR;
+typedef ptrdiff_t           LONG_PTR;
+typedef void                VOID, *PVOID, *HANDLE, *LPVOID;
+typedef const void          *PCVOID, *LPCVOID;
+typedef char                CHAR, *PCHAR;
+typedef const char*         PCSTR;
+typedef float               FLOAT;
+typedef double              DOUBLE;
+typedef LONG                NTSTATUS;
+
+#define TRUE                                1
+#define FALSE                               0
+
+#define NT_SUCCESS(s)                       ((NTSTATUS)(s) >= 0)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000)
+#define STATUS_TIMEOUT                      ((NTSTATUS)0x00000102)
+#define STATUS_PENDING                      ((NTSTATUS)0x00000103)
+#define STATUS_BUFFER_OVERFLOW              ((NTSTATUS)0x80000005)
+#define STATUS_DEVICE_BUSY                  ((NTSTATUS)0x80000011)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001A)
+#define STATUS_UNSUCCESSFUL                 ((NTSTATUS)0xC0000001)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000D)
+#define STATUS_INVALID_DEVICE_REQUEST       ((NTSTATUS)0xC0000010)
+#define STATUS_END_OF_FILE                  ((NTSTATUS)0xC0000011)
+#define STATUS_NO_MEMORY                    ((NTSTATUS)0xC0000017)
+#define STATUS_ACCESS_DENIED                ((NTSTATUS)0xC0000022)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023)
+#define STATUS_OBJECT_NAME_NOT_FOUND        ((NTSTATUS)0xC0000034)
+#define STATUS_DATA_ERROR                   ((NTSTATUS)0xC000003E)
+#define STATUS_CRC_ERROR                    ((NTSTATUS)0xC000003F)
+#define STATUS_QUOTA_EXCEEDED               ((NTSTATUS)0xC0000044)
+#define STATUS_INVALID_IMAGE_FORMAT         ((NTSTATUS)0xC000007B)
+#define STATUS_INTEGER_OVERFLOW             ((NTSTATUS)0xC0000095)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009A)
+#define STATUS_DEVICE_DATA_ERROR            ((NTSTATUS)0xC000009C)
+#define STATUS_DEVICE_NOT_READY             ((NTSTATUS)0xC00000A3)
+#define STATUS_IO_TIMEOUT                   ((NTSTATUS)0xC00000B5)
+#define STATUS_NOT_SUPPORTED                ((NTSTATUS)0xC00000BB)
+#define STATUS_CANCELLED                    ((NTSTATUS)0xC0000120)
+#define STATUS_INVALID_DEVICE_STATE         ((NTSTATUS)0xC0000184)
+#define STATUS_DEVICE_PROTOCOL_ERROR        ((NTSTATUS)0xC0000186)
+#define STATUS_INVALID_BUFFER_SIZE          ((NTSTATUS)0xC0000206)
+#define STATUS_NOT_FOUND                    ((NTSTATUS)0xC0000225)
+#define STATUS_RETRY                        ((NTSTATUS)0xC000022D)
+#define STATUS_DEVICE_POWERED_OFF           ((NTSTATUS)0xC000028F)
+
+#define ERROR_FILE_NOT_FOUND                2
+#define ERROR_ACCESS_DENIED                 5
+#define ERROR_WRITE_FAULT                   29
+#define ERROR_READ_FAULT                    30
+#define ERROR_TIMEOUT                       1460
+#define HRESULT_FROM_WIN32(x)               ((LONG)(x))
+#define NTSTATUS_FROM_WIN32(x)              ((NTSTATUS)(x))
+
+#define _countof(a)                         (sizeof(a) / sizeof((a)[0]))
+#ifndef min
+#define min(a, b)                           (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                           (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(d, n)                 memset((d), 0, (n))
+#define RtlCopyMemory(d, s, n)              memcpy((d), (s), (n))
+#define RtlMoveMemory(d, s, n)              memmove((d), (s), (n))
+#define RtlFillMemory(d, n, v)              memset((d), (v), (n))
+#define ZeroMemory                          RtlZeroMemory
+#define CopyMemory                          RtlCopyMemory
+#define FIELD_OFFSET(t, f)                  offsetof(t, f)
+#define ARGUMENT_PRESENT(x)                 ((x) != NULL)
+#define C_ASSERT(e)                         static_assert(e, #e)
+
+// Bytes of the two buffers that match, from the start
+inline SIZE_T RtlCompareMemory(const void* pA, const void* pB, SIZE_T Length)
+{
+    SIZE_T i = 0;
+    while (i < Length && static_cast<const BYTE*>(pA)[i] == static_cast<const BYTE*>(pB)[i])
+    {
+        i++;
+    }
+    return i;
+}
+
+#define INFINITE                            0xFFFFFFFF
+#define MAXBYTE                             0xFF
+#define MAXUSHORT                           0xFFFF
+#define MAXULONG                            0xFFFFFFFFu
+#define MAXLONGLONG                         0x7FFFFFFFFFFFFFFFLL
+#define MAXULONGLONG                        0xFFFFFFFFFFFFFFFFULL
+
+// Interlocked operations and ordered accesses
+inline LONG InterlockedIncrement(volatile LONG* p)                  { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedDecrement(volatile LONG* p)                  { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchange(volatile LONG* p, LONG v)           { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG v)        { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG v, LONG c)
+{
+    __atomic_compare_exchange_n(p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG* p)        { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* p, LONGLONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+inline LONG ReadAcquire(const volatile LONG* p)                     { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline LONGLONG ReadAcquire64(const volatile LONGLONG* p)           { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline LONGLONG ReadNoFence64(const volatile LONGLONG* p)           { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+inline void WriteRelease(volatile LONG* p, LONG v)                  { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+inline void WriteRelease64(volatile LONGLONG* p, LONGLONG v)        { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+#define MemoryBarrier()                     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define _ReadWriteBarrier()                 __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        ULONG   LowPart;
+        LONG    HighPart;
+    };
+    LONGLONG    QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+    ULONG   Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    BYTE    Data4[8];
+} GUID, CLSID;
+
+#define DEFINE_GUID(n, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    const GUID n = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+inline bool IsEqualGUID(const GUID& a, const GUID& b)
+{
+    return 0 == memcmp(&a, &b, sizeof(GUID));
+}
+
+typedef struct _FILETIME
+{
+    DWORD   dwLowDateTime;
+    DWORD   dwHighDateTime;
+} FILETIME;
+
+// Strings
+typedef struct _UNICODE_STRING
+{
+    USHORT  Length;             // Bytes, without a terminator
+    USHORT  MaximumLength;      // Bytes
+    PWSTR   Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(n, s) \
+    const UNICODE_STRING n = { sizeof(s) - sizeof(WCHAR), sizeof(s), const_cast<PWSTR>(s) }
+#define DECLARE_UNICODE_STRING_SIZE(n, s) \
+    WCHAR n##_buffer[s]; UNICODE_STRING n = { 0, (s) * sizeof(WCHAR), n##_buffer }
+
+// glibc's wide string functions assume a 32-bit wchar_t
+#define wcslen                              HostWcslen
+#define _wcsnicmp                           HostWcsnicmp
+size_t wcslen(const WCHAR* s);
+int _wcsnicmp(const WCHAR* a, const WCHAR* b, size_t Count);
+
+#define CSTR_LESS_THAN                      1
+#define CSTR_EQUAL                          2
+#define CSTR_GREATER_THAN                   3
+int CompareStringOrdinal(PCWSTR a, int aLength, PCWSTR b, int bLength, BOOL IgnoreCase);
+
+VOID RtlInitUnicodeString(PUNICODE_STRING pString, PCWSTR Source);
+NTSTATUS StringCchCopyW(PWSTR pDest, size_t DestChars, PCWSTR pSource);
+NTSTATUS StringCbPrintfW(PWSTR pDest, size_t DestBytes, PCWSTR pFormat, ...);
+
+// Resource hub
+#define RESOURCE_HUB_DEVICE_NAME            L"\\\\.\\RESOURCE_HUB"
+#define RESOURCE_HUB_PATH_CHARS             (_countof(RESOURCE_HUB_DEVICE_NAME) + 1 + 16)
+#define RESOURCE_HUB_PATH_SIZE              (RESOURCE_HUB_PATH_CHARS * sizeof(WCHAR))
+
+// Tracing. WPP is not run on the host; the trace calls compile away.
+#define DPFLTR_ERROR_LEVEL                  0
+void DbgPrintEx(ULONG ComponentId, ULONG Level, PCSTR pFormat, ...);
+#define WPP_INIT_TRACING(a, b)              ((void)0)
+#define WPP_CLEANUP(a)                      ((void)0)
+#define TraceError(...)                     ((void)0)
+#define TraceWarning(...)                   ((void)0)
+#define TraceInformation(...)               ((void)0)
+#define TraceVerbose(...)                   ((void)0)
+#define TraceData(...)                      ((void)0)
+#define TraceDriverStatus(...)              ((void)0)
+#define TracePerformance(...)               ((void)0)
+#define SENSOR_FunctionEnter(...)           ((void)0)
+#define SENSOR_FunctionExit(...)            ((void)0)
+
+// Time, on the host's virtual clock
+BOOL QueryPerformanceCounter(LARGE_INTEGER* pCounter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* pFrequency);
+VOID Sleep(DWORD Milliseconds);
+VOID GetSystemTimePreciseAsFileTime(FILETIME* pTime);
+
+// Slim reader/writer locks and condition variables
+typedef struct _SRWLOCK
+{
+    LONG    Readers;
+    LONG    Writer;
+} SRWLOCK, *PSRWLOCK;
+
+typedef struct _CONDITION_VARIABLE
+{
+    PVOID   Reserved;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+VOID InitializeSRWLock(PSRWLOCK pLock);
+VOID AcquireSRWLockExclusive(PSRWLOCK pLock);
+VOID ReleaseSRWLockExclusive(PSRWLOCK pLock);
+VOID AcquireSRWLockShared(PSRWLOCK pLock);
+VOID ReleaseSRWLockShared(PSRWLOCK pLock);
+VOID InitializeConditionVariable(PCONDITION_VARIABLE pCondition);
+BOOL SleepConditionVariableSRW(PCONDITION_VARIABLE pCondition, PSRWLOCK pLock, DWORD Milliseconds, ULONG Flags);
+VOID WakeAllConditionVariable(PCONDITION_VARIABLE pCondition);
+
+// Files, sections and processes
+#define INVALID_HANDLE_VALUE                ((HANDLE)(LONG_PTR)-1)
+#define MAX_PATH                            260
+#define GENERIC_READ                        0x80000000
+#define GENERIC_WRITE                       0x40000000
+#define FILE_SHARE_READ                     0x00000001
+#define CREATE_ALWAYS                       2
+#define OPEN_EXISTING                       3
+#define OPEN_ALWAYS                         4
+#define FILE_ATTRIBUTE_NORMAL               0x00000080
+#define FILE_BEGIN                          0
+#define FILE_END                            2
+#define PAGE_READWRITE                      0x04
+#define FILE_MAP_WRITE                      0x0002
+#define FILE_MAP_READ                       0x0004
+#define FILE_MAP_ALL_ACCESS                 0x000F001F
+#define PROCESS_DUP_HANDLE                  0x0040
+#define DUPLICATE_SAME_ACCESS               0x00000002
+
+DWORD GetLastError();
+HANDLE GetCurrentProcess();
+HANDLE OpenProcess(DWORD Access, BOOL Inherit, DWORD ProcessId);
+BOOL DuplicateHandle(HANDLE SourceProcess, HANDLE Source, HANDLE TargetProcess, HANDLE* pTarget, DWORD Access, BOOL Inherit, DWORD Options);
+BOOL CloseHandle(HANDLE Handle);
+HANDLE CreateFileW(PCWSTR Path, DWORD Access, DWORD Share, PVOID Security, DWORD Disposition, DWORD Flags, HANDLE Template);
+BOOL ReadFile(HANDLE File, LPVOID pBuffer, DWORD Bytes, DWORD* pRead, PVOID pOverlapped);
+BOOL WriteFile(HANDLE File, LPCVOID pBuffer, DWORD Bytes, DWORD* pWritten, PVOID pOverlapped);
+BOOL SetFilePointerEx(HANDLE File, LARGE_INTEGER Distance, PLARGE_INTEGER pNewPosition, DWORD Method);
+BOOL GetFileSizeEx(HANDLE File, PLARGE_INTEGER pSize);
+BOOL SetEndOfFile(HANDLE File);
+HANDLE CreateFileMappingW(HANDLE File, PVOID Security, DWORD Protect, DWORD SizeHigh, DWORD SizeLow, PCWSTR Name);
+#define CreateFileMapping                   CreateFileMappingW
+PVOID MapViewOfFile(HANDLE Mapping, DWORD Access, DWORD OffsetHigh, DWORD OffsetLow, SIZE_T Bytes);
+BOOL UnmapViewOfFile(LPCVOID pView);
+
+// I/O control codes
+#define CTL_CODE(t, f, m, a)                (((t) << 16) | ((a) << 14) | ((f) << 2) | (m))
+#define METHOD_BUFFERED                     0
+#define METHOD_IN_DIRECT                    1
+#define METHOD_OUT_DIRECT                   2
+#define FILE_ANY_ACCESS                     0
+#define FILE_READ_ACCESS                    1
+#define FILE_WRITE_ACCESS                   2
+#define FILE_DEVICE_UNKNOWN                 0x00000022
+#define FILE_ALL_ACCESS                     0x001F01FF
+
+// Framework handles
+#define DECLARE_HOST_HANDLE(n)              struct n##__; typedef struct n##__* n;
+DECLARE_HOST_HANDLE(WDFDRIVER)
+DECLARE_HOST_HANDLE(WDFDEVICE)
+DECLARE_HOST_HANDLE(WDFIOTARGET)
+DECLARE_HOST_HANDLE(WDFWAITLOCK)
+DECLARE_HOST_HANDLE(WDFINTERRUPT)
+DECLARE_HOST_HANDLE(WDFCMRESLIST)
+DECLARE_HOST_HANDLE(WDFMEMORY)
+DECLARE_HOST_HANDLE(WDFREQUEST)
+DECLARE_HOST_HANDLE(WDFTIMER)
+DECLARE_HOST_HANDLE(WDFWORKITEM)
+DECLARE_HOST_HANDLE(WDFKEY)
+DECLARE_HOST_HANDLE(WDFQUEUE)
+DECLARE_HOST_HANDLE(WDFFILEOBJECT)
+DECLARE_HOST_HANDLE(SENSOROBJECT)
+typedef void* WDFOBJECT;
+typedef void* WDFCONTEXT;
+typedef struct _WDFDEVICE_INIT* PWDFDEVICE_INIT;
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+
+#define WDF_NO_OBJECT_ATTRIBUTES            NULL
+#define WDF_NO_HANDLE                       NULL
+#define WDF_NO_SEND_OPTIONS                 NULL
+
+typedef enum _WDF_TRI_STATE
+{
+    WdfFalse = 0,
+    WdfTrue,
+    WdfUseDefault
+} WDF_TRI_STATE;
+
+typedef enum _POOL_TYPE
+{
+    NonPagedPool = 0,
+    PagedPool,
+    NonPagedPoolNx
+} POOL_TYPE;
+
+typedef enum _WDF_POWER_DEVICE_STATE
+{
+    WdfPowerDeviceInvalid = 0,
+    WdfPowerDeviceD0,
+    WdfPowerDeviceD1,
+    WdfPowerDeviceD2,
+    WdfPowerDeviceD3,
+    WdfPowerDeviceD3Final,
+    WdfPowerDevicePrepareForHibernation
+} WDF_POWER_DEVICE_STATE;
+
+typedef enum _WDF_EXECUTION_LEVEL
+{
+    WdfExecutionLevelInvalid = 0,
+    WdfExecutionLevelInheritFromParent,
+    WdfExecutionLevelPassive
+} WDF_EXECUTION_LEVEL;
+
+typedef enum _WDF_SYNCHRONIZATION_SCOPE
+{
+    WdfSynchronizationScopeInvalid = 0,
+    WdfSynchronizationScopeInheritFromParent,
+    WdfSynchronizationScopeNone
+} WDF_SYNCHRONIZATION_SCOPE;
+
+// Object attributes and typed contexts. A context type is identified by
+// the address of its type info, one per type for the whole program.
+typedef struct _WDF_OBJECT_CONTEXT_TYPE_INFO
+{
+    PCSTR   ContextName;
+    size_t  ContextSize;
+} WDF_OBJECT_CONTEXT_TYPE_INFO, *PWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef VOID EVT_WDF_OBJECT_CONTEXT_CLEANUP(WDFOBJECT Object);
+typedef EVT_WDF_OBJECT_CONTEXT_CLEANUP* PFN_WDF_OBJECT_CONTEXT_CLEANUP;
+typedef VOID EVT_WDF_OBJECT_CONTEXT_DESTROY(WDFOBJECT Object);
+typedef EVT_WDF_OBJECT_CONTEXT_DESTROY* PFN_WDF_OBJECT_CONTEXT_DESTROY;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES
+{
+    ULONG                                   Size;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP          EvtCleanupCallback;
+    PFN_WDF_OBJECT_CONTEXT_DESTROY          EvtDestroyCallback;
+    WDF_EXECUTION_LEVEL                     ExecutionLevel;
+    WDF_SYNCHRONIZATION_SCOPE               SynchronizationScope;
+    WDFOBJECT                               ParentObject;
+    size_t                                  ContextSizeOverride;
+    const WDF_OBJECT_CONTEXT_TYPE_INFO*     ContextTypeInfo;
+} WDF_OBJECT_ATTRIBUTES, *PWDF_OBJECT_ATTRIBUTES;
+
+inline VOID WDF_OBJECT_ATTRIBUTES_INIT(PWDF_OBJECT_ATTRIBUTES pAttributes)
+{
+    RtlZeroMemory(pAttributes, sizeof(*pAttributes));
+    pAttributes->Size = sizeof(*pAttributes);
+    pAttributes->ExecutionLevel = WdfExecutionLevelInheritFromParent;
+    pAttributes->SynchronizationScope = WdfSynchronizationScopeInheritFromParent;
+}
+
+PVOID HostObjectGetTypedContext(WDFOBJECT Handle, const WDF_OBJECT_CONTEXT_TYPE_INFO* pTypeInfo);
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(t, f)                                    \
+    inline const WDF_OBJECT_CONTEXT_TYPE_INFO* HostContextTypeInfo_##t()            \
+    {                                                                               \
+        static const WDF_OBJECT_CONTEXT_TYPE_INFO Info = { #t, sizeof(t) };         \
+        return &Info;                                                               \
+    }                                                                               \
+    inline t* f(WDFOBJECT Handle)                                                   \
+    {                                                                               \
+        return static_cast<t*>(HostObjectGetTypedContext(Handle, HostContextTypeInfo_##t())); \
+    }
+#define WDF_DECLARE_CONTEXT_TYPE(t)         WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(t, WdfObjectGet_##t)
+#define WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(a, t) \
+    ((a)->ContextTypeInfo = HostContextTypeInfo_##t())
+#define WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(a, t) \
+    (WDF_OBJECT_ATTRIBUTES_INIT(a), WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(a, t))
+
+VOID WdfObjectDelete(WDFOBJECT Object);
+
+// Relative timeouts are negative, in 100 ns units
+#define WDF_TIMEOUT_TO_SEC                  ((LONGLONG)10000000)
+#define WDF_REL_TIMEOUT_IN_MS(ms)           (-(LONGLONG)(ms) * 10000)
+#define WDF_REL_TIMEOUT_IN_US(us)           (-(LONGLONG)(us) * 10)
+
+// Driver
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef VOID EVT_WDF_DRIVER_UNLOAD(WDFDRIVER Driver);
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PWDFDEVICE_INIT DeviceInit);
+
+typedef struct _WDF_DRIVER_CONFIG
+{
+    ULONG                           Size;
+    EVT_WDF_DRIVER_DEVICE_ADD*      EvtDriverDeviceAdd;
+    EVT_WDF_DRIVER_UNLOAD*          EvtDriverUnload;
+    ULONG                           DriverInitFlags;
+    ULONG                           DriverPoolTag;
+} WDF_DRIVER_CONFIG, *PWDF_DRIVER_CONFIG;
+
+inline VOID WDF_DRIVER_CONFIG_INIT(PWDF_DRIVER_CONFIG pConfig, EVT_WDF_DRIVER_DEVICE_ADD* EvtDriverDeviceAdd)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+    pConfig->EvtDriverDeviceAdd = EvtDriverDeviceAdd;
+}
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath, PWDF_OBJECT_ATTRIBUTES pAttributes,
+                         PWDF_DRIVER_CONFIG pConfig, WDFDRIVER* pDriver);
+WDFDRIVER WdfGetDriver();
+PDRIVER_OBJECT WdfDriverWdmGetDriverObject(WDFDRIVER Driver);
+
+// Registry
+#define KEY_READ                            0x00020019
+#define KEY_WRITE                           0x00020006
+#define PLUGPLAY_REGKEY_DEVICE              1
+#define PLUGPLAY_REGKEY_DRIVER              2
+#define REG_SZ                              1
+#define REG_BINARY                          3
+#define REG_DWORD                           4
+#define REG_MULTI_SZ                        7
+
+NTSTATUS WdfDriverOpenParametersRegistryKey(WDFDRIVER Driver, ULONG Access, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFKEY* pKey);
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE Device, ULONG KeyType, ULONG Access, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFKEY* pKey);
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG pValue);
+NTSTATUS WdfRegistryQueryValue(WDFKEY Key, PCUNICODE_STRING ValueName, ULONG ValueLength, PVOID pValue,
+                               PULONG pValueLengthQueried, PULONG pValueType);
+NTSTATUS WdfRegistryQueryUnicodeString(WDFKEY Key, PCUNICODE_STRING ValueName, PUSHORT pValueByteLength, PUNICODE_STRING pValue);
+VOID WdfRegistryClose(WDFKEY Key);
+
+// Device
+typedef NTSTATUS EVT_WDF_DEVICE_PREPARE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesRaw, WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_RELEASE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesTranslated);
+typedef NTSTATUS EVT_WDF_DEVICE_D0_ENTRY(WDFDEVICE Device, WDF_POWER_DEVICE_STATE PreviousState);
+typedef NTSTATUS EVT_WDF_DEVICE_D0_EXIT(WDFDEVICE Device, WDF_POWER_DEVICE_STATE TargetState);
+
+typedef struct _WDF_PNPPOWER_EVENT_CALLBACKS
+{
+    ULONG                               Size;
+    EVT_WDF_DEVICE_PREPARE_HARDWARE*    EvtDevicePrepareHardware;
+    EVT_WDF_DEVICE_RELEASE_HARDWARE*    EvtDeviceReleaseHardware;
+    EVT_WDF_DEVICE_D0_ENTRY*            EvtDeviceD0Entry;
+    EVT_WDF_DEVICE_D0_EXIT*             EvtDeviceD0Exit;
+} WDF_PNPPOWER_EVENT_CALLBACKS, *PWDF_PNPPOWER_EVENT_CALLBACKS;
+
+inline VOID WDF_PNPPOWER_EVENT_CALLBACKS_INIT(PWDF_PNPPOWER_EVENT_CALLBACKS pCallbacks)
+{
+    RtlZeroMemory(pCallbacks, sizeof(*pCallbacks));
+    pCallbacks->Size = sizeof(*pCallbacks);
+}
+
+typedef enum _WDF_DEVICE_IO_TYPE
+{
+    WdfDeviceIoUndefined = 0,
+    WdfDeviceIoNeither,
+    WdfDeviceIoBuffered,
+    WdfDeviceIoDirect,
+    WdfDeviceIoBufferedOrDirect
+} WDF_DEVICE_IO_TYPE;
+
+typedef struct _WDF_IO_TYPE_CONFIG
+{
+    ULONG               Size;
+    WDF_DEVICE_IO_TYPE  ReadWriteIoType;
+    WDF_DEVICE_IO_TYPE  DeviceControlIoType;
+    ULONG               DirectTransferThreshold;
+} WDF_IO_TYPE_CONFIG, *PWDF_IO_TYPE_CONFIG;
+
+inline VOID WDF_IO_TYPE_CONFIG_INIT(PWDF_IO_TYPE_CONFIG pConfig)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+    pConfig->ReadWriteIoType = WdfDeviceIoBuffered;
+    pConfig->DeviceControlIoType = WdfDeviceIoBuffered;
+}
+
+typedef struct _WDF_DEVICE_STATE
+{
+    ULONG           Size;
+    WDF_TRI_STATE   Disabled;
+    WDF_TRI_STATE   DontDisplayInUI;
+    WDF_TRI_STATE   Failed;
+    WDF_TRI_STATE   NotDisableable;
+} WDF_DEVICE_STATE, *PWDF_DEVICE_STATE;
+
+inline VOID WDF_DEVICE_STATE_INIT(PWDF_DEVICE_STATE pState)
+{
+    RtlZeroMemory(pState, sizeof(*pState));
+    pState->Size = sizeof(*pState);
+    pState->Disabled = WdfUseDefault;
+    pState->DontDisplayInUI = WdfUseDefault;
+    pState->Failed = WdfUseDefault;
+    pState->NotDisableable = WdfUseDefault;
+}
+
+VOID WdfDeviceInitSetPowerPolicyOwnership(PWDFDEVICE_INIT pDeviceInit, BOOLEAN IsPowerPolicyOwner);
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT pDeviceInit, PWDF_PNPPOWER_EVENT_CALLBACKS pCallbacks);
+VOID WdfDeviceInitSetIoTypeEx(PWDFDEVICE_INIT pDeviceInit, PWDF_IO_TYPE_CONFIG pConfig);
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* ppDeviceInit, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFDEVICE* pDevice);
+VOID WdfDeviceSetDeviceState(WDFDEVICE Device, PWDF_DEVICE_STATE pState);
+
+// Resources
+#define CmResourceTypeConnection            0x84
+#define CM_RESOURCE_CONNECTION_CLASS_GPIO   0x01
+#define CM_RESOURCE_CONNECTION_CLASS_SERIAL 0x03
+#define CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C 0x01
+
+typedef struct _CM_PARTIAL_RESOURCE_DESCRIPTOR
+{
+    UCHAR   Type;
+    UCHAR   ShareDisposition;
+    USHORT  Flags;
+    union
+    {
+        struct
+        {
+            UCHAR   Class;
+            UCHAR   Type;
+            UCHAR   Reserved1;
+            UCHAR   Reserved2;
+            ULONG   IdLowPart;
+            ULONG   IdHighPart;
+        } Connection;
+    } u;
+} CM_PARTIAL_RESOURCE_DESCRIPTOR, *PCM_PARTIAL_RESOURCE_DESCRIPTOR;
+
+ULONG WdfCmResourceListGetCount(WDFCMRESLIST List);
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(WDFCMRESLIST List, ULONG Index);
+
+// Locks
+NTSTATUS WdfWaitLockCreate(PWDF_OBJECT_ATTRIBUTES pAttributes, WDFWAITLOCK* pLock);
+NTSTATUS WdfWaitLockAcquire(WDFWAITLOCK Lock, PLONGLONG pTimeout);
+VOID WdfWaitLockRelease(WDFWAITLOCK Lock);
+
+// Timers
+typedef VOID EVT_WDF_TIMER(WDFTIMER Timer);
+typedef EVT_WDF_TIMER* PFN_WDF_TIMER;
+
+typedef struct _WDF_TIMER_CONFIG
+{
+    ULONG           Size;
+    PFN_WDF_TIMER   EvtTimerFunc;
+    ULONG           Period;                 // ms, 0 for a one-shot timer
+    BOOLEAN         AutomaticSerialization;
+    ULONG           TolerableDelay;
+    BOOLEAN         UseHighResolutionTimer;
+} WDF_TIMER_CONFIG, *PWDF_TIMER_CONFIG;
+
+inline VOID WDF_TIMER_CONFIG_INIT(PWDF_TIMER_CONFIG pConfig, PFN_WDF_TIMER EvtTimerFunc)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+    pConfig->EvtTimerFunc = EvtTimerFunc;
+    pConfig->AutomaticSerialization = TRUE;
+}
+
+inline VOID WDF_TIMER_CONFIG_INIT_PERIODIC(PWDF_TIMER_CONFIG pConfig, PFN_WDF_TIMER EvtTimerFunc, LONG Period)
+{
+    WDF_TIMER_CONFIG_INIT(pConfig, EvtTimerFunc);
+    pConfig->Period = Period;
+}
+
+NTSTATUS WdfTimerCreate(PWDF_TIMER_CONFIG pConfig, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFTIMER* pTimer);
+BOOLEAN WdfTimerStart(WDFTIMER Timer, LONGLONG DueTime);
+BOOLEAN WdfTimerStop(WDFTIMER Timer, BOOLEAN Wait);
+WDFOBJECT WdfTimerGetParentObject(WDFTIMER Timer);
+
+// Work items
+typedef VOID EVT_WDF_WORKITEM(WDFWORKITEM WorkItem);
+typedef EVT_WDF_WORKITEM* PFN_WDF_WORKITEM;
+
+typedef struct _WDF_WORKITEM_CONFIG
+{
+    ULONG               Size;
+    PFN_WDF_WORKITEM    EvtWorkItemFunc;
+    BOOLEAN             AutomaticSerialization;
+} WDF_WORKITEM_CONFIG, *PWDF_WORKITEM_CONFIG;
+
+inline VOID WDF_WORKITEM_CONFIG_INIT(PWDF_WORKITEM_CONFIG pConfig, PFN_WDF_WORKITEM EvtWorkItemFunc)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+    pConfig->EvtWorkItemFunc = EvtWorkItemFunc;
+    pConfig->AutomaticSerialization = TRUE;
+}
+
+NTSTATUS WdfWorkItemCreate(PWDF_WORKITEM_CONFIG pConfig, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFWORKITEM* pWorkItem);
+VOID WdfWorkItemEnqueue(WDFWORKITEM WorkItem);
+WDFOBJECT WdfWorkItemGetParentObject(WDFWORKITEM WorkItem);
+
+// Memory
+typedef struct _WDFMEMORY_OFFSET
+{
+    size_t  BufferOffset;
+    size_t  BufferLength;
+} WDFMEMORY_OFFSET, *PWDFMEMORY_OFFSET;
+
+NTSTATUS WdfMemoryCreate(PWDF_OBJECT_ATTRIBUTES pAttributes, POOL_TYPE PoolType, ULONG PoolTag, size_t BufferSize,
+                         WDFMEMORY* pMemory, PVOID* ppBuffer);
+NTSTATUS WdfMemoryCreatePreallocated(PWDF_OBJECT_ATTRIBUTES pAttributes, PVOID pBuffer, size_t BufferSize, WDFMEMORY* pMemory);
+
+// I/O targets and requests
+typedef struct _WDF_IO_TARGET_OPEN_PARAMS
+{
+    ULONG               Size;
+    PUNICODE_STRING     TargetDeviceName;
+    ULONG               DesiredAccess;
+} WDF_IO_TARGET_OPEN_PARAMS, *PWDF_IO_TARGET_OPEN_PARAMS;
+
+inline VOID WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(PWDF_IO_TARGET_OPEN_PARAMS pParams, PUNICODE_STRING pName, ULONG Access)
+{
+    RtlZeroMemory(pParams, sizeof(*pParams));
+    pParams->Size = sizeof(*pParams);
+    pParams->TargetDeviceName = pName;
+    pParams->DesiredAccess = Access;
+}
+
+NTSTATUS WdfIoTargetCreate(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES pAttributes, WDFIOTARGET* pTarget);
+NTSTATUS WdfIoTargetOpen(WDFIOTARGET Target, PWDF_IO_TARGET_OPEN_PARAMS pParams);
+
+typedef struct _IO_STATUS_BLOCK
+{
+    NTSTATUS    Status;
+    ULONG_PTR   Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _WDF_REQUEST_COMPLETION_PARAMS
+{
+    ULONG           Size;
+    ULONG           Type;
+    IO_STATUS_BLOCK IoStatus;
+} WDF_REQUEST_COMPLETION_PARAMS, *PWDF_REQUEST_COMPLETION_PARAMS;
+
+typedef VOID EVT_WDF_REQUEST_COMPLETION_ROUTINE(WDFREQUEST Request, WDFIOTARGET Target,
+                                                PWDF_REQUEST_COMPLETION_PARAMS pParams, WDFCONTEXT Context);
+typedef EVT_WDF_REQUEST_COMPLETION_ROUTINE* PFN_WDF_REQUEST_COMPLETION_ROUTINE;
+typedef VOID EVT_WDF_REQUEST_CANCEL(WDFREQUEST Request);
+typedef EVT_WDF_REQUEST_CANCEL* PFN_WDF_REQUEST_CANCEL;
+
+#define WDF_REQUEST_REUSE_NO_FLAGS          0x00000000
+
+typedef struct _WDF_REQUEST_REUSE_PARAMS
+{
+    ULONG       Size;
+    ULONG       Flags;
+    NTSTATUS    Status;
+} WDF_REQUEST_REUSE_PARAMS, *PWDF_REQUEST_REUSE_PARAMS;
+
+inline VOID WDF_REQUEST_REUSE_PARAMS_INIT(PWDF_REQUEST_REUSE_PARAMS pParams, ULONG Flags, NTSTATUS Status)
+{
+    RtlZeroMemory(pParams, sizeof(*pParams));
+    pParams->Size = sizeof(*pParams);
+    pParams->Flags = Flags;
+    pParams->Status = Status;
+}
+
+typedef struct _WDF_REQUEST_SEND_OPTIONS
+{
+    ULONG       Size;
+    ULONG       Flags;
+    LONGLONG    Timeout;
+} WDF_REQUEST_SEND_OPTIONS, *PWDF_REQUEST_SEND_OPTIONS;
+
+NTSTATUS WdfRequestCreate(PWDF_OBJECT_ATTRIBUTES pAttributes, WDFIOTARGET Target, WDFREQUEST* pRequest);
+NTSTATUS WdfRequestReuse(WDFREQUEST Request, PWDF_REQUEST_REUSE_PARAMS pParams);
+NTSTATUS WdfIoTargetFormatRequestForWrite(WDFIOTARGET Target, WDFREQUEST Request, WDFMEMORY Memory,
+                                          PWDFMEMORY_OFFSET pOffset, PLONGLONG pDeviceOffset);
+VOID WdfRequestSetCompletionRoutine(WDFREQUEST Request, PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine, WDFCONTEXT Context);
+BOOLEAN WdfRequestSend(WDFREQUEST Request, WDFIOTARGET Target, PWDF_REQUEST_SEND_OPTIONS pOptions);
+NTSTATUS WdfRequestGetStatus(WDFREQUEST Request);
+BOOLEAN WdfRequestCancelSentRequest(WDFREQUEST Request);
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status);
+VOID WdfRequestCompleteWithInformation(WDFREQUEST Request, NTSTATUS Status, ULONG_PTR Information);
+NTSTATUS WdfRequestRetrieveInputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* ppBuffer, size_t* pLength);
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* ppBuffer, size_t* pLength);
+ULONG WdfRequestGetRequestorProcessId(WDFREQUEST Request);
+WDFFILEOBJECT WdfRequestGetFileObject(WDFREQUEST Request);
+WDFQUEUE WdfRequestGetIoQueue(WDFREQUEST Request);
+NTSTATUS WdfRequestMarkCancelableEx(WDFREQUEST Request, PFN_WDF_REQUEST_CANCEL EvtRequestCancel);
+NTSTATUS WdfRequestUnmarkCancelable(WDFREQUEST Request);
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE Queue);
+
+// SPB register access of the sensors utility library. The register
+// address is written first, then Length bytes are written or read.
+NTSTATUS I2CSensorReadRegister(WDFIOTARGET Target, BYTE Register, BYTE* pData, ULONG Length);
+NTSTATUS I2CSensorWriteRegister(WDFIOTARGET Target, BYTE Register, BYTE* pData, ULONG Length);
+
+// Property keys and variants
+typedef struct _PROPERTYKEY
+{
+    GUID    fmtid;
+    DWORD   pid;
+} PROPERTYKEY, DEVPROPKEY;
+
+inline bool IsEqualPropertyKey(const PROPERTYKEY& a, const PROPERTYKEY& b)
+{
+    return IsEqualGUID(a.fmtid, b.fmtid) && a.pid == b.pid;
+}
+
+#define VT_EMPTY                            0
+#define VT_R4                               4
+#define VT_BOOL                             11
+#define VT_UI4                              19
+#define VT_UI8                              21
+#define VT_LPWSTR                           31
+#define VT_FILETIME                         64
+#define VT_CLSID                            72
+
+typedef struct _PROPVARIANT
+{
+    USHORT  vt;
+    union
+    {
+        ULONG       ulVal;
+        LONG        lVal;
+        float       fltVal;
+        double      dblVal;
+        ULONGLONG   uhVal;
+        BOOL        boolVal;
+        FILETIME    filetime;
+        PCWSTR      pwszVal;
+        const GUID* puuid;
+    };
+} PROPVARIANT;
+
+VOID InitPropVariantFromCLSID(const GUID& Clsid, PROPVARIANT* pVariant);
+VOID InitPropVariantFromString(PCWSTR pString, PROPVARIANT* pVariant);
+VOID InitPropVariantFromUInt32(ULONG Value, PROPVARIANT* pVariant);
+VOID InitPropVariantFromFloat(float Value, PROPVARIANT* pVariant);
+VOID InitPropVariantFromFileTime(const FILETIME* pTime, PROPVARIANT* pVariant);
+
+// Sensor collections
+typedef struct _SENSOR_VALUE_PAIR
+{
+    PROPERTYKEY Key;
+    PROPVARIANT Value;
+} SENSOR_VALUE_PAIR, *PSENSOR_VALUE_PAIR;
+
+typedef struct _SENSOR_COLLECTION_LIST
+{
+    ULONG               AllocatedSizeInBytes;
+    ULONG               Count;
+    SENSOR_VALUE_PAIR   List[1];
+} SENSOR_COLLECTION_LIST, *PSENSOR_COLLECTION_LIST;
+
+typedef struct _SENSOR_PROPERTY_LIST
+{
+    ULONG       AllocatedSizeInBytes;
+    ULONG       Count;
+    PROPERTYKEY List[1];
+} SENSOR_PROPERTY_LIST, *PSENSOR_PROPERTY_LIST;
+
+#define SENSOR_COLLECTION_LIST_HEADER_SIZE  ((ULONG)FIELD_OFFSET(SENSOR_COLLECTION_LIST, List))
+#define SENSOR_COLLECTION_LIST_SIZE(n)      ((ULONG)(SENSOR_COLLECTION_LIST_HEADER_SIZE + (n) * sizeof(SENSOR_VALUE_PAIR)))
+#define SENSOR_PROPERTY_LIST_HEADER_SIZE    ((ULONG)FIELD_OFFSET(SENSOR_PROPERTY_LIST, List))
+#define SENSOR_PROPERTY_LIST_SIZE(n)        ((ULONG)(SENSOR_PROPERTY_LIST_HEADER_SIZE + (n) * sizeof(PROPERTYKEY)))
+
+inline VOID SENSOR_COLLECTION_LIST_INIT(PSENSOR_COLLECTION_LIST pList, ULONG Size)
+{
+    RtlZeroMemory(pList, Size);
+    pList->AllocatedSizeInBytes = Size;
+}
+
+inline VOID SENSOR_PROPERTY_LIST_INIT(PSENSOR_PROPERTY_LIST pList, ULONG Size)
+{
+    RtlZeroMemory(pList, Size);
+    pList->AllocatedSizeInBytes = Size;
+}
+
+typedef struct _VEC3D
+{
+    float   X;
+    float   Y;
+    float   Z;
+} VEC3D, *PVEC3D;
+
+NTSTATUS CollectionsListCopyAndMarshall(PSENSOR_COLLECTION_LIST pTarget, PSENSOR_COLLECTION_LIST pSource);
+ULONG CollectionsListGetMarshalledSize(PSENSOR_COLLECTION_LIST pList);
+NTSTATUS PropKeyFindKeyGetFloat(PSENSOR_COLLECTION_LIST pList, const PROPERTYKEY* pKey, float* pValue);
+NTSTATUS PropKeyFindKeySetFloat(PSENSOR_COLLECTION_LIST pList, const PROPERTYKEY* pKey, float Value);
+
+extern const PROPERTYKEY DEVPKEY_Sensor_Type;
+extern const PROPERTYKEY DEVPKEY_Sensor_Category;
+extern const PROPERTYKEY DEVPKEY_Sensor_Manufacturer;
+extern const PROPERTYKEY DEVPKEY_Sensor_Model;
+extern const PROPERTYKEY DEVPKEY_Sensor_PersistentUniqueId;
+extern const PROPERTYKEY DEVPKEY_Sensor_VendorDefinedSubType;
+extern const PROPERTYKEY DEVPKEY_Sensor_Name;
+extern const PROPERTYKEY DEVPKEY_Sensor_ConnectionType;
+extern const PROPERTYKEY DEVPKEY_Sensor_IsPrimary;
+extern const PROPERTYKEY PKEY_Sensor_State;
+extern const PROPERTYKEY PKEY_Sensor_MinimumDataInterval_Ms;
+extern const PROPERTYKEY PKEY_Sensor_MaximumDataFieldSize_Bytes;
+extern const PROPERTYKEY PKEY_Sensor_Type;
+extern const PROPERTYKEY PKEY_Sensor_ChangeSensitivity;
+extern const PROPERTYKEY PKEY_Sensor_ReportingDelay_Ms;
+extern const PROPERTYKEY PKEY_SensorData_Timestamp;
+extern const PROPERTYKEY PKEY_SensorDataField_Resolution;
+extern const PROPERTYKEY PKEY_SensorDataField_RangeMinimum;
+extern const PROPERTYKEY PKEY_SensorDataField_RangeMaximum;
+extern const PROPERTYKEY PKEY_SensorHistory_Interval_Ms;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue1;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue2;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue3;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue4;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue5;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue6;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue7;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue8;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue9;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue10;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue11;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue12;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue13;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue14;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue15;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue16;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue17;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue18;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue19;
+extern const PROPERTYKEY PKEY_SensorData_CustomValue20;
+extern const GUID GUID_SensorType_Custom;
+extern const GUID GUID_SensorCategory_Other;
+
+typedef enum _SENSOR_STATE
+{
+    SensorState_Initializing = 0,
+    SensorState_Idle,
+    SensorState_Active,
+    SensorState_Error
+} SENSOR_STATE;
+
+// Sensor class extension
+typedef NTSTATUS EVT_SENSOR_DRIVER_START_SENSOR(SENSOROBJECT Sensor);
+typedef NTSTATUS EVT_SENSOR_DRIVER_STOP_SENSOR(SENSOROBJECT Sensor);
+typedef NTSTATUS EVT_SENSOR_DRIVER_GET_SUPPORTED_DATA_FIELDS(SENSOROBJECT Sensor, PSENSOR_PROPERTY_LIST pFields, PULONG pSize);
+typedef NTSTATUS EVT_SENSOR_DRIVER_GET_PROPERTIES(SENSOROBJECT Sensor, PSENSOR_COLLECTION_LIST pProperties, PULONG pSize);
+typedef NTSTATUS EVT_SENSOR_DRIVER_GET_DATA_FIELD_PROPERTIES(SENSOROBJECT Sensor, const PROPERTYKEY* pDataField,
+                                                             PSENSOR_COLLECTION_LIST pProperties, PULONG pSize);
+typedef NTSTATUS EVT_SENSOR_DRIVER_GET_DATA_INTERVAL(SENSOROBJECT Sensor, PULONG pIntervalMs);
+typedef NTSTATUS EVT_SENSOR_DRIVER_SET_DATA_INTERVAL(SENSOROBJECT Sensor, ULONG IntervalMs);
+typedef NTSTATUS EVT_SENSOR_DRIVER_GET_DATA_THRESHOLDS(SENSOROBJECT Sensor, PSENSOR_COLLECTION_LIST pThresholds, PULONG pSize);
+typedef NTSTATUS EVT_SENSOR_DRIVER_SET_DATA_THRESHOLDS(SENSOROBJECT Sensor, PSENSOR_COLLECTION_LIST pThresholds);
+typedef NTSTATUS EVT_SENSOR_DRIVER_DEVICE_IO_CONTROL(SENSOROBJECT Sensor, WDFREQUEST Request, size_t OutputBufferLength,
+                                                     size_t InputBufferLength, ULONG IoControlCode);
+
+typedef struct _SENSOR_CONTROLLER_CONFIG
+{
+    ULONG                                           Size;
+    WDF_TRI_STATE                                   DriverIsPowerPolicyOwner;
+    EVT_SENSOR_DRIVER_START_SENSOR*                 EvtSensorStart;
+    EVT_SENSOR_DRIVER_STOP_SENSOR*                  EvtSensorStop;
+    EVT_SENSOR_DRIVER_GET_SUPPORTED_DATA_FIELDS*    EvtSensorGetSupportedDataFields;
+    EVT_SENSOR_DRIVER_GET_DATA_INTERVAL*            EvtSensorGetDataInterval;
+    EVT_SENSOR_DRIVER_SET_DATA_INTERVAL*            EvtSensorSetDataInterval;
+    EVT_SENSOR_DRIVER_GET_DATA_FIELD_PROPERTIES*    EvtSensorGetDataFieldProperties;
+    EVT_SENSOR_DRIVER_GET_DATA_THRESHOLDS*          EvtSensorGetDataThresholds;
+    EVT_SENSOR_DRIVER_SET_DATA_THRESHOLDS*          EvtSensorSetDataThresholds;
+    EVT_SENSOR_DRIVER_GET_PROPERTIES*               EvtSensorGetProperties;
+    EVT_SENSOR_DRIVER_DEVICE_IO_CONTROL*            EvtSensorDeviceIoControl;
+} SENSOR_CONTROLLER_CONFIG, *PSENSOR_CONTROLLER_CONFIG;
+
+inline VOID SENSOR_CONTROLLER_CONFIG_INIT(PSENSOR_CONTROLLER_CONFIG pConfig)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+}
+
+typedef struct _SENSOR_CONFIG
+{
+    ULONG                   Size;
+    PSENSOR_COLLECTION_LIST pEnumerationList;
+} SENSOR_CONFIG, *PSENSOR_CONFIG;
+
+inline VOID SENSOR_CONFIG_INIT(PSENSOR_CONFIG pConfig)
+{
+    RtlZeroMemory(pConfig, sizeof(*pConfig));
+    pConfig->Size = sizeof(*pConfig);
+}
+
+NTSTATUS SensorsCxDeviceInitConfig(PWDFDEVICE_INIT pDeviceInit, PWDF_OBJECT_ATTRIBUTES pAttributes, ULONG Flags);
+NTSTATUS SensorsCxDeviceInitialize(WDFDEVICE Device, PSENSOR_CONTROLLER_CONFIG pConfig);
+NTSTATUS SensorsCxSensorCreate(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES pAttributes, SENSOROBJECT* pSensor);
+NTSTATUS SensorsCxSensorInitialize(SENSOROBJECT Sensor, PSENSOR_CONFIG pConfig);
+NTSTATUS SensorsCxDeviceGetSensorList(WDFDEVICE Device, SENSOROBJECT* pSensors, PULONG pCount);
+NTSTATUS SensorsCxSensorDataReady(SENSOROBJECT Sensor, PSENSOR_COLLECTION_LIST pData);
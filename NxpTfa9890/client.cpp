@@ -1,303 +1,966 @@
-//Copyright (C) Microsoft Corporation, All Rights Reserved.
-//
-//Abstract:
-//
-//    This module contains the implementation of driver callback functions
-//    from clx to TFA9890 accelerometer.
-//
-//Environment:
-//
-//   Windows User-Mode Driver Framework (UMDF)
-
-#include "Device.h"
-#include "TFA9890.h"
-
-#include <timeapi.h>
-
-#include "Client.tmh"
-
-
-// Analog TFA9890 Unique ID
-// {EF2C014C-DEBA-43F4-890D-978095684DD6}
-DEFINE_GUID(GUID_TFA9890Device_UniqueID,
-    0xef2c014c, 0xdeba, 0x43f4, 0x89, 0xd, 0x97, 0x80, 0x95, 0x68, 0x4d, 0xd6);
-
-// {F0113F45-0810-49EA-BC6A-0FFD297C1266}
-DEFINE_GUID(GUID_TFA9890Device_SubType,
-	0xf0113f45, 0x810, 0x49ea, 0xbc, 0x6a, 0xf, 0xfd, 0x29, 0x7c, 0x12, 0x66);
-
-
-// Helper function for initializing NxpTfa9890Device. Returns status.
-inline NTSTATUS InitSensorCollection(
-    _In_ ULONG CollectionListCount,
-    _Outptr_ PSENSOR_COLLECTION_LIST *CollectionList,
-    _In_ SENSOROBJECT SensorInstance)                   // SENSOROBJECT for sensor instance
-{
-    WDF_OBJECT_ATTRIBUTES MemoryAttributes;
-    WDF_OBJECT_ATTRIBUTES_INIT(&MemoryAttributes);
-    MemoryAttributes.ParentObject = SensorInstance;
-
-    WDFMEMORY MemoryHandle = NULL;
-    ULONG MemorySize = SENSOR_COLLECTION_LIST_SIZE(CollectionListCount);
-    NTSTATUS Status = WdfMemoryCreate(&MemoryAttributes,
-                                      PagedPool,
-                                      PA_POOL_TAG_ACCELEROMETER,
-                                      MemorySize,
-                                      &MemoryHandle,
-                                      reinterpret_cast<PVOID*>(CollectionList));
-    if (!NT_SUCCESS(Status) || nullptr == *CollectionList)
-    {
-        Status = STATUS_UNSUCCESSFUL;
-        TraceError("ACC %!FUNC! WdfMemoryCreate failed %!STATUS!", Status);
-        return Status;
-    }
-
-    SENSOR_COLLECTION_LIST_INIT(*CollectionList, MemorySize);
-    (*CollectionList)->Count = CollectionListCount;
-    return Status;
-}
-
-
-// This routine initializes the sensor to its default properties
-NTSTATUS NxpTfa9890Device::Initialize(
-    _In_ WDFDEVICE Device,            // WDFDEVICE object
-    _In_ SENSOROBJECT SensorInstance) // SENSOROBJECT for each sensor instance
-{
-    SENSOR_FunctionEnter();
-
-    //// Store device and instance
-    m_Device = Device;
-    m_SensorInstance = SensorInstance;
-    m_Started = false;
-
-    // Create Lock
-    NTSTATUS Status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &(m_I2CWaitLock));
-    if (!NT_SUCCESS(Status))
-    {
-        TraceError("ACC %!FUNC! WdfWaitLockCreate failed %!STATUS!", Status);
-    }
-
-    // Sensor Enumeration Properties
-    if (NT_SUCCESS(Status))
-    {
-        Status = InitSensorCollection(SENSOR_ENUMERATION_PROPERTIES_COUNT, &m_pEnumerationProperties, SensorInstance);
-        if (NT_SUCCESS(Status))
-        {
-            m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_TYPE].Key = DEVPKEY_Sensor_Type;
-			InitPropVariantFromCLSID(GUID_SensorType_Custom,
-                &(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_TYPE].Value));
-
-			m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_CATEGORY].Key = DEVPKEY_Sensor_Category;
-			InitPropVariantFromCLSID(GUID_SensorCategory_Other,
-				&(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_CATEGORY].Value));
-        
-            m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_MANUFACTURER].Key = DEVPKEY_Sensor_Manufacturer;
-            InitPropVariantFromString(SENSOR_PA_MANUFACTURER,
-                &(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_MANUFACTURER].Value));
-        
-            m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_MODEL].Key = DEVPKEY_Sensor_Model;
-            InitPropVariantFromString(SENSOR_PA_MODEL,
-                &(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_MODEL].Value));
-            
-            m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID].Key = DEVPKEY_Sensor_PersistentUniqueId;
-            InitPropVariantFromCLSID(GUID_TFA9890Device_UniqueID,
-                &(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID].Value));
-
-			m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_SUBTYPE].Key = DEVPKEY_Sensor_VendorDefinedSubType;
-			InitPropVariantFromCLSID(GUID_TFA9890Device_SubType,
-				&(m_pEnumerationProperties->List[SENSOR_ENUMERATION_PROPERTY_SUBTYPE].Value));
-
-        }
-    }
-
-	// Reset the FirstSample flag
-    if (NT_SUCCESS(Status))
-    {
-        m_FirstSample = true;
-    }
-    // Trace to this function in case of failure
-    else
-    {
-        TraceError("ACC %!FUNC! failed %!STATUS!", Status);
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-VOID NxpTfa9890Device::DeInit()
-{
-    // Delete lock
-    if (NULL != m_I2CWaitLock)
-    {
-        WdfObjectDelete(m_I2CWaitLock);
-        m_I2CWaitLock = NULL;
-    }
-
-    // Delete sensor instance
-    if (NULL != m_SensorInstance)
-    {
-        WdfObjectDelete(m_SensorInstance);
-    }
-}
-
-// This routine reads a single sample, compares threshold and pushes sample
-// to sensor class extension. This routine is protected by the caller.
-NTSTATUS NxpTfa9890Device::GetData() 
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to begin continously sampling the sensor.
-NTSTATUS NxpTfa9890Device::OnStart(
-    _In_ SENSOROBJECT SensorInstance)    // Sensor device object
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to stop continously sampling the sensor.
-NTSTATUS NxpTfa9890Device::OnStop(
-    _In_ SENSOROBJECT SensorInstance)   // Sensor device object
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to get supported data fields. The typical usage is to call
-// this function once with buffer pointer as NULL to acquire the required size 
-// for the buffer, allocate buffer, then call the function again to retrieve 
-// sensor information.
-NTSTATUS NxpTfa9890Device::OnGetSupportedDataFields(
-    _In_ SENSOROBJECT SensorInstance,          // Sensor device object
-    _Inout_opt_ PSENSOR_PROPERTY_LIST pFields, // Pointer to a list of supported properties
-    _Out_ PULONG pSize)                        // Number of bytes for the list of supported properties
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to get sensor properties. The typical usage is to call
-// this function once with buffer pointer as NULL to acquire the required size 
-// for the buffer, allocate buffer, then call the function again to retrieve 
-// sensor information.
-NTSTATUS NxpTfa9890Device::OnGetProperties(
-    _In_ SENSOROBJECT SensorInstance,                // Sensor device object
-    _Inout_opt_ PSENSOR_COLLECTION_LIST pProperties, // Pointer to a list of sensor properties
-    _Out_ PULONG pSize)                              // Number of bytes for the list of sensor properties
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to get data field properties. The typical usage is to call
-// this function once with buffer pointer as NULL to acquire the required size 
-// for the buffer, allocate buffer, then call the function again to retrieve 
-// sensor information.
-NTSTATUS NxpTfa9890Device::OnGetDataFieldProperties(
-    _In_ SENSOROBJECT SensorInstance,                   // Sensor device object
-    _In_ const PROPERTYKEY *pDataField,                 // Pointer to the propertykey of requested property
-    _Inout_opt_ PSENSOR_COLLECTION_LIST pProperties,    // Pointer to a list of sensor properties
-    _Out_ PULONG pSize)                                 // Number of bytes for the list of sensor properties
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to get sampling rate of the sensor.
-NTSTATUS NxpTfa9890Device::OnGetDataInterval(
-    _In_ SENSOROBJECT SensorInstance,   // Sensor device object
-    _Out_ PULONG pDataRateMs)           // Sampling rate in milliseconds
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-	SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to set sampling rate of the sensor.
-NTSTATUS NxpTfa9890Device::OnSetDataInterval(
-    _In_ SENSOROBJECT SensorInstance, // Sensor device object
-    _In_ ULONG DataRateMs)            // Sampling rate in milliseconds
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to get data thresholds. The typical usage is to call
-// this function once with buffer pointer as NULL to acquire the required size
-// for the buffer, allocate buffer, then call the function again to retrieve
-// sensor information.
-NTSTATUS NxpTfa9890Device::OnGetDataThresholds(
-    _In_ SENSOROBJECT SensorInstance,                   // Sensor Device Object
-    _Inout_opt_ PSENSOR_COLLECTION_LIST pThresholds,    // Pointer to a list of sensor thresholds
-    _Out_ PULONG pSize)                                 // Number of bytes for the list of sensor thresholds
-{
-
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to set data thresholds.
-NTSTATUS NxpTfa9890Device::OnSetDataThresholds(
-    _In_ SENSOROBJECT SensorInstance,           // Sensor Device Object
-    _In_ PSENSOR_COLLECTION_LIST pThresholds)   // Pointer to a list of sensor thresholds
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Called by Sensor CLX to handle IOCTLs that clx does not support
-NTSTATUS NxpTfa9890Device::OnIoControl(
-    _In_ SENSOROBJECT /*SensorInstance*/, // WDF queue object
-    _In_ WDFREQUEST /*Request*/,          // WDF request object
-    _In_ size_t /*OutputBufferLength*/,   // number of bytes to retrieve from output buffer
-    _In_ size_t /*InputBufferLength*/,    // number of bytes to retrieve from input buffer
-    _In_ ULONG /*IoControlCode*/)         // IOCTL control code
-{
-    NTSTATUS Status = STATUS_NOT_SUPPORTED;
-
-    SENSOR_FunctionEnter();
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the implementation of driver callback functions
+//    from clx to TFA9890 accelerometer.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "TFA9890.h"
+
+#include <timeapi.h>
+
+#include "Client.tmh"
+
+
+// Analog TFA9890 Unique ID
+// {EF2C014C-DEBA-43F4-890D-978095684DD6}
+DEFINE_GUID(GUID_TFA9890Device_UniqueID,
+    0xef2c014c, 0xdeba, 0x43f4, 0x89, 0xd, 0x97, 0x80, 0x95, 0x68, 0x4d, 0xd6);
+
+// {F0113F45-0810-49EA-BC6A-0FFD297C1266}
+DEFINE_GUID(GUID_TFA9890Device_SubType,
+	0xf0113f45, 0x810, 0x49ea, 0xbc, 0x6a, 0xf, 0xfd, 0x29, 0x7c, 0x12, 0x66);
+
+
+// Helper function for initializing NxpTfa9890Device. Returns status.
+inline NTSTATUS InitSensorCollection(
+    _In_ ULONG CollectionListCount,
+    _Outptr_ PSENSOR_COLLECTION_LIST *CollectionList,
+    _In_ SENSOROBJECT SensorInstance)                   // SENSOROBJECT for sensor instance
+{
+    WDF_OBJECT_ATTRIBUTES MemoryAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&MemoryAttributes);
+    MemoryAttributes.ParentObject = SensorInstance;
+
+    WDFMEMORY MemoryHandle = NULL;
+    ULONG MemorySize = SENSOR_COLLECTION_LIST_SIZE(CollectionListCount);
+    NTSTATUS Status = WdfMemoryCreate(&MemoryAttributes,
+                                      PagedPool,
+                                      PA_POOL_TAG_ACCELEROMETER,
+                                      MemorySize,
+                                      &MemoryHandle,
+                                      reinterpret_cast<PVOID*>(CollectionList));
+    if (!NT_SUCCESS(Status) || nullptr == *CollectionList)
+    {
+        Status = STATUS_UNSUCCESSFUL;
+        TraceError("ACC %!FUNC! WdfMemoryCreate failed %!STATUS!", Status);
+        return Status;
+    }
+
+    SENSOR_COLLECTION_LIST_INIT(*CollectionList, MemorySize);
+    (*CollectionList)->Count = CollectionListCount;
+    return Status;
+}
+
+// Set the four data fields of one aggregated channel, starting at its minimum
+inline VOID SetWindowStats(
+    _Inout_ PSENSOR_COLLECTION_LIST pData,
+    _In_ ULONG First,                       // SENSOR_DATA_*_MIN of the channel
+    _In_ const TFA9890_WINDOW_STATS* pStats)
+{
+    InitPropVariantFromFloat(pStats->Min, &(pData->List[First].Value));
+    InitPropVariantFromFloat(pStats->Max, &(pData->List[First + 1].Value));
+    InitPropVariantFromFloat(pStats->Mean, &(pData->List[First + 2].Value));
+    InitPropVariantFromFloat(pStats->Rms, &(pData->List[First + 3].Value));
+}
+
+
+// This routine initializes the sensor to its default properties
+NTSTATUS NxpTfa9890Device::Initialize(
+    _In_ WDFDEVICE Device,            // WDFDEVICE object
+    _In_ SENSOROBJECT SensorInstance) // SENSOROBJECT for each sensor instance
+{
+    SENSOR_FunctionEnter();
+
+    //// Store device and instance
+    m_Device = Device;
+    m_SensorInstance = SensorInstance;
+
+    // Create Lock
+    NTSTATUS Status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &(m_I2CWaitLock));
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfWaitLockCreate failed %!STATUS!", Status);
+    }
+
+    // Speaker model polling and health diagnostics
+    if (NT_SUCCESS(Status))
+    {
+        InitializeSRWLock(&m_HealthLock);
+        InitializeSRWLock(&m_RecordLock);
+        InitializeSRWLock(&m_SubscriptionLock);
+        InitializeSRWLock(&m_SampleLock);
+        InitializeSRWLock(&m_HistoryLock);
+        InitializeSRWLock(&m_AggregateLock);
+        InitializeSRWLock(&m_PerfLock);
+        InitializeSRWLock(&m_EqLoadLock);
+        DiagInitializeFft(&m_DiagFft);
+        Status = CreateModelTimer();
+    }
+
+    // Power gating on audio stream hints
+    if (NT_SUCCESS(Status))
+    {
+        Status = CreateGateTimer();
+    }
+
+    // Adaptive telemetry sampling
+    if (NT_SUCCESS(Status))
+    {
+        Status = CreateSampleTimer();
+    }
+
+    // Sensor of the first amp
+    if (NT_SUCCESS(Status))
+    {
+        Status = InitializeAmpSensor(0, SensorInstance);
+    }
+
+	// Reset the FirstSample flag
+    if (NT_SUCCESS(Status))
+    {
+        m_SampleRate.FirstSample = true;
+    }
+    // Trace to this function in case of failure
+    else
+    {
+        TraceError("ACC %!FUNC! failed %!STATUS!", Status);
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Set up the property and data lists of the sensor instance of one amp.
+// Each amp's sensor has its own persistent ID, derived from the device's.
+NTSTATUS NxpTfa9890Device::InitializeAmpSensor(
+    _In_ ULONG Amp,                   // Amp the sensor reports for
+    _In_ SENSOROBJECT SensorInstance) // SENSOROBJECT of the amp
+{
+    PTFA9890_AMP_SENSOR pSensor = &m_AmpSensors[Amp];
+    GUID UniqueId = GUID_TFA9890Device_UniqueID;
+
+    UniqueId.Data4[7] = static_cast<BYTE>(UniqueId.Data4[7] + Amp);
+
+    pSensor->SensorInstance = SensorInstance;
+    pSensor->Started = false;
+    pSensor->Interval = TFA9890_SAMPLE_DEFAULT_INTERVAL_MS;
+    pSensor->TemperatureStepC = TFA9890_SAMPLE_TEMPERATURE_STEP_C;
+    pSensor->BatteryStepV = TFA9890_SAMPLE_BATTERY_STEP_V;
+    RtlZeroMemory(&pSensor->Rate, sizeof(pSensor->Rate));
+
+    // Sensor Enumeration Properties
+    NTSTATUS Status = InitSensorCollection(SENSOR_ENUMERATION_PROPERTIES_COUNT, &pSensor->pEnumerationProperties, SensorInstance);
+    if (NT_SUCCESS(Status))
+    {
+        PSENSOR_COLLECTION_LIST pProperties = pSensor->pEnumerationProperties;
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_TYPE].Key = DEVPKEY_Sensor_Type;
+        InitPropVariantFromCLSID(GUID_SensorType_Custom,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_TYPE].Value));
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_CATEGORY].Key = DEVPKEY_Sensor_Category;
+        InitPropVariantFromCLSID(GUID_SensorCategory_Other,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_CATEGORY].Value));
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_MANUFACTURER].Key = DEVPKEY_Sensor_Manufacturer;
+        InitPropVariantFromString(SENSOR_PA_MANUFACTURER,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_MANUFACTURER].Value));
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_MODEL].Key = DEVPKEY_Sensor_Model;
+        InitPropVariantFromString(SENSOR_PA_MODEL,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_MODEL].Value));
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID].Key = DEVPKEY_Sensor_PersistentUniqueId;
+        InitPropVariantFromCLSID(UniqueId,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_PERSISTENT_UNIQUE_ID].Value));
+
+        pProperties->List[SENSOR_ENUMERATION_PROPERTY_SUBTYPE].Key = DEVPKEY_Sensor_VendorDefinedSubType;
+        InitPropVariantFromCLSID(GUID_TFA9890Device_SubType,
+            &(pProperties->List[SENSOR_ENUMERATION_PROPERTY_SUBTYPE].Value));
+    }
+
+    // Sensor data
+    if (NT_SUCCESS(Status))
+    {
+        Status = InitSensorCollection(SENSOR_DATA_COUNT, &pSensor->pSensorData, SensorInstance);
+        if (NT_SUCCESS(Status))
+        {
+            PSENSOR_COLLECTION_LIST pData = pSensor->pSensorData;
+
+            pData->List[SENSOR_DATA_TIMESTAMP].Key = PKEY_SensorData_Timestamp;
+            pData->List[SENSOR_DATA_TEMPERATURE_C].Key = PKEY_SensorData_CustomValue1;
+            pData->List[SENSOR_DATA_BATTERY_V].Key = PKEY_SensorData_CustomValue2;
+            pData->List[SENSOR_DATA_FAULTS].Key = PKEY_SensorData_CustomValue3;
+            pData->List[SENSOR_DATA_INTERVAL_MS].Key = PKEY_SensorData_CustomValue4;
+            pData->List[SENSOR_DATA_WINDOW_SAMPLES].Key = PKEY_SensorData_CustomValue5;
+            pData->List[SENSOR_DATA_TEMPERATURE_MIN].Key = PKEY_SensorData_CustomValue6;
+            pData->List[SENSOR_DATA_TEMPERATURE_MAX].Key = PKEY_SensorData_CustomValue7;
+            pData->List[SENSOR_DATA_TEMPERATURE_MEAN].Key = PKEY_SensorData_CustomValue8;
+            pData->List[SENSOR_DATA_TEMPERATURE_RMS].Key = PKEY_SensorData_CustomValue9;
+            pData->List[SENSOR_DATA_IMPEDANCE_MIN].Key = PKEY_SensorData_CustomValue10;
+            pData->List[SENSOR_DATA_IMPEDANCE_MAX].Key = PKEY_SensorData_CustomValue11;
+            pData->List[SENSOR_DATA_IMPEDANCE_MEAN].Key = PKEY_SensorData_CustomValue12;
+            pData->List[SENSOR_DATA_IMPEDANCE_RMS].Key = PKEY_SensorData_CustomValue13;
+            pData->List[SENSOR_DATA_EXCURSION_MIN].Key = PKEY_SensorData_CustomValue14;
+            pData->List[SENSOR_DATA_EXCURSION_MAX].Key = PKEY_SensorData_CustomValue15;
+            pData->List[SENSOR_DATA_EXCURSION_MEAN].Key = PKEY_SensorData_CustomValue16;
+            pData->List[SENSOR_DATA_EXCURSION_RMS].Key = PKEY_SensorData_CustomValue17;
+        }
+    }
+
+    // Sensor thresholds
+    if (NT_SUCCESS(Status))
+    {
+        Status = InitSensorCollection(SENSOR_THRESHOLDS_COUNT, &pSensor->pThresholds, SensorInstance);
+        if (NT_SUCCESS(Status))
+        {
+            PSENSOR_COLLECTION_LIST pThresholds = pSensor->pThresholds;
+
+            pThresholds->List[SENSOR_THRESHOLD_TEMPERATURE_C].Key = PKEY_SensorData_CustomValue1;
+            InitPropVariantFromFloat(pSensor->TemperatureStepC, &(pThresholds->List[SENSOR_THRESHOLD_TEMPERATURE_C].Value));
+
+            pThresholds->List[SENSOR_THRESHOLD_BATTERY_V].Key = PKEY_SensorData_CustomValue2;
+            InitPropVariantFromFloat(pSensor->BatteryStepV, &(pThresholds->List[SENSOR_THRESHOLD_BATTERY_V].Value));
+        }
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! Sensor of amp %u failed %!STATUS!", Amp, Status);
+    }
+
+    return Status;
+}
+
+// Register a sensor instance with clx for every amp after the first. The
+// amps are only known once the IoTargets are configured.
+NTSTATUS NxpTfa9890Device::CreateAmpSensors()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    for (ULONG Amp = 1; NT_SUCCESS(Status) && Amp < m_AmpCount; Amp++)
+    {
+        WDF_OBJECT_ATTRIBUTES SensorAttributes;
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&SensorAttributes, TFA9890_SENSOR_CONTEXT);
+
+        SENSOROBJECT SensorInstance = NULL;
+        Status = SensorsCxSensorCreate(m_Device, &SensorAttributes, &SensorInstance);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! SensorsCxSensorCreate for amp %u failed %!STATUS!", Amp, Status);
+            DLog("PA: SensorsCxSensorCreate for amp %u failed %d\n", Amp, Status);//DebugLog
+            break;
+        }
+
+        PTFA9890_SENSOR_CONTEXT pContext = GetTfa9890SensorContext(SensorInstance);
+        pContext->pDevice = this;
+        pContext->Amp = Amp;
+
+        Status = InitializeAmpSensor(Amp, SensorInstance);
+        if (NT_SUCCESS(Status))
+        {
+            SENSOR_CONFIG SensorConfig;
+            SENSOR_CONFIG_INIT(&SensorConfig);
+            SensorConfig.pEnumerationList = m_AmpSensors[Amp].pEnumerationProperties;
+            Status = SensorsCxSensorInitialize(SensorInstance, &SensorConfig);
+            if (!NT_SUCCESS(Status))
+            {
+                TraceError("ACC %!FUNC! SensorsCxSensorInitialize for amp %u failed %!STATUS!", Amp, Status);
+                DLog("PA: SensorsCxSensorInitialize for amp %u failed %d\n", Amp, Status);//DebugLog
+            }
+        }
+    }
+
+    return Status;
+}
+
+VOID NxpTfa9890Device::DeInit()
+{
+    // Keep learned amp state for the next start of the same connections
+    SaveAmpStates();
+
+    // Stop model polling and release the speaker model stream
+    DestroyStream();
+
+    if (NULL != m_ModelTimer)
+    {
+        WdfObjectDelete(m_ModelTimer);
+        m_ModelTimer = NULL;
+    }
+
+    if (NULL != m_GateTimer)
+    {
+        WdfObjectDelete(m_GateTimer);
+        m_GateTimer = NULL;
+    }
+
+    if (NULL != m_WatchdogTimer)
+    {
+        WdfObjectDelete(m_WatchdogTimer);
+        m_WatchdogTimer = NULL;
+    }
+
+    // End telemetry subscriptions and stop sampling
+    CancelSubscriptions();
+
+    if (NULL != m_SampleTimer)
+    {
+        WdfObjectDelete(m_SampleTimer);
+        m_SampleTimer = NULL;
+    }
+
+    // Write out and close the bus trace and the telemetry history
+    CloseRecorder();
+    CloseHistory();
+
+    // Drop this device's references on the shared DSP images
+    ReleaseImages();
+
+    // Delete lock
+    if (NULL != m_I2CWaitLock)
+    {
+        WdfObjectDelete(m_I2CWaitLock);
+        m_I2CWaitLock = NULL;
+    }
+
+    // Delete the sensor instances, this context's last
+    for (ULONG Amp = TFA9890_MAX_AMPS - 1; Amp > 0; Amp--)
+    {
+        if (NULL != m_AmpSensors[Amp].SensorInstance)
+        {
+            WdfObjectDelete(m_AmpSensors[Amp].SensorInstance);
+            m_AmpSensors[Amp].SensorInstance = NULL;
+        }
+    }
+
+    if (NULL != m_SensorInstance)
+    {
+        WdfObjectDelete(m_SensorInstance);
+    }
+}
+
+// This routine reads the amps whose samples are due, compares threshold
+// and pushes each amp's sample to its sensor instance, then hands the last
+// sample to the subscriptions that are due. Runs on the sample timer, beside
+// the sensor callbacks; m_SampleLock is dropped for the bus read.
+NTSTATUS NxpTfa9890Device::GetData() 
+{
+    TFA9890_TELEMETRY Telemetry;
+    TFA9890_TELEMETRY AmpTelemetry[TFA9890_MAX_AMPS];
+    TFA9890_PERF_MARK Mark;
+    NTSTATUS Status = STATUS_SUCCESS;
+    LONGLONG Now = QpcNow();
+    ULONG Fields = 0;
+    ULONG DueMask = 0;
+    ULONG ReadMask = 0;
+
+    SENSOR_FunctionEnter();
+
+    AcquireSRWLockShared(&m_SampleLock);
+
+    // The history and the subscriptions need every amp, a sensor only its
+    // own. Between bus reads the timer only serves subscriptions.
+    LONGLONG Slack = QpcFromMs(m_SampleTick / 2);
+    bool SharedDue = (0 != m_SampleRate.Demand && Now + Slack >= m_SampleRate.NextReadQpc);
+    ULONG AmpMask = SharedDue ? ((1UL << m_AmpCount) - 1) : 0;
+
+    if (SharedDue)
+    {
+        Fields = m_SampleFields;
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (m_AmpSensors[Amp].Started && Now + Slack >= m_AmpSensors[Amp].Rate.NextReadQpc)
+        {
+            DueMask |= 1UL << Amp;
+            Fields = TFA9890_TELEMETRY_FIELDS_ALL;
+        }
+    }
+
+    ReleaseSRWLockShared(&m_SampleLock);
+
+    AmpMask |= DueMask;
+
+    if (0 != AmpMask)
+    {
+        PerfBegin(&Mark);
+        Status = ReadTelemetry(Fields, AmpMask, &Telemetry, AmpTelemetry, &ReadMask);
+        PerfEnd(TFA9890_PERF_TELEMETRY, &Mark);
+    }
+    else
+    {
+        Status = STATUS_NO_MORE_ENTRIES;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        FILETIME Timestamp = {};
+        GetSystemTimePreciseAsFileTime(&Timestamp);
+
+        if (SharedDue)
+        {
+            // The demand may have gone away while the amps were read
+            AcquireSRWLockExclusive(&m_SampleLock);
+            bool Event = IsTelemetryEvent(&m_SampleRate, &Telemetry,
+                                          TFA9890_SAMPLE_TEMPERATURE_STEP_C, TFA9890_SAMPLE_BATTERY_STEP_V);
+            if (0 != m_SampleRate.Demand)
+            {
+                AdaptInterval(&m_SampleRate, Event);
+                m_SampleRate.NextReadQpc = Now + QpcFromMs(m_SampleRate.Effective);
+            }
+            if (Event)
+            {
+                m_SampleRate.Last = Telemetry;
+                m_SampleRate.FirstSample = false;
+            }
+            ReleaseSRWLockExclusive(&m_SampleLock);
+
+            AcquireSRWLockExclusive(&m_SubscriptionLock);
+            m_Telemetry = Telemetry;
+            m_TelemetryFields = Fields;
+            m_TelemetryTime = (static_cast<LONGLONG>(Timestamp.dwHighDateTime) << 32) | Timestamp.dwLowDateTime;
+            m_TelemetrySequence++;
+            ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+            if (Event && 0 != Telemetry.Faults)
+            {
+                TraceWarning("ACC %!FUNC! Amp faults 0x%x reported", Telemetry.Faults);
+            }
+        }
+
+        for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+        {
+            if (0 != (DueMask & ReadMask & (1UL << Amp)))
+            {
+                ReportAmpSample(Amp, &AmpTelemetry[Amp], &Timestamp, Now);
+            }
+        }
+    }
+
+    DeliverTelemetry();
+    FlushHistory(false);
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Adapt the rate of an amp's sensor to its new sample and push the sample
+// to the sensor when it is an event. With a window configured only closed
+// windows are reported. A sensor stopped while its amp was read gets
+// nothing.
+VOID NxpTfa9890Device::ReportAmpSample(
+    _In_ ULONG Amp,
+    _In_ const TFA9890_TELEMETRY* pTelemetry,   // The amp's sample
+    _In_ const FILETIME* pTimestamp,
+    _In_ LONGLONG Now)                          // QPC time the read was started
+{
+    PTFA9890_AMP_SENSOR pSensor = &m_AmpSensors[Amp];
+    PSENSOR_COLLECTION_LIST pData = pSensor->pSensorData;
+    TFA9890_AGGREGATES Aggregates = {};
+
+    AcquireSRWLockExclusive(&m_SampleLock);
+
+    if (!pSensor->Started)
+    {
+        ReleaseSRWLockExclusive(&m_SampleLock);
+        return;
+    }
+
+    // Aggregation needs the full rate whether or not the readings move
+    bool Event = IsTelemetryEvent(&pSensor->Rate, pTelemetry, pSensor->TemperatureStepC, pSensor->BatteryStepV);
+    bool Aggregating = (0 != m_AggregateWindow);
+    if (Aggregating)
+    {
+        AggregateTemperature(Amp, pTelemetry->TemperatureC);
+    }
+    bool WindowDone = Aggregating && CloseAggregateWindow(Amp, &Aggregates);
+    AdaptInterval(&pSensor->Rate, Event || Aggregating);
+    pSensor->Rate.NextReadQpc = Now + QpcFromMs(pSensor->Rate.Effective);
+
+    ULONG Effective = pSensor->Rate.Effective;
+
+    if (Event)
+    {
+        pSensor->Rate.Last = *pTelemetry;
+        pSensor->Rate.FirstSample = false;
+    }
+
+    ReleaseSRWLockExclusive(&m_SampleLock);
+
+    if (Event && 0 != pTelemetry->Faults)
+    {
+        TraceWarning("ACC %!FUNC! Amp %u faults 0x%x reported", Amp, pTelemetry->Faults);
+    }
+
+    if (!(Aggregating ? WindowDone : Event))
+    {
+        return;
+    }
+
+    InitPropVariantFromFileTime(pTimestamp, &(pData->List[SENSOR_DATA_TIMESTAMP].Value));
+    InitPropVariantFromFloat(pTelemetry->TemperatureC, &(pData->List[SENSOR_DATA_TEMPERATURE_C].Value));
+    InitPropVariantFromFloat(pTelemetry->BatteryV, &(pData->List[SENSOR_DATA_BATTERY_V].Value));
+    InitPropVariantFromUInt32(pTelemetry->Faults, &(pData->List[SENSOR_DATA_FAULTS].Value));
+    InitPropVariantFromUInt32(Effective, &(pData->List[SENSOR_DATA_INTERVAL_MS].Value));
+    InitPropVariantFromUInt32(Aggregates.Samples, &(pData->List[SENSOR_DATA_WINDOW_SAMPLES].Value));
+    SetWindowStats(pData, SENSOR_DATA_TEMPERATURE_MIN, &Aggregates.Temperature);
+    SetWindowStats(pData, SENSOR_DATA_IMPEDANCE_MIN, &Aggregates.Impedance);
+    SetWindowStats(pData, SENSOR_DATA_EXCURSION_MIN, &Aggregates.Excursion);
+
+    SensorsCxSensorDataReady(pSensor->SensorInstance, pData);
+}
+
+// Called by Sensor CLX to begin continously sampling the sensor.
+NTSTATUS NxpTfa9890Device::OnStart(
+    _In_ SENSOROBJECT SensorInstance)    // Sensor device object
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Sensor parameter is invalid. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    // Every start reports its first sample and samples at the client's
+    // interval until the readings settle
+    PTFA9890_AMP_SENSOR pSensor = &pDevice->m_AmpSensors[Amp];
+    AcquireSRWLockExclusive(&pDevice->m_SampleLock);
+    RtlZeroMemory(&pSensor->Rate, sizeof(pSensor->Rate));
+    pSensor->Rate.FirstSample = true;
+    pSensor->Started = true;
+    pDevice->RestartAmpSensor(Amp);
+    ReleaseSRWLockExclusive(&pDevice->m_SampleLock);
+    pDevice->ScheduleSample();
+
+    // An aggregating sensor needs its amp's model frames
+    if (0 != pDevice->m_AggregateWindow && pDevice->m_PoweredOn)
+    {
+        pDevice->SuspendModelPolling();
+        pDevice->ResumeModelPolling();
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to stop continously sampling the sensor.
+NTSTATUS NxpTfa9890Device::OnStop(
+    _In_ SENSOROBJECT SensorInstance)   // Sensor device object
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Sensor parameter is invalid. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    // The amp is no longer read for this sensor; the history and the
+    // subscriptions keep sampling, if there are any
+    PTFA9890_AMP_SENSOR pSensor = &pDevice->m_AmpSensors[Amp];
+    AcquireSRWLockExclusive(&pDevice->m_SampleLock);
+    pSensor->Started = false;
+    pDevice->RestartAmpSensor(Amp);
+    TFA9890_SAMPLE_RATE Rate = pSensor->Rate;
+    ULONG Interval = pSensor->Interval;
+    ReleaseSRWLockExclusive(&pDevice->m_SampleLock);
+    pDevice->ScheduleSample();
+
+    if (0 != pDevice->m_AggregateWindow && pDevice->m_PoweredOn)
+    {
+        pDevice->SuspendModelPolling();
+        pDevice->ResumeModelPolling();
+    }
+
+    TraceInformation("ACC %!FUNC! Amp %u: %u samples at a mean interval of %u ms (client %u ms), %u backoffs, %u ramp-ups",
+                     Amp,
+                     Rate.Count,
+                     (0 != Rate.Count) ? static_cast<ULONG>(Rate.IntervalTotal / Rate.Count) : 0,
+                     Interval,
+                     Rate.Backoffs,
+                     Rate.RampUps);
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to get supported data fields. The typical usage is to call
+// this function once with buffer pointer as NULL to acquire the required size 
+// for the buffer, allocate buffer, then call the function again to retrieve 
+// sensor information.
+NTSTATUS NxpTfa9890Device::OnGetSupportedDataFields(
+    _In_ SENSOROBJECT SensorInstance,          // Sensor device object
+    _Inout_opt_ PSENSOR_PROPERTY_LIST pFields, // Pointer to a list of supported properties
+    _Out_ PULONG pSize)                        // Number of bytes for the list of supported properties
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Size = SENSOR_PROPERTY_LIST_SIZE(SENSOR_DATA_COUNT);
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice || nullptr == pSize)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Invalid parameters! %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    *pSize = Size;
+    if (nullptr == pFields)
+    {
+        // Just return size
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    if (pFields->AllocatedSizeInBytes < Size)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        TraceError("ACC %!FUNC! Buffer is too small. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    SENSOR_PROPERTY_LIST_INIT(pFields, Size);
+    pFields->Count = SENSOR_DATA_COUNT;
+    for (ULONG i = 0; i < SENSOR_DATA_COUNT; i++)
+    {
+        pFields->List[i] = pDevice->m_AmpSensors[Amp].pSensorData->List[i].Key;
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to get sensor properties. The typical usage is to call
+// this function once with buffer pointer as NULL to acquire the required size 
+// for the buffer, allocate buffer, then call the function again to retrieve 
+// sensor information.
+NTSTATUS NxpTfa9890Device::OnGetProperties(
+    _In_ SENSOROBJECT SensorInstance,                // Sensor device object
+    _Inout_opt_ PSENSOR_COLLECTION_LIST pProperties, // Pointer to a list of sensor properties
+    _Out_ PULONG pSize)                              // Number of bytes for the list of sensor properties
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to get data field properties. The typical usage is to call
+// this function once with buffer pointer as NULL to acquire the required size 
+// for the buffer, allocate buffer, then call the function again to retrieve 
+// sensor information.
+NTSTATUS NxpTfa9890Device::OnGetDataFieldProperties(
+    _In_ SENSOROBJECT SensorInstance,                   // Sensor device object
+    _In_ const PROPERTYKEY *pDataField,                 // Pointer to the propertykey of requested property
+    _Inout_opt_ PSENSOR_COLLECTION_LIST pProperties,    // Pointer to a list of sensor properties
+    _Out_ PULONG pSize)                                 // Number of bytes for the list of sensor properties
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to get sampling rate of the sensor.
+NTSTATUS NxpTfa9890Device::OnGetDataInterval(
+    _In_ SENSOROBJECT SensorInstance,   // Sensor device object
+    _Out_ PULONG pDataRateMs)           // Sampling rate in milliseconds
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice || nullptr == pDataRateMs)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Invalid parameters! %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    // The client's interval; the one in effect is reported with each sample
+    AcquireSRWLockShared(&pDevice->m_SampleLock);
+    *pDataRateMs = pDevice->m_AmpSensors[Amp].Interval;
+    ReleaseSRWLockShared(&pDevice->m_SampleLock);
+
+	SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to set sampling rate of the sensor.
+NTSTATUS NxpTfa9890Device::OnSetDataInterval(
+    _In_ SENSOROBJECT SensorInstance, // Sensor device object
+    _In_ ULONG DataRateMs)            // Sampling rate in milliseconds
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Sensor parameter is invalid. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    // The client's interval is the fastest the sampler reads the amp for
+    // it. A new one takes effect at once.
+    AcquireSRWLockExclusive(&pDevice->m_SampleLock);
+    pDevice->m_AmpSensors[Amp].Interval = max(DataRateMs, static_cast<ULONG>(TFA9890_SAMPLE_MIN_INTERVAL_MS));
+    pDevice->RestartAmpSensor(Amp);
+    ReleaseSRWLockExclusive(&pDevice->m_SampleLock);
+    pDevice->ScheduleSample();
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to get data thresholds. The typical usage is to call
+// this function once with buffer pointer as NULL to acquire the required size
+// for the buffer, allocate buffer, then call the function again to retrieve
+// sensor information.
+NTSTATUS NxpTfa9890Device::OnGetDataThresholds(
+    _In_ SENSOROBJECT SensorInstance,                   // Sensor Device Object
+    _Inout_opt_ PSENSOR_COLLECTION_LIST pThresholds,    // Pointer to a list of sensor thresholds
+    _Out_ PULONG pSize)                                 // Number of bytes for the list of sensor thresholds
+{
+
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice || nullptr == pSize)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Invalid parameters! %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    PSENSOR_COLLECTION_LIST pSensorThresholds = pDevice->m_AmpSensors[Amp].pThresholds;
+
+    *pSize = CollectionsListGetMarshalledSize(pSensorThresholds);
+    if (nullptr == pThresholds)
+    {
+        // Just return size
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    if (pThresholds->AllocatedSizeInBytes < *pSize)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        TraceError("ACC %!FUNC! Buffer is too small. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    Status = CollectionsListCopyAndMarshall(pThresholds, pSensorThresholds);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! CollectionsListCopyAndMarshall failed %!STATUS!", Status);
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to set data thresholds. Each amp's sensor keeps its
+// own; thresholds not in the list are left as they are.
+NTSTATUS NxpTfa9890Device::OnSetDataThresholds(
+    _In_ SENSOROBJECT SensorInstance,           // Sensor Device Object
+    _In_ PSENSOR_COLLECTION_LIST pThresholds)   // Pointer to a list of sensor thresholds
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice || nullptr == pThresholds)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Invalid parameters! %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    PTFA9890_AMP_SENSOR pSensor = &pDevice->m_AmpSensors[Amp];
+    AcquireSRWLockShared(&pDevice->m_SampleLock);
+    float TemperatureStepC = pSensor->TemperatureStepC;
+    float BatteryStepV = pSensor->BatteryStepV;
+    ReleaseSRWLockShared(&pDevice->m_SampleLock);
+
+    PropKeyFindKeyGetFloat(pThresholds, &PKEY_SensorData_CustomValue1, &TemperatureStepC);
+    PropKeyFindKeyGetFloat(pThresholds, &PKEY_SensorData_CustomValue2, &BatteryStepV);
+
+    if (!(TemperatureStepC >= 0.0f) || !(BatteryStepV >= 0.0f))
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Amp %u thresholds must not be negative %!STATUS!", Amp, Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    // The next sample is compared with the new thresholds
+    AcquireSRWLockExclusive(&pDevice->m_SampleLock);
+    pSensor->TemperatureStepC = TemperatureStepC;
+    pSensor->BatteryStepV = BatteryStepV;
+    ReleaseSRWLockExclusive(&pDevice->m_SampleLock);
+    PropKeyFindKeySetFloat(pSensor->pThresholds, &PKEY_SensorData_CustomValue1, TemperatureStepC);
+    PropKeyFindKeySetFloat(pSensor->pThresholds, &PKEY_SensorData_CustomValue2, BatteryStepV);
+
+    TraceInformation("ACC %!FUNC! Amp %u thresholds %d mC, %d mV", Amp,
+                     static_cast<LONG>(TemperatureStepC * 1000), static_cast<LONG>(BatteryStepV * 1000));
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Called by Sensor CLX to handle IOCTLs that clx does not support. The
+// driver's private IOCTLs (see Tfa9890Ioctl.h) are completed here, with
+// their status, and STATUS_SUCCESS is returned; anything else is failed
+// back to the clx uncompleted.
+NTSTATUS NxpTfa9890Device::OnIoControl(
+    _In_ SENSOROBJECT SensorInstance,     // WDF queue object
+    _In_ WDFREQUEST Request,              // WDF request object
+    _In_ size_t /*OutputBufferLength*/,   // number of bytes to retrieve from output buffer
+    _In_ size_t /*InputBufferLength*/,    // number of bytes to retrieve from input buffer
+    _In_ ULONG IoControlCode)             // IOCTL control code
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    size_t Information = 0;
+    TFA9890_PERF_MARK Mark;
+
+    SENSOR_FunctionEnter();
+
+    // The private IOCTLs address amps by mask, whichever sensor they come to
+    ULONG Amp = 0;
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromAmpSensor(SensorInstance, &Amp);
+    if (nullptr == pDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! Sensor parameter is invalid. Failed %!STATUS!", Status);
+        SENSOR_FunctionExit(Status);
+        return Status;
+    }
+
+    pDevice->PerfBegin(&Mark);
+
+    switch (IoControlCode)
+    {
+        case IOCTL_TFA9890_STAGE_REGISTERS:
+            Status = pDevice->IoctlStageRegisters(Request);
+            break;
+
+        case IOCTL_TFA9890_COMMIT_STAGED:
+            Status = pDevice->IoctlCommitStaged(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_DISCARD_STAGED:
+            Status = pDevice->IoctlDiscardStaged();
+            break;
+
+        case IOCTL_TFA9890_SET_EQ:
+            Status = pDevice->IoctlSetEq(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_SWITCH_BANK:
+            Status = pDevice->IoctlSwitchBank(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_MAP_STREAM:
+            Status = pDevice->IoctlMapStream(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_STOP_STREAM:
+            Status = pDevice->IoctlStopStream();
+            break;
+
+        case IOCTL_TFA9890_DUMP:
+            Status = pDevice->IoctlDump(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_GET_HEALTH:
+            Status = pDevice->IoctlGetHealth(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_STREAM_HINT:
+            Status = pDevice->IoctlStreamHint(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_GET_IMAGE_CACHE:
+            Status = pDevice->IoctlGetImageCache(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_SUBSCRIBE_TELEMETRY:
+            Status = pDevice->IoctlSubscribeTelemetry(Request);
+            break;
+
+        case IOCTL_TFA9890_READ_TELEMETRY:
+            Status = pDevice->IoctlReadTelemetry(Request);
+            break;
+
+        case IOCTL_TFA9890_GET_WATCHDOG:
+            Status = pDevice->IoctlGetWatchdog(Request, &Information);
+            break;
+
+        case IOCTL_TFA9890_GET_PERF:
+            Status = pDevice->IoctlGetPerf(Request, &Information);
+            break;
+
+        default:
+            Status = STATUS_NOT_SUPPORTED;
+            SENSOR_FunctionExit(Status);
+            return Status;
+    }
+
+    // Telemetry reads are completed when their sample is handed out
+    if (STATUS_PENDING != Status)
+    {
+        WdfRequestCompleteWithInformation(Request, Status, Information);
+        pDevice->PerfEnd(TFA9890_PERF_IOCTL, &Mark);
+    }
+
+    SENSOR_FunctionExit(Status);
+
+    // The request is completed or kept by the driver either way; a failure
+    // returned here would have the clx complete it a second time
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,313 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the implementation of the register shadow and of
+//    the two-phase commit that applies staged settings to all amplifiers
+//    in one tightly clustered burst.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Commit.tmh"
+
+
+// A run of contiguous staged registers on one amplifier, written as a
+// single auto-incrementing transaction
+typedef struct _COMMIT_RUN
+{
+    BYTE    Register;
+    ULONG   First;          // Index of the first staged entry of the run
+    ULONG   Count;          // Number of registers in the run
+} COMMIT_RUN;
+
+// Record data written to the amplifier in its register shadow. Data is a
+// sequence of 16-bit register values starting at Register.
+VOID NxpTfa9890Device::UpdateShadow(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier that was written
+    _In_ BYTE Register,                             // First register written
+    _In_reads_bytes_(Length) const BYTE* pData,     // Data that was written
+    _In_ ULONG Length)                              // Number of bytes written
+{
+    const WORD* pValues = reinterpret_cast<const WORD*>(pData);
+
+    for (ULONG i = 0; i < Length / sizeof(WORD) && Register + i < TFA9890_REGISTER_COUNT; i++)
+    {
+        ULONG Index = Register + i;
+        pAmp->Shadow[Index] = pValues[i];
+        pAmp->ShadowValid[Index / 32] |= (1UL << (Index % 32));
+    }
+}
+
+// Returns true if the shadow holds Value for Register
+inline bool IsShadowed(
+    _In_ PTFA9890_AMP pAmp,
+    _In_ BYTE Register,
+    _In_ WORD Value)
+{
+    return (0 != (pAmp->ShadowValid[Register / 32] & (1UL << (Register % 32)))) &&
+           (pAmp->Shadow[Register] == Value);
+}
+
+// Stage a register change on every amplifier selected by AmpMask. Staged
+// entries are kept sorted by register; staging the same register again
+// replaces the earlier value. Changes that match the shadow are dropped.
+// The change is staged on all selected amps or, if one is full, on none.
+// The read-only status registers and the DSP window are refused: a commit
+// bursts adjacent entries, which in the window would stream into DSP
+// memory.
+NTSTATUS NxpTfa9890Device::StageRegister(
+    _In_ ULONG AmpMask,     // Bit n selects amplifier n
+    _In_ BYTE Register,     // Register address
+    _In_ WORD Value)        // Register value
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Inserted = 0;                         // Bit n: entry added on amp n
+    ULONG Replaced = 0;                         // Bit n: entry of amp n overwritten
+    WORD Previous[TFA9890_MAX_AMPS] = {};       // Overwritten values
+    ULONG Amp = 0;
+
+    if (0 == AmpMask || 0 != (AmpMask >> m_AmpCount) ||
+        !IsRestorable(Register) || Register <= TFA9890_TEMPERATURE)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for (Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        ULONG i = 0;
+
+        if (0 == (AmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        while (i < pAmp->StagedCount && pAmp->Staged[i].Register < Register)
+        {
+            i++;
+        }
+
+        if (i < pAmp->StagedCount && pAmp->Staged[i].Register == Register)
+        {
+            Previous[Amp] = pAmp->Staged[i].Value;
+            Replaced |= 1UL << Amp;
+            pAmp->Staged[i].Value = Value;
+            continue;
+        }
+
+        if (IsShadowed(pAmp, Register, Value))
+        {
+            continue;
+        }
+
+        if (pAmp->StagedCount >= TFA9890_MAX_STAGED)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            TraceError("ACC %!FUNC! Amp %u staging area full %!STATUS!", Amp, Status);
+            DLog("PA: Amp %u staging area full %d\n", Amp, Status);//DebugLog
+            break;
+        }
+
+        RtlMoveMemory(&pAmp->Staged[i + 1], &pAmp->Staged[i], (pAmp->StagedCount - i) * sizeof(REGISTER_SETTING));
+        pAmp->Staged[i].Register = Register;
+        pAmp->Staged[i].Value = Value;
+        pAmp->Staged[i].Flags = 0;
+        pAmp->StagedCount++;
+        Inserted |= 1UL << Amp;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    // Take the change back from the amps it was already staged on
+    for (Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        ULONG i = 0;
+
+        if (0 == ((Inserted | Replaced) & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        while (pAmp->Staged[i].Register != Register)
+        {
+            i++;
+        }
+
+        if (0 != (Replaced & (1UL << Amp)))
+        {
+            pAmp->Staged[i].Value = Previous[Amp];
+            continue;
+        }
+
+        pAmp->StagedCount--;
+        RtlMoveMemory(&pAmp->Staged[i], &pAmp->Staged[i + 1], (pAmp->StagedCount - i) * sizeof(REGISTER_SETTING));
+    }
+
+    return Status;
+}
+
+VOID NxpTfa9890Device::DiscardStaged()
+{
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        m_Amps[Amp].StagedCount = 0;
+    }
+}
+
+// Apply every staged change. All buffers are prepared up front and the bus
+// of every involved amplifier is held for the whole burst, so nothing else
+// can be interleaved. Runs are split wherever a run of any amp starts or
+// ends, so the amps' runs cover the same registers, and applied in rounds
+// by register: each round writes one register range to every amp that
+// staged it, back to back. The skew of a round is the time between the
+// first and the last amp completing it.
+NTSTATUS NxpTfa9890Device::CommitStaged(
+    _In_ ULONG SkewBudgetUs,                // Skew budget, 0 selects the configured budget
+    _Out_ PTFA9890_COMMIT_OUTPUT pResult)   // Commit statistics
+{
+    COMMIT_RUN Runs[TFA9890_MAX_AMPS][TFA9890_MAX_STAGED];
+    WORD Data[TFA9890_MAX_AMPS][TFA9890_MAX_STAGED];
+    ULONG RunCount[TFA9890_MAX_AMPS] = {};
+    ULONG Cursor[TFA9890_MAX_AMPS] = {};
+    ULONG Boundaries[(TFA9890_REGISTER_COUNT + 1 + 31) / 32] = {};
+    LONGLONG MaxSkew = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    RtlZeroMemory(pResult, sizeof(*pResult));
+    pResult->SkewBudgetUs = (0 != SkewBudgetUs) ? SkewBudgetUs : m_CommitSkewBudgetUs;
+
+    // Phase 1: find where the contiguous runs of staged registers of every
+    // amp start and end
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        for (ULONG i = 0; i < pAmp->StagedCount; i++)
+        {
+            ULONG Register = pAmp->Staged[i].Register;
+
+            if (0 == i || Register != pAmp->Staged[i - 1].Register + 1U)
+            {
+                Boundaries[Register / 32] |= 1UL << (Register % 32);
+            }
+            if (i + 1 == pAmp->StagedCount || pAmp->Staged[i + 1].Register != Register + 1)
+            {
+                Boundaries[(Register + 1) / 32] |= 1UL << ((Register + 1) % 32);
+            }
+        }
+    }
+
+    // and coalesce each amp's staged registers into runs split at all of them
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        for (ULONG i = 0; i < pAmp->StagedCount; i++)
+        {
+            ULONG Register = pAmp->Staged[i].Register;
+
+            Data[Amp][i] = pAmp->Staged[i].Value;
+
+            if (0 != (Boundaries[Register / 32] & (1UL << (Register % 32))))
+            {
+                COMMIT_RUN* pRun = &Runs[Amp][RunCount[Amp]++];
+                pRun->Register = static_cast<BYTE>(Register);
+                pRun->First = i;
+                pRun->Count = 0;
+            }
+
+            Runs[Amp][RunCount[Amp] - 1].Count++;
+        }
+    }
+
+    // Phase 2: hold the bus of every involved amp and apply the runs
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (RunCount[Amp] > 0)
+        {
+            m_Amps[Amp].Scheduler.Acquire(TFA9890_CMD_CLASS_GAIN);
+        }
+    }
+
+    for (ULONG Register = 0; Register < TFA9890_REGISTER_COUNT; Register++)
+    {
+        LONGLONG First = 0;
+        LONGLONG Last = 0;
+
+        if (0 == (Boundaries[Register / 32] & (1UL << (Register % 32))))
+        {
+            continue;
+        }
+
+        for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+        {
+            if (Cursor[Amp] >= RunCount[Amp] || Runs[Amp][Cursor[Amp]].Register != Register)
+            {
+                continue;
+            }
+
+            PTFA9890_AMP pAmp = &m_Amps[Amp];
+            COMMIT_RUN* pRun = &Runs[Amp][Cursor[Amp]++];
+            BYTE* pRunData = reinterpret_cast<BYTE*>(&Data[Amp][pRun->First]);
+            ULONG Length = pRun->Count * sizeof(WORD);
+
+            NTSTATUS WriteStatus = BusWrite(pAmp, pRun->Register, pRunData, Length);
+            LONGLONG Done = QpcNow();
+
+            pResult->WritesApplied++;
+            if (NT_SUCCESS(WriteStatus))
+            {
+                UpdateShadow(pAmp, pRun->Register, pRunData, Length);
+            }
+            else
+            {
+                pAmp->Recovery.Failures++;
+                Status = NT_SUCCESS(Status) ? WriteStatus : Status;
+                TraceError("ACC %!FUNC! Amp %u commit to 0x%02x failed %!STATUS!", Amp, pRun->Register, WriteStatus);
+                DLog("PA: Amp %u commit to 0x%02x failed %d\n", Amp, pRun->Register, WriteStatus);//DebugLog
+            }
+
+            First = (0 == First) ? Done : First;
+            Last = Done;
+        }
+
+        MaxSkew = max(MaxSkew, Last - First);
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (RunCount[Amp] > 0)
+        {
+            m_Amps[Amp].Scheduler.Release();
+        }
+    }
+
+    DiscardStaged();
+
+    // Report the skew
+    pResult->Status = Status;
+    pResult->SkewUs = QpcToUs(MaxSkew);
+
+    m_CommitCount++;
+    m_MaxCommitSkewUs = max(m_MaxCommitSkewUs, pResult->SkewUs);
+    if (pResult->SkewUs > pResult->SkewBudgetUs)
+    {
+        m_CommitBudgetExceeded++;
+        TraceWarning("ACC %!FUNC! Commit skew %u us exceeds budget %u us", pResult->SkewUs, pResult->SkewBudgetUs);
+        DLog("PA: Commit skew %u us exceeds budget %u us\n", pResult->SkewUs, pResult->SkewBudgetUs);//DebugLog
+    }
+
+    pResult->MaxSkewUs = m_MaxCommitSkewUs;
+    pResult->Commits = m_CommitCount;
+    pResult->BudgetExceeded = m_CommitBudgetExceeded;
+
+    return Status;
+}
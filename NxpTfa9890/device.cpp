@@ -1,566 +1,1020 @@
-//Copyright (C) Microsoft Corporation, All Rights Reserved.
-//
-//Abstract:
-//
-//    This module contains the implementation of WDF callback functions 
-//    for the NxpTfa9890 driver.
-//
-//Environment:
-//
-//   Windows User-Mode Driver Framework (UMDF)
-
-#include "Device.h"
-
-#include "Device.tmh"
-
-
-// This routine is the AddDevice entry point for the custom sensor client
-// driver. This routine is called by the framework in response to AddDevice
-// call from the PnP manager. It will create and initialize the device object
-// to represent a new instance of the sensor client.
-NTSTATUS NxpTfa9890Device::OnDeviceAdd(
-    _In_    WDFDRIVER /* Driver */,         // Supplies a handle to the driver object created in DriverEntry
-    _Inout_ PWDFDEVICE_INIT pDeviceInit) // Supplies a pointer to a framework-allocated WDFDEVICE_INIT structure
-{
-    WDFDEVICE Device = nullptr;
-
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter OnDeviceAdd.\n");
-
-	WdfDeviceInitSetPowerPolicyOwnership(pDeviceInit, true);
-
-    WDF_OBJECT_ATTRIBUTES FdoAttributes;
-    WDF_OBJECT_ATTRIBUTES_INIT(&FdoAttributes);
-
-    // Initialize FDO (functional device object) attributes and set up file object with sensor extension
-	NTSTATUS Status = SensorsCxDeviceInitConfig(pDeviceInit, &FdoAttributes, 0);
-    if (!NT_SUCCESS(Status))
-    {
-        TraceError("ACC %!FUNC! SensorsCxDeviceInitConfig failed %!STATUS!", Status);
-		DLog("PA: SensorsCxDeviceInitConfig failed %d\n", Status);
-    }
-
-    else // if (NT_SUCCESS(Status))
-    {
-        // Register the PnP callbacks with the framework.
-        WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
-        WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&pnpPowerCallbacks);
-        pnpPowerCallbacks.EvtDevicePrepareHardware = NxpTfa9890Device::OnPrepareHardware;
-        pnpPowerCallbacks.EvtDeviceReleaseHardware = NxpTfa9890Device::OnReleaseHardware;
-        pnpPowerCallbacks.EvtDeviceD0Entry = NxpTfa9890Device::OnD0Entry;
-        pnpPowerCallbacks.EvtDeviceD0Exit = NxpTfa9890Device::OnD0Exit;
-    
-		WdfDeviceInitSetPnpPowerEventCallbacks(pDeviceInit, &pnpPowerCallbacks);
-    
-        // Call the framework to create the device
-		Status = WdfDeviceCreate(&pDeviceInit, &FdoAttributes, &Device);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! WdfDeviceCreate failed %!STATUS!", Status);
-			DLog("PA: WdfDeviceCreate failed %d\n", Status);//DebugLog
-        }
-    }
-
-    if (NT_SUCCESS(Status))
-    {
-        // Register CLX callback function pointers
-        SENSOR_CONTROLLER_CONFIG SensorConfig;
-        SENSOR_CONTROLLER_CONFIG_INIT(&SensorConfig);
-        SensorConfig.DriverIsPowerPolicyOwner = WdfUseDefault;
-    
-        SensorConfig.EvtSensorStart = NxpTfa9890Device::OnStart;
-        SensorConfig.EvtSensorStop = NxpTfa9890Device::OnStop;
-        SensorConfig.EvtSensorGetSupportedDataFields = NxpTfa9890Device::OnGetSupportedDataFields;
-        SensorConfig.EvtSensorGetDataInterval = NxpTfa9890Device::OnGetDataInterval;
-        SensorConfig.EvtSensorSetDataInterval = NxpTfa9890Device::OnSetDataInterval;
-        SensorConfig.EvtSensorGetDataFieldProperties = NxpTfa9890Device::OnGetDataFieldProperties;
-        SensorConfig.EvtSensorGetDataThresholds = NxpTfa9890Device::OnGetDataThresholds;
-        SensorConfig.EvtSensorSetDataThresholds = NxpTfa9890Device::OnSetDataThresholds;
-        SensorConfig.EvtSensorGetProperties = NxpTfa9890Device::OnGetProperties;
-        SensorConfig.EvtSensorDeviceIoControl = NxpTfa9890Device::OnIoControl;
-    
-        // Initialize the sensor device with the Sensor CLX
-        // This lets the CLX call the above callbacks when
-        // necessary and allows applications to retrieve and
-        // set device data.
-        Status = SensorsCxDeviceInitialize(Device, &SensorConfig);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! SensorsCxDeviceInitialize failed %!STATUS!", Status);
-			DLog("PA: SensorsCxDeviceInitialize failed %d\n", Status);//DebugLog
-        }
-    }
-
-    // Ensure device is disable-able
-    // By default, devices enumerated by ACPI are not disable-able
-    // Our accelerometer is enumerated by the ACPI so we must
-    // explicitly make it disable-able.
-    if (NT_SUCCESS(Status))
-    {
-        WDF_DEVICE_STATE DeviceState;
-        WDF_DEVICE_STATE_INIT(&DeviceState);
-        DeviceState.NotDisableable = WdfFalse;
-        WdfDeviceSetDeviceState(Device, &DeviceState);
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// This routine is called by the framework when the PnP manager sends an
-// IRP_MN_START_DEVICE request to the driver stack. This routine is
-// responsible for performing operations that are necessary to make the
-// driver's device operational (for e.g. mapping the hardware resources
-// into memory).
-NTSTATUS NxpTfa9890Device::OnPrepareHardware(
-    _In_ WDFDEVICE Device,                  // Supplies a handle to the framework device object
-    _In_ WDFCMRESLIST ResourcesRaw,         // Supplies a handle to a collection of framework resource
-                                            // objects. This collection identifies the raw (bus-relative) hardware
-                                            // resources that have been assigned to the device.
-    _In_ WDFCMRESLIST ResourcesTranslated)  // Supplies a handle to a collection of framework
-                                            // resource objects. This collection identifies the translated
-                                            // (system-physical) hardware resources that have been assigned to the
-                                            // device. The resources appear from the CPU's point of view.
-{
-    PNxpTfa9890Device pDevice = nullptr;
-    
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter OnPrepareHardware.\n");
-
-    // Create WDFOBJECT for the sensor
-    WDF_OBJECT_ATTRIBUTES sensorAttributes;
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&sensorAttributes, NxpTfa9890Device);
-
-    // Register sensor instance with clx
-    SENSOROBJECT SensorInstance = NULL;
-    NTSTATUS Status = SensorsCxSensorCreate(Device, &sensorAttributes, &SensorInstance);
-    if (!NT_SUCCESS(Status))
-    {
-        TraceError("ACC %!FUNC! SensorsCxSensorCreate failed %!STATUS!", Status);
-		DLog("PA: SensorsCxSensorCreate failed %d\n", Status);//DebugLog
-    }
-
-    else // if (NT_SUCCESS(Status))
-    {    
-		pDevice = GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
-		if (nullptr == pDevice)
-        {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            TraceError("ACC %!FUNC! SensorsCxSensorCreate failed %!STATUS!", Status);
-			DLog("PA: SensorsCxSensorCreate failed %d\n", Status);//DebugLog
-        }
-    }
-
-    // Fill out sensor context
-    if (NT_SUCCESS(Status))
-    {
-		Status = pDevice->Initialize(Device, SensorInstance);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! Initialize device object failed %!STATUS!", Status);
-			DLog("PA: Initialize device object failed failed %d\n", Status);//DebugLog        
-		}
-    }
-        
-    // Initialize sensor instance with clx
-    if (NT_SUCCESS(Status))
-    {
-        SENSOR_CONFIG SensorConfig;
-        SENSOR_CONFIG_INIT(&SensorConfig);
-		SensorConfig.pEnumerationList = pDevice->m_pEnumerationProperties;
-        Status = SensorsCxSensorInitialize(SensorInstance, &SensorConfig);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! SensorsCxSensorInitialize failed %!STATUS!", Status);
-			DLog("PA: SensorsCxSensorInitialize failed %d\n", Status);//DebugLog
-        }
-    }
-    
-    // ACPI and IoTarget configuration
-    if (NT_SUCCESS(Status))
-    {
-		Status = pDevice->ConfigureIoTarget(ResourcesRaw, ResourcesTranslated);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! Failed to configure IoTarget %!STATUS!", Status);
-			DLog("PA: Failed to configure IoTarget %d\n", Status);//DebugLog        
-		}
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// This routine is called by the framework when the PnP manager is revoking
-// ownership of our resources. This may be in response to either
-// IRP_MN_STOP_DEVICE or IRP_MN_REMOVE_DEVICE. This routine is responsible for
-// performing cleanup of resources allocated in PrepareHardware callback.
-// This callback is invoked before passing  the request down to the lower driver.
-// This routine will also be invoked by the framework if the prepare hardware
-// callback returns a failure.
-NTSTATUS NxpTfa9890Device::OnReleaseHardware(
-    _In_ WDFDEVICE Device,                      // Supplies a handle to the framework device object
-    _In_ WDFCMRESLIST /*ResourcesTranslated*/)  // Supplies a handle to a collection of framework
-                                                // resource objects. This collection identifies the translated
-                                                // (system-physical) hardware resources that have been assigned to the
-                                                // device. The resources appear from the CPU's point of view.
-{
-    PNxpTfa9890Device pAccDevice = nullptr;
-
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter OnReleaseHardware.\n");
-
-    // Get the sensor instance
-    ULONG SensorInstanceCount = 1;
-    SENSOROBJECT SensorInstance = NULL;
-    NTSTATUS Status = SensorsCxDeviceGetSensorList(Device, &SensorInstance, &SensorInstanceCount);
-    if (!NT_SUCCESS(Status) || 0 == SensorInstanceCount || NULL == SensorInstance)
-    {
-        Status = STATUS_INVALID_PARAMETER;
-        TraceError("ACC %!FUNC! SensorsCxDeviceGetSensorList failed %!STATUS!", Status);
-		DLog("PA: SensorsCxDeviceGetSensorList failed %d\n", Status);//DebugLog
-	}
-
-    else // if (NT_SUCCESS(Status))
-    {
-        pAccDevice = GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
-        if (nullptr == pAccDevice)
-        {
-            Status = STATUS_INVALID_PARAMETER;
-            TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromSensorInstance failed %!STATUS!", Status);
-			DLog("PA: GetNxpTfa9890ContextFromSensorInstance failed %d\n", Status);//DebugLog
-		}
-    }
-
-    if (NT_SUCCESS(Status))
-    {
-        pAccDevice->DeInit();
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// This routine is invoked by the framework to program the device to goto 
-// D0, which is the working state. The framework invokes callback every
-// time the hardware needs to be (re-)initialized.  This includes after
-// IRP_MN_START_DEVICE, IRP_MN_CANCEL_STOP_DEVICE, IRP_MN_CANCEL_REMOVE_DEVICE,
-// and IRP_MN_SET_POWER-D0.
-NTSTATUS NxpTfa9890Device::OnD0Entry(
-    _In_  WDFDEVICE Device,                         // Supplies a handle to the framework device object
-    _In_  WDF_POWER_DEVICE_STATE /*PreviousState*/) // WDF_POWER_DEVICE_STATE-typed enumerator that identifies
-                                                    // the device power state that the device was in before this transition to D0
-{
-    PNxpTfa9890Device pAccDevice = nullptr;
-
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter OnD0Entry.\n");
-
-    // Get the sensor instance
-    ULONG SensorInstanceCount = 1;
-    SENSOROBJECT SensorInstance = NULL;
-    NTSTATUS Status = SensorsCxDeviceGetSensorList(Device, &SensorInstance, &SensorInstanceCount);
-    if (!NT_SUCCESS(Status) || 0 == SensorInstanceCount || NULL == SensorInstance)
-    {
-        Status = STATUS_INVALID_PARAMETER;
-        TraceError("ACC %!FUNC! SensorsCxDeviceGetSensorList failed %!STATUS!", Status);
-		DLog("PA: SensorsCxDeviceGetSensorList failed %d\n", Status);//DebugLog
-	}
-
-    // Get the device context
-    else // if (NT_SUCCESS(Status))
-    {
-        pAccDevice = GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
-        if (nullptr == pAccDevice)
-        {
-            Status = STATUS_INVALID_PARAMETER;
-            TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromSensorInstance failed %!STATUS!", Status);
-			DLog("PA: GetNxpTfa9890ContextFromSensorInstance failed %d\n", Status);//DebugLog
-		}
-    }
-
-    if (NT_SUCCESS(Status))
-    {
-        Status = pAccDevice->PowerOn();
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// This routine is invoked by the framework to program the device to go into
-// a certain Dx state. The framework invokes callback every the the device is 
-// leaving the D0 state, which happens when the device is stopped, when it is 
-// removed, and when it is powered off. EvtDeviceD0Exit event callback must 
-// perform any operations that are necessary before the specified device is 
-// moved out of the D0 state.  If the driver needs to save hardware state 
-// before the device is powered down, then that should be done here.
-NTSTATUS NxpTfa9890Device::OnD0Exit(
-    _In_ WDFDEVICE Device,                      // Supplies a handle to the framework device object
-    _In_ WDF_POWER_DEVICE_STATE)/*TargetState*/ // Supplies the device power state which the device will be put
-                                                // in once the callback is complete
-{
-    PNxpTfa9890Device pAccDevice = nullptr;
-
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter OnD0Exit.\n");
-
-    // Get the sensor instance
-    ULONG SensorInstanceCount = 1;
-    SENSOROBJECT SensorInstance = NULL;
-    NTSTATUS Status = SensorsCxDeviceGetSensorList(Device, &SensorInstance, &SensorInstanceCount);
-    if (!NT_SUCCESS(Status) || 0 == SensorInstanceCount || NULL == SensorInstance)
-    {
-        Status = STATUS_INVALID_PARAMETER;
-        TraceError("ACC %!FUNC! SensorsCxDeviceGetSensorList failed %!STATUS!", Status);
-		DLog("PA: SensorsCxDeviceGetSensorList failed %d\n", Status);//DebugLog
-	}
-
-    // Get the device context
-    else // if (NT_SUCCESS(Status))
-    {
-        pAccDevice = GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
-        if (nullptr == pAccDevice)
-        {
-            Status = STATUS_INVALID_PARAMETER;
-            TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromSensorInstance failed %!STATUS!", Status);
-			DLog("PA: GetNxpTfa9890ContextFromSensorInstance failed %d\n", Status);//DebugLog
-		}
-    }
-
-    if (NT_SUCCESS(Status))
-    {
-        //Status = pAccDevice->PowerOff();
-    }
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Get the HW resource from the ACPI, then configure and store the IoTarget
-NTSTATUS NxpTfa9890Device::ConfigureIoTarget(
-    _In_ WDFCMRESLIST ResourcesRaw,         // Supplies a handle to a collection of framework resource
-                                            // objects. This collection identifies the raw (bus-relative) hardware
-                                            // resources that have been assigned to the device.
-    _In_ WDFCMRESLIST ResourcesTranslated)  // Supplies a handle to a collection of framework
-                                            // resource objects. This collection identifies the translated
-                                            // (system-physical) hardware resources that have been assigned to the
-                                            // device. The resources appear from the CPU's point of view.
-{
-    NTSTATUS Status = STATUS_SUCCESS;
-    ULONG I2CConnectionResourceCount = 0;
-	LARGE_INTEGER I2CConnId[2] = { {}, {} };
-
-
-    DECLARE_UNICODE_STRING_SIZE(deviceName1, RESOURCE_HUB_PATH_SIZE);
-	DECLARE_UNICODE_STRING_SIZE(deviceName2, RESOURCE_HUB_PATH_SIZE);
-	
-    SENSOR_FunctionEnter();
-	DLog("PA: Enter ConfigureIoTarget.\n");
-
-    // Get hardware resource from ACPI and set up IO target
-    ULONG ResourceCount = WdfCmResourceListGetCount(ResourcesTranslated);
-    for (ULONG i = 0; i < ResourceCount; i++)
-    {
-        PCM_PARTIAL_RESOURCE_DESCRIPTOR DescriptorRaw = WdfCmResourceListGetDescriptor(ResourcesRaw, i);
-        PCM_PARTIAL_RESOURCE_DESCRIPTOR Descriptor = WdfCmResourceListGetDescriptor(ResourcesTranslated, i);
-        switch (Descriptor->Type) 
-        {
-            // Check we have I2C bus assigned in ACPI
-            case CmResourceTypeConnection:
-                TraceInformation("ACC %!FUNC! I2C resource found.");
-				DLog("PA: I2C resource found\n");
-                if (Descriptor->u.Connection.Class == CM_RESOURCE_CONNECTION_CLASS_SERIAL &&
-                    Descriptor->u.Connection.Type == CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C) 
-                {
-                    I2CConnId[i].LowPart = Descriptor->u.Connection.IdLowPart;
-                    I2CConnId[i].HighPart = Descriptor->u.Connection.IdHighPart;
-                    I2CConnectionResourceCount++;
-                }
-                break;
-    
-
-            default:
-                break;
-        }
-    }
-
-    if (NT_SUCCESS(Status) && I2CConnectionResourceCount != 2)
-    {
-        Status = STATUS_UNSUCCESSFUL;
-        TraceError("ACC %!FUNC! Did not find I2C resource! %!STATUS!", Status);
-		DLog("PA: Did not find I2C resource %d\n", Status);//DebugLog
-	}
-
-    // Set up I2C I/O target. Issued with I2C R/W transfers
-    if (NT_SUCCESS(Status))
-    {
-        m_I2CIoTarget1 = NULL;
-		m_I2CIoTarget2 = NULL;
-        Status = WdfIoTargetCreate(m_Device, WDF_NO_OBJECT_ATTRIBUTES, &m_I2CIoTarget1);
-        if (!NT_SUCCESS(Status))
-        {
-            TraceError("ACC %!FUNC! WdfIoTargetCreate failed! %!STATUS!", Status);
-			DLog("PA: WdfIoTargetCreate failed %d\n", Status);//DebugLog
-		}
-		Status = WdfIoTargetCreate(m_Device, WDF_NO_OBJECT_ATTRIBUTES, &m_I2CIoTarget2);
-		if (!NT_SUCCESS(Status))
-		{
-			TraceError("ACC %!FUNC! WdfIoTargetCreate failed! %!STATUS!", Status);
-			DLog("PA: WdfIoTargetCreate failed %d\n", Status);//DebugLog
-		}
-    }
-
-	// Setup Target string (\\\\.\\RESOURCE_HUB\\<ConnID from ResHub>
-	if (NT_SUCCESS(Status))
-	{
-		Status = StringCbPrintfW(deviceName1.Buffer, RESOURCE_HUB_PATH_SIZE, L"%s\\%0*I64x", RESOURCE_HUB_DEVICE_NAME, static_cast<unsigned int>(sizeof(LARGE_INTEGER) * 2), I2CConnId[0].QuadPart);
-		deviceName1.Length = _countof(deviceName1_buffer);
-
-		DLog("PA: Device Name 1: %ws \n", deviceName1.Buffer); //DebugLog
-
-		if (!NT_SUCCESS(Status))
-		{
-			TraceError("ACC %!FUNC! RESOURCE_HUB_CREATE_PATH_FROM_ID failed!");
-			DLog("PA: RESOURCE_HUB_CREATE_PATH_FROM_ID failed %d\n", Status);//DebugLog
-		}
-
-		Status = StringCbPrintfW(deviceName2.Buffer, RESOURCE_HUB_PATH_SIZE, L"%s\\%0*I64x", RESOURCE_HUB_DEVICE_NAME, static_cast<unsigned int>(sizeof(LARGE_INTEGER) * 2), I2CConnId[1].QuadPart);
-		deviceName2.Length = _countof(deviceName2_buffer);
-
-		DLog("PA: Device Name 2: %ws \n", deviceName2.Buffer); //DebugLog
-
-		if (!NT_SUCCESS(Status))
-		{
-			TraceError("ACC %!FUNC! RESOURCE_HUB_CREATE_PATH_FROM_ID failed!");
-			DLog("PA: RESOURCE_HUB_CREATE_PATH_FROM_ID failed %d\n", Status);//DebugLog
-		}
-	}
-
-	// Connect to I2C target
-	if (NT_SUCCESS(Status))
-	{
-		WDF_IO_TARGET_OPEN_PARAMS OpenParams1;
-		WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(&OpenParams1, &deviceName1, FILE_ALL_ACCESS);
-
-		Status = WdfIoTargetOpen(m_I2CIoTarget1, &OpenParams1);
-		if (!NT_SUCCESS(Status))
-		{
-			TraceError("ACC %!FUNC! WdfIoTargetOpen failed! %!STATUS!", Status);
-			DLog("PA: WdfIoTargetOpen failed %d\n", Status);//DebugLog
-		}
-
-		WDF_IO_TARGET_OPEN_PARAMS OpenParams2;
-		WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(&OpenParams2, &deviceName2, FILE_ALL_ACCESS);
-
-		Status = WdfIoTargetOpen(m_I2CIoTarget2, &OpenParams2);
-		if (!NT_SUCCESS(Status))
-		{
-			TraceError("ACC %!FUNC! WdfIoTargetOpen failed! %!STATUS!", Status);
-			DLog("PA: WdfIoTargetOpen failed %d\n", Status);//DebugLog
-		}
-	}
-
-    SENSOR_FunctionExit(Status);
-    return Status;
-}
-
-// Write the default device configuration to the device
-NTSTATUS NxpTfa9890Device::PowerOn()
-{
-	DLog("PA: Enter PowerOn.\n");
-
-    NTSTATUS Status = STATUS_SUCCESS;
-
-    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
-
-	WORD registerBits = 0;
-
-	//I2C address 34
-	registerBits = TFA9890_I2S_CONTROL_BYPASS;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget1, TFA9890_I2S_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_I2S_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_I2S_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_I2S_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-	registerBits = TFA9890_SYSTEM_CONTROL_BYPASS_1;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget1, TFA9890_SYSTEM_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_SYSTEM_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_SYSTEM_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_SYSTEM_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-	registerBits = TFA9890_SYSTEM_CONTROL_BYPASS_2;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget1, TFA9890_SYSTEM_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_SYSTEM_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_SYSTEM_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_SYSTEM_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-	//I2C address 36
-	registerBits = TFA9890_I2S_CONTROL_BYPASS;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget2, TFA9890_I2S_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_I2S_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_I2S_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_I2S_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-	registerBits = TFA9890_SYSTEM_CONTROL_BYPASS_1;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget2, TFA9890_SYSTEM_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_SYSTEM_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_SYSTEM_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_SYSTEM_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-	registerBits = TFA9890_SYSTEM_CONTROL_BYPASS_2;
-	Status = I2CSensorWriteRegister(m_I2CIoTarget2, TFA9890_SYSTEM_CONTROL, (BYTE*)&registerBits, sizeof(registerBits));
-	DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", TFA9890_SYSTEM_CONTROL, registerBits);//DebugLog
-	if (!NT_SUCCESS(Status))
-	{
-		TraceError("ACC %!FUNC! I2CSensorWriteRegister from 0x%02x failed! %!STATUS!", TFA9890_SYSTEM_CONTROL, Status);
-		DLog("PA: I2CSensorWriteRegister from 0x%02x failed %d\n", TFA9890_SYSTEM_CONTROL, Status);//DebugLog
-		WdfWaitLockRelease(m_I2CWaitLock);
-		return Status;
-	}
-
-
-    WdfWaitLockRelease(m_I2CWaitLock);
-
-    //InitPropVariantFromUInt32(SensorState_Idle, &(m_pSensorProperties->List[SENSOR_PROPERTY_STATE].Value));
-    m_PoweredOn = true;
-
-    return Status;
-}
-
-NTSTATUS NxpTfa9890Device::PowerOff()
-{
-	DLog("PA: Enter PowerOff.\n");
-
-	NTSTATUS Status = STATUS_SUCCESS;
-
-    m_PoweredOn = false;
-
-
-    return Status;
-}
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the implementation of WDF callback functions 
+//    for the NxpTfa9890 driver.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Driver.h"
+
+#include "Device.tmh"
+
+
+// This routine is the AddDevice entry point for the custom sensor client
+// driver. This routine is called by the framework in response to AddDevice
+// call from the PnP manager. It will create and initialize the device object
+// to represent a new instance of the sensor client.
+NTSTATUS NxpTfa9890Device::OnDeviceAdd(
+    _In_    WDFDRIVER /* Driver */,         // Supplies a handle to the driver object created in DriverEntry
+    _Inout_ PWDFDEVICE_INIT pDeviceInit) // Supplies a pointer to a framework-allocated WDFDEVICE_INIT structure
+{
+    WDFDEVICE Device = nullptr;
+
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter OnDeviceAdd.\n");
+
+	WdfDeviceInitSetPowerPolicyOwnership(pDeviceInit, true);
+
+    // Direct I/O lets dump requests fill the caller's buffer without an
+    // intermediate copy
+    WDF_IO_TYPE_CONFIG IoTypeConfig;
+    WDF_IO_TYPE_CONFIG_INIT(&IoTypeConfig);
+    IoTypeConfig.DeviceControlIoType = WdfDeviceIoDirect;
+    WdfDeviceInitSetIoTypeEx(pDeviceInit, &IoTypeConfig);
+
+    WDF_OBJECT_ATTRIBUTES FdoAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&FdoAttributes);
+
+    // Initialize FDO (functional device object) attributes and set up file object with sensor extension
+	NTSTATUS Status = SensorsCxDeviceInitConfig(pDeviceInit, &FdoAttributes, 0);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! SensorsCxDeviceInitConfig failed %!STATUS!", Status);
+		DLog("PA: SensorsCxDeviceInitConfig failed %d\n", Status);
+    }
+
+    else // if (NT_SUCCESS(Status))
+    {
+        // Register the PnP callbacks with the framework.
+        WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
+        WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&pnpPowerCallbacks);
+        pnpPowerCallbacks.EvtDevicePrepareHardware = NxpTfa9890Device::OnPrepareHardware;
+        pnpPowerCallbacks.EvtDeviceReleaseHardware = NxpTfa9890Device::OnReleaseHardware;
+        pnpPowerCallbacks.EvtDeviceD0Entry = NxpTfa9890Device::OnD0Entry;
+        pnpPowerCallbacks.EvtDeviceD0Exit = NxpTfa9890Device::OnD0Exit;
+    
+		WdfDeviceInitSetPnpPowerEventCallbacks(pDeviceInit, &pnpPowerCallbacks);
+    
+        // Call the framework to create the device
+		Status = WdfDeviceCreate(&pDeviceInit, &FdoAttributes, &Device);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfDeviceCreate failed %!STATUS!", Status);
+			DLog("PA: WdfDeviceCreate failed %d\n", Status);//DebugLog
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        // Register CLX callback function pointers
+        SENSOR_CONTROLLER_CONFIG SensorConfig;
+        SENSOR_CONTROLLER_CONFIG_INIT(&SensorConfig);
+        SensorConfig.DriverIsPowerPolicyOwner = WdfUseDefault;
+    
+        SensorConfig.EvtSensorStart = NxpTfa9890Device::OnStart;
+        SensorConfig.EvtSensorStop = NxpTfa9890Device::OnStop;
+        SensorConfig.EvtSensorGetSupportedDataFields = NxpTfa9890Device::OnGetSupportedDataFields;
+        SensorConfig.EvtSensorGetDataInterval = NxpTfa9890Device::OnGetDataInterval;
+        SensorConfig.EvtSensorSetDataInterval = NxpTfa9890Device::OnSetDataInterval;
+        SensorConfig.EvtSensorGetDataFieldProperties = NxpTfa9890Device::OnGetDataFieldProperties;
+        SensorConfig.EvtSensorGetDataThresholds = NxpTfa9890Device::OnGetDataThresholds;
+        SensorConfig.EvtSensorSetDataThresholds = NxpTfa9890Device::OnSetDataThresholds;
+        SensorConfig.EvtSensorGetProperties = NxpTfa9890Device::OnGetProperties;
+        SensorConfig.EvtSensorDeviceIoControl = NxpTfa9890Device::OnIoControl;
+    
+        // Initialize the sensor device with the Sensor CLX
+        // This lets the CLX call the above callbacks when
+        // necessary and allows applications to retrieve and
+        // set device data.
+        Status = SensorsCxDeviceInitialize(Device, &SensorConfig);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! SensorsCxDeviceInitialize failed %!STATUS!", Status);
+			DLog("PA: SensorsCxDeviceInitialize failed %d\n", Status);//DebugLog
+        }
+    }
+
+    // Ensure device is disable-able
+    // By default, devices enumerated by ACPI are not disable-able
+    // Our accelerometer is enumerated by the ACPI so we must
+    // explicitly make it disable-able.
+    if (NT_SUCCESS(Status))
+    {
+        WDF_DEVICE_STATE DeviceState;
+        WDF_DEVICE_STATE_INIT(&DeviceState);
+        DeviceState.NotDisableable = WdfFalse;
+        WdfDeviceSetDeviceState(Device, &DeviceState);
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// This routine is called by the framework when the PnP manager sends an
+// IRP_MN_START_DEVICE request to the driver stack. This routine is
+// responsible for performing operations that are necessary to make the
+// driver's device operational (for e.g. mapping the hardware resources
+// into memory).
+NTSTATUS NxpTfa9890Device::OnPrepareHardware(
+    _In_ WDFDEVICE Device,                  // Supplies a handle to the framework device object
+    _In_ WDFCMRESLIST ResourcesRaw,         // Supplies a handle to a collection of framework resource
+                                            // objects. This collection identifies the raw (bus-relative) hardware
+                                            // resources that have been assigned to the device.
+    _In_ WDFCMRESLIST ResourcesTranslated)  // Supplies a handle to a collection of framework
+                                            // resource objects. This collection identifies the translated
+                                            // (system-physical) hardware resources that have been assigned to the
+                                            // device. The resources appear from the CPU's point of view.
+{
+    PNxpTfa9890Device pDevice = nullptr;
+    
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter OnPrepareHardware.\n");
+
+    // Create WDFOBJECT for the sensor
+    WDF_OBJECT_ATTRIBUTES sensorAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&sensorAttributes, NxpTfa9890Device);
+
+    // Register sensor instance with clx
+    SENSOROBJECT SensorInstance = NULL;
+    NTSTATUS Status = SensorsCxSensorCreate(Device, &sensorAttributes, &SensorInstance);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! SensorsCxSensorCreate failed %!STATUS!", Status);
+		DLog("PA: SensorsCxSensorCreate failed %d\n", Status);//DebugLog
+    }
+
+    else // if (NT_SUCCESS(Status))
+    {    
+		pDevice = GetNxpTfa9890ContextFromSensorInstance(SensorInstance);
+		if (nullptr == pDevice)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            TraceError("ACC %!FUNC! SensorsCxSensorCreate failed %!STATUS!", Status);
+			DLog("PA: SensorsCxSensorCreate failed %d\n", Status);//DebugLog
+        }
+    }
+
+    // Fill out sensor context
+    if (NT_SUCCESS(Status))
+    {
+		Status = pDevice->Initialize(Device, SensorInstance);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! Initialize device object failed %!STATUS!", Status);
+			DLog("PA: Initialize device object failed failed %d\n", Status);//DebugLog        
+		}
+    }
+        
+    // Initialize sensor instance with clx
+    if (NT_SUCCESS(Status))
+    {
+        SENSOR_CONFIG SensorConfig;
+        SENSOR_CONFIG_INIT(&SensorConfig);
+		SensorConfig.pEnumerationList = pDevice->m_AmpSensors[0].pEnumerationProperties;
+        Status = SensorsCxSensorInitialize(SensorInstance, &SensorConfig);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! SensorsCxSensorInitialize failed %!STATUS!", Status);
+			DLog("PA: SensorsCxSensorInitialize failed %d\n", Status);//DebugLog
+        }
+    }
+    
+    // Device tunables
+    if (NT_SUCCESS(Status))
+    {
+        pDevice->ReadConfiguration();
+    }
+
+    // Reset watchdog, at the configured interval
+    if (NT_SUCCESS(Status))
+    {
+        Status = pDevice->CreateWatchdogTimer();
+    }
+
+    // ACPI and IoTarget configuration
+    if (NT_SUCCESS(Status))
+    {
+		Status = pDevice->ConfigureIoTarget(ResourcesRaw, ResourcesTranslated);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! Failed to configure IoTarget %!STATUS!", Status);
+			DLog("PA: Failed to configure IoTarget %d\n", Status);//DebugLog        
+		}
+    }
+
+    // Sensor instances of the other amps
+    if (NT_SUCCESS(Status))
+    {
+        Status = pDevice->CreateAmpSensors();
+    }
+
+    // One write request and timer per amp for the power-up sequence
+    if (NT_SUCCESS(Status))
+    {
+        Status = pDevice->CreateSequencer();
+    }
+
+    // Bus transaction recorder and telemetry history, need the amps' connections
+    if (NT_SUCCESS(Status))
+    {
+        pDevice->OpenRecorder();
+        pDevice->OpenHistory();
+    }
+
+    // Reattach what the driver learned about these amps before a PnP stop
+    if (NT_SUCCESS(Status))
+    {
+        pDevice->RestoreAmpStates();
+    }
+
+    // Probe the bus of amps seen for the first time
+    if (NT_SUCCESS(Status))
+    {
+        pDevice->TuneBus(false);
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// This routine is called by the framework when the PnP manager is revoking
+// ownership of our resources. This may be in response to either
+// IRP_MN_STOP_DEVICE or IRP_MN_REMOVE_DEVICE. This routine is responsible for
+// performing cleanup of resources allocated in PrepareHardware callback.
+// This callback is invoked before passing  the request down to the lower driver.
+// This routine will also be invoked by the framework if the prepare hardware
+// callback returns a failure.
+NTSTATUS NxpTfa9890Device::OnReleaseHardware(
+    _In_ WDFDEVICE Device,                      // Supplies a handle to the framework device object
+    _In_ WDFCMRESLIST /*ResourcesTranslated*/)  // Supplies a handle to a collection of framework
+                                                // resource objects. This collection identifies the translated
+                                                // (system-physical) hardware resources that have been assigned to the
+                                                // device. The resources appear from the CPU's point of view.
+{
+    PNxpTfa9890Device pAccDevice = nullptr;
+
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter OnReleaseHardware.\n");
+
+    // Get the device context, on the sensor instance of the first amp
+    NTSTATUS Status = STATUS_SUCCESS;
+    pAccDevice = GetNxpTfa9890ContextFromDevice(Device);
+    if (nullptr == pAccDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromDevice failed %!STATUS!", Status);
+		DLog("PA: GetNxpTfa9890ContextFromDevice failed %d\n", Status);//DebugLog
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        pAccDevice->DeInit();
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// This routine is invoked by the framework to program the device to goto 
+// D0, which is the working state. The framework invokes callback every
+// time the hardware needs to be (re-)initialized.  This includes after
+// IRP_MN_START_DEVICE, IRP_MN_CANCEL_STOP_DEVICE, IRP_MN_CANCEL_REMOVE_DEVICE,
+// and IRP_MN_SET_POWER-D0.
+NTSTATUS NxpTfa9890Device::OnD0Entry(
+    _In_  WDFDEVICE Device,                         // Supplies a handle to the framework device object
+    _In_  WDF_POWER_DEVICE_STATE /*PreviousState*/) // WDF_POWER_DEVICE_STATE-typed enumerator that identifies
+                                                    // the device power state that the device was in before this transition to D0
+{
+    PNxpTfa9890Device pAccDevice = nullptr;
+
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter OnD0Entry.\n");
+
+    // Get the device context, on the sensor instance of the first amp
+    NTSTATUS Status = STATUS_SUCCESS;
+    pAccDevice = GetNxpTfa9890ContextFromDevice(Device);
+    if (nullptr == pAccDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromDevice failed %!STATUS!", Status);
+		DLog("PA: GetNxpTfa9890ContextFromDevice failed %d\n", Status);//DebugLog
+    }
+
+    // The amps come up asynchronously; FinishPowerUp resumes the rest
+    if (NT_SUCCESS(Status))
+    {
+        pAccDevice->RecordMarker(TFA9890_TRACE_MARKER_D0_ENTRY);
+        Status = pAccDevice->PowerOn();
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// This routine is invoked by the framework to program the device to go into
+// a certain Dx state. The framework invokes callback every the the device is 
+// leaving the D0 state, which happens when the device is stopped, when it is 
+// removed, and when it is powered off. EvtDeviceD0Exit event callback must 
+// perform any operations that are necessary before the specified device is 
+// moved out of the D0 state.  If the driver needs to save hardware state 
+// before the device is powered down, then that should be done here.
+NTSTATUS NxpTfa9890Device::OnD0Exit(
+    _In_ WDFDEVICE Device,                      // Supplies a handle to the framework device object
+    _In_ WDF_POWER_DEVICE_STATE)/*TargetState*/ // Supplies the device power state which the device will be put
+                                                // in once the callback is complete
+{
+    PNxpTfa9890Device pAccDevice = nullptr;
+
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter OnD0Exit.\n");
+
+    // Get the device context, on the sensor instance of the first amp
+    NTSTATUS Status = STATUS_SUCCESS;
+    pAccDevice = GetNxpTfa9890ContextFromDevice(Device);
+    if (nullptr == pAccDevice)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        TraceError("ACC %!FUNC! GetNxpTfa9890ContextFromDevice failed %!STATUS!", Status);
+		DLog("PA: GetNxpTfa9890ContextFromDevice failed %d\n", Status);//DebugLog
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        pAccDevice->RecordMarker(TFA9890_TRACE_MARKER_D0_EXIT);
+        pAccDevice->CancelSequence();
+        Status = pAccDevice->PowerOff();
+        pAccDevice->SuspendSampling();
+        pAccDevice->SuspendWatchdog();
+        pAccDevice->SuspendPowerGating();
+        pAccDevice->SuspendModelPolling();
+        pAccDevice->CaptureHibernateImages();
+        pAccDevice->RecordMarker(TFA9890_TRACE_MARKER_D0_EXIT_DONE);
+        pAccDevice->TraceBusStatistics();
+        pAccDevice->HistoryAppendPower(false);
+        pAccDevice->FlushHistory(true);
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Get the HW resource from the ACPI, then configure and store one IoTarget
+// per amplifier
+NTSTATUS NxpTfa9890Device::ConfigureIoTarget(
+    _In_ WDFCMRESLIST ResourcesRaw,         // Supplies a handle to a collection of framework resource
+                                            // objects. This collection identifies the raw (bus-relative) hardware
+                                            // resources that have been assigned to the device.
+    _In_ WDFCMRESLIST ResourcesTranslated)  // Supplies a handle to a collection of framework
+                                            // resource objects. This collection identifies the translated
+                                            // (system-physical) hardware resources that have been assigned to the
+                                            // device. The resources appear from the CPU's point of view.
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    SENSOR_FunctionEnter();
+	DLog("PA: Enter ConfigureIoTarget.\n");
+
+    m_AmpCount = 0;
+
+    // Get hardware resource from ACPI and set up IO target
+    ULONG ResourceCount = WdfCmResourceListGetCount(ResourcesTranslated);
+    for (ULONG i = 0; i < ResourceCount; i++)
+    {
+        PCM_PARTIAL_RESOURCE_DESCRIPTOR DescriptorRaw = WdfCmResourceListGetDescriptor(ResourcesRaw, i);
+        PCM_PARTIAL_RESOURCE_DESCRIPTOR Descriptor = WdfCmResourceListGetDescriptor(ResourcesTranslated, i);
+        UNREFERENCED_PARAMETER(DescriptorRaw);
+        switch (Descriptor->Type) 
+        {
+            // Check we have I2C bus assigned in ACPI
+            case CmResourceTypeConnection:
+                TraceInformation("ACC %!FUNC! I2C resource found.");
+				DLog("PA: I2C resource found\n");
+                if (Descriptor->u.Connection.Class == CM_RESOURCE_CONNECTION_CLASS_SERIAL &&
+                    Descriptor->u.Connection.Type == CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C &&
+                    m_AmpCount < TFA9890_MAX_AMPS)
+                {
+                    m_Amps[m_AmpCount].ConnectionId.LowPart = Descriptor->u.Connection.IdLowPart;
+                    m_Amps[m_AmpCount].ConnectionId.HighPart = Descriptor->u.Connection.IdHighPart;
+                    m_Amps[m_AmpCount].Scheduler.Initialize();
+                    m_AmpCount++;
+                }
+                break;
+    
+
+            default:
+                break;
+        }
+    }
+
+    if (NT_SUCCESS(Status) && 0 == m_AmpCount)
+    {
+        Status = STATUS_UNSUCCESSFUL;
+        TraceError("ACC %!FUNC! Did not find I2C resource! %!STATUS!", Status);
+		DLog("PA: Did not find I2C resource %d\n", Status);//DebugLog
+	}
+
+    // Set up one I2C I/O target per amplifier. Issued with I2C R/W transfers
+    for (ULONG Amp = 0; NT_SUCCESS(Status) && Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        DECLARE_UNICODE_STRING_SIZE(deviceName, RESOURCE_HUB_PATH_SIZE);
+
+        pAmp->IoTarget = NULL;
+        Status = WdfIoTargetCreate(m_Device, WDF_NO_OBJECT_ATTRIBUTES, &pAmp->IoTarget);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfIoTargetCreate failed! %!STATUS!", Status);
+			DLog("PA: WdfIoTargetCreate failed %d\n", Status);//DebugLog
+            break;
+		}
+
+        // Setup Target string (\\\\.\\RESOURCE_HUB\\<ConnID from ResHub>
+        Status = StringCbPrintfW(deviceName.Buffer, RESOURCE_HUB_PATH_SIZE, L"%s\\%0*I64x", RESOURCE_HUB_DEVICE_NAME, static_cast<unsigned int>(sizeof(LARGE_INTEGER) * 2), pAmp->ConnectionId.QuadPart);
+        deviceName.Length = _countof(deviceName_buffer);
+
+        DLog("PA: Device Name %u: %ws \n", Amp, deviceName.Buffer); //DebugLog
+
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! RESOURCE_HUB_CREATE_PATH_FROM_ID failed!");
+			DLog("PA: RESOURCE_HUB_CREATE_PATH_FROM_ID failed %d\n", Status);//DebugLog
+            break;
+        }
+
+        // Connect to I2C target
+        WDF_IO_TARGET_OPEN_PARAMS OpenParams;
+        WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(&OpenParams, &deviceName, FILE_ALL_ACCESS);
+
+        Status = WdfIoTargetOpen(pAmp->IoTarget, &OpenParams);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfIoTargetOpen failed! %!STATUS!", Status);
+			DLog("PA: WdfIoTargetOpen failed %d\n", Status);//DebugLog
+        }
+    }
+
+    SENSOR_FunctionExit(Status);
+    return Status;
+}
+
+// Read the driver tunables from the device hardware key. Missing values keep
+// their defaults.
+VOID NxpTfa9890Device::ReadConfiguration()
+{
+    DECLARE_CONST_UNICODE_STRING(PowerUpMaxConcurrentName, L"PowerUpMaxConcurrent");
+    DECLARE_CONST_UNICODE_STRING(PowerUpStaggerMsName, L"PowerUpStaggerMs");
+    DECLARE_CONST_UNICODE_STRING(CommitSkewBudgetUsName, L"CommitSkewBudgetUs");
+    DECLARE_CONST_UNICODE_STRING(DiagnosticsEnabledName, L"DiagnosticsEnabled");
+    DECLARE_CONST_UNICODE_STRING(BusRecordFileName, L"BusRecordFile");
+    DECLARE_CONST_UNICODE_STRING(BusRecordAllName, L"BusRecordAll");
+    DECLARE_CONST_UNICODE_STRING(InitProfileName, L"InitProfile");
+    DECLARE_CONST_UNICODE_STRING(PowerGateHysteresisMsName, L"PowerGateHysteresisMs");
+    DECLARE_CONST_UNICODE_STRING(DspImagesName, L"DspImages");
+    DECLARE_CONST_UNICODE_STRING(HistoryFileName, L"HistoryFile");
+    DECLARE_CONST_UNICODE_STRING(HistoryMaxKBName, L"HistoryMaxKB");
+    DECLARE_CONST_UNICODE_STRING(WatchdogIntervalMsName, L"WatchdogIntervalMs");
+    DECLARE_CONST_UNICODE_STRING(AggregateWindowName, L"AggregateWindow");
+    DECLARE_CONST_UNICODE_STRING(VerifyWritesName, L"VerifyWrites");
+    DECLARE_CONST_UNICODE_STRING(HibernateImageName, L"HibernateImage");
+    DECLARE_UNICODE_STRING_SIZE(InitProfile, TFA9890_PROFILE_NAME_CHARS);
+
+    const TFA9890_PROFILE_SET* pProfiles = &GetNxpTfa9890DriverContext(WdfGetDriver())->Profiles;
+
+    WDFKEY Key = NULL;
+    ULONG Value = 0;
+
+    m_PowerUpMaxConcurrent = TFA9890_POWER_MAX_CONCURRENT;
+    m_PowerUpStaggerMs = TFA9890_POWER_STAGGER_MS;
+    m_CommitSkewBudgetUs = TFA9890_COMMIT_SKEW_BUDGET_US;
+    // Off until the model poll's bus load is measured with all amps running
+    m_DiagnosticsEnabled = false;
+    m_RecordPath[0] = L'\0';
+    m_RecordAll = false;
+    m_pInitProfile = ProfileFind(pProfiles, nullptr);
+    m_GateHysteresisMs = TFA9890_POWER_GATE_HYSTERESIS_MS;
+    m_WatchdogIntervalMs = TFA9890_WATCHDOG_INTERVAL_MS;
+    m_AggregateWindow = 0;
+    m_VerifyPolicy = TFA9890_VERIFY_SAMPLED;
+    m_HibernateEnabled = true;
+    RtlZeroMemory(m_ImageList, sizeof(m_ImageList));
+    m_HistoryPath[0] = L'\0';
+    m_HistorySlots = (TFA9890_HISTORY_DEFAULT_KB * 1024 - sizeof(TFA9890_HISTORY_HEADER)) / TFA9890_HISTORY_BLOCK_BYTES;
+
+    NTSTATUS Status = WdfDeviceOpenRegistryKey(m_Device, PLUGPLAY_REGKEY_DEVICE, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &Key);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceWarning("ACC %!FUNC! WdfDeviceOpenRegistryKey failed, using defaults %!STATUS!", Status);
+        return;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &PowerUpMaxConcurrentName, &Value)) && Value > 0)
+    {
+        m_PowerUpMaxConcurrent = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &PowerUpStaggerMsName, &Value)))
+    {
+        m_PowerUpStaggerMs = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &CommitSkewBudgetUsName, &Value)) && Value > 0)
+    {
+        m_CommitSkewBudgetUs = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &DiagnosticsEnabledName, &Value)))
+    {
+        m_DiagnosticsEnabled = (0 != Value);
+    }
+
+    // The recorder stays idle unless a trace file is named
+    UNICODE_STRING RecordPath;
+    RecordPath.Buffer = m_RecordPath;
+    RecordPath.Length = 0;
+    RecordPath.MaximumLength = static_cast<USHORT>(sizeof(m_RecordPath) - sizeof(WCHAR));
+    if (NT_SUCCESS(WdfRegistryQueryUnicodeString(Key, &BusRecordFileName, NULL, &RecordPath)))
+    {
+        m_RecordPath[RecordPath.Length / sizeof(WCHAR)] = L'\0';
+    }
+    else
+    {
+        m_RecordPath[0] = L'\0';
+    }
+
+    // The history stays idle unless a file is named. Its size is a whole
+    // number of blocks after the header.
+    UNICODE_STRING HistoryPath;
+    HistoryPath.Buffer = m_HistoryPath;
+    HistoryPath.Length = 0;
+    HistoryPath.MaximumLength = static_cast<USHORT>(sizeof(m_HistoryPath) - sizeof(WCHAR));
+    if (NT_SUCCESS(WdfRegistryQueryUnicodeString(Key, &HistoryFileName, NULL, &HistoryPath)))
+    {
+        m_HistoryPath[HistoryPath.Length / sizeof(WCHAR)] = L'\0';
+    }
+    else
+    {
+        m_HistoryPath[0] = L'\0';
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &HistoryMaxKBName, &Value)))
+    {
+        m_HistorySlots = (max(Value, TFA9890_HISTORY_MIN_KB) * 1024 - sizeof(TFA9890_HISTORY_HEADER)) / TFA9890_HISTORY_BLOCK_BYTES;
+    }
+
+    // DSP images, REG_MULTI_SZ of file paths. The list stays terminated
+    // even if the registry data is not.
+    ULONG Length = 0;
+    ULONG Type = 0;
+    if (!NT_SUCCESS(WdfRegistryQueryValue(Key, &DspImagesName, sizeof(m_ImageList) - 2 * sizeof(WCHAR), m_ImageList, &Length, &Type)) ||
+        REG_MULTI_SZ != Type)
+    {
+        RtlZeroMemory(m_ImageList, sizeof(m_ImageList));
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &PowerGateHysteresisMsName, &Value)))
+    {
+        m_GateHysteresisMs = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &WatchdogIntervalMsName, &Value)))
+    {
+        m_WatchdogIntervalMs = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &AggregateWindowName, &Value)))
+    {
+        m_AggregateWindow = min(Value, static_cast<ULONG>(TFA9890_AGGREGATE_MAX_WINDOW));
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &VerifyWritesName, &Value)) && Value <= TFA9890_VERIFY_FULL)
+    {
+        m_VerifyPolicy = Value;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &HibernateImageName, &Value)))
+    {
+        m_HibernateEnabled = (0 != Value);
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(Key, &BusRecordAllName, &Value)))
+    {
+        m_RecordAll = (0 != Value);
+    }
+
+    // Board variant; an unknown name keeps the driver's default profile
+    if (NT_SUCCESS(WdfRegistryQueryUnicodeString(Key, &InitProfileName, NULL, &InitProfile)))
+    {
+        InitProfile_buffer[min(InitProfile.Length / sizeof(WCHAR), TFA9890_PROFILE_NAME_CHARS - 1)] = L'\0';
+
+        const TFA9890_INIT_PROFILE* pProfile = ProfileFind(pProfiles, InitProfile_buffer);
+        if (nullptr != pProfile)
+        {
+            m_pInitProfile = pProfile;
+        }
+        else
+        {
+            TraceWarning("ACC %!FUNC! Init profile %S not found, using %S", InitProfile_buffer, m_pInitProfile->Name);
+        }
+    }
+
+    WdfRegistryClose(Key);
+
+    TraceInformation("ACC %!FUNC! Init profile %S, power-up max concurrent %u, stagger %u ms", m_pInitProfile->Name, m_PowerUpMaxConcurrent, m_PowerUpStaggerMs);
+}
+
+// Issue one I2C write. Counted in the amp's statistics and captured by the
+// recorder; the caller owns the amp's bus.
+NTSTATUS NxpTfa9890Device::BusWrite(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to write to
+    _In_ BYTE Register,                             // First register
+    _In_reads_bytes_(Length) const BYTE* pData,     // Data in bus byte order
+    _In_ ULONG Length)                              // Bytes to write
+{
+    LONGLONG Start = QpcNow();
+
+    pAmp->Recovery.Transactions++;
+    PerfCountTransaction();
+    NTSTATUS Status = I2CSensorWriteRegister(pAmp->IoTarget, Register, const_cast<BYTE*>(pData), Length);
+    AccountTransaction(pAmp, Status);
+
+    RecordTransaction(static_cast<ULONG>(pAmp - m_Amps), 0, Register, pData, Length, Start, QpcNow(), Status);
+    return Status;
+}
+
+// Issue one I2C read. Counted in the amp's statistics and captured by the
+// recorder; the caller owns the amp's bus.
+NTSTATUS NxpTfa9890Device::BusRead(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to read from
+    _In_ BYTE Register,                             // First register
+    _Out_writes_bytes_(Length) BYTE* pData,         // Receives the data in bus byte order
+    _In_ ULONG Length)                              // Bytes to read
+{
+    LONGLONG Start = QpcNow();
+
+    pAmp->Recovery.Transactions++;
+    PerfCountTransaction();
+    NTSTATUS Status = I2CSensorReadRegister(pAmp->IoTarget, Register, pData, Length);
+    AccountTransaction(pAmp, Status);
+
+    RecordTransaction(static_cast<ULONG>(pAmp - m_Amps), TFA9890_TRACE_FLAG_READ, Register, pData, Length, Start, QpcNow(), Status);
+    return Status;
+}
+
+// Write one 16-bit register, re-issuing the transaction with exponential
+// backoff until it succeeds, the retries run out or the deadline would be
+// passed. Every attempt is accounted in the amp's recovery statistics.
+NTSTATUS NxpTfa9890Device::WriteRegisterWithRetry(
+    _In_ PTFA9890_AMP pAmp,         // Amplifier to write to
+    _In_ TFA9890_CMD_CLASS Class,   // Priority class of the write
+    _In_ BYTE Register,             // Register address
+    _In_ WORD Value,                // Register value
+    _In_ LONGLONG Deadline)         // QPC time after which no retry may be started
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    for (ULONG Attempt = 0; ; Attempt++)
+    {
+        // The bus is held per attempt only, so urgent commands can get in
+        // while this write backs off
+        pAmp->Scheduler.Acquire(Class);
+        Status = BusWrite(pAmp, Register, reinterpret_cast<BYTE*>(&Value), sizeof(Value));
+        pAmp->Scheduler.Release();
+        DLog("PA: I2CSensorWriteRegister to 0x%02x with value 0x%02x\n", Register, Value);//DebugLog
+        if (NT_SUCCESS(Status))
+        {
+            UpdateShadow(pAmp, Register, reinterpret_cast<BYTE*>(&Value), sizeof(Value));
+            if (Attempt > 0)
+            {
+                pAmp->Recovery.Recovered++;
+            }
+            break;
+        }
+
+        TraceWarning("ACC %!FUNC! I2CSensorWriteRegister to 0x%02x failed, attempt %u %!STATUS!", Register, Attempt, Status);
+        DLog("PA: I2CSensorWriteRegister to 0x%02x failed, attempt %u %d\n", Register, Attempt, Status);//DebugLog
+
+        if (Attempt >= TFA9890_I2C_RETRY_COUNT)
+        {
+            pAmp->Recovery.Failures++;
+            break;
+        }
+
+        ULONG BackoffMs = TFA9890_I2C_RETRY_BACKOFF_MS << Attempt;
+        if (QpcNow() + QpcFromMs(BackoffMs) >= Deadline)
+        {
+            pAmp->Recovery.DeadlineHits++;
+            pAmp->Recovery.Failures++;
+            break;
+        }
+
+        Sleep(BackoffMs);
+        pAmp->Recovery.Retries++;
+    }
+
+    return Status;
+}
+
+// Write a long buffer to one amplifier in pieces of the amp's bulk chunk.
+// With AutoIncrement each chunk starts at the register following the
+// previous chunk, otherwise every chunk is written to the same (streaming)
+// register. Between chunks the bus is handed to any more urgent class.
+NTSTATUS NxpTfa9890Device::WriteBurst(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to write to
+    _In_ TFA9890_CMD_CLASS Class,                   // Priority class of the transfer
+    _In_ BYTE Register,                             // First register address
+    _In_reads_bytes_(Length) const BYTE* pData,     // Data to write
+    _In_ ULONG Length,                              // Number of bytes to write
+    _In_ bool AutoIncrement)                        // Advance the register address per chunk
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Offset = 0;
+    ULONG ChunkBytes = BulkChunkBytes(pAmp);
+
+    pAmp->Scheduler.Acquire(Class);
+
+    while (Offset < Length)
+    {
+        ULONG ChunkLength = min(Length - Offset, ChunkBytes);
+        BYTE ChunkRegister = AutoIncrement ? static_cast<BYTE>(Register + Offset / sizeof(WORD)) : Register;
+
+        Status = BusWrite(pAmp, ChunkRegister, pData + Offset, ChunkLength);
+        if (!NT_SUCCESS(Status))
+        {
+            pAmp->Recovery.Failures++;
+            TraceError("ACC %!FUNC! Burst to 0x%02x failed at offset %u %!STATUS!", Register, Offset, Status);
+            DLog("PA: Burst to 0x%02x failed at offset %u %d\n", Register, Offset, Status);//DebugLog
+            break;
+        }
+
+        if (AutoIncrement)
+        {
+            UpdateShadow(pAmp, ChunkRegister, pData + Offset, ChunkLength);
+        }
+
+        Offset += ChunkLength;
+
+        if (Offset < Length && pAmp->Scheduler.ShouldYield(Class))
+        {
+            pAmp->Scheduler.CountPreemption(Class);
+            pAmp->Scheduler.Release();
+            pAmp->Scheduler.Acquire(Class);
+        }
+    }
+
+    pAmp->Scheduler.Release();
+
+    return Status;
+}
+
+// Long read split into chunks of at most ChunkBytes, yielding the bus like
+// WriteBurst. Larger chunks mean fewer transactions but a longer wait for
+// urgent commands queued behind one. Chunks are also kept within the
+// longest read the amp was found to take.
+NTSTATUS NxpTfa9890Device::ReadBurst(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to read from
+    _In_ TFA9890_CMD_CLASS Class,                   // Priority class of the transfer
+    _In_ BYTE Register,                             // First register address
+    _Out_writes_bytes_(Length) BYTE* pData,         // Receives the data
+    _In_ ULONG Length,                              // Number of bytes to read
+    _In_ bool AutoIncrement,                        // Advance the register address per chunk
+    _In_ ULONG ChunkBytes)                          // Largest single transaction
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Offset = 0;
+
+    ChunkBytes = ClampChunkBytes(pAmp, ChunkBytes);
+
+    pAmp->Scheduler.Acquire(Class);
+
+    while (Offset < Length)
+    {
+        ULONG ChunkLength = min(Length - Offset, ChunkBytes);
+        BYTE ChunkRegister = AutoIncrement ? static_cast<BYTE>(Register + Offset / sizeof(WORD)) : Register;
+
+        Status = BusRead(pAmp, ChunkRegister, pData + Offset, ChunkLength);
+        if (!NT_SUCCESS(Status))
+        {
+            pAmp->Recovery.Failures++;
+            TraceError("ACC %!FUNC! Burst from 0x%02x failed at offset %u %!STATUS!", Register, Offset, Status);
+            DLog("PA: Burst from 0x%02x failed at offset %u %d\n", Register, Offset, Status);//DebugLog
+            break;
+        }
+
+        Offset += ChunkLength;
+
+        if (Offset < Length && pAmp->Scheduler.ShouldYield(Class))
+        {
+            pAmp->Scheduler.CountPreemption(Class);
+            pAmp->Scheduler.Release();
+            pAmp->Scheduler.Acquire(Class);
+        }
+    }
+
+    pAmp->Scheduler.Release();
+
+    return Status;
+}
+
+// Start bringing up every amplifier. If every amp has a hibernate image
+// from the last D0 exit, the sequencer writes the amps back from the
+// images, otherwise it runs the init sequences. Either way the power-up
+// runs asynchronously; FinishPowerUp completes it once every amp is
+// configured or has failed twice, so D0 entry does not wait for the
+// hardware. An amp that fails is given a second chance, resuming from the
+// failed step, once the others are configured.
+NTSTATUS NxpTfa9890Device::PowerOn()
+{
+	DLog("PA: Enter PowerOn.\n");
+
+    PerfBegin(&m_SequenceMark);
+
+    // Reference the DSP images from the driver's cache on first use
+    AcquireImages();
+
+    // Amps whose error rate rose since their last probe are measured again
+    TuneBus(true);
+
+    // Nothing else may use the bus until the power-up has finished
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    m_PoweredOn = false;
+    bool FromImages = HibernateImagesValid();
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    // D0 exit waited for any earlier run, so this only fails on a bug
+    if (!StartSequence(Tfa9890RunPowerUp, FromImages, (1UL << m_AmpCount) - 1))
+    {
+        TraceError("ACC %!FUNC! The sequencer is still running %!STATUS!", STATUS_DEVICE_BUSY);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Complete the power-up once the init sequences or the hibernate images
+// are written: verify them, upload the DSP images and resume the background
+// work that needs the amps. Runs on the power-up work item once the last
+// sequence is done.
+VOID NxpTfa9890Device::FinishPowerUp()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG OnlineCount = 0;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    if (m_PowerUpRestored)
+    {
+        AdoptHibernateImages();
+    }
+
+    // Read back what the sequence wrote before anything builds on it
+    if (TFA9890_VERIFY_OFF != m_VerifyPolicy)
+    {
+        ULONG Written[TFA9890_REGISTER_COUNT / 32] = {};
+        TFA9890_PERF_MARK Mark;
+
+        for (ULONG Step = 0; Step < m_pInitProfile->StepCount; Step++)
+        {
+            if (0 == (m_pInitProfile->Steps[Step].Flags & TFA9890_STEP_SETTLE))
+            {
+                ULONG Register = m_pInitProfile->Steps[Step].Register;
+                Written[Register / 32] |= 1UL << (Register % 32);
+            }
+        }
+
+        PerfBegin(&Mark);
+        for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+        {
+            if (m_Amps[Amp].Online)
+            {
+                VerifyAmp(&m_Amps[Amp], TFA9890_CMD_CLASS_CONFIG,
+                          m_PowerUpRestored ? m_Amps[Amp].Hibernate.Written : Written, m_SequenceDeadline);
+            }
+        }
+        PerfEnd(TFA9890_PERF_VERIFY, &Mark);
+    }
+
+    // DSP images go to every amp that came up; the bypass path works without
+    // them, so a failed upload is traced but leaves the amp online. After a
+    // restore the EQ bank of the image follows.
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (m_Amps[Amp].Online && NT_SUCCESS(UploadImages(&m_Amps[Amp])) && m_PowerUpRestored)
+        {
+            RestoreEqBank(&m_Amps[Amp]);
+        }
+    }
+
+    if (m_PowerUpRestored)
+    {
+        m_LastRestoreUs = QpcToUs(QpcNow() - m_SequenceStart);
+        TraceInformation("ACC %!FUNC! Restore of %u amps from their hibernate images took %u us, last cold bring-up %u us (restores %u, fallbacks %u)",
+                         m_AmpCount, m_LastRestoreUs, m_LastBringUpUs, m_HibernateRestores, m_HibernateFallbacks);
+        DLog("PA: Restore of %u amps took %u us, cold bring-up %u us\n", m_AmpCount, m_LastRestoreUs, m_LastBringUpUs);//DebugLog
+    }
+    else
+    {
+        m_LastBringUpUs = QpcToUs(QpcNow() - m_SequenceStart);
+        TraceInformation("ACC %!FUNC! Bring-up of %u amps took %u us (max concurrent %u, stagger %u ms)",
+                         m_AmpCount, m_LastBringUpUs, m_PowerUpMaxConcurrent, m_PowerUpStaggerMs);
+        DLog("PA: Bring-up of %u amps took %u us\n", m_AmpCount, m_LastBringUpUs);//DebugLog
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        TraceInformation("ACC %!FUNC! Amp %u online %d, transactions %u, retries %u, recovered %u, failures %u, resumes %u, deadline hits %u",
+                         Amp, pAmp->Online, pAmp->Recovery.Transactions, pAmp->Recovery.Retries, pAmp->Recovery.Recovered,
+                         pAmp->Recovery.Failures, pAmp->Recovery.Resumes, pAmp->Recovery.DeadlineHits);
+        TraceInformation("ACC %!FUNC! Amp %u sequence: writes %u us, backoff %u us, power slot %u us, settle %u us",
+                         Amp, pAmp->SeqStateUs[Tfa9890SeqWrite], pAmp->SeqStateUs[Tfa9890SeqBackoff],
+                         pAmp->SeqStateUs[Tfa9890SeqSlot], pAmp->SeqStateUs[Tfa9890SeqSettle]);
+        TraceInformation("ACC %!FUNC! Amp %u verified %u registers, mismatches %u, rewrites %u, failures %u, %I64u us",
+                         Amp, pAmp->Verify.Checked, pAmp->Verify.Mismatches, pAmp->Verify.Rewrites,
+                         pAmp->Verify.Failures, pAmp->Verify.BusUs);
+
+        if (pAmp->Online)
+        {
+            OnlineCount++;
+        }
+        else
+        {
+            Status = pAmp->LastStatus;
+            TraceError("ACC %!FUNC! Amp %u stopped at step %u %!STATUS!", Amp, pAmp->NextStep, Status);
+            DLog("PA: Amp %u stopped at step %u %d\n", Amp, pAmp->NextStep, Status);//DebugLog
+        }
+    }
+
+    //InitPropVariantFromUInt32(SensorState_Idle, &(m_pSensorProperties->List[SENSOR_PROPERTY_STATE].Value));
+    m_PoweredOn = (OnlineCount > 0);
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    RecordMarker(TFA9890_TRACE_MARKER_D0_ENTRY_DONE);
+
+    if (m_PoweredOn)
+    {
+        ResumePowerGating();
+        ResumeModelPolling();
+        ScheduleSample();
+        HistoryAppendPower(true);
+        ResumeWatchdog();
+        PerfEnd(m_PowerUpRestored ? TFA9890_PERF_RESUME : TFA9890_PERF_D0_ENTRY, &m_SequenceMark);
+    }
+    else
+    {
+        TraceError("ACC %!FUNC! No amp could be configured %!STATUS!", Status);
+        DLog("PA: No amp could be configured %d\n", Status);//DebugLog
+    }
+
+    EndSequence();
+}
+
+// Trace the per-class queueing delay of every amplifier's bus scheduler
+VOID NxpTfa9890Device::TraceBusStatistics()
+{
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        for (ULONG Class = 0; Class < TFA9890_CMD_CLASS_COUNT; Class++)
+        {
+            TFA9890_QUEUE_STATS Stats;
+
+            m_Amps[Amp].Scheduler.GetStats(static_cast<TFA9890_CMD_CLASS>(Class), &Stats);
+            if (0 == Stats.Grants)
+            {
+                continue;
+            }
+
+            TraceInformation("ACC %!FUNC! Amp %u class %u grants %u, mean delay %I64u us, max delay %u us, preemptions %u",
+                             Amp, Class, Stats.Grants, Stats.TotalDelayUs / Stats.Grants,
+                             Stats.MaxDelayUs, Stats.Preemptions);
+        }
+    }
+
+    if (0 != m_BankSwitchCount)
+    {
+        TraceInformation("ACC %!FUNC! DSP bank switches %u, max switch %u us", m_BankSwitchCount, m_MaxBankSwitchUs);
+    }
+}
+
+// Mark the amps down while leaving D0. Taken under the bus lock, so every
+// path that checks m_PoweredOn under it is either done or finds them down
+// before their state is captured.
+NTSTATUS NxpTfa9890Device::PowerOff()
+{
+	DLog("PA: Enter PowerOff.\n");
+
+	NTSTATUS Status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    m_PoweredOn = false;
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+
+    return Status;
+}
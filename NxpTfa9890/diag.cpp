@@ -0,0 +1,450 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the speaker health diagnostics: the window
+//    statistics and FFT kernels, and the per-amp analysis that turns each
+//    window of model data into a compact health summary.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Diag.h"
+
+#include <math.h>
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#elif defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "Diag.tmh"
+
+
+#define DIAG_PI                 3.14159265358979f
+
+C_ASSERT(0 == (TFA9890_DIAG_WINDOW & (TFA9890_DIAG_WINDOW - 1)));
+
+// Four-lane helpers. Loads and stores are unaligned: the windows live in
+// the device context, which is only guaranteed pointer alignment.
+#if defined(_M_ARM) || defined(_M_ARM64)
+
+#define DIAG_SIMD               1
+typedef float32x4_t DIAG_VEC;
+
+inline DIAG_VEC VecLoad(const float* p)             { return vld1q_f32(p); }
+inline VOID     VecStore(float* p, DIAG_VEC v)      { vst1q_f32(p, v); }
+inline DIAG_VEC VecZero()                           { return vdupq_n_f32(0.0f); }
+inline DIAG_VEC VecAdd(DIAG_VEC a, DIAG_VEC b)      { return vaddq_f32(a, b); }
+inline DIAG_VEC VecSub(DIAG_VEC a, DIAG_VEC b)      { return vsubq_f32(a, b); }
+inline DIAG_VEC VecMul(DIAG_VEC a, DIAG_VEC b)      { return vmulq_f32(a, b); }
+inline DIAG_VEC VecMax(DIAG_VEC a, DIAG_VEC b)      { return vmaxq_f32(a, b); }
+inline DIAG_VEC VecMin(DIAG_VEC a, DIAG_VEC b)      { return vminq_f32(a, b); }
+inline DIAG_VEC VecAbs(DIAG_VEC a)                  { return vabsq_f32(a); }
+
+inline float VecSum(DIAG_VEC v)
+{
+    float32x2_t Pair = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(Pair, Pair), 0);
+}
+
+inline float VecMaxLane(DIAG_VEC v)
+{
+    float32x2_t Pair = vpmax_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpmax_f32(Pair, Pair), 0);
+}
+
+inline float VecMinLane(DIAG_VEC v)
+{
+    float32x2_t Pair = vpmin_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpmin_f32(Pair, Pair), 0);
+}
+
+#elif defined(_M_IX86) || defined(_M_X64)
+
+#define DIAG_SIMD               1
+typedef __m128 DIAG_VEC;
+
+inline DIAG_VEC VecLoad(const float* p)             { return _mm_loadu_ps(p); }
+inline VOID     VecStore(float* p, DIAG_VEC v)      { _mm_storeu_ps(p, v); }
+inline DIAG_VEC VecZero()                           { return _mm_setzero_ps(); }
+inline DIAG_VEC VecAdd(DIAG_VEC a, DIAG_VEC b)      { return _mm_add_ps(a, b); }
+inline DIAG_VEC VecSub(DIAG_VEC a, DIAG_VEC b)      { return _mm_sub_ps(a, b); }
+inline DIAG_VEC VecMul(DIAG_VEC a, DIAG_VEC b)      { return _mm_mul_ps(a, b); }
+inline DIAG_VEC VecMax(DIAG_VEC a, DIAG_VEC b)      { return _mm_max_ps(a, b); }
+inline DIAG_VEC VecMin(DIAG_VEC a, DIAG_VEC b)      { return _mm_min_ps(a, b); }
+inline DIAG_VEC VecAbs(DIAG_VEC a)                  { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+inline float VecSum(DIAG_VEC v)
+{
+    DIAG_VEC High = _mm_movehl_ps(v, v);
+    DIAG_VEC Pair = _mm_add_ps(v, High);
+    return _mm_cvtss_f32(_mm_add_ss(Pair, _mm_shuffle_ps(Pair, Pair, 1)));
+}
+
+inline float VecMaxLane(DIAG_VEC v)
+{
+    DIAG_VEC High = _mm_movehl_ps(v, v);
+    DIAG_VEC Pair = _mm_max_ps(v, High);
+    return _mm_cvtss_f32(_mm_max_ss(Pair, _mm_shuffle_ps(Pair, Pair, 1)));
+}
+
+inline float VecMinLane(DIAG_VEC v)
+{
+    DIAG_VEC High = _mm_movehl_ps(v, v);
+    DIAG_VEC Pair = _mm_min_ps(v, High);
+    return _mm_cvtss_f32(_mm_min_ss(Pair, _mm_shuffle_ps(Pair, Pair, 1)));
+}
+
+#else
+
+#define DIAG_SIMD               0
+
+#endif
+
+VOID DiagInitializeFft(
+    _Out_ PDIAG_FFT pFft)
+{
+    ULONG Bits = 0;
+    while ((1UL << Bits) < TFA9890_DIAG_WINDOW)
+    {
+        Bits++;
+    }
+
+    for (ULONG i = 0; i < TFA9890_DIAG_WINDOW; i++)
+    {
+        ULONG Reversed = 0;
+        for (ULONG b = 0; b < Bits; b++)
+        {
+            Reversed |= ((i >> b) & 1) << (Bits - 1 - b);
+        }
+
+        pFft->BitReverse[i] = static_cast<USHORT>(Reversed);
+        pFft->Hann[i] = 0.5f - 0.5f * cosf(2.0f * DIAG_PI * i / TFA9890_DIAG_WINDOW);
+    }
+
+    for (ULONG Half = 1; Half < TFA9890_DIAG_WINDOW; Half *= 2)
+    {
+        for (ULONG j = 0; j < Half; j++)
+        {
+            pFft->TwiddleRe[Half - 1 + j] = cosf(-DIAG_PI * j / Half);
+            pFft->TwiddleIm[Half - 1 + j] = sinf(-DIAG_PI * j / Half);
+        }
+    }
+}
+
+VOID DiagStatistics(
+    _In_reads_(Count) const float* pData,
+    _In_ ULONG Count,
+    _Out_ PDIAG_STATS pStats)
+{
+    float Sum = 0.0f;
+    float SumSquares = 0.0f;
+    float Peak = 0.0f;
+    ULONG i = 0;
+
+#if DIAG_SIMD
+    DIAG_VEC VecSumV = VecZero();
+    DIAG_VEC VecSquares = VecZero();
+    DIAG_VEC VecPeak = VecZero();
+
+    for (; i + 4 <= Count; i += 4)
+    {
+        DIAG_VEC Value = VecLoad(pData + i);
+        VecSumV = VecAdd(VecSumV, Value);
+        VecSquares = VecAdd(VecSquares, VecMul(Value, Value));
+        VecPeak = VecMax(VecPeak, VecAbs(Value));
+    }
+
+    Sum = VecSum(VecSumV);
+    SumSquares = VecSum(VecSquares);
+    Peak = VecMaxLane(VecPeak);
+#endif
+
+    for (; i < Count; i++)
+    {
+        Sum += pData[i];
+        SumSquares += pData[i] * pData[i];
+        Peak = max(Peak, fabsf(pData[i]));
+    }
+
+    pStats->Mean = Sum / Count;
+    pStats->Variance = max(SumSquares / Count - pStats->Mean * pStats->Mean, 0.0f);
+    pStats->Peak = Peak;
+}
+
+VOID DiagAggregate(
+    _In_reads_(Count) const float* pData,
+    _In_ ULONG Count,
+    _Inout_ PDIAG_AGGREGATE pAggregate)
+{
+    if (0 == Count)
+    {
+        return;
+    }
+
+    float Sum = 0.0f;
+    float SumSquares = 0.0f;
+    float Min = pData[0];
+    float Max = pData[0];
+    ULONG i = 0;
+
+#if DIAG_SIMD
+    if (Count >= 4)
+    {
+        DIAG_VEC VecSumV = VecZero();
+        DIAG_VEC VecSquares = VecZero();
+        DIAG_VEC VecMinV = VecLoad(pData);
+        DIAG_VEC VecMaxV = VecMinV;
+
+        for (; i + 4 <= Count; i += 4)
+        {
+            DIAG_VEC Value = VecLoad(pData + i);
+            VecSumV = VecAdd(VecSumV, Value);
+            VecSquares = VecAdd(VecSquares, VecMul(Value, Value));
+            VecMinV = VecMin(VecMinV, Value);
+            VecMaxV = VecMax(VecMaxV, Value);
+        }
+
+        Sum = VecSum(VecSumV);
+        SumSquares = VecSum(VecSquares);
+        Min = VecMinLane(VecMinV);
+        Max = VecMaxLane(VecMaxV);
+    }
+#endif
+
+    for (; i < Count; i++)
+    {
+        Sum += pData[i];
+        SumSquares += pData[i] * pData[i];
+        Min = min(Min, pData[i]);
+        Max = max(Max, pData[i]);
+    }
+
+    pAggregate->Min = (0 == pAggregate->Count) ? Min : min(pAggregate->Min, Min);
+    pAggregate->Max = (0 == pAggregate->Count) ? Max : max(pAggregate->Max, Max);
+    pAggregate->Sum += Sum;
+    pAggregate->SumSquares += SumSquares;
+    pAggregate->Count += Count;
+}
+
+// Iterative radix-2 decimation-in-time FFT. Stages with at least four
+// butterflies per group run four butterflies per vector operation.
+VOID DiagPowerSpectrum(
+    _Inout_ PDIAG_FFT pFft,
+    _In_reads_(TFA9890_DIAG_WINDOW) const float* pSignal,
+    _In_ float Mean)
+{
+    float* pRe = pFft->Re;
+    float* pIm = pFft->Im;
+
+    for (ULONG i = 0; i < TFA9890_DIAG_WINDOW; i++)
+    {
+        pRe[pFft->BitReverse[i]] = (pSignal[i] - Mean) * pFft->Hann[i];
+        pIm[i] = 0.0f;
+    }
+
+    for (ULONG Half = 1; Half < TFA9890_DIAG_WINDOW; Half *= 2)
+    {
+        const float* pWr = &pFft->TwiddleRe[Half - 1];
+        const float* pWi = &pFft->TwiddleIm[Half - 1];
+
+        for (ULONG Start = 0; Start < TFA9890_DIAG_WINDOW; Start += 2 * Half)
+        {
+            ULONG j = 0;
+
+#if DIAG_SIMD
+            for (; j + 4 <= Half; j += 4)
+            {
+                ULONG a = Start + j;
+                ULONG b = a + Half;
+
+                DIAG_VEC Wr = VecLoad(pWr + j);
+                DIAG_VEC Wi = VecLoad(pWi + j);
+                DIAG_VEC Br = VecLoad(pRe + b);
+                DIAG_VEC Bi = VecLoad(pIm + b);
+                DIAG_VEC Tr = VecSub(VecMul(Br, Wr), VecMul(Bi, Wi));
+                DIAG_VEC Ti = VecAdd(VecMul(Br, Wi), VecMul(Bi, Wr));
+                DIAG_VEC Ar = VecLoad(pRe + a);
+                DIAG_VEC Ai = VecLoad(pIm + a);
+
+                VecStore(pRe + a, VecAdd(Ar, Tr));
+                VecStore(pIm + a, VecAdd(Ai, Ti));
+                VecStore(pRe + b, VecSub(Ar, Tr));
+                VecStore(pIm + b, VecSub(Ai, Ti));
+            }
+#endif
+
+            for (; j < Half; j++)
+            {
+                ULONG a = Start + j;
+                ULONG b = a + Half;
+
+                float Tr = pRe[b] * pWr[j] - pIm[b] * pWi[j];
+                float Ti = pRe[b] * pWi[j] + pIm[b] * pWr[j];
+
+                pRe[b] = pRe[a] - Tr;
+                pIm[b] = pIm[a] - Ti;
+                pRe[a] += Tr;
+                pIm[a] += Ti;
+            }
+        }
+    }
+
+    ULONG k = 0;
+
+#if DIAG_SIMD
+    for (; k + 4 <= TFA9890_DIAG_WINDOW / 2; k += 4)
+    {
+        DIAG_VEC Re = VecLoad(pRe + k);
+        DIAG_VEC Im = VecLoad(pIm + k);
+        VecStore(&pFft->Power[k], VecAdd(VecMul(Re, Re), VecMul(Im, Im)));
+    }
+#endif
+
+    for (; k < TFA9890_DIAG_WINDOW / 2; k++)
+    {
+        pFft->Power[k] = pRe[k] * pRe[k] + pIm[k] * pIm[k];
+    }
+}
+
+// Power of bin k and its two neighbours; 0 past the end of the spectrum
+inline float DiagBandPower(
+    _In_ const float* pPower,
+    _In_ ULONG k)
+{
+    if (k + 1 >= TFA9890_DIAG_WINDOW / 2)
+    {
+        return 0.0f;
+    }
+
+    return pPower[k - 1] + pPower[k] + pPower[k + 1];
+}
+
+// Add one model frame to the amp's diagnostics window. Returns true once
+// the window is full; frames arriving before it is analyzed are dropped.
+bool NxpTfa9890Device::DiagAppend(
+    _In_ PTFA9890_AMP pAmp,     // Amplifier the frame came from
+    _In_ LONG Excursion,        // DSP fixed point
+    _In_ LONG Impedance)        // DSP fixed point
+{
+    if (pAmp->DiagCount < TFA9890_DIAG_WINDOW)
+    {
+        pAmp->DiagExcursion[pAmp->DiagCount] = Excursion * DIAG_FIXED_SCALE;
+        pAmp->DiagImpedance[pAmp->DiagCount] = Impedance * DIAG_FIXED_SCALE;
+        pAmp->DiagCount++;
+    }
+
+    return (TFA9890_DIAG_WINDOW == pAmp->DiagCount);
+}
+
+// Analyze a full window: Re from the mean impedance, the resonance from the
+// peak of the excursion spectrum and a distortion indicator from the power
+// at its second and third harmonics. The result replaces the amp's
+// published health summary and the window starts over.
+VOID NxpTfa9890Device::DiagAnalyze(
+    _In_ ULONG Amp)             // Amplifier index
+{
+    PTFA9890_AMP pAmp = &m_Amps[Amp];
+    TFA9890_HEALTH Health = pAmp->Health;
+    DIAG_STATS Excursion;
+    DIAG_STATS Impedance;
+
+    DiagStatistics(pAmp->DiagExcursion, TFA9890_DIAG_WINDOW, &Excursion);
+    DiagStatistics(pAmp->DiagImpedance, TFA9890_DIAG_WINDOW, &Impedance);
+
+    Health.Timestamp = QpcNow();
+    Health.Windows++;
+    Health.Re = Impedance.Mean;
+    Health.ExcursionRms = sqrtf(Excursion.Variance);
+    Health.ExcursionPeak = Excursion.Peak;
+
+    bool Quiet = (Health.ExcursionRms < TFA9890_DIAG_QUIET_RMS);
+    if (Quiet)
+    {
+        Health.QuietWindows++;
+    }
+    else
+    {
+        const float* pPower = m_DiagFft.Power;
+        ULONG First = max(static_cast<ULONG>(TFA9890_DIAG_MIN_RESONANCE_HZ * TFA9890_DIAG_WINDOW / TFA9890_MODEL_FRAME_RATE_HZ), 1UL);
+        ULONG Peak = First;
+
+        DiagPowerSpectrum(&m_DiagFft, pAmp->DiagExcursion, Excursion.Mean);
+
+        for (ULONG k = First + 1; k < TFA9890_DIAG_WINDOW / 2 - 1; k++)
+        {
+            if (pPower[k] > pPower[Peak])
+            {
+                Peak = k;
+            }
+        }
+
+        // Parabolic interpolation between the neighbouring bins
+        float Offset = 0.0f;
+        float Curvature = pPower[Peak - 1] - 2.0f * pPower[Peak] + pPower[Peak + 1];
+        if (Curvature < 0.0f)
+        {
+            Offset = 0.5f * (pPower[Peak - 1] - pPower[Peak + 1]) / Curvature;
+        }
+
+        Health.ResonanceHz = (Peak + Offset) * TFA9890_MODEL_FRAME_RATE_HZ / TFA9890_DIAG_WINDOW;
+
+        float Fundamental = DiagBandPower(pPower, Peak);
+        float Harmonics = DiagBandPower(pPower, 2 * Peak) + DiagBandPower(pPower, 3 * Peak);
+        Health.Distortion = (Fundamental > 0.0f) ? sqrtf(Harmonics / Fundamental) : 0.0f;
+
+        // Establish the baseline from the first usable windows
+        if (pAmp->DiagBaselineWindows < TFA9890_DIAG_BASELINE_WINDOWS)
+        {
+            pAmp->DiagBaselineRe += Health.Re;
+            pAmp->DiagBaselineResonanceHz += Health.ResonanceHz;
+
+            if (++pAmp->DiagBaselineWindows == TFA9890_DIAG_BASELINE_WINDOWS)
+            {
+                Health.BaselineRe = pAmp->DiagBaselineRe / TFA9890_DIAG_BASELINE_WINDOWS;
+                Health.BaselineResonanceHz = pAmp->DiagBaselineResonanceHz / TFA9890_DIAG_BASELINE_WINDOWS;
+
+                TraceInformation("ACC %!FUNC! Amp %u baseline resonance %d Hz", Amp, static_cast<LONG>(Health.BaselineResonanceHz));
+            }
+        }
+    }
+
+    ULONG Flags = 0;
+
+    if (Health.BaselineRe > 0.0f)
+    {
+        Health.ReDrift = (Health.Re - Health.BaselineRe) / Health.BaselineRe;
+        if (fabsf(Health.ReDrift) > TFA9890_DIAG_RE_DRIFT_LIMIT)
+        {
+            Flags |= TFA9890_HEALTH_RE_DRIFT;
+        }
+
+        if (fabsf(Health.ResonanceHz - Health.BaselineResonanceHz) > TFA9890_DIAG_RESONANCE_SHIFT_LIMIT * Health.BaselineResonanceHz)
+        {
+            Flags |= TFA9890_HEALTH_RESONANCE_SHIFT;
+        }
+    }
+
+    if (Health.Distortion > TFA9890_DIAG_DISTORTION_LIMIT)
+    {
+        Flags |= TFA9890_HEALTH_DISTORTION;
+    }
+
+    // Only report changes, so a degraded speaker does not flood the log
+    if (Flags != Health.Flags)
+    {
+        TraceWarning("ACC %!FUNC! Amp %u health flags 0x%x -> 0x%x", Amp, Health.Flags, Flags);
+        DLog("PA: Amp %u health flags 0x%x -> 0x%x\n", Amp, Health.Flags, Flags);//DebugLog
+    }
+    Health.Flags = Flags;
+
+    AcquireSRWLockExclusive(&m_HealthLock);
+    pAmp->Health = Health;
+    ReleaseSRWLockExclusive(&m_HealthLock);
+
+    pAmp->DiagCount = 0;
+}
@@ -0,0 +1,205 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the helpers that access the CoolFlux DSP
+//    memories of an amplifier through its CF_* register window.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Eq.h"
+
+#include "Dsp.tmh"
+
+
+// Chunk of a DSP memory transfer: the amp's chunk, in whole DSP words
+inline ULONG DspChunkBytes(
+    _In_ ULONG ChunkBytes)
+{
+    return max(ChunkBytes - ChunkBytes % TFA9890_DSP_WORD_BYTES, static_cast<ULONG>(TFA9890_DSP_WORD_BYTES));
+}
+
+// Point CF_CONTROLS and CF_MAD at a DSP word in one transaction. The
+// caller owns the amp's bus.
+NTSTATUS NxpTfa9890Device::SetDspAddress(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to set up
+    _In_ BYTE MemoryType,                           // TFA9890_DMEM_*
+    _In_ WORD Address)                              // Word address
+{
+    WORD Setup[2] = { TFA9890_BUS_WORD(TFA9890_CF_CONTROLS_DMEM(MemoryType)), TFA9890_BUS_WORD(Address) };
+
+    NTSTATUS Status = BusWrite(pAmp, TFA9890_CF_CONTROLS, reinterpret_cast<BYTE*>(Setup), sizeof(Setup));
+    if (NT_SUCCESS(Status))
+    {
+        UpdateShadow(pAmp, TFA9890_CF_CONTROLS, reinterpret_cast<BYTE*>(Setup), sizeof(Setup));
+    }
+    else
+    {
+        pAmp->Recovery.Failures++;
+        TraceError("ACC %!FUNC! DSP memory %u address 0x%04x setup failed %!STATUS!", MemoryType, Address, Status);
+    }
+
+    return Status;
+}
+
+// Write 24-bit words to one of the DSP memories. CF_CONTROLS and CF_MAD are
+// set up, then the data is streamed through CF_MEM in bus chunks of whole
+// words. Between chunks the bus is handed to any more urgent class; that
+// traffic may be another DSP transfer, so the address is set up again
+// where the stream resumes. Callers need not hold m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::WriteDspMemory(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to write to
+    _In_ TFA9890_CMD_CLASS Class,                   // Priority class of the transfer
+    _In_ BYTE MemoryType,                           // TFA9890_DMEM_*
+    _In_ WORD Address,                              // First word address
+    _In_reads_bytes_(Length) const BYTE* pData,     // Packed 24-bit words, MSB first
+    _In_ ULONG Length)                              // Number of bytes, a multiple of 3
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG ChunkBytes = DspChunkBytes(BulkChunkBytes(pAmp));
+    ULONG Offset = 0;
+    bool Setup = true;
+
+    if (0 != Length % TFA9890_DSP_WORD_BYTES)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pAmp->Scheduler.Acquire(Class);
+
+    while (Offset < Length)
+    {
+        if (Setup)
+        {
+            Status = SetDspAddress(pAmp, MemoryType, static_cast<WORD>(Address + Offset / TFA9890_DSP_WORD_BYTES));
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+            Setup = false;
+        }
+
+        ULONG ChunkLength = min(Length - Offset, ChunkBytes);
+
+        Status = BusWrite(pAmp, TFA9890_CF_MEM, pData + Offset, ChunkLength);
+        if (!NT_SUCCESS(Status))
+        {
+            pAmp->Recovery.Failures++;
+            TraceError("ACC %!FUNC! DSP memory %u address 0x%04x write failed at offset %u %!STATUS!", MemoryType, Address, Offset, Status);
+            break;
+        }
+
+        Offset += ChunkLength;
+
+        if (Offset < Length && pAmp->Scheduler.ShouldYield(Class))
+        {
+            pAmp->Scheduler.CountPreemption(Class);
+            pAmp->Scheduler.Release();
+            pAmp->Scheduler.Acquire(Class);
+            Setup = true;
+        }
+    }
+
+    pAmp->Scheduler.Release();
+
+    return Status;
+}
+
+// Read 24-bit words from one of the DSP memories, the counterpart of
+// WriteDspMemory
+NTSTATUS NxpTfa9890Device::ReadDspMemory(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to read from
+    _In_ TFA9890_CMD_CLASS Class,                   // Priority class of the transfer
+    _In_ BYTE MemoryType,                           // TFA9890_DMEM_*
+    _In_ WORD Address,                              // First word address
+    _Out_writes_bytes_(Length) BYTE* pData,         // Receives packed 24-bit words, MSB first
+    _In_ ULONG Length,                              // Number of bytes, a multiple of 3
+    _In_ ULONG ChunkBytes)                          // Largest single transaction, a multiple of 3
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG Offset = 0;
+    bool Setup = true;
+
+    if (0 != Length % TFA9890_DSP_WORD_BYTES)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ChunkBytes = DspChunkBytes(ClampChunkBytes(pAmp, ChunkBytes));
+
+    pAmp->Scheduler.Acquire(Class);
+
+    while (Offset < Length)
+    {
+        if (Setup)
+        {
+            Status = SetDspAddress(pAmp, MemoryType, static_cast<WORD>(Address + Offset / TFA9890_DSP_WORD_BYTES));
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+            Setup = false;
+        }
+
+        ULONG ChunkLength = min(Length - Offset, ChunkBytes);
+
+        Status = BusRead(pAmp, TFA9890_CF_MEM, pData + Offset, ChunkLength);
+        if (!NT_SUCCESS(Status))
+        {
+            pAmp->Recovery.Failures++;
+            TraceError("ACC %!FUNC! DSP memory %u address 0x%04x read failed at offset %u %!STATUS!", MemoryType, Address, Offset, Status);
+            break;
+        }
+
+        Offset += ChunkLength;
+
+        if (Offset < Length && pAmp->Scheduler.ShouldYield(Class))
+        {
+            pAmp->Scheduler.CountPreemption(Class);
+            pAmp->Scheduler.Release();
+            pAmp->Scheduler.Acquire(Class);
+            Setup = true;
+        }
+    }
+
+    pAmp->Scheduler.Release();
+
+    return Status;
+}
+
+// Write a single 24-bit word to one of the DSP memories in one bus
+// transaction: CF_CONTROLS, CF_MAD and the word in CF_MEM are sent as one
+// auto-increment write, so the DSP either sees the new word or the old one.
+NTSTATUS NxpTfa9890Device::WriteDspWord(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to write to
+    _In_ TFA9890_CMD_CLASS Class,                   // Priority class of the transfer
+    _In_ BYTE MemoryType,                           // TFA9890_DMEM_*
+    _In_ WORD Address,                              // Word address
+    _In_ LONG Value)                                // 24-bit value
+{
+    BYTE Buffer[2 * sizeof(WORD) + TFA9890_DSP_WORD_BYTES];
+    WORD Setup[2] = { TFA9890_BUS_WORD(TFA9890_CF_CONTROLS_DMEM(MemoryType)), TFA9890_BUS_WORD(Address) };
+
+    RtlCopyMemory(Buffer, Setup, sizeof(Setup));
+    EqPackDspWords(&Value, 1, Buffer + sizeof(Setup));
+
+    pAmp->Scheduler.Acquire(Class);
+
+    NTSTATUS Status = BusWrite(pAmp, TFA9890_CF_CONTROLS, Buffer, sizeof(Buffer));
+    if (NT_SUCCESS(Status))
+    {
+        UpdateShadow(pAmp, TFA9890_CF_CONTROLS, Buffer, sizeof(Setup));
+    }
+    else
+    {
+        pAmp->Recovery.Failures++;
+        TraceError("ACC %!FUNC! DSP memory %u address 0x%04x write failed %!STATUS!", MemoryType, Address, Status);
+    }
+
+    pAmp->Scheduler.Release();
+
+    return Status;
+}
@@ -0,0 +1,162 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the post-mortem dump of an amplifier's register
+//    file and DSP memories.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Dump.tmh"
+
+
+// Bytes one register or DSP word of the region takes in the dump image
+inline ULONG DumpUnitBytes(
+    _In_ const TFA9890_DUMP_REGION* pRegion)
+{
+    return (Tfa9890DumpRegisters == pRegion->Source) ? static_cast<ULONG>(sizeof(WORD)) : TFA9890_DSP_WORD_BYTES;
+}
+
+// Returns true if the region lies inside the register or DSP address space
+inline bool IsDumpRegionValid(
+    _In_ const TFA9890_DUMP_REGION* pRegion)
+{
+    ULONG Limit = (Tfa9890DumpRegisters == pRegion->Source) ? TFA9890_REGISTER_COUNT : 0x10000;
+
+    return pRegion->Source < Tfa9890DumpSourceCount &&
+           0 != pRegion->Count &&
+           pRegion->Address < Limit &&
+           pRegion->Count <= Limit - pRegion->Address;
+}
+
+// Read Length bytes of one region, starting Skip bytes into it, with bulk
+// priority. Callers pass at most one dump chunk, so other traffic is only
+// held off one chunk at a time.
+NTSTATUS NxpTfa9890Device::ReadDumpRegion(
+    _In_ PTFA9890_AMP pAmp,                         // Amplifier to read from
+    _In_ const TFA9890_DUMP_REGION* pRegion,        // Region to read
+    _In_ ULONG Skip,                                // Byte offset into the region, whole units
+    _Out_writes_bytes_(Length) BYTE* pData,         // Receives the data
+    _In_ ULONG Length)                              // Number of bytes, whole units
+{
+    ULONG First = pRegion->Address + Skip / DumpUnitBytes(pRegion);
+
+    if (Tfa9890DumpRegisters == pRegion->Source)
+    {
+        return ReadBurst(pAmp, TFA9890_CMD_CLASS_BULK, static_cast<BYTE>(First), pData, Length, true, TFA9890_DUMP_CHUNK_BYTES);
+    }
+
+    return ReadDspMemory(pAmp, TFA9890_CMD_CLASS_BULK, static_cast<BYTE>(pRegion->Source - Tfa9890DumpPmem),
+                         static_cast<WORD>(First), pData, Length, TFA9890_DUMP_CHUNK_BYTES);
+}
+
+// Validate the regions and the resume offset, then fill as much of the
+// dump image as fits in Space bytes of pOutput->Data. Read failures are
+// reported in pOutput; what was read before the failure is kept.
+NTSTATUS NxpTfa9890Device::DumpAmp(
+    _In_ const TFA9890_DUMP_INPUT* pInput,          // Amplifier, regions and resume offset
+    _Out_ PTFA9890_DUMP_OUTPUT pOutput,             // Receives the header and the data
+    _In_ ULONG Space)                               // Bytes available in pOutput->Data
+{
+    ULONG TotalBytes = 0;
+    bool OffsetAligned = false;
+
+    if (pInput->Amp >= m_AmpCount || 0 == pInput->RegionCount || pInput->RegionCount > TFA9890_DUMP_MAX_REGIONS)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Validate everything before touching the bus
+    for (ULONG i = 0; i < pInput->RegionCount; i++)
+    {
+        const TFA9890_DUMP_REGION* pRegion = &pInput->Regions[i];
+
+        if (!IsDumpRegionValid(pRegion))
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        ULONG RegionBytes = pRegion->Count * DumpUnitBytes(pRegion);
+        if (pInput->Offset >= TotalBytes && pInput->Offset < TotalBytes + RegionBytes)
+        {
+            OffsetAligned = (0 == (pInput->Offset - TotalBytes) % DumpUnitBytes(pRegion));
+        }
+        TotalBytes += RegionBytes;
+    }
+
+    if (!OffsetAligned && pInput->Offset != TotalBytes)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PTFA9890_AMP pAmp = &m_Amps[pInput->Amp];
+    ULONG Offset = pInput->Offset;
+    ULONG RegionStart = 0;
+    ULONG Written = 0;
+    NTSTATUS ReadStatus = STATUS_SUCCESS;
+
+    for (ULONG i = 0; i < pInput->RegionCount && Offset < TotalBytes; i++)
+    {
+        const TFA9890_DUMP_REGION* pRegion = &pInput->Regions[i];
+        ULONG Unit = DumpUnitBytes(pRegion);
+        ULONG RegionBytes = pRegion->Count * Unit;
+
+        if (Offset >= RegionStart + RegionBytes)
+        {
+            RegionStart += RegionBytes;
+            continue;
+        }
+
+        ULONG Skip = Offset - RegionStart;
+        ULONG Length = min(RegionBytes - Skip, Space - Space % Unit);
+        if (0 == Length)
+        {
+            break;
+        }
+
+        // The bus lock is taken one chunk at a time, so other sequences can
+        // run between chunks. Each chunk sets its DSP address up again, since
+        // those sequences may move it.
+        for (ULONG Done = 0; NT_SUCCESS(ReadStatus) && Done < Length; )
+        {
+            ULONG Chunk = min(Length - Done, static_cast<ULONG>(TFA9890_DUMP_CHUNK_BYTES));
+
+            WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+            ReadStatus = ReadDumpRegion(pAmp, pRegion, Skip + Done, &pOutput->Data[Written + Done], Chunk);
+            WdfWaitLockRelease(m_I2CWaitLock);
+
+            if (NT_SUCCESS(ReadStatus))
+            {
+                Done += Chunk;
+            }
+            else
+            {
+                // Keep what was read before the failure
+                Length = Done;
+            }
+        }
+
+        Offset += Length;
+        Written += Length;
+        Space -= Length;
+        RegionStart += RegionBytes;
+
+        if (!NT_SUCCESS(ReadStatus))
+        {
+            TraceError("ACC %!FUNC! Amp %u dump of region %u failed %!STATUS!", pInput->Amp, i, ReadStatus);
+            DLog("PA: Amp %u dump of region %u failed %d\n", pInput->Amp, i, ReadStatus);//DebugLog
+            break;
+        }
+    }
+
+    pOutput->Status = ReadStatus;
+    pOutput->Offset = pInput->Offset;
+    pOutput->BytesWritten = Written;
+    pOutput->TotalBytes = TotalBytes;
+
+    return STATUS_SUCCESS;
+}
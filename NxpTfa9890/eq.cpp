@@ -0,0 +1,578 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the implementation of the parametric EQ
+//    coefficient engine and the changed-band upload to the DSP.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Eq.h"
+
+#include <math.h>
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#elif defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "Eq.tmh"
+
+
+// Halved coefficients in 1.23 format
+#define EQ_FIXED_SCALE          4194304.0f      // 2^23 / 2
+#define EQ_FIXED_MAX            8388607.0f      // 2^23 - 1
+#define EQ_FIXED_MIN            -8388608.0f     // -2^23
+
+#define EQ_PI                   3.14159265358979f
+
+// Audio EQ cookbook designs (R. Bristow-Johnson). The trigonometry is done
+// per band; everything after it is batched.
+NTSTATUS EqDesignBand(
+    _In_ const TFA9890_EQ_BAND* pBand,  // Band parameters
+    _Inout_ PEQ_BATCH pBatch)           // Batch to append the design to
+{
+    const float Nyquist = TFA9890_EQ_SAMPLE_RATE / 2.0f;
+
+    if (pBatch->Count >= EQ_BATCH_SIZE ||
+        pBand->Type >= Tfa9890EqTypeCount ||
+        (Tfa9890EqBypass != pBand->Type &&
+         (!(pBand->FrequencyHz > 0.0f && pBand->FrequencyHz < Nyquist) ||
+          !(pBand->Q > 0.0f) ||
+          !(fabsf(pBand->GainDb) <= TFA9890_EQ_MAX_GAIN_DB))))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    float W0 = 2.0f * EQ_PI * pBand->FrequencyHz / TFA9890_EQ_SAMPLE_RATE;
+    float CosW0 = cosf(W0);
+    float Alpha = sinf(W0) / (2.0f * pBand->Q);
+    float A = powf(10.0f, pBand->GainDb / 40.0f);
+    float SqrtA2Alpha = 2.0f * sqrtf(A) * Alpha;
+
+    float B0 = 1.0f, B1 = 0.0f, B2 = 0.0f;
+    float A0 = 1.0f, A1 = 0.0f, A2 = 0.0f;
+
+    switch (pBand->Type)
+    {
+        case Tfa9890EqPeaking:
+            B0 = 1.0f + Alpha * A;
+            B1 = -2.0f * CosW0;
+            B2 = 1.0f - Alpha * A;
+            A0 = 1.0f + Alpha / A;
+            A1 = -2.0f * CosW0;
+            A2 = 1.0f - Alpha / A;
+            break;
+
+        case Tfa9890EqLowShelf:
+            B0 = A * ((A + 1.0f) - (A - 1.0f) * CosW0 + SqrtA2Alpha);
+            B1 = 2.0f * A * ((A - 1.0f) - (A + 1.0f) * CosW0);
+            B2 = A * ((A + 1.0f) - (A - 1.0f) * CosW0 - SqrtA2Alpha);
+            A0 = (A + 1.0f) + (A - 1.0f) * CosW0 + SqrtA2Alpha;
+            A1 = -2.0f * ((A - 1.0f) + (A + 1.0f) * CosW0);
+            A2 = (A + 1.0f) + (A - 1.0f) * CosW0 - SqrtA2Alpha;
+            break;
+
+        case Tfa9890EqHighShelf:
+            B0 = A * ((A + 1.0f) + (A - 1.0f) * CosW0 + SqrtA2Alpha);
+            B1 = -2.0f * A * ((A - 1.0f) + (A + 1.0f) * CosW0);
+            B2 = A * ((A + 1.0f) + (A - 1.0f) * CosW0 - SqrtA2Alpha);
+            A0 = (A + 1.0f) - (A - 1.0f) * CosW0 + SqrtA2Alpha;
+            A1 = 2.0f * ((A - 1.0f) - (A + 1.0f) * CosW0);
+            A2 = (A + 1.0f) - (A - 1.0f) * CosW0 - SqrtA2Alpha;
+            break;
+
+        case Tfa9890EqLowPass:
+            B0 = (1.0f - CosW0) / 2.0f;
+            B1 = 1.0f - CosW0;
+            B2 = (1.0f - CosW0) / 2.0f;
+            A0 = 1.0f + Alpha;
+            A1 = -2.0f * CosW0;
+            A2 = 1.0f - Alpha;
+            break;
+
+        case Tfa9890EqHighPass:
+            B0 = (1.0f + CosW0) / 2.0f;
+            B1 = -(1.0f + CosW0);
+            B2 = (1.0f + CosW0) / 2.0f;
+            A0 = 1.0f + Alpha;
+            A1 = -2.0f * CosW0;
+            A2 = 1.0f - Alpha;
+            break;
+
+        case Tfa9890EqNotch:
+            B0 = 1.0f;
+            B1 = -2.0f * CosW0;
+            B2 = 1.0f;
+            A0 = 1.0f + Alpha;
+            A1 = -2.0f * CosW0;
+            A2 = 1.0f - Alpha;
+            break;
+
+        default:
+            // Bypass: unity gain
+            break;
+    }
+
+    ULONG i = pBatch->Count++;
+    pBatch->B0[i] = B0;
+    pBatch->B1[i] = B1;
+    pBatch->B2[i] = B2;
+    pBatch->A0[i] = A0;
+    pBatch->A1[i] = A1;
+    pBatch->A2[i] = A2;
+
+    return STATUS_SUCCESS;
+}
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+
+// Scale, saturate and round half away from zero, four lanes at a time
+inline int32x4_t EqToFixed(float32x4_t Value, float32x4_t Scale)
+{
+    float32x4_t Scaled = vmulq_f32(Value, Scale);
+    Scaled = vminq_f32(vmaxq_f32(Scaled, vdupq_n_f32(EQ_FIXED_MIN)), vdupq_n_f32(EQ_FIXED_MAX));
+    float32x4_t Half = vbslq_f32(vdupq_n_u32(0x80000000), Scaled, vdupq_n_f32(0.5f));
+    return vcvtq_s32_f32(vaddq_f32(Scaled, Half));
+}
+
+VOID EqQuantizeBatch(
+    _Inout_ PEQ_BATCH pBatch,
+    _Out_writes_(pBatch->Count) LONG (*pCoeffs)[TFA9890_EQ_COEFFS])
+{
+    DECLSPEC_ALIGN(16) int32_t Fixed[TFA9890_EQ_COEFFS][EQ_VECTOR_WIDTH];
+    float32x4_t Scale = vdupq_n_f32(EQ_FIXED_SCALE);
+    float32x4_t NegScale = vdupq_n_f32(-EQ_FIXED_SCALE);
+
+    // Unused lanes of the last vector are designed as unity gain
+    for (ULONG i = pBatch->Count; i < EQ_BATCH_SIZE; i++)
+    {
+        pBatch->B0[i] = pBatch->A0[i] = 1.0f;
+        pBatch->B1[i] = pBatch->B2[i] = pBatch->A1[i] = pBatch->A2[i] = 0.0f;
+    }
+
+    for (ULONG i = 0; i < pBatch->Count; i += EQ_VECTOR_WIDTH)
+    {
+        // 1 / a0 by reciprocal estimate refined with two Newton-Raphson steps
+        float32x4_t A0 = vld1q_f32(&pBatch->A0[i]);
+        float32x4_t Inv = vrecpeq_f32(A0);
+        Inv = vmulq_f32(vrecpsq_f32(A0, Inv), Inv);
+        Inv = vmulq_f32(vrecpsq_f32(A0, Inv), Inv);
+
+        vst1q_s32(Fixed[0], EqToFixed(vmulq_f32(vld1q_f32(&pBatch->B0[i]), Inv), Scale));
+        vst1q_s32(Fixed[1], EqToFixed(vmulq_f32(vld1q_f32(&pBatch->B1[i]), Inv), Scale));
+        vst1q_s32(Fixed[2], EqToFixed(vmulq_f32(vld1q_f32(&pBatch->B2[i]), Inv), Scale));
+        vst1q_s32(Fixed[3], EqToFixed(vmulq_f32(vld1q_f32(&pBatch->A1[i]), Inv), NegScale));
+        vst1q_s32(Fixed[4], EqToFixed(vmulq_f32(vld1q_f32(&pBatch->A2[i]), Inv), NegScale));
+
+        for (ULONG Lane = 0; Lane < EQ_VECTOR_WIDTH && i + Lane < pBatch->Count; Lane++)
+        {
+            for (ULONG c = 0; c < TFA9890_EQ_COEFFS; c++)
+            {
+                pCoeffs[i + Lane][c] = Fixed[c][Lane];
+            }
+        }
+    }
+}
+
+#elif defined(_M_IX86) || defined(_M_X64)
+
+// Scale, saturate and round half away from zero, four lanes at a time, as
+// the ARM and scalar paths do
+inline __m128i EqToFixed(__m128 Value, __m128 Scale)
+{
+    __m128 Scaled = _mm_mul_ps(Value, Scale);
+    Scaled = _mm_min_ps(_mm_max_ps(Scaled, _mm_set1_ps(EQ_FIXED_MIN)), _mm_set1_ps(EQ_FIXED_MAX));
+    __m128 Half = _mm_or_ps(_mm_and_ps(Scaled, _mm_set1_ps(-0.0f)), _mm_set1_ps(0.5f));
+    return _mm_cvttps_epi32(_mm_add_ps(Scaled, Half));
+}
+
+VOID EqQuantizeBatch(
+    _Inout_ PEQ_BATCH pBatch,
+    _Out_writes_(pBatch->Count) LONG (*pCoeffs)[TFA9890_EQ_COEFFS])
+{
+    DECLSPEC_ALIGN(16) INT32 Fixed[TFA9890_EQ_COEFFS][EQ_VECTOR_WIDTH];
+    __m128 Scale = _mm_set1_ps(EQ_FIXED_SCALE);
+    __m128 NegScale = _mm_set1_ps(-EQ_FIXED_SCALE);
+
+    // Unused lanes of the last vector are designed as unity gain
+    for (ULONG i = pBatch->Count; i < EQ_BATCH_SIZE; i++)
+    {
+        pBatch->B0[i] = pBatch->A0[i] = 1.0f;
+        pBatch->B1[i] = pBatch->B2[i] = pBatch->A1[i] = pBatch->A2[i] = 0.0f;
+    }
+
+    for (ULONG i = 0; i < pBatch->Count; i += EQ_VECTOR_WIDTH)
+    {
+        __m128 Inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_load_ps(&pBatch->A0[i]));
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(Fixed[0]), EqToFixed(_mm_mul_ps(_mm_load_ps(&pBatch->B0[i]), Inv), Scale));
+        _mm_store_si128(reinterpret_cast<__m128i*>(Fixed[1]), EqToFixed(_mm_mul_ps(_mm_load_ps(&pBatch->B1[i]), Inv), Scale));
+        _mm_store_si128(reinterpret_cast<__m128i*>(Fixed[2]), EqToFixed(_mm_mul_ps(_mm_load_ps(&pBatch->B2[i]), Inv), Scale));
+        _mm_store_si128(reinterpret_cast<__m128i*>(Fixed[3]), EqToFixed(_mm_mul_ps(_mm_load_ps(&pBatch->A1[i]), Inv), NegScale));
+        _mm_store_si128(reinterpret_cast<__m128i*>(Fixed[4]), EqToFixed(_mm_mul_ps(_mm_load_ps(&pBatch->A2[i]), Inv), NegScale));
+
+        for (ULONG Lane = 0; Lane < EQ_VECTOR_WIDTH && i + Lane < pBatch->Count; Lane++)
+        {
+            for (ULONG c = 0; c < TFA9890_EQ_COEFFS; c++)
+            {
+                pCoeffs[i + Lane][c] = Fixed[c][Lane];
+            }
+        }
+    }
+}
+
+#else
+
+inline LONG EqToFixed(float Value, float Scale)
+{
+    float Scaled = Value * Scale;
+    Scaled = (Scaled < EQ_FIXED_MIN) ? EQ_FIXED_MIN : ((Scaled > EQ_FIXED_MAX) ? EQ_FIXED_MAX : Scaled);
+    return static_cast<LONG>(Scaled + ((Scaled < 0.0f) ? -0.5f : 0.5f));
+}
+
+VOID EqQuantizeBatch(
+    _Inout_ PEQ_BATCH pBatch,
+    _Out_writes_(pBatch->Count) LONG (*pCoeffs)[TFA9890_EQ_COEFFS])
+{
+    for (ULONG i = 0; i < pBatch->Count; i++)
+    {
+        float Inv = 1.0f / pBatch->A0[i];
+
+        pCoeffs[i][0] = EqToFixed(pBatch->B0[i] * Inv, EQ_FIXED_SCALE);
+        pCoeffs[i][1] = EqToFixed(pBatch->B1[i] * Inv, EQ_FIXED_SCALE);
+        pCoeffs[i][2] = EqToFixed(pBatch->B2[i] * Inv, EQ_FIXED_SCALE);
+        pCoeffs[i][3] = EqToFixed(pBatch->A1[i] * Inv, -EQ_FIXED_SCALE);
+        pCoeffs[i][4] = EqToFixed(pBatch->A2[i] * Inv, -EQ_FIXED_SCALE);
+    }
+}
+
+#endif
+
+VOID EqPackDspWords(
+    _In_reads_(Count) const LONG* pWords,
+    _In_ ULONG Count,
+    _Out_writes_bytes_(Count * TFA9890_DSP_WORD_BYTES) BYTE* pBuffer)
+{
+    for (ULONG i = 0; i < Count; i++)
+    {
+        pBuffer[i * TFA9890_DSP_WORD_BYTES + 0] = static_cast<BYTE>(pWords[i] >> 16);
+        pBuffer[i * TFA9890_DSP_WORD_BYTES + 1] = static_cast<BYTE>(pWords[i] >> 8);
+        pBuffer[i * TFA9890_DSP_WORD_BYTES + 2] = static_cast<BYTE>(pWords[i]);
+    }
+}
+
+// Returns true if the bank does not hold Coeffs for Band
+inline bool IsEqBandDifferent(
+    _In_ PTFA9890_AMP pAmp,
+    _In_ ULONG Bank,
+    _In_ ULONG Band,
+    _In_reads_(TFA9890_EQ_COEFFS) const LONG* pCoeffs)
+{
+    return (0 == (pAmp->EqValid[Bank] & (1UL << Band))) ||
+           (0 != memcmp(pAmp->EqCoeffs[Bank][Band], pCoeffs, sizeof(pAmp->EqCoeffs[Bank][Band])));
+}
+
+// Design and convert the requested bands once, then load them into the idle
+// parameter bank of every selected amplifier and, unless deferred, switch
+// the amps over. Loads run one at a time under m_EqLoadLock; m_I2CWaitLock
+// is only taken around the EQ state and the switch, so bank switches and
+// background reads are not held up for the whole upload.
+NTSTATUS NxpTfa9890Device::SetEqBands(
+    _In_ ULONG AmpMask,                                 // Bit n selects amplifier n
+    _In_reads_(Count) const TFA9890_EQ_BAND* pBands,    // Bands to change
+    _In_ ULONG Count,                                   // Number of bands
+    _In_ ULONG Flags,                                   // TFA9890_EQ_FLAG_*
+    _Out_ PTFA9890_EQ_OUTPUT pResult)                   // Upload statistics
+{
+    EQ_BATCH Batch;
+    LONG Coeffs[EQ_BATCH_SIZE][TFA9890_EQ_COEFFS];
+    LONG Requested[TFA9890_EQ_BANDS][TFA9890_EQ_COEFFS];
+    ULONG RequestedMask = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    RtlZeroMemory(pResult, sizeof(*pResult));
+
+    if (0 == AmpMask || 0 != (AmpMask >> m_AmpCount) || 0 == Count || Count > TFA9890_EQ_BANDS)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    LONGLONG Start = QpcNow();
+
+    Batch.Count = 0;
+    for (ULONG i = 0; i < Count; i++)
+    {
+        if (pBands[i].Index >= TFA9890_EQ_BANDS)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Status = EqDesignBand(&pBands[i], &Batch);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! Band %u is invalid %!STATUS!", pBands[i].Index, Status);
+            return Status;
+        }
+    }
+
+    EqQuantizeBatch(&Batch, Coeffs);
+
+    // Later entries for the same band win
+    for (ULONG i = 0; i < Count; i++)
+    {
+        RtlCopyMemory(Requested[pBands[i].Index], Coeffs[i], sizeof(Coeffs[i]));
+        RequestedMask |= (1UL << pBands[i].Index);
+    }
+
+    pResult->ComputeUs = QpcToUs(QpcNow() - Start);
+    Start = QpcNow();
+
+    AcquireSRWLockExclusive(&m_EqLoadLock);
+
+    // Audio keeps playing from the active banks during the whole upload
+    ULONG LoadedMask = 0;
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (0 == (AmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        NTSTATUS LoadStatus = LoadEqBank(&m_Amps[Amp], RequestedMask, Requested, pResult);
+        if (NT_SUCCESS(LoadStatus))
+        {
+            LoadedMask |= (1UL << Amp);
+        }
+        else
+        {
+            Status = NT_SUCCESS(Status) ? LoadStatus : Status;
+            TraceError("ACC %!FUNC! Amp %u EQ load failed %!STATUS!", Amp, LoadStatus);
+            DLog("PA: Amp %u EQ load failed %d\n", Amp, LoadStatus);//DebugLog
+        }
+    }
+
+    pResult->UploadUs = QpcToUs(QpcNow() - Start);
+
+    // Amps whose upload failed keep running their previous set
+    if (0 == (Flags & TFA9890_EQ_FLAG_DEFER_SWITCH) && 0 != LoadedMask)
+    {
+        TFA9890_BANK_SWITCH_OUTPUT Switch;
+
+        WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+        NTSTATUS SwitchStatus = SwitchBanks(LoadedMask, &Switch);
+        WdfWaitLockRelease(m_I2CWaitLock);
+
+        Status = NT_SUCCESS(Status) ? SwitchStatus : Status;
+        pResult->AmpsSwitched = Switch.AmpsSwitched;
+        pResult->SwitchUs = Switch.SwitchUs;
+    }
+
+    ReleaseSRWLockExclusive(&m_EqLoadLock);
+
+    pResult->Status = Status;
+
+    TraceInformation("ACC %!FUNC! EQ %u bands uploaded, %u unchanged, compute %u us, upload %u us, switch %u us",
+                     pResult->BandsUploaded, pResult->BandsUnchanged, pResult->ComputeUs, pResult->UploadUs, pResult->SwitchUs);
+
+    return Status;
+}
+
+// Bring the idle bank of one amplifier to the set the DSP should run next:
+// the requested bands over whatever the amp already runs (or has pending).
+// Only bands the idle bank does not already hold are written, and runs of
+// adjacent bands go out as one DSP memory transfer. The transfers run
+// without m_I2CWaitLock; meanwhile the amp is marked EqLoading and its
+// idle bank is not switched to. A restore of the amp abandons the load.
+// The caller holds m_EqLoadLock.
+NTSTATUS NxpTfa9890Device::LoadEqBank(
+    _In_ PTFA9890_AMP pAmp,                             // Amplifier to load
+    _In_ ULONG RequestedMask,                           // Bit n set if band n was requested
+    _In_ LONG (*pRequested)[TFA9890_EQ_COEFFS],         // Requested coefficients, by band
+    _Inout_ PTFA9890_EQ_OUTPUT pResult)                 // Upload statistics
+{
+    LONG Target[TFA9890_EQ_BANDS][TFA9890_EQ_COEFFS];
+    ULONG WriteMask = 0;
+    ULONG WrittenMask = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    if (!m_PoweredOn)
+    {
+        WdfWaitLockRelease(m_I2CWaitLock);
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    ULONG Idle = pAmp->ActiveBank ^ 1;
+    ULONG Base = pAmp->BankPending ? Idle : pAmp->ActiveBank;
+    bool SwitchNeeded = pAmp->BankPending;
+
+    for (ULONG Band = 0; Band < TFA9890_EQ_BANDS; Band++)
+    {
+        if (0 != (RequestedMask & (1UL << Band)))
+        {
+            RtlCopyMemory(Target[Band], pRequested[Band], sizeof(Target[Band]));
+        }
+        else if (0 != (pAmp->EqValid[Base] & (1UL << Band)))
+        {
+            RtlCopyMemory(Target[Band], pAmp->EqCoeffs[Base][Band], sizeof(Target[Band]));
+        }
+        else
+        {
+            continue;
+        }
+
+        if (IsEqBandDifferent(pAmp, pAmp->ActiveBank, Band, Target[Band]))
+        {
+            SwitchNeeded = true;
+        }
+        else if (0 != (RequestedMask & (1UL << Band)))
+        {
+            pResult->BandsUnchanged++;
+        }
+
+        if (IsEqBandDifferent(pAmp, Idle, Band, Target[Band]))
+        {
+            WriteMask |= (1UL << Band);
+        }
+    }
+
+    // The DSP already runs this set
+    if (!SwitchNeeded)
+    {
+        WdfWaitLockRelease(m_I2CWaitLock);
+        return STATUS_SUCCESS;
+    }
+
+    // Invalidate first so a failed transfer never leaves a band marked as
+    // matching the DSP
+    pAmp->EqValid[Idle] &= ~WriteMask;
+    pAmp->BankPending = false;
+    pAmp->EqLoading = true;
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    ULONG Band = 0;
+    while (NT_SUCCESS(Status) && Band < TFA9890_EQ_BANDS)
+    {
+        // Find the next run of bands the idle bank does not hold yet
+        ULONG First = Band;
+        while (First < TFA9890_EQ_BANDS && 0 == (WriteMask & (1UL << First)))
+        {
+            First++;
+        }
+
+        ULONG Last = First;
+        while (Last < TFA9890_EQ_BANDS && 0 != (WriteMask & (1UL << Last)))
+        {
+            Last++;
+        }
+
+        if (First < Last)
+        {
+            BYTE Buffer[TFA9890_EQ_BANDS * TFA9890_EQ_COEFFS * TFA9890_DSP_WORD_BYTES];
+            ULONG Words = (Last - First) * TFA9890_EQ_COEFFS;
+
+            EqPackDspWords(&Target[First][0], Words, Buffer);
+
+            Status = WriteDspMemory(pAmp, TFA9890_CMD_CLASS_CONFIG, TFA9890_DMEM_XMEM,
+                                    static_cast<WORD>(TFA9890_XMEM_EQ_BANK(Idle) + First * TFA9890_EQ_COEFFS),
+                                    Buffer, Words * TFA9890_DSP_WORD_BYTES);
+            if (NT_SUCCESS(Status))
+            {
+                WrittenMask |= WriteMask & ~((1UL << First) - 1) & ((1UL << Last) - 1);
+            }
+            else
+            {
+                TraceError("ACC %!FUNC! EQ upload of bands %u-%u to bank %u failed %!STATUS!", First, Last - 1, Idle, Status);
+            }
+        }
+
+        Band = Last;
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    if (pAmp->EqLoading)
+    {
+        for (ULONG b = 0; b < TFA9890_EQ_BANDS; b++)
+        {
+            if (0 != (WrittenMask & (1UL << b)))
+            {
+                RtlCopyMemory(pAmp->EqCoeffs[Idle][b], Target[b], sizeof(Target[b]));
+                pAmp->EqValid[Idle] |= (1UL << b);
+                pResult->BandsUploaded++;
+            }
+        }
+
+        // A partly loaded bank is never switched to
+        pAmp->BankPending = NT_SUCCESS(Status);
+        pAmp->EqLoading = false;
+    }
+    else if (NT_SUCCESS(Status))
+    {
+        // The amp was restored meanwhile, which dropped its idle bank
+        Status = STATUS_CANCELLED;
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    return Status;
+}
+
+// Switch every selected amplifier that has a loaded idle bank over to it.
+// Each switch is one bus transaction, which is the only time the audio path
+// is in transition. The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::SwitchBanks(
+    _In_ ULONG AmpMask,                                 // Bit n selects amplifier n
+    _Out_ PTFA9890_BANK_SWITCH_OUTPUT pResult)          // Switch statistics
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    RtlZeroMemory(pResult, sizeof(*pResult));
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        if (0 == (AmpMask & (1UL << Amp)) || !pAmp->BankPending)
+        {
+            continue;
+        }
+
+        ULONG Idle = pAmp->ActiveBank ^ 1;
+        LONGLONG Start = QpcNow();
+
+        NTSTATUS SwitchStatus = WriteDspWord(pAmp, TFA9890_CMD_CLASS_MUTE, TFA9890_DMEM_XMEM, TFA9890_XMEM_BANK_SELECT, static_cast<LONG>(Idle));
+
+        ULONG SwitchUs = QpcToUs(QpcNow() - Start);
+
+        if (!NT_SUCCESS(SwitchStatus))
+        {
+            Status = NT_SUCCESS(Status) ? SwitchStatus : Status;
+            TraceError("ACC %!FUNC! Amp %u switch to bank %u failed %!STATUS!", Amp, Idle, SwitchStatus);
+            DLog("PA: Amp %u switch to bank %u failed %d\n", Amp, Idle, SwitchStatus);//DebugLog
+            continue;
+        }
+
+        pAmp->ActiveBank = Idle;
+        pAmp->BankPending = false;
+
+        pResult->AmpsSwitched++;
+        pResult->SwitchUs = max(pResult->SwitchUs, SwitchUs);
+
+        m_BankSwitchCount++;
+        m_MaxBankSwitchUs = max(m_MaxBankSwitchUs, SwitchUs);
+    }
+
+    pResult->Status = Status;
+    pResult->MaxSwitchUs = m_MaxBankSwitchUs;
+    pResult->Switches = m_BankSwitchCount;
+
+    return Status;
+}
@@ -0,0 +1,360 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the hibernate images. Without them every D0 entry
+//    replays the init sequence one register write at a time, although the
+//    driver already knows the state each amp was in when it left D0. On D0
+//    exit that state is captured per amp into a checksummed image, ordered
+//    the way it is written back: the configuration registers as maximal
+//    bursts, then the power steps of the init sequence, then the power
+//    registers' last values. On D0 entry the sequencer runs the images in
+//    place of the init sequence, with the same asynchronous writes, settle
+//    timers and inrush limits, and the DSP gets its images and EQ bank as
+//    after a watchdog restore. Any amp without a valid image, or one the
+//    restore leaves down, sends the power-up down the cold path.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Hibernate.tmh"
+
+
+#define HIBERNATE_FNV_OFFSET    0x811C9DC5UL
+#define HIBERNATE_FNV_PRIME     0x01000193UL
+
+inline ULONG HibernateHash(
+    _In_ ULONG Hash,
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length)
+{
+    for (ULONG i = 0; i < Length; i++)
+    {
+        Hash = (Hash ^ pData[i]) * HIBERNATE_FNV_PRIME;
+    }
+    return Hash;
+}
+
+// Checksum of everything in the image after the checksum itself. Images
+// are zeroed before they are built, so the padding is covered as well.
+inline ULONG HibernateChecksum(
+    _In_ const TFA9890_HIBERNATE_IMAGE* pImage)
+{
+    const ULONG Offset = FIELD_OFFSET(TFA9890_HIBERNATE_IMAGE, ProfileHash);
+
+    return HibernateHash(HIBERNATE_FNV_OFFSET,
+                         reinterpret_cast<const BYTE*>(pImage) + Offset,
+                         sizeof(*pImage) - Offset);
+}
+
+// Append one write to an image. Returns nullptr if the image is full.
+inline PTFA9890_HIBERNATE_BURST AppendHibernateBurst(
+    _Inout_ PTFA9890_HIBERNATE_IMAGE pImage,
+    _In_ ULONG Register,                        // First register
+    _In_reads_opt_(Count) const WORD* pWords,   // Values in bus byte order
+    _In_ ULONG Count,                           // Registers written, 0 for a settle step
+    _In_ BYTE Flags)                            // TFA9890_STEP_*
+{
+    if (pImage->BurstCount >= TFA9890_HIBERNATE_MAX_BURSTS ||
+        pImage->WordCount + Count > TFA9890_HIBERNATE_MAX_WORDS)
+    {
+        return nullptr;
+    }
+
+    PTFA9890_HIBERNATE_BURST pBurst = &pImage->Bursts[pImage->BurstCount++];
+    pBurst->Register = static_cast<BYTE>(Register);
+    pBurst->Count = static_cast<BYTE>(Count);
+    pBurst->Flags = Flags;
+    pBurst->Word = static_cast<WORD>(pImage->WordCount);
+
+    for (ULONG i = 0; i < Count; i++)
+    {
+        pImage->Words[pImage->WordCount++] = pWords[i];
+        pImage->Written[(Register + i) / 32] |= 1UL << ((Register + i) % 32);
+    }
+
+    return pBurst;
+}
+
+// Value a register is written back with. A soft reset requested through
+// system control is not replayed.
+inline WORD HibernateValue(
+    _In_ ULONG Register,
+    _In_ WORD Value)            // Bus byte order
+{
+    if (TFA9890_SYSTEM_CONTROL == Register)
+    {
+        Value = static_cast<WORD>(Value & ~TFA9890_BUS_WORD(TFA9890_SYSTEM_CONTROL_I2CR));
+    }
+    return Value;
+}
+
+// Hash of the init sequence. An image captured under another profile is
+// not restored.
+ULONG NxpTfa9890Device::HibernateProfileHash()
+{
+    ULONG Hash = HibernateHash(HIBERNATE_FNV_OFFSET,
+                               reinterpret_cast<const BYTE*>(&m_pInitProfile->StepCount),
+                               sizeof(m_pInitProfile->StepCount));
+
+    for (ULONG Step = 0; Step < m_pInitProfile->StepCount; Step++)
+    {
+        const REGISTER_SETTING* pSetting = &m_pInitProfile->Steps[Step];
+
+        Hash = HibernateHash(Hash, &pSetting->Register, sizeof(pSetting->Register));
+        Hash = HibernateHash(Hash, reinterpret_cast<const BYTE*>(&pSetting->Value), sizeof(pSetting->Value));
+        Hash = HibernateHash(Hash, &pSetting->Flags, sizeof(pSetting->Flags));
+    }
+
+    return Hash;
+}
+
+// Capture the image of every amp that is online while leaving D0. Amps
+// that are not get none, so the next D0 entry takes the cold path.
+VOID NxpTfa9890Device::CaptureHibernateImages()
+{
+    ULONG Captured = 0;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        pAmp->Hibernate.Checksum = 0;
+
+        if (!m_HibernateEnabled || !pAmp->Online)
+        {
+            continue;
+        }
+
+        if (CaptureHibernateImage(pAmp, &pAmp->Hibernate))
+        {
+            Captured++;
+        }
+        else
+        {
+            TraceWarning("ACC %!FUNC! Amp %u state does not fit a hibernate image", Amp);
+        }
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    if (m_HibernateEnabled)
+    {
+        TraceInformation("ACC %!FUNC! Captured hibernate images of %u of %u amps", Captured, m_AmpCount);
+        DLog("PA: Captured hibernate images of %u of %u amps\n", Captured, m_AmpCount);//DebugLog
+    }
+}
+
+// Build one amp's image from its shadow and the EQ bank it runs from. The
+// configuration registers go first so the power stage comes up on a
+// complete configuration. Also used by the watchdog to restore an amp in
+// the same order. The caller holds m_I2CWaitLock.
+bool NxpTfa9890Device::CaptureHibernateImage(
+    _In_ PTFA9890_AMP pAmp,                     // Online amplifier
+    _Out_ PTFA9890_HIBERNATE_IMAGE pImage)      // Receives the image
+{
+    const TFA9890_INIT_PROFILE* pProfile = m_pInitProfile;
+    ULONG PowerRegisters[TFA9890_REGISTER_COUNT / 32] = {};
+
+    RtlZeroMemory(pImage, sizeof(*pImage));
+
+    for (ULONG Step = 0; Step < pProfile->StepCount; Step++)
+    {
+        if (0 != (pProfile->Steps[Step].Flags & TFA9890_STEP_POWER))
+        {
+            ULONG Register = pProfile->Steps[Step].Register;
+            PowerRegisters[Register / 32] |= 1UL << (Register % 32);
+        }
+    }
+
+    // Every contiguous run of configuration registers as one burst. The
+    // power registers are left to the power steps.
+    for (ULONG Register = 0; Register < TFA9890_REGISTER_COUNT; )
+    {
+        if (!IsRestorable(Register) ||
+            !IsRegisterShadowed(pAmp, Register) ||
+            0 != (PowerRegisters[Register / 32] & (1UL << (Register % 32))))
+        {
+            Register++;
+            continue;
+        }
+
+        ULONG End = Register + 1;
+        while (End < TFA9890_REGISTER_COUNT &&
+               End - Register < MAXBYTE &&
+               IsRestorable(End) &&
+               IsRegisterShadowed(pAmp, End) &&
+               0 == (PowerRegisters[End / 32] & (1UL << (End % 32))))
+        {
+            End++;
+        }
+
+        ULONG First = pImage->WordCount;
+        if (nullptr == AppendHibernateBurst(pImage, Register, &pAmp->Shadow[Register], End - Register, 0))
+        {
+            RtlZeroMemory(pImage, sizeof(*pImage));
+            return false;
+        }
+
+        for (ULONG i = 0; i < End - Register; i++)
+        {
+            pImage->Words[First + i] = HibernateValue(Register + i, pImage->Words[First + i]);
+        }
+
+        Register = End;
+    }
+
+    // The power-up steps of the init sequence, in order
+    for (ULONG Step = 0; Step < pProfile->StepCount; Step++)
+    {
+        const REGISTER_SETTING* pSetting = &pProfile->Steps[Step];
+        PTFA9890_HIBERNATE_BURST pBurst = nullptr;
+
+        if (0 != (pSetting->Flags & TFA9890_STEP_SETTLE))
+        {
+            pBurst = AppendHibernateBurst(pImage, 0, nullptr, 0, TFA9890_STEP_SETTLE);
+            if (nullptr != pBurst)
+            {
+                pBurst->Word = pSetting->Value;
+            }
+        }
+        else if (0 != (pSetting->Flags & TFA9890_STEP_POWER))
+        {
+            pBurst = AppendHibernateBurst(pImage, pSetting->Register, &pSetting->Value, 1, TFA9890_STEP_POWER);
+        }
+        else
+        {
+            continue;
+        }
+
+        if (nullptr == pBurst)
+        {
+            RtlZeroMemory(pImage, sizeof(*pImage));
+            return false;
+        }
+    }
+
+    // Then what the power registers held when leaving D0 where it differs
+    // from their last step, with the power stage on. Gating decides again
+    // once the device is up.
+    for (ULONG Register = 0; Register < TFA9890_REGISTER_COUNT; Register++)
+    {
+        if (0 == (PowerRegisters[Register / 32] & (1UL << (Register % 32))) ||
+            !IsRegisterShadowed(pAmp, Register))
+        {
+            continue;
+        }
+
+        WORD Value = HibernateValue(Register, pAmp->Shadow[Register]);
+        if (TFA9890_SYSTEM_CONTROL == Register)
+        {
+            Value = static_cast<WORD>(Value & ~TFA9890_BUS_WORD(TFA9890_SYSTEM_CONTROL_PWDN));
+        }
+
+        WORD Last = 0;
+        for (ULONG Step = 0; Step < pProfile->StepCount; Step++)
+        {
+            if (0 != (pProfile->Steps[Step].Flags & TFA9890_STEP_POWER) && pProfile->Steps[Step].Register == Register)
+            {
+                Last = pProfile->Steps[Step].Value;
+            }
+        }
+
+        if (Value != Last && nullptr == AppendHibernateBurst(pImage, Register, &Value, 1, TFA9890_STEP_POWER))
+        {
+            RtlZeroMemory(pImage, sizeof(*pImage));
+            return false;
+        }
+    }
+
+    // A set loaded into the idle bank but not yet switched to is not kept
+    pImage->EqBank = pAmp->ActiveBank;
+    pImage->EqValid = pAmp->EqValid[pAmp->ActiveBank];
+    RtlCopyMemory(pImage->EqCoeffs, pAmp->EqCoeffs[pAmp->ActiveBank], sizeof(pImage->EqCoeffs));
+
+    pImage->ProfileHash = HibernateProfileHash();
+    pImage->Checksum = HibernateChecksum(pImage);
+
+    return true;
+}
+
+// Build the image the watchdog restores a reset amp from: its hibernate
+// image, then the power-down the gate timer had written, if any, so an
+// output stage that was off stays off. It has no checksum, so D0 entry
+// never takes it for a hibernate image. The caller holds m_I2CWaitLock.
+bool NxpTfa9890Device::CaptureRestoreImage(
+    _In_ PTFA9890_AMP pAmp,                     // Online amplifier that was reset
+    _Out_ PTFA9890_HIBERNATE_IMAGE pImage)      // Receives the image
+{
+    WORD SystemControl = HibernateValue(TFA9890_SYSTEM_CONTROL, pAmp->Shadow[TFA9890_SYSTEM_CONTROL]);
+    bool Gated = IsRegisterShadowed(pAmp, TFA9890_SYSTEM_CONTROL) &&
+                 0 != (SystemControl & TFA9890_BUS_WORD(TFA9890_SYSTEM_CONTROL_PWDN));
+
+    if (!CaptureHibernateImage(pAmp, pImage))
+    {
+        return false;
+    }
+
+    if (Gated && nullptr == AppendHibernateBurst(pImage, TFA9890_SYSTEM_CONTROL, &SystemControl, 1, 0))
+    {
+        RtlZeroMemory(pImage, sizeof(*pImage));
+        return false;
+    }
+
+    pImage->Checksum = 0;
+    return true;
+}
+
+// Check that every amp has a valid image captured under the current init
+// sequence. If one has not, the power-up runs the init sequence. The
+// caller holds m_I2CWaitLock.
+bool NxpTfa9890Device::HibernateImagesValid()
+{
+    if (!m_HibernateEnabled)
+    {
+        return false;
+    }
+
+    ULONG ProfileHash = HibernateProfileHash();
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        const TFA9890_HIBERNATE_IMAGE* pImage = &m_Amps[Amp].Hibernate;
+
+        if (0 == pImage->Checksum ||
+            pImage->Checksum != HibernateChecksum(pImage) ||
+            pImage->ProfileHash != ProfileHash)
+        {
+            m_HibernateFallbacks++;
+            TraceInformation("ACC %!FUNC! Amp %u has no usable hibernate image, running the init sequence", Amp);
+            DLog("PA: Amp %u has no usable hibernate image\n", Amp);//DebugLog
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Take over the EQ state of the images once the sequencer has written every
+// amp back from them. The EQ bank itself is written by FinishPowerUp after
+// the DSP images. The caller holds m_I2CWaitLock.
+VOID NxpTfa9890Device::AdoptHibernateImages()
+{
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        const TFA9890_HIBERNATE_IMAGE* pImage = &pAmp->Hibernate;
+
+        pAmp->ActiveBank = pImage->EqBank;
+        pAmp->EqLoading = false;
+        pAmp->EqValid[pImage->EqBank] = pImage->EqValid;
+        RtlCopyMemory(pAmp->EqCoeffs[pImage->EqBank], pImage->EqCoeffs, sizeof(pImage->EqCoeffs));
+    }
+
+    m_HibernateRestores++;
+}
@@ -0,0 +1,311 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module keeps a long-running history of each amp's telemetry and
+//    fault events for post-mortem analysis. When HistoryFile names a file
+//    in the device hardware key, every telemetry sample is delta and varint
+//    encoded into a fixed block in memory, and blocks are written to a ring
+//    of slots in the file in the format described in Tfa9890History.h. The
+//    file is reopened across restarts and continues after its newest block.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "History.tmh"
+
+
+C_ASSERT(TFA9890_MAX_AMPS <= TFA9890_HISTORY_MAX_AMPS);
+C_ASSERT(TFA9890_HISTORY_MAX_AMPS - 1 <= TFA9890_HISTORY_AMP_MASK);
+
+// Milliseconds between two QPC times, without the 32-bit limit of QpcToUs
+inline ULONGLONG HistoryMs(
+    _In_ LONGLONG Ticks)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    return static_cast<ULONGLONG>((Ticks / Frequency.QuadPart) * 1000 + ((Ticks % Frequency.QuadPart) * 1000) / Frequency.QuadPart);
+}
+
+// Open the history file named in the configuration. A file written with
+// the same geometry is continued after its newest block; anything else is
+// started over. Failures are traced and leave the history idle.
+VOID NxpTfa9890Device::OpenHistory()
+{
+    TFA9890_HISTORY_HEADER Header = {};
+    LARGE_INTEGER Offset = {};
+    DWORD Transferred = 0;
+
+    if (L'\0' == m_HistoryPath[0] || NULL != m_HistoryFile)
+    {
+        return;
+    }
+
+    HANDLE File = CreateFileW(m_HistoryPath,
+                              GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ,
+                              NULL,
+                              OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+    if (INVALID_HANDLE_VALUE == File)
+    {
+        NTSTATUS Status = NTSTATUS_FROM_WIN32(GetLastError());
+        TraceError("ACC %!FUNC! CreateFileW for %S failed %!STATUS!", m_HistoryPath, Status);
+        DLog("PA: CreateFileW for history file failed %d\n", Status);//DebugLog
+        return;
+    }
+
+    ULONG Sequence = 0;
+    ULONG Slot = 0;
+
+    bool Continue = ReadFile(File, &Header, sizeof(Header), &Transferred, NULL) &&
+                    sizeof(Header) == Transferred &&
+                    TFA9890_HISTORY_MAGIC == Header.Magic &&
+                    TFA9890_HISTORY_VERSION == Header.Version &&
+                    sizeof(Header) == Header.HeaderBytes &&
+                    TFA9890_HISTORY_BLOCK_BYTES == Header.BlockBytes &&
+                    m_HistorySlots == Header.SlotCount;
+
+    // Find the newest block; unused slots fail the magic check
+    for (ULONG i = 0; Continue && i < m_HistorySlots; i++)
+    {
+        TFA9890_HISTORY_BLOCK Block = {};
+
+        Offset.QuadPart = sizeof(Header) + static_cast<LONGLONG>(i) * TFA9890_HISTORY_BLOCK_BYTES;
+        if (SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) &&
+            ReadFile(File, &Block, sizeof(Block), &Transferred, NULL) &&
+            sizeof(Block) == Transferred &&
+            TFA9890_HISTORY_BLOCK_MAGIC == Block.Magic &&
+            Block.Sequence >= Sequence)
+        {
+            Sequence = Block.Sequence + 1;
+            Slot = (i + 1) % m_HistorySlots;
+        }
+    }
+
+    // The header is rewritten so it names the amps of this start
+    RtlZeroMemory(&Header, sizeof(Header));
+    Header.Magic = TFA9890_HISTORY_MAGIC;
+    Header.Version = TFA9890_HISTORY_VERSION;
+    Header.HeaderBytes = sizeof(Header);
+    Header.BlockBytes = TFA9890_HISTORY_BLOCK_BYTES;
+    Header.SlotCount = m_HistorySlots;
+    Header.AmpCount = m_AmpCount;
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        Header.ConnectionIds[Amp] = m_Amps[Amp].ConnectionId.QuadPart;
+    }
+
+    Offset.QuadPart = 0;
+    bool Written = SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) &&
+                   WriteFile(File, &Header, sizeof(Header), &Transferred, NULL) &&
+                   sizeof(Header) == Transferred;
+
+    // A new file is sized up front; its zeroed slots read as unused
+    if (Written && !Continue)
+    {
+        Offset.QuadPart = sizeof(Header) + static_cast<LONGLONG>(m_HistorySlots) * TFA9890_HISTORY_BLOCK_BYTES;
+        Written = SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) && SetEndOfFile(File);
+    }
+
+    if (!Written)
+    {
+        TraceError("ACC %!FUNC! History file %S could not be set up %!STATUS!", m_HistoryPath, NTSTATUS_FROM_WIN32(GetLastError()));
+        CloseHandle(File);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_HistoryLock);
+    m_HistoryFile = File;
+    m_HistorySequence = Sequence;
+    m_HistorySlot = Slot;
+    StartHistoryBlock();
+    m_HistoryFlushQpc = QpcNow();
+    ReleaseSRWLockExclusive(&m_HistoryLock);
+
+    TraceInformation("ACC %!FUNC! History of %u amps kept in %u blocks of %S, %s at block %u",
+                     m_AmpCount, m_HistorySlots, m_HistoryPath, Continue ? "continued" : "started", Sequence);
+
+    // Sample for the history even with no client
+    UpdateSampleDemand();
+}
+
+// Write out the current block and close the file
+VOID NxpTfa9890Device::CloseHistory()
+{
+    if (NULL == m_HistoryFile)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_HistoryLock);
+    if (m_HistoryDirty)
+    {
+        WriteHistoryBlock();
+    }
+    CloseHandle(m_HistoryFile);
+    m_HistoryFile = NULL;
+    ReleaseSRWLockExclusive(&m_HistoryLock);
+}
+
+// Write out a partly filled block so a crash loses little. Without Force
+// this only happens once TFA9890_HISTORY_FLUSH_MS have passed.
+VOID NxpTfa9890Device::FlushHistory(
+    _In_ bool Force)    // Write now
+{
+    if (NULL == m_HistoryFile)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_HistoryLock);
+    if (NULL != m_HistoryFile && m_HistoryDirty &&
+        (Force || QpcNow() - m_HistoryFlushQpc >= QpcFromMs(TFA9890_HISTORY_FLUSH_MS)))
+    {
+        WriteHistoryBlock();
+    }
+    ReleaseSRWLockExclusive(&m_HistoryLock);
+}
+
+// Begin a block in the current slot. Deltas and fault state start over so
+// the block decodes on its own. The caller holds m_HistoryLock.
+VOID NxpTfa9890Device::StartHistoryBlock()
+{
+    PTFA9890_HISTORY_BLOCK pBlock = reinterpret_cast<PTFA9890_HISTORY_BLOCK>(m_HistoryBlock);
+    FILETIME StartTime;
+
+    GetSystemTimePreciseAsFileTime(&StartTime);
+
+    RtlZeroMemory(m_HistoryBlock, sizeof(m_HistoryBlock));
+    pBlock->Magic = TFA9890_HISTORY_BLOCK_MAGIC;
+    pBlock->Sequence = m_HistorySequence++;
+    pBlock->StartTime = (static_cast<LONGLONG>(StartTime.dwHighDateTime) << 32) | StartTime.dwLowDateTime;
+
+    m_HistoryUsed = 0;
+    m_HistoryBlockQpc = QpcNow();
+    m_HistoryLastMs = 0;
+    m_HistoryDirty = false;
+    RtlZeroMemory(m_HistoryTemperature, sizeof(m_HistoryTemperature));
+    RtlZeroMemory(m_HistoryBattery, sizeof(m_HistoryBattery));
+    RtlZeroMemory(m_HistoryFaults, sizeof(m_HistoryFaults));
+}
+
+// Write the current block to its slot. The caller holds m_HistoryLock.
+VOID NxpTfa9890Device::WriteHistoryBlock()
+{
+    LARGE_INTEGER Offset;
+    DWORD Written = 0;
+
+    reinterpret_cast<PTFA9890_HISTORY_BLOCK>(m_HistoryBlock)->UsedBytes = static_cast<USHORT>(m_HistoryUsed);
+
+    Offset.QuadPart = sizeof(TFA9890_HISTORY_HEADER) + static_cast<LONGLONG>(m_HistorySlot) * TFA9890_HISTORY_BLOCK_BYTES;
+    if (!SetFilePointerEx(m_HistoryFile, Offset, NULL, FILE_BEGIN) ||
+        !WriteFile(m_HistoryFile, m_HistoryBlock, TFA9890_HISTORY_BLOCK_BYTES, &Written, NULL) ||
+        TFA9890_HISTORY_BLOCK_BYTES != Written)
+    {
+        TraceError("ACC %!FUNC! Writing history block %u failed %!STATUS!", m_HistorySlot, NTSTATUS_FROM_WIN32(GetLastError()));
+    }
+
+    m_HistoryDirty = false;
+    m_HistoryFlushQpc = QpcNow();
+}
+
+// Make room for one record, moving on to the next slot when the block is
+// full. Callers that encode deltas do this first, as a new block resets
+// their baselines. The caller holds m_HistoryLock.
+VOID NxpTfa9890Device::ReserveHistoryRecord()
+{
+    if (m_HistoryUsed + TFA9890_HISTORY_RECORD_MAX_BYTES > TFA9890_HISTORY_BLOCK_BYTES - sizeof(TFA9890_HISTORY_BLOCK))
+    {
+        WriteHistoryBlock();
+        m_HistorySlot = (m_HistorySlot + 1) % m_HistorySlots;
+        StartHistoryBlock();
+    }
+}
+
+// Encode one record into the current block. The caller holds m_HistoryLock.
+VOID NxpTfa9890Device::AppendHistoryRecord(
+    _In_ ULONG Kind,                        // TFA9890_HISTORY_KIND_*
+    _In_ ULONG Amp,                         // Amp index
+    _In_reads_(Count) const ULONG* pValues, // Payload varints
+    _In_ ULONG Count)                       // At most 2
+{
+    ReserveHistoryRecord();
+
+    BYTE* pRecord = m_HistoryBlock + sizeof(TFA9890_HISTORY_BLOCK) + m_HistoryUsed;
+    ULONGLONG Ms = HistoryMs(QpcNow() - m_HistoryBlockQpc);
+    ULONG Length = 0;
+
+    pRecord[Length++] = static_cast<BYTE>((Kind << TFA9890_HISTORY_KIND_SHIFT) | Amp);
+    Length += Tfa9890HistoryPutVarint(pRecord + Length, static_cast<ULONG>(Ms - m_HistoryLastMs));
+    for (ULONG i = 0; i < Count; i++)
+    {
+        Length += Tfa9890HistoryPutVarint(pRecord + Length, pValues[i]);
+    }
+
+    m_HistoryUsed += Length;
+    m_HistoryLastMs = Ms;
+    m_HistoryDirty = true;
+}
+
+// Record one amp's sample, and its fault bits if they changed
+VOID NxpTfa9890Device::HistoryAppendSample(
+    _In_ ULONG Amp,             // Amp index
+    _In_ LONG TemperatureC,     // Die temperature
+    _In_ ULONG BatteryLsb,      // Battery voltage register value
+    _In_ ULONG Faults)          // TFA9890_STATUS_FAULTS bits
+{
+    if (NULL == m_HistoryFile)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_HistoryLock);
+
+    if (NULL != m_HistoryFile)
+    {
+        ULONG Deltas[2];
+
+        // Roll the block before the deltas are taken against its baselines
+        ReserveHistoryRecord();
+        Deltas[0] = Tfa9890HistoryZigzag(TemperatureC - m_HistoryTemperature[Amp]);
+        Deltas[1] = Tfa9890HistoryZigzag(static_cast<LONG>(BatteryLsb) - m_HistoryBattery[Amp]);
+        AppendHistoryRecord(TFA9890_HISTORY_KIND_SAMPLE, Amp, Deltas, _countof(Deltas));
+
+        // A new block starts from zero
+        m_HistoryTemperature[Amp] = TemperatureC;
+        m_HistoryBattery[Amp] = static_cast<LONG>(BatteryLsb);
+
+        if (Faults != m_HistoryFaults[Amp])
+        {
+            AppendHistoryRecord(TFA9890_HISTORY_KIND_FAULTS, Amp, &Faults, 1);
+            m_HistoryFaults[Amp] = Faults;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&m_HistoryLock);
+}
+
+// Record the amps being powered up or down
+VOID NxpTfa9890Device::HistoryAppendPower(
+    _In_ bool Powered)  // true on power-up
+{
+    if (NULL == m_HistoryFile)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_HistoryLock);
+
+    for (ULONG Amp = 0; NULL != m_HistoryFile && Amp < m_AmpCount; Amp++)
+    {
+        ULONG Value = Powered ? 1 : 0;
+        AppendHistoryRecord(TFA9890_HISTORY_KIND_POWER, Amp, &Value, 1);
+    }
+
+    ReleaseSRWLockExclusive(&m_HistoryLock);
+}
@@ -0,0 +1,334 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the driver-wide cache of DSP images and their
+//    upload. Image files named in a device's DspImages value are loaded on
+//    the device's first power-up. They are kept once per driver, keyed by
+//    content, and shared read-only by every device and amp that uses them.
+//    Entries are reference counted and freed with their last user.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Driver.h"
+
+#include "Image.tmh"
+
+
+// 64-bit FNV-1a of the image file
+static ULONGLONG ImageHash(
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length)
+{
+    ULONGLONG Hash = 0xCBF29CE484222325ULL;
+
+    for (ULONG i = 0; i < Length; i++)
+    {
+        Hash = (Hash ^ pData[i]) * 0x100000001B3ULL;
+    }
+    return Hash;
+}
+
+// Returns true if the file holds a well-formed image
+static bool IsImageValid(
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length)
+{
+    const TFA9890_DSP_IMAGE_HEADER* pHeader = reinterpret_cast<const TFA9890_DSP_IMAGE_HEADER*>(pData);
+
+    return Length >= sizeof(TFA9890_DSP_IMAGE_HEADER) &&
+           TFA9890_DSP_IMAGE_MAGIC == pHeader->Magic &&
+           TFA9890_DSP_IMAGE_VERSION == pHeader->Version &&
+           pHeader->MemoryType <= TFA9890_DMEM_IOMEM &&
+           0 != pHeader->WordCount &&
+           static_cast<ULONG>(pHeader->Address) + pHeader->WordCount <= 0x10000 &&
+           Length == sizeof(TFA9890_DSP_IMAGE_HEADER) + pHeader->WordCount * TFA9890_DSP_WORD_BYTES;
+}
+
+// Read and validate an image file into memory owned by the driver object
+static NTSTATUS ImageLoad(
+    _In_ PCWSTR Path,
+    _Out_ WDFMEMORY* pMemory,
+    _Out_ BYTE** ppData,
+    _Out_ ULONG* pLength)
+{
+    LARGE_INTEGER Size = {};
+    DWORD Read = 0;
+
+    *pMemory = NULL;
+
+    HANDLE File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == File)
+    {
+        NTSTATUS Status = NTSTATUS_FROM_WIN32(GetLastError());
+        TraceError("ACC %!FUNC! CreateFileW for %S failed %!STATUS!", Path, Status);
+        return Status;
+    }
+
+    NTSTATUS Status = STATUS_SUCCESS;
+    if (!GetFileSizeEx(File, &Size))
+    {
+        Status = NTSTATUS_FROM_WIN32(GetLastError());
+    }
+    else if (Size.QuadPart > TFA9890_DSP_IMAGE_MAX_BYTES)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        WDF_OBJECT_ATTRIBUTES MemoryAttributes;
+        WDF_OBJECT_ATTRIBUTES_INIT(&MemoryAttributes);
+        MemoryAttributes.ParentObject = WdfGetDriver();
+
+        Status = WdfMemoryCreate(&MemoryAttributes,
+                                 PagedPool,
+                                 PA_POOL_TAG_ACCELEROMETER,
+                                 static_cast<size_t>(max(Size.QuadPart, 1)),
+                                 pMemory,
+                                 reinterpret_cast<PVOID*>(ppData));
+    }
+
+    if (NT_SUCCESS(Status) && (!ReadFile(File, *ppData, Size.LowPart, &Read, NULL) || Read != Size.LowPart))
+    {
+        Status = NTSTATUS_FROM_WIN32(GetLastError());
+    }
+
+    if (NT_SUCCESS(Status) && !IsImageValid(*ppData, Size.LowPart))
+    {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+
+    CloseHandle(File);
+
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! Image %S could not be loaded %!STATUS!", Path, Status);
+        if (NULL != *pMemory)
+        {
+            WdfObjectDelete(*pMemory);
+            *pMemory = NULL;
+        }
+        return Status;
+    }
+
+    *pLength = Size.LowPart;
+    return STATUS_SUCCESS;
+}
+
+// Take a reference on the image loaded from Path. A path already in the
+// cache is resolved without touching the file; otherwise the file is read
+// and shares the entry of an identical image loaded from another path.
+NTSTATUS ImageCacheAcquire(
+    _In_ PCWSTR Path,                       // Image file
+    _Out_ const TFA9890_IMAGE** ppImage)    // Receives the referenced image
+{
+    PTFA9890_IMAGE_CACHE pCache = &GetNxpTfa9890DriverContext(WdfGetDriver())->ImageCache;
+    PTFA9890_IMAGE pImage = nullptr;
+
+    *ppImage = nullptr;
+
+    AcquireSRWLockExclusive(&pCache->Lock);
+    for (ULONG i = 0; i < TFA9890_IMAGE_CACHE_ENTRIES; i++)
+    {
+        if (0 != pCache->Images[i].Bytes &&
+            CSTR_EQUAL == CompareStringOrdinal(pCache->Images[i].Path, -1, Path, -1, TRUE))
+        {
+            pImage = &pCache->Images[i];
+            pImage->References++;
+            pCache->Stats.PathHits++;
+            pCache->Stats.References++;
+            pCache->Stats.SharedBytes += pImage->Bytes;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&pCache->Lock);
+
+    if (nullptr != pImage)
+    {
+        *ppImage = pImage;
+        return STATUS_SUCCESS;
+    }
+
+    // The file is read outside the lock; a concurrent load of the same
+    // content ends up as a content hit below
+    WDFMEMORY Memory = NULL;
+    BYTE* pData = nullptr;
+    ULONG Length = 0;
+
+    NTSTATUS Status = ImageLoad(Path, &Memory, &pData, &Length);
+    ULONGLONG Hash = NT_SUCCESS(Status) ? ImageHash(pData, Length) : 0;
+
+    AcquireSRWLockExclusive(&pCache->Lock);
+
+    if (!NT_SUCCESS(Status))
+    {
+        pCache->Stats.Failures++;
+    }
+
+    PTFA9890_IMAGE pFree = nullptr;
+    for (ULONG i = 0; NT_SUCCESS(Status) && i < TFA9890_IMAGE_CACHE_ENTRIES; i++)
+    {
+        PTFA9890_IMAGE pEntry = &pCache->Images[i];
+        if (0 == pEntry->Bytes)
+        {
+            pFree = (nullptr == pFree) ? pEntry : pFree;
+        }
+        else if (pEntry->Hash == Hash && pEntry->Bytes == Length &&
+                 0 == memcmp(pEntry->pHeader, pData, Length))
+        {
+            pImage = pEntry;
+            break;
+        }
+    }
+
+    if (nullptr != pImage)
+    {
+        pImage->References++;
+        pCache->Stats.ContentHits++;
+        pCache->Stats.References++;
+        pCache->Stats.SharedBytes += pImage->Bytes;
+    }
+    else if (NT_SUCCESS(Status) && nullptr == pFree)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        pCache->Stats.Failures++;
+        TraceError("ACC %!FUNC! Image cache is full, %S not cached", Path);
+    }
+    else if (NT_SUCCESS(Status))
+    {
+        pImage = pFree;
+        pImage->Hash = Hash;
+        pImage->Bytes = Length;
+        pImage->References = 1;
+        pImage->Memory = Memory;
+        pImage->pHeader = reinterpret_cast<const TFA9890_DSP_IMAGE_HEADER*>(pData);
+        StringCchCopyW(pImage->Path, MAX_PATH, Path);
+        Memory = NULL;
+
+        pCache->Stats.Misses++;
+        pCache->Stats.Entries++;
+        pCache->Stats.References++;
+        pCache->Stats.ResidentBytes += Length;
+    }
+
+    ReleaseSRWLockExclusive(&pCache->Lock);
+
+    // Duplicate content, or no room for it
+    if (NULL != Memory)
+    {
+        WdfObjectDelete(Memory);
+    }
+
+    *ppImage = pImage;
+    return Status;
+}
+
+// Drop a reference taken by ImageCacheAcquire. The last one frees the image.
+VOID ImageCacheRelease(
+    _In_ const TFA9890_IMAGE* pImage)       // Image to release
+{
+    PTFA9890_IMAGE_CACHE pCache = &GetNxpTfa9890DriverContext(WdfGetDriver())->ImageCache;
+    PTFA9890_IMAGE pEntry = &pCache->Images[pImage - pCache->Images];
+    WDFMEMORY Memory = NULL;
+
+    AcquireSRWLockExclusive(&pCache->Lock);
+
+    pCache->Stats.References--;
+    if (0 == --pEntry->References)
+    {
+        Memory = pEntry->Memory;
+        pCache->Stats.Entries--;
+        pCache->Stats.ResidentBytes -= pEntry->Bytes;
+        RtlZeroMemory(pEntry, sizeof(*pEntry));
+    }
+    else
+    {
+        pCache->Stats.SharedBytes -= pEntry->Bytes;
+    }
+
+    ReleaseSRWLockExclusive(&pCache->Lock);
+
+    if (NULL != Memory)
+    {
+        WdfObjectDelete(Memory);
+    }
+}
+
+VOID ImageCacheQuery(
+    _Out_ PTFA9890_IMAGE_CACHE_OUTPUT pOutput)
+{
+    PTFA9890_IMAGE_CACHE pCache = &GetNxpTfa9890DriverContext(WdfGetDriver())->ImageCache;
+
+    AcquireSRWLockShared(&pCache->Lock);
+    *pOutput = pCache->Stats;
+    ReleaseSRWLockShared(&pCache->Lock);
+}
+
+// Reference every image named in DspImages. Called on the first power-up so
+// devices that never reach D0 load nothing. Images that cannot be loaded
+// are skipped.
+VOID NxpTfa9890Device::AcquireImages()
+{
+    if (m_ImagesAcquired)
+    {
+        return;
+    }
+    m_ImagesAcquired = true;
+
+    for (PCWSTR pPath = m_ImageList; L'\0' != *pPath; pPath += wcslen(pPath) + 1)
+    {
+        if (TFA9890_MAX_IMAGES == m_ImageCount)
+        {
+            TraceWarning("ACC %!FUNC! Only %u DSP images are used, %S and later ignored", TFA9890_MAX_IMAGES, pPath);
+            break;
+        }
+
+        if (NT_SUCCESS(ImageCacheAcquire(pPath, &m_Images[m_ImageCount])))
+        {
+            m_ImageCount++;
+        }
+    }
+}
+
+VOID NxpTfa9890Device::ReleaseImages()
+{
+    for (ULONG i = 0; i < m_ImageCount; i++)
+    {
+        ImageCacheRelease(m_Images[i]);
+        m_Images[i] = nullptr;
+    }
+
+    m_ImageCount = 0;
+    m_ImagesAcquired = false;
+}
+
+// Write every image to one amplifier's DSP, in the order they are named.
+// The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::UploadImages(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier to upload to
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    for (ULONG i = 0; NT_SUCCESS(Status) && i < m_ImageCount; i++)
+    {
+        const TFA9890_DSP_IMAGE_HEADER* pHeader = m_Images[i]->pHeader;
+
+        Status = WriteDspMemory(pAmp,
+                                TFA9890_CMD_CLASS_BULK,
+                                pHeader->MemoryType,
+                                pHeader->Address,
+                                reinterpret_cast<const BYTE*>(pHeader + 1),
+                                pHeader->WordCount * TFA9890_DSP_WORD_BYTES);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! Upload of %S failed %!STATUS!", m_Images[i]->Path, Status);
+            DLog("PA: DSP image upload failed %d\n", Status);//DebugLog
+        }
+    }
+
+    return Status;
+}
@@ -0,0 +1,526 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the handlers for the driver's private IOCTLs.
+//    Each handler validates the request buffers and performs the
+//    operation; the caller completes the request unless the handler
+//    returns STATUS_PENDING.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Ioctl.tmh"
+
+
+// IOCTL_TFA9890_STAGE_REGISTERS
+NTSTATUS NxpTfa9890Device::IoctlStageRegisters(
+    _In_ WDFREQUEST Request)    // WDF request object
+{
+    PTFA9890_STAGE_INPUT pInput = nullptr;
+    size_t InputLength = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_STAGE_INPUT), reinterpret_cast<PVOID*>(&pInput), &InputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    // A request is capped at the staging areas of all amps together. The
+    // length is checked by division so that no Count can wrap it.
+    if (0 == pInput->Count ||
+        pInput->Count > TFA9890_MAX_STAGED * m_AmpCount ||
+        pInput->Count > (InputLength - FIELD_OFFSET(TFA9890_STAGE_INPUT, Entries)) / sizeof(TFA9890_STAGE_ENTRY))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG i = 0; i < pInput->Count && NT_SUCCESS(Status); i++)
+    {
+        Status = StageRegister(pInput->Entries[i].AmpMask, pInput->Entries[i].Register, pInput->Entries[i].Value);
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    return Status;
+}
+
+// IOCTL_TFA9890_COMMIT_STAGED
+NTSTATUS NxpTfa9890Device::IoctlCommitStaged(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_COMMIT_INPUT pInput = nullptr;
+    PTFA9890_COMMIT_OUTPUT pOutput = nullptr;
+    ULONG SkewBudgetUs = 0;
+
+    *pInformation = 0;
+
+    // The input buffer is optional
+    if (NT_SUCCESS(WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_COMMIT_INPUT), reinterpret_cast<PVOID*>(&pInput), NULL)))
+    {
+        SkewBudgetUs = pInput->SkewBudgetUs;
+    }
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_COMMIT_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    if (!m_PoweredOn)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    Status = CommitStaged(SkewBudgetUs, pOutput);
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    // Partial failures are reported in the output buffer
+    *pInformation = sizeof(TFA9890_COMMIT_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_DISCARD_STAGED
+NTSTATUS NxpTfa9890Device::IoctlDiscardStaged()
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    DiscardStaged();
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_SET_EQ
+NTSTATUS NxpTfa9890Device::IoctlSetEq(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_EQ_INPUT pInput = nullptr;
+    PTFA9890_EQ_OUTPUT pOutput = nullptr;
+    size_t InputLength = 0;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_EQ_INPUT), reinterpret_cast<PVOID*>(&pInput), &InputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_EQ_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    // Checked by division so that no Count can wrap the length
+    if (0 == pInput->Count ||
+        pInput->Count > TFA9890_EQ_BANDS ||
+        pInput->Count > (InputLength - FIELD_OFFSET(TFA9890_EQ_INPUT, Bands)) / sizeof(TFA9890_EQ_BAND))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!m_PoweredOn)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    // Takes the locks it needs itself; the upload must not hold off bank
+    // switches
+    Status = SetEqBands(pInput->AmpMask, pInput->Bands, pInput->Count, pInput->Flags, pOutput);
+
+    if (STATUS_INVALID_PARAMETER == Status)
+    {
+        return Status;
+    }
+
+    // Upload failures are reported in the output buffer
+    *pInformation = sizeof(TFA9890_EQ_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_SWITCH_BANK
+NTSTATUS NxpTfa9890Device::IoctlSwitchBank(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_BANK_SWITCH_INPUT pInput = nullptr;
+    PTFA9890_BANK_SWITCH_OUTPUT pOutput = nullptr;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_BANK_SWITCH_INPUT), reinterpret_cast<PVOID*>(&pInput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_BANK_SWITCH_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    if (0 == pInput->AmpMask || 0 != (pInput->AmpMask >> m_AmpCount))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!m_PoweredOn)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    Status = SwitchBanks(pInput->AmpMask, pOutput);
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    // Switch failures are reported in the output buffer
+    *pInformation = sizeof(TFA9890_BANK_SWITCH_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_MAP_STREAM
+NTSTATUS NxpTfa9890Device::IoctlMapStream(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_STREAM_INPUT pInput = nullptr;
+    PTFA9890_STREAM_OUTPUT pOutput = nullptr;
+    HANDLE CallerProcess = NULL;
+    HANDLE CallerSection = NULL;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_STREAM_INPUT), reinterpret_cast<PVOID*>(&pInput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_STREAM_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    if (0 == pInput->AmpMask || 0 != (pInput->AmpMask >> m_AmpCount))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    Status = StartStream(pInput->AmpMask);
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    // Hand the caller its own handle to the section
+    CallerProcess = OpenProcess(PROCESS_DUP_HANDLE, FALSE, WdfRequestGetRequestorProcessId(Request));
+    if (NULL == CallerProcess ||
+        !DuplicateHandle(GetCurrentProcess(), m_StreamSection, CallerProcess, &CallerSection, FILE_MAP_READ | FILE_MAP_WRITE, FALSE, 0))
+    {
+        Status = NTSTATUS_FROM_WIN32(GetLastError());
+        TraceError("ACC %!FUNC! Section handle duplication failed %!STATUS!", Status);
+        DLog("PA: Section handle duplication failed %d\n", Status);//DebugLog
+
+        WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+        StopStream();
+        WdfWaitLockRelease(m_I2CWaitLock);
+    }
+
+    if (NULL != CallerProcess)
+    {
+        CloseHandle(CallerProcess);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    pOutput->Section = reinterpret_cast<ULONG_PTR>(CallerSection);
+    pOutput->ViewBytes = static_cast<ULONG>(TFA9890_STREAM_VIEW_BYTES);
+    pOutput->Reserved = 0;
+
+    *pInformation = sizeof(TFA9890_STREAM_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_STOP_STREAM
+NTSTATUS NxpTfa9890Device::IoctlStopStream()
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    StopStream();
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_DUMP
+NTSTATUS NxpTfa9890Device::IoctlDump(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_DUMP_INPUT pInput = nullptr;
+    PTFA9890_DUMP_OUTPUT pOutput = nullptr;
+    size_t InputLength = 0;
+    size_t OutputLength = 0;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_DUMP_INPUT), reinterpret_cast<PVOID*>(&pInput), &InputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    // Direct I/O: this is the caller's buffer, not a copy
+    Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_DUMP_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), &OutputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    // Checked by division so that no RegionCount can wrap the length
+    if (0 == pInput->RegionCount ||
+        pInput->RegionCount > TFA9890_DUMP_MAX_REGIONS ||
+        pInput->RegionCount > (InputLength - FIELD_OFFSET(TFA9890_DUMP_INPUT, Regions)) / sizeof(TFA9890_DUMP_REGION))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!m_PoweredOn)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    ULONG Space = static_cast<ULONG>(min(OutputLength - FIELD_OFFSET(TFA9890_DUMP_OUTPUT, Data), static_cast<size_t>(MAXULONG)));
+
+    Status = DumpAmp(pInput, pOutput, Space);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    *pInformation = FIELD_OFFSET(TFA9890_DUMP_OUTPUT, Data) + pOutput->BytesWritten;
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_GET_HEALTH
+NTSTATUS NxpTfa9890Device::IoctlGetHealth(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_HEALTH_OUTPUT pOutput = nullptr;
+    size_t OutputLength = 0;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_HEALTH_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), &OutputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    ULONG Count = static_cast<ULONG>(min((OutputLength - FIELD_OFFSET(TFA9890_HEALTH_OUTPUT, Amps)) / sizeof(TFA9890_HEALTH), static_cast<size_t>(m_AmpCount)));
+
+    AcquireSRWLockShared(&m_HealthLock);
+    for (ULONG Amp = 0; Amp < Count; Amp++)
+    {
+        pOutput->Amps[Amp] = m_Amps[Amp].Health;
+    }
+    ReleaseSRWLockShared(&m_HealthLock);
+
+    pOutput->AmpCount = Count;
+    pOutput->Reserved = 0;
+
+    *pInformation = FIELD_OFFSET(TFA9890_HEALTH_OUTPUT, Amps) + Count * sizeof(TFA9890_HEALTH);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_GET_WATCHDOG
+NTSTATUS NxpTfa9890Device::IoctlGetWatchdog(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_WATCHDOG_OUTPUT pOutput = nullptr;
+    size_t OutputLength = 0;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_WATCHDOG_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), &OutputLength);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    ULONG Count = static_cast<ULONG>(min((OutputLength - FIELD_OFFSET(TFA9890_WATCHDOG_OUTPUT, Amps)) / sizeof(TFA9890_WATCHDOG_AMP), static_cast<size_t>(m_AmpCount)));
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    for (ULONG Amp = 0; Amp < Count; Amp++)
+    {
+        pOutput->Amps[Amp] = m_Amps[Amp].Watchdog;
+    }
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    pOutput->IntervalMs = m_WatchdogIntervalMs;
+    pOutput->AmpCount = Count;
+
+    *pInformation = FIELD_OFFSET(TFA9890_WATCHDOG_OUTPUT, Amps) + Count * sizeof(TFA9890_WATCHDOG_AMP);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_GET_PERF
+NTSTATUS NxpTfa9890Device::IoctlGetPerf(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_PERF_OUTPUT pOutput = nullptr;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_PERF_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    AcquireSRWLockShared(&m_PerfLock);
+    RtlCopyMemory(pOutput->Flows, m_PerfFlows, sizeof(m_PerfFlows));
+    ReleaseSRWLockShared(&m_PerfLock);
+
+    pOutput->Version = TFA9890_PERF_VERSION;
+    pOutput->AmpCount = m_AmpCount;
+
+    *pInformation = sizeof(TFA9890_PERF_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_STREAM_HINT
+NTSTATUS NxpTfa9890Device::IoctlStreamHint(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_STREAM_HINT_INPUT pInput = nullptr;
+    PTFA9890_STREAM_HINT_OUTPUT pOutput = nullptr;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_STREAM_HINT_INPUT), reinterpret_cast<PVOID*>(&pInput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_STREAM_HINT_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    if (pInput->Hint >= Tfa9890HintCount)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // A hint that has to wait for the power stage is completed by
+    // RunStreamHints
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    Status = QueueStreamHint(Request, static_cast<TFA9890_STREAM_HINT>(pInput->Hint), pOutput);
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    if (NT_SUCCESS(Status) && STATUS_PENDING != Status)
+    {
+        *pInformation = sizeof(TFA9890_STREAM_HINT_OUTPUT);
+    }
+    return Status;
+}
+
+// IOCTL_TFA9890_GET_IMAGE_CACHE
+NTSTATUS NxpTfa9890Device::IoctlGetImageCache(
+    _In_ WDFREQUEST Request,    // WDF request object
+    _Out_ size_t* pInformation) // Number of bytes returned
+{
+    PTFA9890_IMAGE_CACHE_OUTPUT pOutput = nullptr;
+
+    *pInformation = 0;
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_IMAGE_CACHE_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    ImageCacheQuery(pOutput);
+
+    *pInformation = sizeof(TFA9890_IMAGE_CACHE_OUTPUT);
+    return STATUS_SUCCESS;
+}
+
+// IOCTL_TFA9890_SUBSCRIBE_TELEMETRY
+NTSTATUS NxpTfa9890Device::IoctlSubscribeTelemetry(
+    _In_ WDFREQUEST Request)    // WDF request object
+{
+    PTFA9890_SUBSCRIBE_INPUT pInput = nullptr;
+
+    NTSTATUS Status = WdfRequestRetrieveInputBuffer(Request, sizeof(TFA9890_SUBSCRIBE_INPUT), reinterpret_cast<PVOID*>(&pInput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveInputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    WDFFILEOBJECT Owner = WdfRequestGetFileObject(Request);
+    if (NULL == Owner ||
+        (0 != pInput->IntervalMs && 0 == (pInput->Fields & TFA9890_TELEMETRY_FIELDS_ALL)) ||
+        0 != (pInput->Fields & ~TFA9890_TELEMETRY_FIELDS_ALL))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return Subscribe(Owner, pInput->IntervalMs, pInput->Fields);
+}
+
+// IOCTL_TFA9890_READ_TELEMETRY. Pends until the subscription's next sample.
+NTSTATUS NxpTfa9890Device::IoctlReadTelemetry(
+    _In_ WDFREQUEST Request)    // WDF request object
+{
+    PTFA9890_TELEMETRY_SAMPLE pOutput = nullptr;
+
+    NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(TFA9890_TELEMETRY_SAMPLE), reinterpret_cast<PVOID*>(&pOutput), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfRequestRetrieveOutputBuffer failed %!STATUS!", Status);
+        return Status;
+    }
+
+    return QueueTelemetryRead(Request);
+}
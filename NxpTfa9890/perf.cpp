@@ -0,0 +1,56 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the performance counters. Each core flow is
+//    timed from its start to its end, and the bus transactions issued
+//    meanwhile are counted, so a benchmark can follow the cost of the flows
+//    from build to build through IOCTL_TFA9890_GET_PERF. The transactions
+//    of the model poll and the watchdog check are left out: they run on
+//    their own timers and would make the count of a flow depend on when
+//    they happened to fire.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Perf.tmh"
+
+
+VOID NxpTfa9890Device::PerfBegin(
+    _Out_ PTFA9890_PERF_MARK pMark)
+{
+    pMark->Transactions = static_cast<ULONG>(ReadAcquire(&m_PerfTransactions));
+    pMark->Qpc = QpcNow();
+}
+
+// Account one run of a flow. Transactions issued concurrently by other
+// flows are counted with it; benchmarks time one flow at a time.
+VOID NxpTfa9890Device::PerfEnd(
+    _In_ ULONG Flow,                        // TFA9890_PERF_*
+    _In_ const TFA9890_PERF_MARK* pMark)    // From PerfBegin
+{
+    ULONG Us = QpcToUs(QpcNow() - pMark->Qpc);
+    ULONG Transactions = static_cast<ULONG>(ReadAcquire(&m_PerfTransactions));
+
+    AcquireSRWLockExclusive(&m_PerfLock);
+    PTFA9890_PERF_FLOW pFlow = &m_PerfFlows[Flow];
+    pFlow->Count++;
+    pFlow->Transactions += Transactions - pMark->Transactions;
+    pFlow->TotalUs += Us;
+    pFlow->LastUs = Us;
+    pFlow->MaxUs = max(pFlow->MaxUs, Us);
+    ReleaseSRWLockExclusive(&m_PerfLock);
+}
+
+// Count one bus transaction for the flows, unless the model poll or the
+// watchdog issued it. Called for every transaction sent to an amp.
+VOID NxpTfa9890Device::PerfCountTransaction()
+{
+    if (!m_BusBackground)
+    {
+        InterlockedIncrement(&m_PerfTransactions);
+    }
+}
@@ -0,0 +1,461 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module gates the amplifiers' power stage on audio stream hints.
+//    D-state transitions alone know nothing about when audio plays, so the
+//    audio stack reports imminent, started and stopped streams. Amps are
+//    pre-warmed on an imminent hint and gated to low power once no stream
+//    has run for the hysteresis window. Hints are only acted on after the
+//    first one arrives; until then the amps stay powered throughout D0.
+//
+//    The power stage is written by the sequencer as a one-step run per
+//    online amp, with the same asynchronous writes and timer backoff as a
+//    power-up, so neither the gate timer nor a hint's IOCTL thread waits
+//    for the bus. A hint that needs the amps powered pends until the run
+//    is done; hints that arrive meanwhile queue behind it and complete in
+//    order. Other hints complete right away.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Power.tmh"
+
+
+// A hint that wants the amps powered and finds them gated
+inline bool HintNeedsPowerUp(
+    _In_ const TFA9890_PENDING_HINT* pHint,
+    _In_ TFA9890_AMP_POWER Power)
+{
+    return !pHint->PoweredUp && Tfa9890HintStop != pHint->Hint && Tfa9890PowerGated == Power;
+}
+
+// Create the hysteresis timer that gates idle amps
+NTSTATUS NxpTfa9890Device::CreateGateTimer()
+{
+    WDF_TIMER_CONFIG TimerConfig;
+    WDF_TIMER_CONFIG_INIT(&TimerConfig, NxpTfa9890Device::OnGateTimer);
+    TimerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES TimerAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+    TimerAttributes.ParentObject = m_SensorInstance;
+
+    NTSTATUS Status = WdfTimerCreate(&TimerConfig, &TimerAttributes, &m_GateTimer);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfTimerCreate failed %!STATUS!", Status);
+    }
+
+    return Status;
+}
+
+// Start writing the output stage of every online amp up or down through
+// the PWDN bit of its shadowed system control value. The sequencer writes
+// it with timer backoff, and the amps stay offline until FinishPowerStage
+// has them back. Returns STATUS_PENDING once the run is started,
+// STATUS_SUCCESS if no amp has a value to write and STATUS_DEVICE_BUSY if
+// the sequencer is restoring an amp. The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::StartPowerStage(
+    _In_ bool Powered)          // true to power up, false to gate
+{
+    ULONG AmpMask = 0;
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        if (!pAmp->Online)
+        {
+            continue;
+        }
+
+        if (0 == (pAmp->ShadowValid[TFA9890_SYSTEM_CONTROL / 32] & (1UL << (TFA9890_SYSTEM_CONTROL % 32))))
+        {
+            TraceWarning("ACC %!FUNC! Amp %u has no shadowed system control, left as is", Amp);
+            continue;
+        }
+
+        WORD Value = TFA9890_BUS_WORD(pAmp->Shadow[TFA9890_SYSTEM_CONTROL]);
+        Value = static_cast<WORD>(Powered ? (Value & ~TFA9890_SYSTEM_CONTROL_PWDN) : (Value | TFA9890_SYSTEM_CONTROL_PWDN));
+
+        pAmp->SeqPowerStage = TFA9890_BUS_WORD(Value);
+        AmpMask |= 1UL << Amp;
+    }
+
+    if (0 == AmpMask)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    m_PowerStageOn = Powered;
+    if (!StartSequence(Tfa9890RunPowerStage, false, AmpMask))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    // The lock is held, so nothing has used the amps since the run started
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (0 != (AmpMask & (1UL << Amp)))
+        {
+            m_Amps[Amp].Online = false;
+        }
+    }
+
+    m_PowerStaging = true;
+    return STATUS_PENDING;
+}
+
+// Complete a power-stage run: bring its amps back online, account the
+// result and go on with the hints that waited for it. Runs on the sequence
+// work item.
+VOID NxpTfa9890Device::FinishPowerStage()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        if (0 == (m_SequenceAmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        pAmp->Online = true;
+
+        if (Tfa9890SeqDone != pAmp->SeqState)
+        {
+            // Stopped by the recovery deadline if no write failed
+            Status = NT_SUCCESS(pAmp->LastStatus) ? STATUS_IO_TIMEOUT : pAmp->LastStatus;
+            TraceError("ACC %!FUNC! Amp %u power stage %d failed %!STATUS!", Amp, m_PowerStageOn, Status);
+            DLog("PA: Amp %u power stage %d failed %d\n", Amp, m_PowerStageOn, Status);//DebugLog
+        }
+    }
+
+    // The next run may start from here on
+    m_PowerStaging = false;
+    EndSequence();
+
+    PowerStageDone(m_PowerStageOn, Status);
+    if (m_PoweredOn)
+    {
+        RunStreamHints();
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+// Take the result of a power-stage write. A power-up that woke gated amps
+// is credited to the hint at the front, which waited for it. A failed gate
+// powers the amps up again rather than leave some gated behind the state's
+// back. The caller holds m_I2CWaitLock.
+VOID NxpTfa9890Device::PowerStageDone(
+    _In_ bool Powered,          // The amps were being powered up
+    _In_ NTSTATUS Status)       // Outcome of the write
+{
+    if (Powered)
+    {
+        bool Woke = (Tfa9890PowerGated == m_AmpPower);
+        PTFA9890_PENDING_HINT pHint = (0 != m_PendingHintCount) ? &m_PendingHints[0] : nullptr;
+
+        m_PowerUpDue = false;
+        if (NT_SUCCESS(Status) && Woke)
+        {
+            m_AmpPower = Tfa9890PowerWarm;
+        }
+
+        // Polling also resumes after a failed undo of a gate, which left the state warm
+        if (NT_SUCCESS(Status) || !Woke)
+        {
+            ResumeModelPolling();
+        }
+
+        if (Woke && nullptr != pHint && Tfa9890HintStop != pHint->Hint)
+        {
+            pHint->PoweredUp = true;
+            pHint->Status = Status;
+        }
+    }
+    else if (NT_SUCCESS(Status))
+    {
+        m_AmpPower = Tfa9890PowerGated;
+        m_Gates++;
+        TraceInformation("ACC %!FUNC! Amps gated after %u ms without a stream", m_GateHysteresisMs);
+    }
+    else
+    {
+        m_PowerUpDue = true;
+    }
+}
+
+// Act on a hint right away if nothing has to be written first, else queue
+// it behind the hints already waiting and return STATUS_PENDING. A hint
+// waits at most for the runs ahead of it, so it is not made cancelable.
+// The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::QueueStreamHint(
+    _In_ WDFREQUEST Request,                        // IOCTL_TFA9890_STREAM_HINT request
+    _In_ TFA9890_STREAM_HINT Hint,                  // Hint from the audio stack
+    _Out_ PTFA9890_STREAM_HINT_OUTPUT pOutput)      // Receives the resulting state unless pending
+{
+    TFA9890_PENDING_HINT Pending = {};
+
+    // D0 exit fails the hints still waiting once it has cleared this
+    if (!m_PoweredOn)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    Pending.Request = Request;
+    Pending.Hint = Hint;
+    Pending.Received = QpcNow();
+    Pending.Status = STATUS_SUCCESS;
+
+    m_HintsActive = true;
+
+    if (0 == m_PendingHintCount && !m_PowerStaging && !m_PowerUpDue && !HintNeedsPowerUp(&Pending, m_AmpPower))
+    {
+        return ApplyStreamHint(&Pending, pOutput);
+    }
+
+    if (m_PendingHintCount >= TFA9890_MAX_PENDING_HINTS)
+    {
+        TraceError("ACC %!FUNC! %u hints are already waiting", m_PendingHintCount);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    m_PendingHints[m_PendingHintCount++] = Pending;
+    RunStreamHints();
+
+    return STATUS_PENDING;
+}
+
+// Complete the waiting hints in order. Where the amps have to be powered
+// up first, for the hint at the front or to undo a failed gate, start that
+// run and return; FinishPowerStage comes back here once it is done. Also
+// returns if the sequencer is busy, to be tried again from the gate timer.
+// The caller holds m_I2CWaitLock.
+VOID NxpTfa9890Device::RunStreamHints()
+{
+    while (!m_PowerStaging)
+    {
+        PTFA9890_PENDING_HINT pHint = (0 != m_PendingHintCount) ? &m_PendingHints[0] : nullptr;
+
+        if (m_PowerUpDue || (nullptr != pHint && HintNeedsPowerUp(pHint, m_AmpPower)))
+        {
+            NTSTATUS Status = StartPowerStage(true);
+            if (STATUS_PENDING == Status)
+            {
+                return;
+            }
+            if (STATUS_DEVICE_BUSY == Status)
+            {
+                m_PowerUpDue = true;
+                WdfTimerStart(m_GateTimer, WDF_REL_TIMEOUT_IN_MS(TFA9890_POWER_STAGE_RETRY_MS));
+                return;
+            }
+
+            PowerStageDone(true, Status);
+            continue;
+        }
+
+        if (nullptr == pHint)
+        {
+            return;
+        }
+
+        TFA9890_PENDING_HINT Hint = *pHint;
+        TFA9890_STREAM_HINT_OUTPUT Output;
+
+        m_PendingHintCount--;
+        RtlMoveMemory(&m_PendingHints[0], &m_PendingHints[1], m_PendingHintCount * sizeof(m_PendingHints[0]));
+
+        NTSTATUS Status = ApplyStreamHint(&Hint, &Output);
+
+        PTFA9890_STREAM_HINT_OUTPUT pOutput = nullptr;
+        if (NT_SUCCESS(Status))
+        {
+            Status = WdfRequestRetrieveOutputBuffer(Hint.Request, sizeof(TFA9890_STREAM_HINT_OUTPUT), reinterpret_cast<PVOID*>(&pOutput), NULL);
+        }
+        if (NT_SUCCESS(Status))
+        {
+            *pOutput = Output;
+        }
+        WdfRequestCompleteWithInformation(Hint.Request, Status, NT_SUCCESS(Status) ? sizeof(TFA9890_STREAM_HINT_OUTPUT) : 0);
+    }
+}
+
+// Act on one hint once the amps are in the power state it needs, and
+// report the power state and start latencies. A start is timed from the
+// hint's arrival, so a cold start includes the power-up it waited for.
+// The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::ApplyStreamHint(
+    _In_ const TFA9890_PENDING_HINT* pHint,         // Hint from the audio stack
+    _Out_ PTFA9890_STREAM_HINT_OUTPUT pOutput)      // Receives the resulting state
+{
+    NTSTATUS Status = pHint->Status;
+    bool Cold = pHint->PoweredUp;
+    bool ArmGate = false;
+
+    RtlZeroMemory(pOutput, sizeof(*pOutput));
+
+    switch (pHint->Hint)
+    {
+        case Tfa9890HintImminent:
+            if (Cold && NT_SUCCESS(Status))
+            {
+                m_PreWarms++;
+            }
+
+            // A stream that never starts must not keep the amps warm
+            ArmGate = (0 == m_ActiveStreams);
+            break;
+
+        case Tfa9890HintStart:
+            m_ActiveStreams++;
+            WdfTimerStop(m_GateTimer, FALSE);
+
+            if (!NT_SUCCESS(Status))
+            {
+                break;
+            }
+
+            m_AmpPower = Tfa9890PowerActive;
+            pOutput->StartUs = QpcToUs(QpcNow() - pHint->Received);
+
+            if (Cold)
+            {
+                m_ColdStarts++;
+                m_ColdStartUsTotal += pOutput->StartUs;
+                m_MaxColdStartUs = max(m_MaxColdStartUs, pOutput->StartUs);
+            }
+            else
+            {
+                m_WarmStarts++;
+                m_WarmStartUsTotal += pOutput->StartUs;
+                m_MaxWarmStartUs = max(m_MaxWarmStartUs, pOutput->StartUs);
+            }
+
+            TraceInformation("ACC %!FUNC! %s start took %u us", Cold ? "Cold" : "Warm", pOutput->StartUs);
+            break;
+
+        case Tfa9890HintStop:
+            if (m_ActiveStreams > 0)
+            {
+                m_ActiveStreams--;
+            }
+            if (0 == m_ActiveStreams && Tfa9890PowerActive == m_AmpPower)
+            {
+                m_AmpPower = Tfa9890PowerWarm;
+            }
+            ArmGate = (0 == m_ActiveStreams);
+            break;
+
+        default:
+            break;
+    }
+
+    if (ArmGate && 0 != m_GateHysteresisMs && Tfa9890PowerWarm == m_AmpPower)
+    {
+        WdfTimerStart(m_GateTimer, WDF_REL_TIMEOUT_IN_MS(m_GateHysteresisMs));
+    }
+
+    pOutput->Power = m_AmpPower;
+    pOutput->WarmStarts = m_WarmStarts;
+    pOutput->ColdStarts = m_ColdStarts;
+    pOutput->MeanWarmStartUs = (0 != m_WarmStarts) ? static_cast<ULONG>(m_WarmStartUsTotal / m_WarmStarts) : 0;
+    pOutput->MaxWarmStartUs = m_MaxWarmStartUs;
+    pOutput->MeanColdStartUs = (0 != m_ColdStarts) ? static_cast<ULONG>(m_ColdStartUsTotal / m_ColdStarts) : 0;
+    pOutput->MaxColdStartUs = m_MaxColdStartUs;
+    pOutput->PreWarms = m_PreWarms;
+    pOutput->Gates = m_Gates;
+
+    return Status;
+}
+
+// Gate the amps once the hysteresis has expired with no stream running.
+// Also where a power-up the sequencer was too busy for is tried again.
+VOID NxpTfa9890Device::GateIdleAmps()
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    if (!m_PoweredOn || m_PowerStaging)
+    {
+        // Nothing to do, or FinishPowerStage goes on from here
+    }
+    else if (m_PowerUpDue || 0 != m_PendingHintCount)
+    {
+        RunStreamHints();
+    }
+    else if (0 == m_ActiveStreams && Tfa9890PowerWarm == m_AmpPower)
+    {
+        // The DSP stops producing model data while gated
+        SuspendModelPolling();
+
+        NTSTATUS Status = StartPowerStage(false);
+        if (STATUS_DEVICE_BUSY == Status)
+        {
+            ResumeModelPolling();
+            WdfTimerStart(m_GateTimer, WDF_REL_TIMEOUT_IN_MS(TFA9890_POWER_STAGE_RETRY_MS));
+        }
+        else if (STATUS_PENDING != Status)
+        {
+            PowerStageDone(false, Status);
+        }
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+// Stop the hysteresis timer while leaving D0. Waits for a gate in progress.
+// The sequencer is stopped by then, so hints still waiting fail, and an
+// aborted power-stage run leaves its amps offline for the cold path.
+VOID NxpTfa9890Device::SuspendPowerGating()
+{
+    if (NULL != m_GateTimer)
+    {
+        WdfTimerStop(m_GateTimer, TRUE);
+    }
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG i = 0; i < m_PendingHintCount; i++)
+    {
+        WdfRequestComplete(m_PendingHints[i].Request, STATUS_DEVICE_NOT_READY);
+    }
+    m_PendingHintCount = 0;
+    m_PowerStaging = false;
+    m_PowerUpDue = false;
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+// PowerOn leaves every amp powered. With hints active and no stream
+// running, the hysteresis starts over from D0 entry.
+VOID NxpTfa9890Device::ResumePowerGating()
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    m_AmpPower = (0 != m_ActiveStreams) ? Tfa9890PowerActive : Tfa9890PowerWarm;
+    if (m_HintsActive && 0 == m_ActiveStreams && 0 != m_GateHysteresisMs)
+    {
+        WdfTimerStart(m_GateTimer, WDF_REL_TIMEOUT_IN_MS(m_GateHysteresisMs));
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+VOID NxpTfa9890Device::OnGateTimer(
+    _In_ WDFTIMER Timer)    // Gate timer, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfTimerGetParentObject(Timer));
+    if (nullptr != pDevice)
+    {
+        pDevice->GateIdleAmps();
+    }
+}
@@ -0,0 +1,310 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module compiles the per-board init profiles. They are read from
+//    the driver's Parameters key once at DriverEntry, validated and stored
+//    as flat register sequences that every device shares read-only:
+//
+//      Profiles        REG_MULTI_SZ  Names of the profiles to compile
+//      <Name>          REG_MULTI_SZ  One step per string, "<register>=<value>"
+//                                    in hex with an optional ",power" suffix
+//                                    for steps that enable the power stage,
+//                                    or "settle=<ms>" to let the amp settle
+//                                    before the next step. The status and
+//                                    telemetry registers and the DSP window
+//                                    cannot be written, and a settle needs
+//                                    at least 1 ms.
+//      DefaultProfile  REG_SZ        Profile used by devices whose hardware
+//                                    key does not name one in InitProfile
+//
+//    Register values are written as the register's numeric value and settle
+//    times in hex like every other number. The built-in bypass sequence is
+//    always compiled as profile "Bypass".
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Profile.tmh"
+
+
+static const WCHAR BuiltInProfileName[] = L"Bypass";
+
+// Parse a hex number of at most MaxDigits digits with an optional 0x prefix.
+// Returns the character after the number, or nullptr if there is none.
+static PCWSTR ParseHex(
+    _In_ PCWSTR pText,
+    _In_ ULONG MaxDigits,
+    _Out_ ULONG* pValue)
+{
+    ULONG Digits = 0;
+
+    *pValue = 0;
+    while (L' ' == *pText)
+    {
+        pText++;
+    }
+    if (L'0' == pText[0] && (L'x' == pText[1] || L'X' == pText[1]))
+    {
+        pText += 2;
+    }
+
+    for (;; pText++, Digits++)
+    {
+        ULONG Digit;
+        if (*pText >= L'0' && *pText <= L'9')
+        {
+            Digit = *pText - L'0';
+        }
+        else if (*pText >= L'a' && *pText <= L'f')
+        {
+            Digit = *pText - L'a' + 10;
+        }
+        else if (*pText >= L'A' && *pText <= L'F')
+        {
+            Digit = *pText - L'A' + 10;
+        }
+        else
+        {
+            break;
+        }
+
+        if (Digits == MaxDigits)
+        {
+            return nullptr;
+        }
+        *pValue = (*pValue << 4) | Digit;
+    }
+
+    while (L' ' == *pText)
+    {
+        pText++;
+    }
+    return (0 == Digits) ? nullptr : pText;
+}
+
+// Compile one "<register>=<value>[,power]" or "settle=<ms>" step. A step
+// must be something a restore can write back, so the read-only telemetry
+// and the DSP window are refused, and a settle of 0 would not settle.
+static bool ProfileParseStep(
+    _In_ PCWSTR pText,
+    _Out_ PREGISTER_SETTING pStep)
+{
+    ULONG Register = 0;
+    ULONG Value = 0;
+
+    if (0 == _wcsnicmp(pText, L"settle=", 7))
+    {
+        pText = ParseHex(pText + 7, 4, &Value);
+        if (nullptr == pText || L'\0' != *pText || 0 == Value)
+        {
+            return false;
+        }
+
+        pStep->Register = 0;
+        pStep->Value = static_cast<WORD>(Value);
+        pStep->Flags = TFA9890_STEP_SETTLE;
+        return true;
+    }
+
+    pText = ParseHex(pText, 2, &Register);
+    if (nullptr == pText || L'=' != *pText ||
+        !IsRestorable(Register) || Register <= TFA9890_TEMPERATURE)
+    {
+        return false;
+    }
+
+    pText = ParseHex(pText + 1, 4, &Value);
+    if (nullptr == pText)
+    {
+        return false;
+    }
+
+    pStep->Register = static_cast<BYTE>(Register);
+    pStep->Value = TFA9890_BUS_WORD(Value);
+    pStep->Flags = 0;
+
+    if (L'\0' == *pText)
+    {
+        return true;
+    }
+    if (CSTR_EQUAL == CompareStringOrdinal(pText, -1, L",power", -1, TRUE))
+    {
+        pStep->Flags = TFA9890_STEP_POWER;
+        return true;
+    }
+    return false;
+}
+
+// Read a REG_MULTI_SZ value into pText. The list is terminated even if the
+// registry data is not.
+static NTSTATUS ProfileQueryMultiString(
+    _In_ WDFKEY Key,
+    _In_ PCWSTR Name,
+    _Out_writes_(TFA9890_PROFILE_TEXT_CHARS) PWSTR pText)
+{
+    UNICODE_STRING ValueName;
+    ULONG Length = 0;
+    ULONG Type = 0;
+
+    RtlInitUnicodeString(&ValueName, Name);
+    NTSTATUS Status = WdfRegistryQueryValue(Key, &ValueName, (TFA9890_PROFILE_TEXT_CHARS - 2) * sizeof(WCHAR), pText, &Length, &Type);
+    if (NT_SUCCESS(Status) && REG_MULTI_SZ != Type)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Length /= sizeof(WCHAR);
+    pText[Length] = L'\0';
+    pText[Length + 1] = L'\0';
+    return STATUS_SUCCESS;
+}
+
+// Compile the named profile. Any invalid step rejects the whole profile so
+// a board never runs half of its sequence.
+static NTSTATUS ProfileCompile(
+    _In_ WDFKEY Key,
+    _In_ PCWSTR Name,
+    _Out_ PTFA9890_INIT_PROFILE pProfile)
+{
+    WCHAR Text[TFA9890_PROFILE_TEXT_CHARS];
+
+    NTSTATUS Status = StringCchCopyW(pProfile->Name, TFA9890_PROFILE_NAME_CHARS, Name);
+    if (NT_SUCCESS(Status))
+    {
+        Status = ProfileQueryMultiString(Key, Name, Text);
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! Profile %S could not be read %!STATUS!", Name, Status);
+        return Status;
+    }
+
+    pProfile->StepCount = 0;
+    for (PCWSTR pStep = Text; L'\0' != *pStep; pStep += wcslen(pStep) + 1)
+    {
+        if (TFA9890_MAX_INIT_STEPS == pProfile->StepCount ||
+            !ProfileParseStep(pStep, &pProfile->Steps[pProfile->StepCount]))
+        {
+            TraceError("ACC %!FUNC! Profile %S rejected at step %u \"%S\"", Name, pProfile->StepCount, pStep);
+            DLog("PA: Init profile rejected at step %u\n", pProfile->StepCount);//DebugLog
+            return STATUS_INVALID_PARAMETER;
+        }
+        pProfile->StepCount++;
+    }
+
+    if (0 == pProfile->StepCount)
+    {
+        TraceError("ACC %!FUNC! Profile %S is empty", Name);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Build the profile set. Always succeeds: profiles that cannot be read or
+// do not validate are skipped, leaving at least the built-in sequence.
+VOID ProfileCompileAll(
+    _In_ WDFDRIVER Driver,                  // Driver whose Parameters key holds the profiles
+    _Out_ PTFA9890_PROFILE_SET pSet)        // Receives the compiled profiles
+{
+    DECLARE_CONST_UNICODE_STRING(DefaultProfileName, L"DefaultProfile");
+    DECLARE_UNICODE_STRING_SIZE(DefaultProfile, TFA9890_PROFILE_NAME_CHARS);
+
+    WCHAR Names[TFA9890_PROFILE_TEXT_CHARS];
+    WDFKEY Key = NULL;
+
+    SENSOR_FunctionEnter();
+
+    RtlZeroMemory(pSet, sizeof(*pSet));
+
+    PTFA9890_INIT_PROFILE pBuiltIn = &pSet->Profiles[0];
+    StringCchCopyW(pBuiltIn->Name, TFA9890_PROFILE_NAME_CHARS, BuiltInProfileName);
+    pBuiltIn->StepCount = _countof(g_BypassSequence);
+    RtlCopyMemory(pBuiltIn->Steps, g_BypassSequence, sizeof(g_BypassSequence));
+    pSet->Count = 1;
+
+    NTSTATUS Status = WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &Key);
+    if (NT_SUCCESS(Status))
+    {
+        Status = ProfileQueryMultiString(Key, L"Profiles", Names);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        for (PCWSTR pName = Names; L'\0' != *pName; pName += wcslen(pName) + 1)
+        {
+            if (TFA9890_MAX_PROFILES == pSet->Count)
+            {
+                TraceWarning("ACC %!FUNC! Only %u profiles are compiled, %S and later ignored", TFA9890_MAX_PROFILES, pName);
+                break;
+            }
+            if (nullptr != ProfileFind(pSet, pName))
+            {
+                TraceWarning("ACC %!FUNC! Duplicate profile %S ignored", pName);
+                continue;
+            }
+            if (NT_SUCCESS(ProfileCompile(Key, pName, &pSet->Profiles[pSet->Count])))
+            {
+                pSet->Count++;
+            }
+        }
+
+        if (NT_SUCCESS(WdfRegistryQueryUnicodeString(Key, &DefaultProfileName, NULL, &DefaultProfile)))
+        {
+            DefaultProfile_buffer[min(DefaultProfile.Length / sizeof(WCHAR), TFA9890_PROFILE_NAME_CHARS - 1)] = L'\0';
+
+            const TFA9890_INIT_PROFILE* pDefault = ProfileFind(pSet, DefaultProfile_buffer);
+            if (nullptr != pDefault)
+            {
+                pSet->Default = static_cast<ULONG>(pDefault - pSet->Profiles);
+            }
+            else
+            {
+                TraceWarning("ACC %!FUNC! Default profile %S was not compiled", DefaultProfile_buffer);
+            }
+        }
+    }
+    else
+    {
+        TraceInformation("ACC %!FUNC! No init profiles configured %!STATUS!", Status);
+    }
+
+    if (NULL != Key)
+    {
+        WdfRegistryClose(Key);
+    }
+
+    TraceInformation("ACC %!FUNC! %u init profiles, default %S", pSet->Count, pSet->Profiles[pSet->Default].Name);
+
+    SENSOR_FunctionExit(STATUS_SUCCESS);
+}
+
+// Look up a compiled profile by name, ignoring case. A null or empty name
+// selects the default profile.
+const TFA9890_INIT_PROFILE* ProfileFind(
+    _In_ const TFA9890_PROFILE_SET* pSet,
+    _In_opt_ PCWSTR Name)
+{
+    if (nullptr == Name || L'\0' == Name[0])
+    {
+        return &pSet->Profiles[pSet->Default];
+    }
+
+    for (ULONG i = 0; i < pSet->Count; i++)
+    {
+        if (CSTR_EQUAL == CompareStringOrdinal(pSet->Profiles[i].Name, -1, Name, -1, TRUE))
+        {
+            return &pSet->Profiles[i];
+        }
+    }
+
+    return nullptr;
+}
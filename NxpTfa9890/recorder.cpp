@@ -0,0 +1,242 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the I2C transaction recorder. When BusRecordFile
+//    names a file in the device hardware key, every transaction issued
+//    during a power transition is captured with its timing and status in
+//    the format described in Tfa9890Trace.h, for offline replay.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Recorder.tmh"
+
+
+C_ASSERT(TFA9890_MAX_AMPS <= TFA9890_TRACE_MAX_AMPS);
+C_ASSERT(TFA9890_DUMP_CHUNK_BYTES + sizeof(TFA9890_TRACE_RECORD) <= TFA9890_RECORD_BUFFER_BYTES);
+
+// Microseconds since the recording began, without overflowing the product
+// for long recordings
+inline ULONGLONG RecordTimeUs(
+    _In_ LONGLONG Ticks)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    return static_cast<ULONGLONG>((Ticks / Frequency.QuadPart) * 1000000 +
+                                  ((Ticks % Frequency.QuadPart) * 1000000) / Frequency.QuadPart);
+}
+
+// Open the trace file named in the configuration and write its header.
+// Failures are traced and leave the recorder idle; they never fail the
+// device.
+VOID NxpTfa9890Device::OpenRecorder()
+{
+    if (L'\0' == m_RecordPath[0] || NULL != m_RecordFile)
+    {
+        return;
+    }
+
+    WDF_OBJECT_ATTRIBUTES MemoryAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&MemoryAttributes);
+    MemoryAttributes.ParentObject = m_SensorInstance;
+
+    NTSTATUS Status = WdfMemoryCreate(&MemoryAttributes,
+                                      PagedPool,
+                                      PA_POOL_TAG_ACCELEROMETER,
+                                      TFA9890_RECORD_BUFFER_BYTES,
+                                      &m_RecordMemory,
+                                      reinterpret_cast<PVOID*>(&m_pRecordBuffer));
+    if (!NT_SUCCESS(Status))
+    {
+        m_RecordMemory = NULL;
+        TraceError("ACC %!FUNC! WdfMemoryCreate failed %!STATUS!", Status);
+        return;
+    }
+
+    HANDLE File = CreateFileW(m_RecordPath,
+                              GENERIC_WRITE,
+                              FILE_SHARE_READ,
+                              NULL,
+                              CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+    if (INVALID_HANDLE_VALUE == File)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        TraceError("ACC %!FUNC! CreateFileW for %S failed %!HRESULT!", m_RecordPath, Status);
+        DLog("PA: CreateFileW for bus record file failed %d\n", Status);//DebugLog
+        WdfObjectDelete(m_RecordMemory);
+        m_RecordMemory = NULL;
+        m_pRecordBuffer = nullptr;
+        return;
+    }
+
+    TFA9890_TRACE_HEADER Header = {};
+    FILETIME StartTime;
+    GetSystemTimePreciseAsFileTime(&StartTime);
+
+    Header.Magic = TFA9890_TRACE_MAGIC;
+    Header.Version = TFA9890_TRACE_VERSION;
+    Header.HeaderBytes = sizeof(Header);
+    Header.StartTime = (static_cast<LONGLONG>(StartTime.dwHighDateTime) << 32) | StartTime.dwLowDateTime;
+    Header.AmpCount = m_AmpCount;
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        Header.ConnectionIds[Amp] = m_Amps[Amp].ConnectionId.QuadPart;
+    }
+
+    AcquireSRWLockExclusive(&m_RecordLock);
+    m_RecordFile = File;
+    m_RecordStartQpc = QpcNow();
+    m_RecordDropped = 0;
+    RtlCopyMemory(m_pRecordBuffer, &Header, sizeof(Header));
+    m_RecordUsed = sizeof(Header);
+    ReleaseSRWLockExclusive(&m_RecordLock);
+
+    m_Recording = m_RecordAll;
+
+    TraceInformation("ACC %!FUNC! Recording bus transactions of %u amps to %S", m_AmpCount, m_RecordPath);
+}
+
+// Write out what is left and close the trace file
+VOID NxpTfa9890Device::CloseRecorder()
+{
+    m_Recording = false;
+
+    if (NULL == m_RecordFile)
+    {
+        return;
+    }
+
+    FlushRecorder();
+
+    AcquireSRWLockExclusive(&m_RecordLock);
+    CloseHandle(m_RecordFile);
+    m_RecordFile = NULL;
+    ReleaseSRWLockExclusive(&m_RecordLock);
+
+    if (0 != m_RecordDropped)
+    {
+        TraceWarning("ACC %!FUNC! %u bus records were dropped", m_RecordDropped);
+    }
+
+    WdfObjectDelete(m_RecordMemory);
+    m_RecordMemory = NULL;
+    m_pRecordBuffer = nullptr;
+}
+
+// Write the buffered records to the trace file. The caller holds
+// m_RecordLock.
+static VOID WriteRecords(
+    _In_ HANDLE File,
+    _In_reads_bytes_(Length) const BYTE* pData,
+    _In_ ULONG Length,
+    _Inout_ ULONG* pDropped)
+{
+    DWORD Written = 0;
+    if (0 != Length && (!WriteFile(File, pData, Length, &Written, NULL) || Written != Length))
+    {
+        (*pDropped)++;
+        TraceError("ACC %!FUNC! WriteFile of %u bytes failed %!HRESULT!", Length, HRESULT_FROM_WIN32(GetLastError()));
+    }
+}
+
+VOID NxpTfa9890Device::FlushRecorder()
+{
+    AcquireSRWLockExclusive(&m_RecordLock);
+    if (NULL != m_RecordFile)
+    {
+        WriteRecords(m_RecordFile, m_pRecordBuffer, m_RecordUsed, &m_RecordDropped);
+        m_RecordUsed = 0;
+    }
+    ReleaseSRWLockExclusive(&m_RecordLock);
+}
+
+// Append one transaction. A full buffer is written out inline, which only
+// the transaction that found it full pays for.
+VOID NxpTfa9890Device::RecordTransaction(
+    _In_ ULONG Amp,                                 // Amp index or TFA9890_TRACE_AMP_NONE
+    _In_ BYTE Flags,                                // TFA9890_TRACE_FLAG_*
+    _In_ BYTE Register,                             // Register or marker
+    _In_reads_bytes_opt_(Length) const BYTE* pData, // Payload
+    _In_ ULONG Length,                              // Payload bytes
+    _In_ LONGLONG Start,                            // QPC time the request was issued
+    _In_ LONGLONG End,                              // QPC time the request completed
+    _In_ NTSTATUS Status)                           // Request status
+{
+    if (!m_Recording)
+    {
+        return;
+    }
+
+    // A failed read returned no data
+    if (nullptr == pData || ((Flags & TFA9890_TRACE_FLAG_READ) && !NT_SUCCESS(Status)))
+    {
+        Length = 0;
+    }
+
+    TFA9890_TRACE_RECORD Record = {};
+    Record.DurationUs = QpcToUs(End - Start);
+    Record.Status = Status;
+    Record.Length = static_cast<USHORT>(Length);
+    Record.Amp = static_cast<BYTE>(Amp);
+    Record.Register = Register;
+    Record.Flags = Flags;
+
+    AcquireSRWLockExclusive(&m_RecordLock);
+
+    if (NULL != m_RecordFile)
+    {
+        Record.TimeUs = RecordTimeUs(Start - m_RecordStartQpc);
+
+        if (m_RecordUsed + sizeof(Record) + Length > TFA9890_RECORD_BUFFER_BYTES)
+        {
+            WriteRecords(m_RecordFile, m_pRecordBuffer, m_RecordUsed, &m_RecordDropped);
+            m_RecordUsed = 0;
+        }
+
+        RtlCopyMemory(m_pRecordBuffer + m_RecordUsed, &Record, sizeof(Record));
+        m_RecordUsed += sizeof(Record);
+        if (0 != Length)
+        {
+            RtlCopyMemory(m_pRecordBuffer + m_RecordUsed, pData, Length);
+            m_RecordUsed += Length;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&m_RecordLock);
+}
+
+// Bracket a power transition or a restore. Recording starts at the opening marker; the
+// closing one writes the flow out and, unless everything is recorded, stops
+// recording again.
+VOID NxpTfa9890Device::RecordMarker(
+    _In_ BYTE Marker)   // TFA9890_TRACE_MARKER_*
+{
+    if (NULL == m_RecordFile)
+    {
+        return;
+    }
+
+    bool Begin = (TFA9890_TRACE_MARKER_D0_ENTRY == Marker ||
+                  TFA9890_TRACE_MARKER_D0_EXIT == Marker ||
+                  TFA9890_TRACE_MARKER_RESTORE == Marker);
+    LONGLONG Now = QpcNow();
+
+    if (Begin)
+    {
+        m_Recording = true;
+    }
+
+    RecordTransaction(TFA9890_TRACE_AMP_NONE, TFA9890_TRACE_FLAG_MARKER, Marker, nullptr, 0, Now, Now, STATUS_SUCCESS);
+
+    if (!Begin)
+    {
+        m_Recording = m_RecordAll;
+        FlushRecorder();
+    }
+}
@@ -0,0 +1,627 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the adaptive telemetry sampler. Temperature,
+//    battery voltage and fault status are read in one burst per amp. The
+//    sensor of each amp has only its own amp read, at its client's
+//    interval, so an amp nobody listens to stays off the bus. Every
+//    telemetry subscription shares one read of all amps, at the fastest
+//    interval any of them needs. Stable readings let an interval back off;
+//    a reading that moves past the change steps or reports a fault returns
+//    to the fastest interval on the spot. Each subscription is handed the
+//    last sample at its own interval, so the bus cost does not grow with
+//    the number of subscribers.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include <math.h>
+
+#include "Sampler.tmh"
+
+
+// Create the one-shot timer that drives sampling. It is re-armed after
+// every sample with the interval in effect.
+NTSTATUS NxpTfa9890Device::CreateSampleTimer()
+{
+    WDF_TIMER_CONFIG TimerConfig;
+    WDF_TIMER_CONFIG_INIT(&TimerConfig, NxpTfa9890Device::OnSampleTimer);
+    TimerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES TimerAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+    TimerAttributes.ParentObject = m_SensorInstance;
+
+    NTSTATUS Status = WdfTimerCreate(&TimerConfig, &TimerAttributes, &m_SampleTimer);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfTimerCreate failed %!STATUS!", Status);
+    }
+
+    return Status;
+}
+
+// Stop sampling while leaving D0. Waits for a sample in progress.
+VOID NxpTfa9890Device::SuspendSampling()
+{
+    if (NULL != m_SampleTimer)
+    {
+        WdfTimerStop(m_SampleTimer, TRUE);
+    }
+}
+
+// Arm the timer for the next tick: the shortest interval in effect of any
+// rate, or of the hand-out to the subscriptions. Stops it when nothing
+// needs sampling. Nothing is armed while the amps are down; FinishPowerUp
+// schedules the first tick once they are up.
+VOID NxpTfa9890Device::ScheduleSample()
+{
+    if (NULL == m_SampleTimer)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&m_SampleLock);
+
+    ULONG Tick = (0 != m_SampleRate.Demand) ? m_SampleRate.Effective : 0;
+
+    if (!m_PoweredOn)
+    {
+        WdfTimerStop(m_SampleTimer, FALSE);
+        ReleaseSRWLockExclusive(&m_SampleLock);
+        return;
+    }
+
+    if (0 != m_DeliveryInterval)
+    {
+        Tick = (0 == Tick) ? m_DeliveryInterval : min(Tick, m_DeliveryInterval);
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (m_AmpSensors[Amp].Started)
+        {
+            Tick = (0 == Tick) ? m_AmpSensors[Amp].Rate.Effective : min(Tick, m_AmpSensors[Amp].Rate.Effective);
+        }
+    }
+
+    if (0 == Tick)
+    {
+        WdfTimerStop(m_SampleTimer, FALSE);
+        ReleaseSRWLockExclusive(&m_SampleLock);
+        return;
+    }
+
+    m_SampleTick = Tick;
+    WdfTimerStart(m_SampleTimer, WDF_REL_TIMEOUT_IN_MS(m_SampleTick));
+
+    ReleaseSRWLockExclusive(&m_SampleLock);
+}
+
+// Bit n is set if the sensor of amp n is started
+ULONG NxpTfa9890Device::StartedAmpMask()
+{
+    ULONG Mask = 0;
+
+    AcquireSRWLockShared(&m_SampleLock);
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        Mask |= m_AmpSensors[Amp].Started ? (1UL << Amp) : 0;
+    }
+    ReleaseSRWLockShared(&m_SampleLock);
+
+    return Mask;
+}
+
+// Start the rate of an amp's sensor over from its client's interval, or
+// stop reading the amp for it. Called whenever either changes, with
+// m_SampleLock held; the caller reschedules once it has released it.
+VOID NxpTfa9890Device::RestartAmpSensor(
+    _In_ ULONG Amp)
+{
+    PTFA9890_AMP_SENSOR pSensor = &m_AmpSensors[Amp];
+
+    pSensor->Rate.Demand = pSensor->Started ? pSensor->Interval : 0;
+    pSensor->Rate.Effective = pSensor->Rate.Demand;
+    pSensor->Rate.StableSamples = 0;
+    pSensor->Rate.NextReadQpc = 0;
+
+    if (0 != m_AggregateWindow)
+    {
+        ResetAggregateWindow(Amp);
+    }
+}
+
+// Merge what the history and the subscriptions need into one bus interval
+// and field set, and start their sampling over from it. Called whenever
+// either changes.
+VOID NxpTfa9890Device::UpdateSampleDemand()
+{
+    ULONG Demand = 0;
+    ULONG Fields = 0;
+    ULONG Delivery = 0;
+
+    AcquireSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+    {
+        const TFA9890_SUBSCRIPTION* pSubscription = &m_Subscriptions[i];
+        if (NULL != pSubscription->Owner)
+        {
+            Delivery = (0 == Delivery) ? pSubscription->IntervalMs : min(Delivery, pSubscription->IntervalMs);
+            Fields |= pSubscription->Fields;
+        }
+    }
+
+    Demand = Delivery;
+
+    // The history keeps sampling on its own, every field
+    if (NULL != m_HistoryFile)
+    {
+        Demand = (0 == Demand) ? TFA9890_HISTORY_INTERVAL_MS : min(Demand, static_cast<ULONG>(TFA9890_HISTORY_INTERVAL_MS));
+        Fields = TFA9890_TELEMETRY_FIELDS_ALL;
+    }
+
+    ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+    AcquireSRWLockExclusive(&m_SampleLock);
+    m_SampleRate.Demand = Demand;
+    m_SampleRate.Effective = Demand;
+    m_SampleRate.StableSamples = 0;
+    m_SampleRate.NextReadQpc = 0;
+    m_SampleFields = Fields;
+    m_DeliveryInterval = Delivery;
+    ReleaseSRWLockExclusive(&m_SampleLock);
+
+    ScheduleSample();
+}
+
+// Read the registers holding the requested fields of every online amp in
+// AmpMask, one burst each, and combine them into the worst case: the
+// hottest amp, the lowest battery and every fault bit. Fields not
+// requested are left 0. Complete samples also go to the history, per amp.
+NTSTATUS NxpTfa9890Device::ReadTelemetry(
+    _In_ ULONG Fields,                      // TFA9890_TELEMETRY_FIELD_* bits
+    _In_ ULONG AmpMask,                     // Bit n selects amplifier n
+    _Out_ PTFA9890_TELEMETRY pTelemetry,    // Receives the combined sample
+    _Out_writes_(TFA9890_MAX_AMPS) PTFA9890_TELEMETRY pAmpTelemetry,    // Receives each amp's sample
+    _Out_ PULONG pReadMask)                 // Receives the amps that were read
+{
+    WORD Values[TFA9890_TEMPERATURE + 1] = {};
+    LONG AmpTemperature[TFA9890_MAX_AMPS] = {};
+    ULONG AmpBattery[TFA9890_MAX_AMPS] = {};
+    ULONG AmpFaults[TFA9890_MAX_AMPS] = {};
+    bool AmpRead[TFA9890_MAX_AMPS] = {};
+    LONGLONG Timeout = 0;
+    ULONG Read = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    RtlZeroMemory(pTelemetry, sizeof(*pTelemetry));
+    RtlZeroMemory(pAmpTelemetry, TFA9890_MAX_AMPS * sizeof(*pAmpTelemetry));
+    *pReadMask = 0;
+
+    // Skip the sample rather than stall behind a DSP upload or a power
+    // transition; the next one is at most one interval away
+    if (STATUS_SUCCESS != WdfWaitLockAcquire(m_I2CWaitLock, &Timeout))
+    {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    if (!m_PoweredOn || Tfa9890PowerGated == m_AmpPower)
+    {
+        WdfWaitLockRelease(m_I2CWaitLock);
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    // One burst covers every register needed
+    ULONG First = (Fields & TFA9890_TELEMETRY_FIELD_FAULTS) ? TFA9890_STATUS :
+                  (Fields & TFA9890_TELEMETRY_FIELD_BATTERY) ? TFA9890_BATTERY_VOLTAGE : TFA9890_TEMPERATURE;
+    ULONG Last = (Fields & TFA9890_TELEMETRY_FIELD_TEMPERATURE) ? TFA9890_TEMPERATURE :
+                 (Fields & TFA9890_TELEMETRY_FIELD_BATTERY) ? TFA9890_BATTERY_VOLTAGE : TFA9890_STATUS;
+    ULONG Length = (Last - First + 1) * sizeof(WORD);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        if (!pAmp->Online || 0 == (AmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        NTSTATUS AmpStatus = ReadBurst(pAmp,
+                                       TFA9890_CMD_CLASS_TELEMETRY,
+                                       static_cast<BYTE>(First),
+                                       reinterpret_cast<BYTE*>(&Values[First]),
+                                       Length,
+                                       true,
+                                       Length);
+        if (!NT_SUCCESS(AmpStatus))
+        {
+            Status = AmpStatus;
+            continue;
+        }
+
+        // Temperature is a signed 9-bit value
+        LONG Temperature = TFA9890_BUS_WORD(Values[TFA9890_TEMPERATURE]) & TFA9890_TEMPERATURE_MASK;
+        if (Temperature > (TFA9890_TEMPERATURE_MASK >> 1))
+        {
+            Temperature -= TFA9890_TEMPERATURE_MASK + 1;
+        }
+        ULONG BatteryLsb = TFA9890_BUS_WORD(Values[TFA9890_BATTERY_VOLTAGE]) & 0x03FF;
+        float BatteryV = BatteryLsb * TFA9890_BATTERY_VOLTS_PER_LSB;
+        ULONG StatusBits = TFA9890_BUS_WORD(Values[TFA9890_STATUS]);
+        ULONG Faults = (StatusBits & TFA9890_STATUS_FAULTS_SET) | (~StatusBits & TFA9890_STATUS_FAULTS_CLEAR);
+
+        if (Fields & TFA9890_TELEMETRY_FIELD_TEMPERATURE)
+        {
+            pTelemetry->TemperatureC = (0 == Read) ? Temperature : max(pTelemetry->TemperatureC, static_cast<float>(Temperature));
+        }
+        if (Fields & TFA9890_TELEMETRY_FIELD_BATTERY)
+        {
+            pTelemetry->BatteryV = (0 == Read) ? BatteryV : min(pTelemetry->BatteryV, BatteryV);
+        }
+        if (Fields & TFA9890_TELEMETRY_FIELD_FAULTS)
+        {
+            pTelemetry->Faults |= Faults;
+        }
+
+        pAmpTelemetry[Amp].TemperatureC = (Fields & TFA9890_TELEMETRY_FIELD_TEMPERATURE) ? static_cast<float>(Temperature) : 0.0f;
+        pAmpTelemetry[Amp].BatteryV = (Fields & TFA9890_TELEMETRY_FIELD_BATTERY) ? BatteryV : 0.0f;
+        pAmpTelemetry[Amp].Faults = (Fields & TFA9890_TELEMETRY_FIELD_FAULTS) ? Faults : 0;
+
+        AmpTemperature[Amp] = Temperature;
+        AmpBattery[Amp] = BatteryLsb;
+        AmpFaults[Amp] = Faults;
+        AmpRead[Amp] = true;
+        *pReadMask |= 1UL << Amp;
+        Read++;
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (!AmpRead[Amp])
+        {
+            continue;
+        }
+
+        if (TFA9890_TELEMETRY_FIELDS_ALL == Fields)
+        {
+            HistoryAppendSample(Amp, AmpTemperature[Amp], AmpBattery[Amp], AmpFaults[Amp]);
+        }
+    }
+
+    if (0 == Read)
+    {
+        TraceError("ACC %!FUNC! No amp could be sampled %!STATUS!", Status);
+        return NT_SUCCESS(Status) ? STATUS_DEVICE_NOT_READY : Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Returns true if the sample differs from the last one reported at this
+// rate by at least the thresholds of its consumer, or reports a fault
+bool NxpTfa9890Device::IsTelemetryEvent(
+    _In_ const TFA9890_SAMPLE_RATE* pRate,      // Rate the sample was read at
+    _In_ const TFA9890_TELEMETRY* pTelemetry,   // New sample
+    _In_ float TemperatureStepC,                // Threshold of the temperature
+    _In_ float BatteryStepV)                    // Threshold of the battery voltage
+{
+    return pRate->FirstSample ||
+           0 != pTelemetry->Faults ||
+           pTelemetry->Faults != pRate->Last.Faults ||
+           fabsf(pTelemetry->TemperatureC - pRate->Last.TemperatureC) >= TemperatureStepC ||
+           fabsf(pTelemetry->BatteryV - pRate->Last.BatteryV) >= BatteryStepV;
+}
+
+// Pick the interval of the next bus read. An event returns to the fastest
+// interval needed at once; a run of stable samples doubles it, up to the
+// larger of that interval and TFA9890_SAMPLE_MAX_INTERVAL_MS.
+VOID NxpTfa9890Device::AdaptInterval(
+    _Inout_ PTFA9890_SAMPLE_RATE pRate, // Rate the sample was read at
+    _In_ bool Event)                    // The last sample was reported
+{
+    ULONG Ceiling = max(pRate->Demand, static_cast<ULONG>(TFA9890_SAMPLE_MAX_INTERVAL_MS));
+
+    pRate->Count++;
+    pRate->IntervalTotal += pRate->Effective;
+
+    if (Event)
+    {
+        if (pRate->Effective != pRate->Demand)
+        {
+            pRate->RampUps++;
+            TraceInformation("ACC %!FUNC! Sampling back to %u ms", pRate->Demand);
+        }
+        pRate->Effective = pRate->Demand;
+        pRate->StableSamples = 0;
+    }
+    else if (++pRate->StableSamples >= TFA9890_SAMPLE_STABLE_COUNT && pRate->Effective < Ceiling)
+    {
+        pRate->Effective = min(pRate->Effective * 2, Ceiling);
+        pRate->StableSamples = 0;
+        pRate->Backoffs++;
+        TraceInformation("ACC %!FUNC! Stable, sampling backed off to %u ms", pRate->Effective);
+    }
+}
+
+// Hand the last sample to every subscription that is due. Reads are
+// completed outside the lock.
+VOID NxpTfa9890Device::DeliverTelemetry()
+{
+    WDFREQUEST Requests[TFA9890_MAX_SUBSCRIPTIONS];
+    TFA9890_TELEMETRY_SAMPLE Samples[TFA9890_MAX_SUBSCRIPTIONS];
+    ULONG Count = 0;
+    bool Dropped = false;
+    LONGLONG Now = QpcNow();
+
+    AcquireSRWLockShared(&m_SampleLock);
+    LONGLONG Slack = QpcFromMs(m_SampleTick / 2);
+    ULONG IntervalMs = m_SampleRate.Effective;
+    ReleaseSRWLockShared(&m_SampleLock);
+
+    AcquireSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+    {
+        PTFA9890_SUBSCRIPTION pSubscription = &m_Subscriptions[i];
+        if (NULL == pSubscription->Owner)
+        {
+            continue;
+        }
+
+        // A handle that stopped reading is taken to be gone
+        LONGLONG Interval = QpcFromMs(pSubscription->IntervalMs);
+        if (NULL != pSubscription->Pending)
+        {
+            pSubscription->IdleQpc = Now;
+        }
+        else if (Now - pSubscription->IdleQpc > max(QpcFromMs(TFA9890_SUBSCRIPTION_IDLE_MS), 2 * Interval))
+        {
+            TraceWarning("ACC %!FUNC! Subscription %u dropped, no read pending", i);
+            RtlZeroMemory(pSubscription, sizeof(*pSubscription));
+            Dropped = true;
+            continue;
+        }
+
+        if (0 == m_TelemetrySequence || Now + Slack < pSubscription->DueQpc)
+        {
+            continue;
+        }
+
+        pSubscription->DueQpc += Interval;
+        if (pSubscription->DueQpc + Slack <= Now)
+        {
+            pSubscription->DueQpc = Now + Interval;
+        }
+
+        if (NULL == pSubscription->Pending)
+        {
+            pSubscription->Skipped++;
+            continue;
+        }
+
+        PTFA9890_TELEMETRY_SAMPLE pSample = &Samples[Count];
+        ULONG Fields = pSubscription->Fields & m_TelemetryFields;
+
+        RtlZeroMemory(pSample, sizeof(*pSample));
+        pSample->Timestamp = m_TelemetryTime;
+        pSample->Sequence = m_TelemetrySequence;
+        pSample->Fields = Fields;
+        pSample->TemperatureC = (Fields & TFA9890_TELEMETRY_FIELD_TEMPERATURE) ? m_Telemetry.TemperatureC : 0.0f;
+        pSample->BatteryV = (Fields & TFA9890_TELEMETRY_FIELD_BATTERY) ? m_Telemetry.BatteryV : 0.0f;
+        pSample->Faults = (Fields & TFA9890_TELEMETRY_FIELD_FAULTS) ? m_Telemetry.Faults : 0;
+        pSample->IntervalMs = IntervalMs;
+        pSample->Skipped = pSubscription->Skipped;
+
+        Requests[Count++] = pSubscription->Pending;
+        pSubscription->Pending = NULL;
+        pSubscription->Skipped = 0;
+    }
+
+    ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < Count; i++)
+    {
+        // A read being cancelled is completed by the cancel callback
+        if (STATUS_CANCELLED == WdfRequestUnmarkCancelable(Requests[i]))
+        {
+            continue;
+        }
+
+        PTFA9890_TELEMETRY_SAMPLE pOutput = nullptr;
+        NTSTATUS Status = WdfRequestRetrieveOutputBuffer(Requests[i], sizeof(TFA9890_TELEMETRY_SAMPLE), reinterpret_cast<PVOID*>(&pOutput), NULL);
+        if (NT_SUCCESS(Status))
+        {
+            *pOutput = Samples[i];
+        }
+        WdfRequestCompleteWithInformation(Requests[i], Status, NT_SUCCESS(Status) ? sizeof(TFA9890_TELEMETRY_SAMPLE) : 0);
+    }
+
+    if (Dropped)
+    {
+        UpdateSampleDemand();
+    }
+}
+
+// Add, change or, with an interval of 0, end the subscription of a handle.
+// A read pending on an ended subscription is cancelled.
+NTSTATUS NxpTfa9890Device::Subscribe(
+    _In_ WDFFILEOBJECT Owner,   // Handle the subscription belongs to
+    _In_ ULONG IntervalMs,      // Delivery interval, 0 to unsubscribe
+    _In_ ULONG Fields)          // TFA9890_TELEMETRY_FIELD_* bits
+{
+    PTFA9890_SUBSCRIPTION pSubscription = nullptr;
+    WDFREQUEST Cancelled = NULL;
+    NTSTATUS Status = STATUS_SUCCESS;
+    LONGLONG Now = QpcNow();
+
+    AcquireSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (Owner == m_Subscriptions[i].Owner)
+        {
+            pSubscription = &m_Subscriptions[i];
+            break;
+        }
+        if (nullptr == pSubscription && NULL == m_Subscriptions[i].Owner)
+        {
+            pSubscription = &m_Subscriptions[i];
+        }
+    }
+
+    if (0 == IntervalMs)
+    {
+        if (nullptr != pSubscription && Owner == pSubscription->Owner)
+        {
+            Cancelled = pSubscription->Pending;
+            RtlZeroMemory(pSubscription, sizeof(*pSubscription));
+        }
+    }
+    else if (nullptr == pSubscription)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        TraceError("ACC %!FUNC! All %u subscriptions are in use", TFA9890_MAX_SUBSCRIPTIONS);
+    }
+    else
+    {
+        // The first sample goes out on the next tick
+        pSubscription->Owner = Owner;
+        pSubscription->IntervalMs = max(IntervalMs, static_cast<ULONG>(TFA9890_SAMPLE_MIN_INTERVAL_MS));
+        pSubscription->Fields = Fields;
+        pSubscription->DueQpc = Now;
+        pSubscription->IdleQpc = Now;
+    }
+
+    ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+    if (NULL != Cancelled && STATUS_CANCELLED != WdfRequestUnmarkCancelable(Cancelled))
+    {
+        WdfRequestComplete(Cancelled, STATUS_CANCELLED);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        UpdateSampleDemand();
+    }
+
+    return Status;
+}
+
+// Pend a read on the subscription of the request's handle until its next
+// delivery. Each subscription has at most one read pending.
+NTSTATUS NxpTfa9890Device::QueueTelemetryRead(
+    _In_ WDFREQUEST Request)    // IOCTL_TFA9890_READ_TELEMETRY request
+{
+    WDFFILEOBJECT Owner = WdfRequestGetFileObject(Request);
+    NTSTATUS Status = STATUS_INVALID_DEVICE_STATE;
+
+    AcquireSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; NULL != Owner && i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+    {
+        PTFA9890_SUBSCRIPTION pSubscription = &m_Subscriptions[i];
+        if (Owner != pSubscription->Owner)
+        {
+            continue;
+        }
+
+        if (NULL != pSubscription->Pending)
+        {
+            Status = STATUS_DEVICE_BUSY;
+            break;
+        }
+
+        Status = WdfRequestMarkCancelableEx(Request, NxpTfa9890Device::OnTelemetryReadCancel);
+        if (NT_SUCCESS(Status))
+        {
+            pSubscription->Pending = Request;
+            pSubscription->IdleQpc = QpcNow();
+            Status = STATUS_PENDING;
+        }
+        break;
+    }
+
+    ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+    return Status;
+}
+
+// End every subscription while the hardware is released
+VOID NxpTfa9890Device::CancelSubscriptions()
+{
+    WDFREQUEST Requests[TFA9890_MAX_SUBSCRIPTIONS];
+    ULONG Count = 0;
+
+    AcquireSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (NULL != m_Subscriptions[i].Pending)
+        {
+            Requests[Count++] = m_Subscriptions[i].Pending;
+        }
+        RtlZeroMemory(&m_Subscriptions[i], sizeof(m_Subscriptions[i]));
+    }
+
+    ReleaseSRWLockExclusive(&m_SubscriptionLock);
+
+    for (ULONG i = 0; i < Count; i++)
+    {
+        if (STATUS_CANCELLED != WdfRequestUnmarkCancelable(Requests[i]))
+        {
+            WdfRequestComplete(Requests[i], STATUS_CANCELLED);
+        }
+    }
+}
+
+// A cancelled read ends its subscription; the handle is most likely being
+// closed
+VOID NxpTfa9890Device::OnTelemetryReadCancel(
+    _In_ WDFREQUEST Request)    // Pending IOCTL_TFA9890_READ_TELEMETRY request
+{
+    WDFDEVICE Device = WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request));
+    bool Dropped = false;
+
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromDevice(Device);
+
+    if (nullptr != pDevice)
+    {
+        AcquireSRWLockExclusive(&pDevice->m_SubscriptionLock);
+        for (ULONG i = 0; i < TFA9890_MAX_SUBSCRIPTIONS; i++)
+        {
+            if (Request == pDevice->m_Subscriptions[i].Pending)
+            {
+                RtlZeroMemory(&pDevice->m_Subscriptions[i], sizeof(pDevice->m_Subscriptions[i]));
+                Dropped = true;
+                break;
+            }
+        }
+        ReleaseSRWLockExclusive(&pDevice->m_SubscriptionLock);
+
+        if (Dropped)
+        {
+            pDevice->UpdateSampleDemand();
+        }
+    }
+
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+}
+
+VOID NxpTfa9890Device::OnSampleTimer(
+    _In_ WDFTIMER Timer)    // Sample timer, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfTimerGetParentObject(Timer));
+    if (nullptr != pDevice)
+    {
+        pDevice->GetData();
+        pDevice->ScheduleSample();
+    }
+}
@@ -0,0 +1,115 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the implementation of the per-amplifier
+//    I2C bus scheduler.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Scheduler.tmh"
+
+
+VOID Tfa9890BusScheduler::Initialize()
+{
+    InitializeSRWLock(&m_Lock);
+    InitializeConditionVariable(&m_Released);
+    m_Busy = false;
+    RtlZeroMemory(m_Waiting, sizeof(m_Waiting));
+    RtlZeroMemory(m_NextTicket, sizeof(m_NextTicket));
+    RtlZeroMemory(m_Serving, sizeof(m_Serving));
+    RtlZeroMemory(m_Stats, sizeof(m_Stats));
+}
+
+// Returns true if a class more urgent than Class is waiting for the bus.
+// The caller must hold m_Lock.
+bool Tfa9890BusScheduler::IsMoreUrgentWaiting(
+    _In_ TFA9890_CMD_CLASS Class)   // Class to compare against
+{
+    for (ULONG i = 0; i < static_cast<ULONG>(Class); i++)
+    {
+        if (m_Waiting[i] > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Blocks until the bus is free, no more urgent class is waiting and every
+// earlier caller of the same class has been served, then takes ownership
+// of the bus. The time spent waiting is recorded against the class.
+VOID Tfa9890BusScheduler::Acquire(
+    _In_ TFA9890_CMD_CLASS Class)   // Priority class of the caller
+{
+    LONGLONG Start = QpcNow();
+
+    AcquireSRWLockExclusive(&m_Lock);
+
+    ULONG Ticket = m_NextTicket[Class]++;
+    m_Waiting[Class]++;
+    while (m_Busy || IsMoreUrgentWaiting(Class) || Ticket != m_Serving[Class])
+    {
+        SleepConditionVariableSRW(&m_Released, &m_Lock, INFINITE, 0);
+    }
+    m_Waiting[Class]--;
+    m_Serving[Class]++;
+    m_Busy = true;
+
+    ULONG DelayUs = QpcToUs(QpcNow() - Start);
+    m_Stats[Class].Grants++;
+    m_Stats[Class].TotalDelayUs += DelayUs;
+    if (DelayUs > m_Stats[Class].MaxDelayUs)
+    {
+        m_Stats[Class].MaxDelayUs = DelayUs;
+    }
+
+    ReleaseSRWLockExclusive(&m_Lock);
+}
+
+// Gives up ownership of the bus and wakes all waiters so the first one of
+// the most urgent class can claim it.
+VOID Tfa9890BusScheduler::Release()
+{
+    AcquireSRWLockExclusive(&m_Lock);
+    m_Busy = false;
+    ReleaseSRWLockExclusive(&m_Lock);
+
+    WakeAllConditionVariable(&m_Released);
+}
+
+// Called by the bus owner between chunks of a long transfer. Returns true
+// if the owner should release the bus so a more urgent class can run.
+bool Tfa9890BusScheduler::ShouldYield(
+    _In_ TFA9890_CMD_CLASS Class)   // Priority class of the bus owner
+{
+    AcquireSRWLockShared(&m_Lock);
+    bool Yield = IsMoreUrgentWaiting(Class);
+    ReleaseSRWLockShared(&m_Lock);
+
+    return Yield;
+}
+
+VOID Tfa9890BusScheduler::CountPreemption(
+    _In_ TFA9890_CMD_CLASS Class)   // Priority class that yielded the bus
+{
+    AcquireSRWLockExclusive(&m_Lock);
+    m_Stats[Class].Preemptions++;
+    ReleaseSRWLockExclusive(&m_Lock);
+}
+
+// Copy the statistics of one class. The bus owner and waiters update them
+// concurrently, so they are read under m_Lock.
+VOID Tfa9890BusScheduler::GetStats(
+    _In_ TFA9890_CMD_CLASS Class,       // Priority class to report
+    _Out_ PTFA9890_QUEUE_STATS pStats)  // Receives the class's statistics
+{
+    AcquireSRWLockShared(&m_Lock);
+    *pStats = m_Stats[Class];
+    ReleaseSRWLockShared(&m_Lock);
+}
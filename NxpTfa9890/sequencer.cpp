@@ -0,0 +1,738 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the asynchronous power sequencer. D0 entry only
+//    starts the power-up; every amp then runs its init sequence as a state
+//    machine whose steps are I2C writes completed by the I/O target or WDF
+//    timer waits, for settle steps, retry backoff and power slots. No
+//    thread blocks while the hardware settles, and the steps of different
+//    amps interleave on their own connections. Once every amp is done or
+//    has failed twice, a work item runs FinishPowerUp to bring the rest of
+//    the device up, as that waits for the bus lock and for bus traffic.
+//
+//    A power-up from the hibernate images runs the same state machine over
+//    each amp's image instead of the init sequence: its configuration
+//    bursts go out as asynchronous writes of at most one bulk chunk, and
+//    its settle and power steps wait on the same timers and inrush limits.
+//
+//    The watchdog restores amps that were reset the same way, over an
+//    image of each amp's shadow and only on those amps, so a restore's
+//    settle waits and retries hold no lock either; FinishRestore then
+//    verifies them and reloads their DSP. Power gating and stream hints
+//    gate or power the output stages as one-step runs that write system
+//    control, completed by FinishPowerStage. One run goes at a time.
+//
+//    Each state's duration is traced per amp and summed over the power-up.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Sequencer.tmh"
+
+
+C_ASSERT(TFA9890_BULK_CHUNK_BYTES <= TFA9890_TUNE_MAX_BYTES);
+
+// One step of an amp's power-up: a settle wait, or a write of Count
+// registers from Register on
+typedef struct _SEQUENCE_STEP
+{
+    BYTE        Register;
+    BYTE        Flags;          // TFA9890_STEP_*
+    ULONG       Count;          // Registers written, 0 for a settle step
+    const WORD* pWords;         // Values in bus byte order
+    ULONG       SettleMs;
+} SEQUENCE_STEP, *PSEQUENCE_STEP;
+
+// Number of steps the amp runs: the one write of a power-stage run, its
+// hibernate image's bursts, or the init sequence's steps
+inline ULONG SequenceStepCount(
+    _In_ const TFA9890_INIT_PROFILE* pProfile,
+    _In_ const TFA9890_AMP* pAmp,
+    _In_ TFA9890_SEQ_RUN Run,
+    _In_ bool FromImage)
+{
+    if (Tfa9890RunPowerStage == Run)
+    {
+        return 1;
+    }
+    return FromImage ? pAmp->Hibernate.BurstCount : pProfile->StepCount;
+}
+
+// The amp's step number Step
+inline VOID GetSequenceStep(
+    _In_ const TFA9890_INIT_PROFILE* pProfile,
+    _In_ const TFA9890_AMP* pAmp,
+    _In_ TFA9890_SEQ_RUN Run,
+    _In_ bool FromImage,
+    _In_ ULONG Step,
+    _Out_ PSEQUENCE_STEP pStep)
+{
+    if (Tfa9890RunPowerStage == Run)
+    {
+        // Not a power step: the output stage has no inrush slot to wait for
+        pStep->Register = TFA9890_SYSTEM_CONTROL;
+        pStep->Flags = 0;
+        pStep->Count = 1;
+        pStep->pWords = &pAmp->SeqPowerStage;
+        pStep->SettleMs = 0;
+    }
+    else if (FromImage)
+    {
+        const TFA9890_HIBERNATE_BURST* pBurst = &pAmp->Hibernate.Bursts[Step];
+        bool Settle = (0 != (pBurst->Flags & TFA9890_STEP_SETTLE));
+
+        pStep->Register = pBurst->Register;
+        pStep->Flags = pBurst->Flags;
+        pStep->Count = pBurst->Count;
+        pStep->pWords = Settle ? nullptr : &pAmp->Hibernate.Words[pBurst->Word];
+        pStep->SettleMs = Settle ? pBurst->Word : 0;
+    }
+    else
+    {
+        const REGISTER_SETTING* pSetting = &pProfile->Steps[Step];
+        bool Settle = (0 != (pSetting->Flags & TFA9890_STEP_SETTLE));
+
+        pStep->Register = pSetting->Register;
+        pStep->Flags = pSetting->Flags;
+        pStep->Count = Settle ? 0 : 1;
+        pStep->pWords = Settle ? nullptr : &pSetting->Value;
+        pStep->SettleMs = Settle ? pSetting->Value : 0;
+    }
+}
+
+// Create the request, its buffer and the timer of every amp's state
+// machine, and the work item that completes a run. Needs the amps' I/O
+// targets.
+NTSTATUS NxpTfa9890Device::CreateSequencer()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    InitializeSRWLock(&m_SequenceLock);
+    InitializeConditionVariable(&m_SequenceIdle);
+    m_SequenceRunning = false;
+
+    WDF_OBJECT_ATTRIBUTES WorkItemAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&WorkItemAttributes);
+    WorkItemAttributes.ParentObject = m_SensorInstance;
+
+    WDF_WORKITEM_CONFIG WorkItemConfig;
+    WDF_WORKITEM_CONFIG_INIT(&WorkItemConfig, NxpTfa9890Device::OnSequenceWorkItem);
+    WorkItemConfig.AutomaticSerialization = FALSE;
+
+    Status = WdfWorkItemCreate(&WorkItemConfig, &WorkItemAttributes, &m_SequenceWorkItem);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfWorkItemCreate failed %!STATUS!", Status);
+    }
+
+    for (ULONG Amp = 0; NT_SUCCESS(Status) && Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        WDF_OBJECT_ATTRIBUTES Attributes;
+        WDF_OBJECT_ATTRIBUTES_INIT(&Attributes);
+        Attributes.ParentObject = m_SensorInstance;
+
+        Status = WdfRequestCreate(&Attributes, pAmp->IoTarget, &pAmp->SeqRequest);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfRequestCreate failed %!STATUS!", Status);
+            break;
+        }
+
+        Status = WdfMemoryCreatePreallocated(&Attributes, pAmp->SeqBuffer, sizeof(pAmp->SeqBuffer), &pAmp->SeqMemory);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfMemoryCreatePreallocated failed %!STATUS!", Status);
+            break;
+        }
+
+        WDF_TIMER_CONFIG TimerConfig;
+        WDF_TIMER_CONFIG_INIT(&TimerConfig, NxpTfa9890Device::OnSequenceTimer);
+        TimerConfig.AutomaticSerialization = FALSE;
+
+        Status = WdfTimerCreate(&TimerConfig, &Attributes, &pAmp->SeqTimer);
+        if (!NT_SUCCESS(Status))
+        {
+            TraceError("ACC %!FUNC! WdfTimerCreate failed %!STATUS!", Status);
+        }
+    }
+
+    return Status;
+}
+
+// Start a run on the amps in AmpMask from their first step, running the
+// amps' hibernate images if FromImages, else the init sequence. Returns
+// false if another run is in progress.
+bool NxpTfa9890Device::StartSequence(
+    _In_ TFA9890_SEQ_RUN Run,   // What completes the run
+    _In_ bool FromImages,       // Every amp in AmpMask has a valid hibernate image
+    _In_ ULONG AmpMask)         // Bit n selects amplifier n
+{
+    AcquireSRWLockExclusive(&m_SequenceLock);
+
+    // Once D0 exit has stopped the sequencer only D0 entry starts it again
+    if (m_SequenceRunning || (Tfa9890RunPowerUp != Run && m_SequenceAbort))
+    {
+        ReleaseSRWLockExclusive(&m_SequenceLock);
+        return false;
+    }
+
+    m_SequenceRunning = true;
+    m_SequenceAbort = false;
+    m_SequenceRun = Run;
+    ResetSequence(FromImages, AmpMask);
+
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (0 != (AmpMask & (1UL << Amp)))
+        {
+            SequenceStep(&m_Amps[Amp]);
+        }
+    }
+
+    return true;
+}
+
+// Put the amps in AmpMask back at their first step. A power-up takes its
+// amps offline until they are written; the watchdog does that for a
+// restore, under m_I2CWaitLock. Called with m_SequenceLock held and no
+// step in flight.
+VOID NxpTfa9890Device::ResetSequence(
+    _In_ bool FromImages,       // Run the hibernate images
+    _In_ ULONG AmpMask)         // Bit n selects amplifier n
+{
+    if (Tfa9890RunPowerUp == m_SequenceRun)
+    {
+        m_PowerUpRestored = FromImages;
+    }
+    m_SequenceFromImages = FromImages;
+    m_SequenceAmpMask = AmpMask;
+    m_SequencePass = 0;
+    m_SequencePending = 0;
+    m_SequenceStart = QpcNow();
+    m_SequenceDeadline = m_SequenceStart + QpcFromMs(TFA9890_RECOVERY_LATENCY_CAP_MS);
+    m_SequenceLastEnable = 0;
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        if (0 == (AmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        if (Tfa9890RunPowerUp == m_SequenceRun)
+        {
+            pAmp->Online = false;
+        }
+        m_SequencePending++;
+        pAmp->Failed = false;
+        pAmp->NextStep = 0;
+        pAmp->EnableStart = 0;
+        pAmp->SeqAttempt = 0;
+        pAmp->SeqOffset = 0;
+        pAmp->SeqState = Tfa9890SeqIdle;
+        pAmp->SeqStateStart = m_SequenceStart;
+        RtlZeroMemory(pAmp->SeqStateUs, sizeof(pAmp->SeqStateUs));
+    }
+}
+
+// Mark the run over once its completion is done, and wake D0 exit if it
+// waits for it
+VOID NxpTfa9890Device::EndSequence()
+{
+    AcquireSRWLockExclusive(&m_SequenceLock);
+    m_SequenceRunning = false;
+    WakeAllConditionVariable(&m_SequenceIdle);
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+}
+
+// Stop a run in progress while leaving D0, and wait until no step is in
+// flight. A run already completing is waited for. No restore starts after
+// this until the next power-up.
+VOID NxpTfa9890Device::CancelSequence()
+{
+    AcquireSRWLockExclusive(&m_SequenceLock);
+    bool Running = m_SequenceRunning;
+    m_SequenceAbort = true;
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+
+    if (!Running)
+    {
+        return;
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        // A wait stopped before it expired ends the amp's sequence here;
+        // one that fired sees the abort itself
+        if (NULL != pAmp->SeqTimer && WdfTimerStop(pAmp->SeqTimer, TRUE))
+        {
+            AcquireSRWLockExclusive(&m_SequenceLock);
+            SequenceEnter(pAmp, Tfa9890SeqFailed);
+            SequenceSettled();
+            ReleaseSRWLockExclusive(&m_SequenceLock);
+        }
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        AcquireSRWLockShared(&m_SequenceLock);
+        bool InFlight = (Tfa9890SeqWrite == pAmp->SeqState);
+        ReleaseSRWLockShared(&m_SequenceLock);
+
+        if (InFlight)
+        {
+            WdfRequestCancelSentRequest(pAmp->SeqRequest);
+        }
+    }
+
+    AcquireSRWLockExclusive(&m_SequenceLock);
+    while (m_SequenceRunning)
+    {
+        SleepConditionVariableSRW(&m_SequenceIdle, &m_SequenceLock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+}
+
+// Run the amp's next step after a wait expired or a write completed
+VOID NxpTfa9890Device::SequenceStep(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier to advance
+{
+    AcquireSRWLockExclusive(&m_SequenceLock);
+
+    if (Tfa9890SeqSettle == pAmp->SeqState)
+    {
+        pAmp->NextStep++;
+    }
+
+    bool Send = SequenceAdvance(pAmp);
+    bool Finished = SequenceSettled();
+
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+
+    if (Send)
+    {
+        SequenceSend(pAmp);
+    }
+    else if (Finished)
+    {
+        WdfWorkItemEnqueue(m_SequenceWorkItem);
+    }
+}
+
+// Move the amp on to its next step: start the settle or slot wait it
+// needs, or return true to have the step written. Power steps start at
+// most m_PowerUpMaxConcurrent amps inside their inrush window, at least
+// m_PowerUpStaggerMs apart; configuration steps of other amps go on
+// meanwhile. Called with m_SequenceLock held.
+bool NxpTfa9890Device::SequenceAdvance(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier to advance
+{
+    LONGLONG Now = QpcNow();
+
+    if (m_SequenceAbort)
+    {
+        SequenceEnter(pAmp, Tfa9890SeqFailed);
+        return false;
+    }
+
+    if (pAmp->NextStep == SequenceStepCount(m_pInitProfile, pAmp, m_SequenceRun, m_SequenceFromImages))
+    {
+        // The amps of other runs are brought back online by their completion
+        if (Tfa9890RunPowerUp == m_SequenceRun)
+        {
+            pAmp->Online = true;
+        }
+        SequenceEnter(pAmp, Tfa9890SeqDone);
+        return false;
+    }
+
+    SEQUENCE_STEP Step;
+    GetSequenceStep(m_pInitProfile, pAmp, m_SequenceRun, m_SequenceFromImages, pAmp->NextStep, &Step);
+
+    if (0 != (Step.Flags & TFA9890_STEP_SETTLE))
+    {
+        SequenceEnter(pAmp, Tfa9890SeqSettle);
+        WdfTimerStart(pAmp->SeqTimer, WDF_REL_TIMEOUT_IN_MS(Step.SettleMs));
+        return false;
+    }
+
+    if (0 != (Step.Flags & TFA9890_STEP_POWER) && 0 == pAmp->EnableStart)
+    {
+        LONGLONG InrushWindow = QpcFromMs(TFA9890_POWER_INRUSH_WINDOW_MS);
+        LONGLONG Wait = 0;
+        ULONG Enabling = 0;
+        LONGLONG FirstFree = MAXLONGLONG;
+
+        for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+        {
+            PTFA9890_AMP pOther = &m_Amps[Amp];
+            // An amp draws inrush current for the whole window once enabled,
+            // whether its sequence has since finished or failed
+            if (0 != pOther->EnableStart && Now - pOther->EnableStart < InrushWindow)
+            {
+                Enabling++;
+                FirstFree = min(FirstFree, pOther->EnableStart + InrushWindow);
+            }
+        }
+
+        if (Enabling >= m_PowerUpMaxConcurrent)
+        {
+            Wait = FirstFree - Now;
+        }
+        if (0 != m_SequenceLastEnable)
+        {
+            Wait = max(Wait, m_SequenceLastEnable + QpcFromMs(m_PowerUpStaggerMs) - Now);
+        }
+
+        if (Wait > 0)
+        {
+            SequenceEnter(pAmp, Tfa9890SeqSlot);
+            WdfTimerStart(pAmp->SeqTimer, WDF_REL_TIMEOUT_IN_MS(QpcToUs(Wait) / 1000 + 1));
+            return false;
+        }
+
+        pAmp->EnableStart = Now;
+        m_SequenceLastEnable = Now;
+    }
+
+    SequenceEnter(pAmp, Tfa9890SeqWrite);
+    return true;
+}
+
+// Send the amp's next step, or the next bulk chunk of a longer burst, as
+// one asynchronous write. The request is reused for every step of the amp.
+VOID NxpTfa9890Device::SequenceSend(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier in Tfa9890SeqWrite
+{
+    SEQUENCE_STEP Step;
+    WDF_REQUEST_REUSE_PARAMS ReuseParams;
+    WDFMEMORY_OFFSET Offset;
+
+    GetSequenceStep(m_pInitProfile, pAmp, m_SequenceRun, m_SequenceFromImages, pAmp->NextStep, &Step);
+
+    ULONG ChunkWords = max(static_cast<ULONG>(min(BulkChunkBytes(pAmp), sizeof(pAmp->SeqBuffer) - 1) / sizeof(WORD)), 1UL);
+    ULONG Words = min(Step.Count - pAmp->SeqOffset, ChunkWords);
+
+    pAmp->SeqBuffer[0] = static_cast<BYTE>(Step.Register + pAmp->SeqOffset);
+    RtlCopyMemory(&pAmp->SeqBuffer[1], Step.pWords + pAmp->SeqOffset, Words * sizeof(WORD));
+    pAmp->SeqLength = 1 + Words * sizeof(WORD);
+
+    Offset.BufferOffset = 0;
+    Offset.BufferLength = pAmp->SeqLength;
+
+    WDF_REQUEST_REUSE_PARAMS_INIT(&ReuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+    NTSTATUS Status = WdfRequestReuse(pAmp->SeqRequest, &ReuseParams);
+    if (NT_SUCCESS(Status))
+    {
+        Status = WdfIoTargetFormatRequestForWrite(pAmp->IoTarget, pAmp->SeqRequest, pAmp->SeqMemory, &Offset, NULL);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        WdfRequestSetCompletionRoutine(pAmp->SeqRequest, NxpTfa9890Device::OnSequenceWriteComplete, this);
+
+        // A restore runs in the background, like the watchdog that starts it
+        pAmp->Recovery.Transactions++;
+        if (Tfa9890RunRestore != m_SequenceRun)
+        {
+            PerfCountTransaction();
+        }
+        pAmp->SeqSendStart = QpcNow();
+        if (WdfRequestSend(pAmp->SeqRequest, pAmp->IoTarget, WDF_NO_SEND_OPTIONS))
+        {
+            return;
+        }
+        Status = WdfRequestGetStatus(pAmp->SeqRequest);
+    }
+
+    // Not sent; handled like a failed transaction
+    TraceError("ACC %!FUNC! Step %u could not be sent %!STATUS!", pAmp->NextStep, Status);
+    SequenceWriteDone(pAmp, Status);
+}
+
+// Account a completed step write and move on: to the next chunk or step,
+// to a backoff before the write is re-issued, or to Failed once the
+// retries or the latency cap are used up.
+VOID NxpTfa9890Device::SequenceWriteDone(
+    _In_ PTFA9890_AMP pAmp,     // Amplifier whose write completed
+    _In_ NTSTATUS Status)       // Completion status of the write
+{
+    ULONG Amp = static_cast<ULONG>(pAmp - m_Amps);
+    BYTE Register = pAmp->SeqBuffer[0];
+    ULONG Length = pAmp->SeqLength - 1;
+    bool Send = false;
+
+    AccountTransaction(pAmp, Status);
+    RecordTransaction(Amp, 0, Register, &pAmp->SeqBuffer[1], Length, pAmp->SeqSendStart, QpcNow(), Status);
+
+    AcquireSRWLockExclusive(&m_SequenceLock);
+
+    pAmp->LastStatus = Status;
+
+    if (NT_SUCCESS(Status))
+    {
+        SEQUENCE_STEP Step;
+        GetSequenceStep(m_pInitProfile, pAmp, m_SequenceRun, m_SequenceFromImages, pAmp->NextStep, &Step);
+
+        UpdateShadow(pAmp, Register, &pAmp->SeqBuffer[1], Length);
+        if (pAmp->SeqAttempt > 0)
+        {
+            pAmp->Recovery.Recovered++;
+        }
+        pAmp->SeqAttempt = 0;
+        pAmp->SeqOffset += Length / sizeof(WORD);
+        if (pAmp->SeqOffset >= Step.Count)
+        {
+            pAmp->SeqOffset = 0;
+            pAmp->NextStep++;
+        }
+        Send = SequenceAdvance(pAmp);
+    }
+    else
+    {
+        ULONG BackoffMs = TFA9890_I2C_RETRY_BACKOFF_MS << pAmp->SeqAttempt;
+
+        TraceWarning("ACC %!FUNC! Amp %u step %u to 0x%02x failed, attempt %u %!STATUS!",
+                     Amp, pAmp->NextStep, Register, pAmp->SeqAttempt, Status);
+        DLog("PA: Amp %u step %u failed, attempt %u %d\n", Amp, pAmp->NextStep, pAmp->SeqAttempt, Status);//DebugLog
+
+        if (m_SequenceAbort)
+        {
+            SequenceEnter(pAmp, Tfa9890SeqFailed);
+        }
+        else if (pAmp->SeqAttempt >= TFA9890_I2C_RETRY_COUNT)
+        {
+            pAmp->Recovery.Failures++;
+            SequenceEnter(pAmp, Tfa9890SeqFailed);
+        }
+        else if (QpcNow() + QpcFromMs(BackoffMs) >= m_SequenceDeadline)
+        {
+            pAmp->Recovery.DeadlineHits++;
+            pAmp->Recovery.Failures++;
+            SequenceEnter(pAmp, Tfa9890SeqFailed);
+        }
+        else
+        {
+            pAmp->Recovery.Retries++;
+            pAmp->SeqAttempt++;
+            SequenceEnter(pAmp, Tfa9890SeqBackoff);
+            WdfTimerStart(pAmp->SeqTimer, WDF_REL_TIMEOUT_IN_MS(BackoffMs));
+        }
+    }
+
+    bool Finished = SequenceSettled();
+
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+
+    if (Send)
+    {
+        SequenceSend(pAmp);
+    }
+    else if (Finished)
+    {
+        WdfWorkItemEnqueue(m_SequenceWorkItem);
+    }
+}
+
+// Leave the amp's current state, tracing how long it lasted. Entering Done
+// or Failed ends the amp's part of the pass. Called with m_SequenceLock held.
+VOID NxpTfa9890Device::SequenceEnter(
+    _In_ PTFA9890_AMP pAmp,             // Amplifier changing state
+    _In_ TFA9890_SEQ_STATE State)       // New state
+{
+    LONGLONG Now = QpcNow();
+    ULONG Us = QpcToUs(Now - pAmp->SeqStateStart);
+
+    TraceVerbose("ACC %!FUNC! Amp %u step %u: state %u took %u us, entering %u",
+                 static_cast<ULONG>(pAmp - m_Amps), pAmp->NextStep, pAmp->SeqState, Us, State);
+
+    pAmp->SeqStateUs[pAmp->SeqState] += Us;
+    pAmp->SeqState = State;
+    pAmp->SeqStateStart = Now;
+
+    if (Tfa9890SeqFailed == State)
+    {
+        pAmp->Failed = true;
+    }
+    if (Tfa9890SeqDone == State || Tfa9890SeqFailed == State)
+    {
+        m_SequencePending--;
+    }
+}
+
+// Check whether the pass is over. Amps that failed in the first pass are
+// resumed from their failed step, after waiting for a power slot again.
+// Returns true once the run is complete and its completion is due; an
+// aborted run is marked stopped instead. Called with m_SequenceLock
+// held.
+bool NxpTfa9890Device::SequenceSettled()
+{
+    if (0 != m_SequencePending || !m_SequenceRunning)
+    {
+        return false;
+    }
+
+    if (m_SequenceAbort)
+    {
+        m_SequenceRunning = false;
+        WakeAllConditionVariable(&m_SequenceIdle);
+        return false;
+    }
+
+    if (0 == m_SequencePass)
+    {
+        m_SequencePass++;
+
+        for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+        {
+            PTFA9890_AMP pAmp = &m_Amps[Amp];
+            if (0 == (m_SequenceAmpMask & (1UL << Amp)) || !pAmp->Failed)
+            {
+                continue;
+            }
+
+            pAmp->Recovery.Resumes++;
+            pAmp->Failed = false;
+            pAmp->EnableStart = 0;
+            pAmp->SeqAttempt = 0;
+            m_SequencePending++;
+            SequenceEnter(pAmp, Tfa9890SeqSlot);
+            WdfTimerStart(pAmp->SeqTimer, WDF_REL_TIMEOUT_IN_MS(1));
+        }
+
+        if (0 != m_SequencePending)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Once a power-up from the hibernate images has settled, check that it
+// brought every amp up. If it did not, every amp is run through the init
+// sequence instead, as the cold path would have on D0 entry; an aborted
+// power-up just stops. Returns true if the power-up is not finished.
+bool NxpTfa9890Device::SequenceFallBack()
+{
+    ULONG Down = m_AmpCount;
+
+    AcquireSRWLockExclusive(&m_SequenceLock);
+
+    for (ULONG Amp = 0; m_PowerUpRestored && Amp < m_AmpCount; Amp++)
+    {
+        if (!m_Amps[Amp].Online)
+        {
+            Down = Amp;
+            break;
+        }
+    }
+
+    if (Down < m_AmpCount)
+    {
+        m_HibernateFallbacks++;
+        TraceError("ACC %!FUNC! Amp %u could not be restored from its hibernate image %!STATUS!", Down, m_Amps[Down].LastStatus);
+        DLog("PA: Amp %u could not be restored from its hibernate image %d\n", Down, m_Amps[Down].LastStatus);//DebugLog
+
+        if (m_SequenceAbort)
+        {
+            m_SequenceRunning = false;
+            WakeAllConditionVariable(&m_SequenceIdle);
+        }
+        else
+        {
+            ResetSequence(false, m_SequenceAmpMask);
+        }
+    }
+
+    bool Restart = (Down < m_AmpCount) && m_SequenceRunning;
+
+    ReleaseSRWLockExclusive(&m_SequenceLock);
+
+    for (ULONG Amp = 0; Restart && Amp < m_AmpCount; Amp++)
+    {
+        SequenceStep(&m_Amps[Amp]);
+    }
+
+    return Down < m_AmpCount;
+}
+
+VOID NxpTfa9890Device::OnSequenceTimer(
+    _In_ WDFTIMER Timer)    // Sequencing timer of one amp, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfTimerGetParentObject(Timer));
+    if (nullptr == pDevice)
+    {
+        return;
+    }
+
+    for (ULONG Amp = 0; Amp < pDevice->m_AmpCount; Amp++)
+    {
+        if (Timer == pDevice->m_Amps[Amp].SeqTimer)
+        {
+            pDevice->SequenceStep(&pDevice->m_Amps[Amp]);
+            break;
+        }
+    }
+}
+
+VOID NxpTfa9890Device::OnSequenceWriteComplete(
+    _In_ WDFREQUEST Request,                            // Step write of one amp
+    _In_ WDFIOTARGET /*Target*/,                        // The amp's I/O target
+    _In_ PWDF_REQUEST_COMPLETION_PARAMS pParams,        // Completion status of the write
+    _In_ WDFCONTEXT Context)                            // Device that sent the write
+{
+    PNxpTfa9890Device pDevice = static_cast<PNxpTfa9890Device>(Context);
+
+    for (ULONG Amp = 0; Amp < pDevice->m_AmpCount; Amp++)
+    {
+        if (Request == pDevice->m_Amps[Amp].SeqRequest)
+        {
+            pDevice->SequenceWriteDone(&pDevice->m_Amps[Amp], pParams->IoStatus.Status);
+            break;
+        }
+    }
+}
+
+VOID NxpTfa9890Device::OnSequenceWorkItem(
+    _In_ WDFWORKITEM WorkItem)  // Sequence work item, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfWorkItemGetParentObject(WorkItem));
+    if (nullptr == pDevice)
+    {
+        return;
+    }
+
+    // The run does not change until it has been completed
+    switch (pDevice->m_SequenceRun)
+    {
+        case Tfa9890RunRestore:
+            pDevice->FinishRestore();
+            break;
+
+        case Tfa9890RunPowerStage:
+            pDevice->FinishPowerStage();
+            break;
+
+        default:
+            if (!pDevice->SequenceFallBack())
+            {
+                pDevice->FinishPowerUp();
+            }
+            break;
+    }
+}
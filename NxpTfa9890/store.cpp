@@ -0,0 +1,209 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module keeps learned amp state in the driver object across PnP
+//    stop/start. The device context goes away with the sensor instance when
+//    the hardware is released; register shadows, EQ banks, calibration,
+//    bus tuning, hibernate images and statistics are saved by ACPI
+//    connection and reattached when the same connection is prepared again.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Driver.h"
+
+#include "Store.tmh"
+
+
+// Registers never revalidated by reading them back. Reads of the DSP
+// memory window have side effects.
+inline bool IsRevalidatable(
+    _In_ ULONG Register)
+{
+    return Register < TFA9890_CF_CONTROLS || Register > TFA9890_CF_STATUS;
+}
+
+// Save every amp's learned state in the driver's store. An amp already in
+// the store updates its entry; a new one takes a free or the oldest entry.
+VOID NxpTfa9890Device::SaveAmpStates()
+{
+    PNXPTFA9890_DRIVER_CONTEXT pContext = GetNxpTfa9890DriverContext(WdfGetDriver());
+
+    // Hardware that never finished preparing has nothing worth keeping
+    if (!m_AmpStatesRestored)
+    {
+        return;
+    }
+    m_AmpStatesRestored = false;
+
+    AcquireSRWLockExclusive(&pContext->StoreLock);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        PTFA9890_AMP_STATE pState = nullptr;
+
+        for (ULONG i = 0; i < TFA9890_STORE_ENTRIES; i++)
+        {
+            PTFA9890_AMP_STATE pEntry = &pContext->Store[i];
+            if (pEntry->ConnectionId == pAmp->ConnectionId.QuadPart)
+            {
+                pState = pEntry;
+                break;
+            }
+            if (nullptr == pState || pEntry->Saved < pState->Saved)
+            {
+                pState = pEntry;
+            }
+        }
+
+        pState->ConnectionId = pAmp->ConnectionId.QuadPart;
+        pState->Saved = ++pContext->StoreSaves;
+        pState->Recovery = pAmp->Recovery;
+        pState->Tuning = pAmp->Tuning;
+        RtlCopyMemory(pState->Shadow, pAmp->Shadow, sizeof(pState->Shadow));
+        RtlCopyMemory(pState->ShadowValid, pAmp->ShadowValid, sizeof(pState->ShadowValid));
+        RtlCopyMemory(pState->EqCoeffs, pAmp->EqCoeffs, sizeof(pState->EqCoeffs));
+        RtlCopyMemory(pState->EqValid, pAmp->EqValid, sizeof(pState->EqValid));
+        pState->ActiveBank = pAmp->ActiveBank;
+        pState->BankPending = pAmp->BankPending;
+        pState->DiagBaselineWindows = pAmp->DiagBaselineWindows;
+        pState->DiagBaselineRe = pAmp->DiagBaselineRe;
+        pState->DiagBaselineResonanceHz = pAmp->DiagBaselineResonanceHz;
+        RtlCopyMemory(&pState->Hibernate, &pAmp->Hibernate, sizeof(pState->Hibernate));
+    }
+
+    ReleaseSRWLockExclusive(&pContext->StoreLock);
+
+    TraceInformation("ACC %!FUNC! Saved the state of %u amps", m_AmpCount);
+}
+
+// Reattach saved state to the amps found by ConfigureIoTarget, then check
+// it against the hardware. Amps seen for the first time start clean.
+VOID NxpTfa9890Device::RestoreAmpStates()
+{
+    PNXPTFA9890_DRIVER_CONTEXT pContext = GetNxpTfa9890DriverContext(WdfGetDriver());
+    ULONG Restored = 0;
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        bool Found = false;
+
+        AcquireSRWLockShared(&pContext->StoreLock);
+
+        for (ULONG i = 0; i < TFA9890_STORE_ENTRIES; i++)
+        {
+            const TFA9890_AMP_STATE* pState = &pContext->Store[i];
+            if (0 != pState->ConnectionId && pState->ConnectionId == pAmp->ConnectionId.QuadPart)
+            {
+                pAmp->Recovery = pState->Recovery;
+                pAmp->Tuning = pState->Tuning;
+                RtlCopyMemory(pAmp->Shadow, pState->Shadow, sizeof(pAmp->Shadow));
+                RtlCopyMemory(pAmp->ShadowValid, pState->ShadowValid, sizeof(pAmp->ShadowValid));
+                RtlCopyMemory(pAmp->EqCoeffs, pState->EqCoeffs, sizeof(pAmp->EqCoeffs));
+                RtlCopyMemory(pAmp->EqValid, pState->EqValid, sizeof(pAmp->EqValid));
+                pAmp->ActiveBank = pState->ActiveBank;
+                pAmp->BankPending = pState->BankPending;
+                pAmp->DiagBaselineWindows = pState->DiagBaselineWindows;
+                pAmp->DiagBaselineRe = pState->DiagBaselineRe;
+                pAmp->DiagBaselineResonanceHz = pState->DiagBaselineResonanceHz;
+                RtlCopyMemory(&pAmp->Hibernate, &pState->Hibernate, sizeof(pAmp->Hibernate));
+                Found = true;
+                break;
+            }
+        }
+
+        ReleaseSRWLockShared(&pContext->StoreLock);
+
+        if (Found)
+        {
+            RevalidateAmpState(pAmp);
+            Restored++;
+        }
+    }
+
+    m_AmpStatesRestored = true;
+
+    TraceInformation("ACC %!FUNC! Reattached the state of %u of %u amps", Restored, m_AmpCount);
+}
+
+// Read back the shadowed registers of a reattached amp. Registers that no
+// longer hold their shadowed value are dropped from the shadow. If any did
+// not survive, the amp was reset and the DSP banks are assumed lost too; if
+// the amp cannot be read at all, only calibration and statistics are kept.
+VOID NxpTfa9890Device::RevalidateAmpState(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier with reattached state
+{
+    WORD Values[TFA9890_REGISTER_COUNT];
+    ULONG Checked = 0;
+    ULONG Changed = 0;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG Register = 0; NT_SUCCESS(Status) && Register < TFA9890_REGISTER_COUNT; )
+    {
+        if (0 == (pAmp->ShadowValid[Register / 32] & (1UL << (Register % 32))))
+        {
+            Register++;
+            continue;
+        }
+
+        if (!IsRevalidatable(Register))
+        {
+            pAmp->ShadowValid[Register / 32] &= ~(1UL << (Register % 32));
+            Register++;
+            continue;
+        }
+
+        // Read each run of shadowed registers in one auto-incrementing burst
+        ULONG End = Register + 1;
+        while (End < TFA9890_REGISTER_COUNT &&
+               IsRevalidatable(End) &&
+               0 != (pAmp->ShadowValid[End / 32] & (1UL << (End % 32))))
+        {
+            End++;
+        }
+
+        Status = ReadBurst(pAmp,
+                           TFA9890_CMD_CLASS_CONFIG,
+                           static_cast<BYTE>(Register),
+                           reinterpret_cast<BYTE*>(&Values[Register]),
+                           (End - Register) * sizeof(WORD),
+                           true,
+                           TFA9890_DUMP_CHUNK_BYTES);
+
+        for (; NT_SUCCESS(Status) && Register < End; Register++)
+        {
+            Checked++;
+            if (Values[Register] != pAmp->Shadow[Register])
+            {
+                pAmp->ShadowValid[Register / 32] &= ~(1UL << (Register % 32));
+                Changed++;
+            }
+        }
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    if (!NT_SUCCESS(Status) || 0 != Changed)
+    {
+        RtlZeroMemory(pAmp->EqValid, sizeof(pAmp->EqValid));
+        pAmp->ActiveBank = 0;
+        pAmp->BankPending = false;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        RtlZeroMemory(pAmp->ShadowValid, sizeof(pAmp->ShadowValid));
+        TraceWarning("ACC %!FUNC! Amp 0x%I64x could not be revalidated, shadow dropped %!STATUS!", pAmp->ConnectionId.QuadPart, Status);
+    }
+    else
+    {
+        TraceInformation("ACC %!FUNC! Amp 0x%I64x revalidated, %u of %u shadowed registers changed", pAmp->ConnectionId.QuadPart, Changed, Checked);
+    }
+}
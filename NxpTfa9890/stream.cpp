@@ -0,0 +1,408 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the speaker model poller and the stream built on
+//    it. A periodic timer reads the DSP's model sequence word and then only
+//    the history slots of the frames produced since the last poll, and
+//    hands the new excursion and impedance frames to the diagnostics stage
+//    and to a ring in a section shared with one user-mode consumer.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Stream.tmh"
+
+
+C_ASSERT(0 == (TFA9890_STREAM_CAPACITY & (TFA9890_STREAM_CAPACITY - 1)));
+C_ASSERT(TFA9890_MODEL_FRAMES_PER_POLL <= TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD);
+
+// Create the model poll timer. It is started only while some amp is
+// streamed or diagnosed.
+NTSTATUS NxpTfa9890Device::CreateModelTimer()
+{
+    WDF_TIMER_CONFIG TimerConfig;
+    WDF_TIMER_CONFIG_INIT_PERIODIC(&TimerConfig, NxpTfa9890Device::OnModelTimer, TFA9890_STREAM_PERIOD_MS);
+    TimerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES TimerAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+    TimerAttributes.ParentObject = m_SensorInstance;
+
+    NTSTATUS Status = WdfTimerCreate(&TimerConfig, &TimerAttributes, &m_ModelTimer);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfTimerCreate failed %!STATUS!", Status);
+    }
+
+    return Status;
+}
+
+// Amps whose model history is polled
+ULONG NxpTfa9890Device::ModelAmpMask()
+{
+    ULONG AllMask = m_DiagnosticsEnabled ? ((1UL << m_AmpCount) - 1) : 0;
+    ULONG AggregateMask = (0 != m_AggregateWindow) ? StartedAmpMask() : 0;
+    return m_StreamAmpMask | AllMask | AggregateMask;
+}
+
+// Stop polling without forgetting the selection, e.g. while leaving D0.
+// Waits for a poll in progress to finish.
+VOID NxpTfa9890Device::SuspendModelPolling()
+{
+    if (NULL != m_ModelTimer)
+    {
+        WdfTimerStop(m_ModelTimer, TRUE);
+    }
+}
+
+// Restart polling if any amp is streamed, diagnosed or aggregated and the
+// amps are not gated. The first poll of each amp only records the DSP's current frame,
+// since frames produced while polling was suspended can no longer be
+// recovered from the history.
+VOID NxpTfa9890Device::ResumeModelPolling()
+{
+    if (NULL == m_ModelTimer || 0 == ModelAmpMask() || Tfa9890PowerGated == m_AmpPower)
+    {
+        return;
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        m_Amps[Amp].ModelPrimed = false;
+    }
+
+    WdfTimerStart(m_ModelTimer, WDF_REL_TIMEOUT_IN_MS(TFA9890_STREAM_PERIOD_MS));
+}
+
+// Create the shared section
+NTSTATUS NxpTfa9890Device::CreateStream()
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    m_StreamSection = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(TFA9890_STREAM_VIEW_BYTES), NULL);
+    if (NULL == m_StreamSection)
+    {
+        Status = NTSTATUS_FROM_WIN32(GetLastError());
+        TraceError("ACC %!FUNC! CreateFileMapping failed %!STATUS!", Status);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        m_pStream = static_cast<PTFA9890_STREAM_HEADER>(MapViewOfFile(m_StreamSection, FILE_MAP_WRITE, 0, 0, TFA9890_STREAM_VIEW_BYTES));
+        if (nullptr == m_pStream)
+        {
+            Status = NTSTATUS_FROM_WIN32(GetLastError());
+            TraceError("ACC %!FUNC! MapViewOfFile failed %!STATUS!", Status);
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        LARGE_INTEGER Frequency;
+        QueryPerformanceFrequency(&Frequency);
+
+        // The section is zero-filled, so the indices and counters start at 0
+        m_pStream->Version = TFA9890_STREAM_VERSION;
+        m_pStream->HeaderBytes = sizeof(TFA9890_STREAM_HEADER);
+        m_pStream->SampleBytes = sizeof(TFA9890_STREAM_SAMPLE);
+        m_pStream->Capacity = TFA9890_STREAM_CAPACITY;
+        m_pStream->QpcFrequency = Frequency.QuadPart;
+
+        m_pStreamSamples = reinterpret_cast<PTFA9890_STREAM_SAMPLE>(m_pStream + 1);
+        m_StreamWriteIndex = 0;
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DLog("PA: Stream creation failed %d\n", Status);//DebugLog
+        DestroyStream();
+    }
+
+    return Status;
+}
+
+VOID NxpTfa9890Device::DestroyStream()
+{
+    SuspendModelPolling();
+    m_StreamAmpMask = 0;
+
+    if (nullptr != m_pStream)
+    {
+        UnmapViewOfFile(m_pStream);
+        m_pStream = nullptr;
+        m_pStreamSamples = nullptr;
+    }
+
+    // Views mapped by the consumer keep the section alive until it closes them
+    if (NULL != m_StreamSection)
+    {
+        CloseHandle(m_StreamSection);
+        m_StreamSection = NULL;
+    }
+}
+
+// Start (or retarget) streaming of the amplifiers in AmpMask
+NTSTATUS NxpTfa9890Device::StartStream(
+    _In_ ULONG AmpMask)     // Bit n selects amplifier n
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (nullptr == m_pStream)
+    {
+        Status = CreateStream();
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        SuspendModelPolling();
+        m_StreamAmpMask = AmpMask;
+        ResumeModelPolling();
+    }
+
+    return Status;
+}
+
+VOID NxpTfa9890Device::StopStream()
+{
+    SuspendModelPolling();
+    m_StreamAmpMask = 0;
+    ResumeModelPolling();
+}
+
+// Append one frame to the shared ring. It becomes visible to the consumer
+// when PublishStream advances the shared WriteIndex.
+inline VOID AppendStreamSample(
+    _Inout_ PTFA9890_STREAM_SAMPLE pSamples,
+    _Inout_ LONGLONG* pWriteIndex,
+    _In_ LONGLONG Timestamp,
+    _In_ ULONG Frame,
+    _In_ ULONG Amp,
+    _In_ LONG Excursion,
+    _In_ LONG Impedance)
+{
+    PTFA9890_STREAM_SAMPLE pSample = &pSamples[*pWriteIndex & (TFA9890_STREAM_CAPACITY - 1)];
+
+    pSample->Timestamp = Timestamp;
+    pSample->Sequence = Frame;
+    pSample->Amp = static_cast<USHORT>(Amp);
+    pSample->Reserved = 0;
+    pSample->Excursion = Excursion;
+    pSample->Impedance = Impedance;
+    (*pWriteIndex)++;
+}
+
+// Fetch the frames every polled amplifier produced since the previous
+// poll and pass them on to the stream, the diagnostics windows and the
+// aggregation window. The sequence word is read first and then only the
+// slots of the new frames, with the bus lock taken per amp so other
+// traffic gets in between amps.
+VOID NxpTfa9890Device::PollModel()
+{
+    LONGLONG WriteIndex = m_StreamWriteIndex;
+    ULONG Mask = ModelAmpMask();
+    ULONG StreamMask = (nullptr != m_pStream) ? m_StreamAmpMask : 0;
+    ULONG PolledCount = 0;
+    ULONG FailedCount = 0;
+    ULONG LostCount = 0;
+    ULONG AnalyzeMask = 0;
+    ULONG AggregateMask = (0 != m_AggregateWindow) ? StartedAmpMask() : 0;
+    ULONG AggregateCount[TFA9890_MAX_AMPS] = {};
+    float AggregateExcursion[TFA9890_MAX_AMPS][TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD];
+    float AggregateImpedance[TFA9890_MAX_AMPS][TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD];
+    const ULONG FrameBytes = TFA9890_MODEL_WORDS_PER_SAMPLE * TFA9890_DSP_WORD_BYTES;
+
+    if (!m_PoweredOn)
+    {
+        return;
+    }
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        BYTE SequenceWord[TFA9890_DSP_WORD_BYTES];
+        BYTE Buffer[TFA9890_MODEL_HISTORY_LENGTH * FrameBytes];
+        LONGLONG Timeout = 0;
+
+        if (0 == (Mask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        // DSP uploads hold the lock for their whole duration. Skip the amp
+        // rather than stall behind one; the DSP history covers the gap.
+        if (STATUS_SUCCESS != WdfWaitLockAcquire(m_I2CWaitLock, &Timeout))
+        {
+            FailedCount++;
+            continue;
+        }
+
+        if (!pAmp->Online)
+        {
+            WdfWaitLockRelease(m_I2CWaitLock);
+            continue;
+        }
+
+        // Not counted against the flows timed for IOCTL_TFA9890_GET_PERF
+        m_BusBackground = true;
+        PolledCount++;
+
+        NTSTATUS Status = ReadDspMemory(pAmp, TFA9890_CMD_CLASS_TELEMETRY, TFA9890_DMEM_XMEM, TFA9890_XMEM_MODEL_SEQUENCE,
+                                        SequenceWord, sizeof(SequenceWord), BulkChunkBytes(pAmp));
+        if (!NT_SUCCESS(Status))
+        {
+            m_BusBackground = false;
+            WdfWaitLockRelease(m_I2CWaitLock);
+            FailedCount++;
+            continue;
+        }
+
+        LONGLONG Timestamp = QpcNow();
+        ULONG Sequence = static_cast<ULONG>(DspWordToLong(SequenceWord)) & TFA9890_MODEL_SEQUENCE_MASK;
+        ULONG NewFrames = pAmp->ModelPrimed ? ((Sequence - pAmp->ModelSequence) & TFA9890_MODEL_SEQUENCE_MASK) : 0;
+
+        if (NewFrames > TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD)
+        {
+            LostCount += NewFrames - (TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD);
+            NewFrames = TFA9890_MODEL_HISTORY_LENGTH - TFA9890_MODEL_HISTORY_GUARD;
+
+            // A gap inside a diagnostics window would show up as a spectral artefact
+            pAmp->DiagCount = 0;
+        }
+        else if (!pAmp->ModelPrimed)
+        {
+            pAmp->DiagCount = 0;
+        }
+
+        // The new frames' slots, oldest first; they wrap at the end of the
+        // history, which takes a second read
+        ULONG FirstSlot = ((Sequence - NewFrames + 1) & TFA9890_MODEL_SEQUENCE_MASK) % TFA9890_MODEL_HISTORY_LENGTH;
+        ULONG Head = min(NewFrames, TFA9890_MODEL_HISTORY_LENGTH - FirstSlot);
+
+        if (Head > 0)
+        {
+            Status = ReadDspMemory(pAmp, TFA9890_CMD_CLASS_TELEMETRY, TFA9890_DMEM_XMEM,
+                                   static_cast<WORD>(TFA9890_XMEM_MODEL_HISTORY + FirstSlot * TFA9890_MODEL_WORDS_PER_SAMPLE),
+                                   Buffer, Head * FrameBytes, BulkChunkBytes(pAmp));
+        }
+        if (NT_SUCCESS(Status) && NewFrames > Head)
+        {
+            Status = ReadDspMemory(pAmp, TFA9890_CMD_CLASS_TELEMETRY, TFA9890_DMEM_XMEM, TFA9890_XMEM_MODEL_HISTORY,
+                                   Buffer + Head * FrameBytes, (NewFrames - Head) * FrameBytes, BulkChunkBytes(pAmp));
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            // The frames are read again on the next poll
+            m_BusBackground = false;
+            WdfWaitLockRelease(m_I2CWaitLock);
+            FailedCount++;
+            continue;
+        }
+
+        // The guard assumes a poll gets the bus when it wants it. Frames
+        // whose slots the DSP may have reached again by the end of the read
+        // can be torn; drop them as lost
+        ULONGLONG Produced = static_cast<ULONGLONG>(QpcToUs(QpcNow() - Timestamp)) * TFA9890_MODEL_FRAME_RATE_HZ / 1000000 + 1;
+        ULONG Torn = 0;
+
+        if (NewFrames + Produced > TFA9890_MODEL_HISTORY_LENGTH)
+        {
+            Torn = static_cast<ULONG>(min(NewFrames + Produced - TFA9890_MODEL_HISTORY_LENGTH, static_cast<ULONGLONG>(NewFrames)));
+            LostCount += Torn;
+            pAmp->DiagCount = 0;
+        }
+
+        // Oldest frame first
+        for (ULONG i = Torn; i < NewFrames; i++)
+        {
+            ULONG Frame = (Sequence - NewFrames + 1 + i) & TFA9890_MODEL_SEQUENCE_MASK;
+            const BYTE* pSlot = Buffer + i * FrameBytes;
+            LONG Excursion = DspWordToLong(pSlot);
+            LONG Impedance = DspWordToLong(pSlot + TFA9890_DSP_WORD_BYTES);
+
+            if (0 != (StreamMask & (1UL << Amp)))
+            {
+                AppendStreamSample(m_pStreamSamples, &WriteIndex, Timestamp, Frame, Amp, Excursion, Impedance);
+            }
+
+            if (m_DiagnosticsEnabled && DiagAppend(pAmp, Excursion, Impedance))
+            {
+                AnalyzeMask |= (1UL << Amp);
+            }
+
+            if (0 != (AggregateMask & (1UL << Amp)))
+            {
+                AggregateExcursion[Amp][AggregateCount[Amp]] = Excursion * DIAG_FIXED_SCALE;
+                AggregateImpedance[Amp][AggregateCount[Amp]] = Impedance * DIAG_FIXED_SCALE;
+                AggregateCount[Amp]++;
+            }
+        }
+
+        pAmp->ModelSequence = Sequence;
+        pAmp->ModelPrimed = true;
+
+        m_BusBackground = false;
+        WdfWaitLockRelease(m_I2CWaitLock);
+    }
+
+    // Windows are analyzed and aggregated off the bus lock
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        if (0 != (AnalyzeMask & (1UL << Amp)))
+        {
+            DiagAnalyze(Amp);
+        }
+
+        if (0 != AggregateCount[Amp])
+        {
+            AggregateModel(Amp, AggregateExcursion[Amp], AggregateImpedance[Amp], AggregateCount[Amp]);
+        }
+    }
+
+    if (0 != StreamMask)
+    {
+        m_pStream->Polls += PolledCount;
+        m_pStream->FailedPolls += FailedCount;
+        m_pStream->DspLost += LostCount;
+        PublishStream(WriteIndex);
+    }
+}
+
+// Make the samples appended up to WriteIndex visible to the consumer
+VOID NxpTfa9890Device::PublishStream(
+    _In_ LONGLONG WriteIndex)   // New end of the produced samples
+{
+    if (WriteIndex == m_StreamWriteIndex)
+    {
+        return;
+    }
+
+    // The consumer owns ReadIndex; a value outside the produced range is
+    // treated as fully caught up
+    LONGLONG ReadIndex = ReadAcquire64(&m_pStream->ReadIndex);
+    if (ReadIndex >= 0 && ReadIndex <= m_StreamWriteIndex)
+    {
+        LONGLONG Lag = WriteIndex - ReadIndex;
+        if (Lag > TFA9890_STREAM_CAPACITY)
+        {
+            m_pStream->Overruns += static_cast<ULONG>(min(Lag - TFA9890_STREAM_CAPACITY, WriteIndex - m_StreamWriteIndex));
+        }
+    }
+
+    // Publish the new samples after their contents are visible
+    WriteRelease64(&m_pStream->WriteIndex, WriteIndex);
+    m_StreamWriteIndex = WriteIndex;
+}
+
+VOID NxpTfa9890Device::OnModelTimer(
+    _In_ WDFTIMER Timer)    // Model poll timer, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfTimerGetParentObject(Timer));
+    if (nullptr != pDevice)
+    {
+        pDevice->PollModel();
+    }
+}
@@ -1,32 +1,280 @@
-//Copyright (C) Microsoft Corporation, All Rights Reserved
-//
-//Abstract:
-//
-//      This module contains the constant definitions for the accelerometer's
-//      register interface and default property values.
-
-#pragma once
-
-#include "WTypesbase.h"
-
-#if DBG
-#define DLog(...)  DbgPrintEx(0, DPFLTR_ERROR_LEVEL, __VA_ARGS__); 
-#else
-#define DLog(...)
-#endif
-
-// Register interface
-#define TFA9890_I2S_CONTROL                 0x04
-#define TFA9890_SYSTEM_CONTROL              0x09
-
-// I2S control register bits
-#define TFA9890_I2S_CONTROL_BYPASS          0x0B88
-
-
-// System control register bits
-#define TFA9890_SYSTEM_CONTROL_BYPASS_1     0x0982
-#define TFA9890_SYSTEM_CONTROL_BYPASS_2     0x0806
-
-
-const unsigned short SENSOR_PA_MANUFACTURER[] = L"NXP";
-const unsigned short SENSOR_PA_MODEL[] = L"TFA9890";
+//Copyright (C) Microsoft Corporation, All Rights Reserved
+//
+//Abstract:
+//
+//      This module contains the constant definitions for the accelerometer's
+//      register interface and default property values.
+
+#pragma once
+
+#include "WTypesbase.h"
+
+#if DBG
+#define DLog(...)  DbgPrintEx(0, DPFLTR_ERROR_LEVEL, __VA_ARGS__); 
+#else
+#define DLog(...)
+#endif
+
+// Register interface
+#define TFA9890_STATUS                      0x00
+#define TFA9890_BATTERY_VOLTAGE             0x01
+#define TFA9890_TEMPERATURE                 0x02
+#define TFA9890_I2S_CONTROL                 0x04
+#define TFA9890_SYSTEM_CONTROL              0x09
+#define TFA9890_CF_CONTROLS                 0x70
+#define TFA9890_CF_MAD                      0x71
+#define TFA9890_CF_MEM                      0x72
+#define TFA9890_CF_STATUS                   0x73
+
+// Register values are kept in the byte order they appear on the bus, which
+// is the reverse of the register's numeric value. Values computed at run
+// time are converted with TFA9890_BUS_WORD.
+#define TFA9890_BUS_WORD(v)                 ((WORD)((((v) & 0xFF) << 8) | (((v) >> 8) & 0xFF)))
+
+// I2S control register bits
+#define TFA9890_I2S_CONTROL_BYPASS          0x0B88
+
+
+// System control register bits
+#define TFA9890_SYSTEM_CONTROL_BYPASS_1     0x0982
+#define TFA9890_SYSTEM_CONTROL_BYPASS_2     0x0806
+
+// CoolFlux DSP memory access. CF_CONTROLS selects the memory, CF_MAD the
+// word address and CF_MEM streams 24-bit words, most significant byte first.
+#define TFA9890_CF_CONTROLS_DMEM(m)         ((WORD)(((m) & 0x3) << 1))
+#define TFA9890_DMEM_PMEM                   0
+#define TFA9890_DMEM_XMEM                   1
+#define TFA9890_DMEM_YMEM                   2
+#define TFA9890_DMEM_IOMEM                  3
+#define TFA9890_DSP_WORD_BYTES              3
+
+// Parametric EQ. The DSP runs TFA9890_EQ_BANDS biquads, each stored in XMEM
+// as five 24-bit words { b0, b1, b2, -a1, -a2 }. Coefficients are halved
+// before conversion so that values in [-2, 2) fit the 1.23 format.
+#define TFA9890_EQ_BANDS                    10
+#define TFA9890_EQ_COEFFS                   5
+#define TFA9890_EQ_SAMPLE_RATE              48000
+#define TFA9890_EQ_MAX_GAIN_DB              24.0f
+#define TFA9890_XMEM_EQ_BASE                0x0400
+
+// DSP parameter banks. Every parameter set is held twice in XMEM, one bank
+// every TFA9890_XMEM_BANK_STRIDE words. The patch reads the bank select
+// word once per frame and runs from the bank it names, so a new set is
+// loaded into the idle bank while audio plays and switched to with a single
+// CF window transaction.
+#define TFA9890_DSP_BANKS                   2
+#define TFA9890_XMEM_BANK_STRIDE            0x0100
+#define TFA9890_XMEM_BANK_SELECT            0x03FF
+#define TFA9890_XMEM_EQ_BANK(n)             (TFA9890_XMEM_EQ_BASE + (n) * TFA9890_XMEM_BANK_STRIDE)
+
+// Speaker model history. Every model frame the patch stores one
+// { excursion, impedance } pair in a circular history in XMEM and then
+// increments the 24-bit sequence word that precedes it. Frame n is stored
+// in slot n % TFA9890_MODEL_HISTORY_LENGTH, so a poll reads the sequence
+// word and then only the slots of the frames that are new.
+#define TFA9890_XMEM_MODEL_SEQUENCE         0x0600
+#define TFA9890_XMEM_MODEL_HISTORY          0x0601
+#define TFA9890_MODEL_HISTORY_LENGTH        64
+#define TFA9890_MODEL_WORDS_PER_SAMPLE      2
+#define TFA9890_MODEL_SEQUENCE_MASK         0x00FFFFFF
+#define TFA9890_MODEL_FRAME_RATE_HZ         4000
+
+// Model poll timing, derived from the frame rate. A poll comes every
+// TFA9890_MODEL_POLL_MS, half the time the DSP takes to wrap its history.
+// One frame takes TFA9890_MODEL_FRAME_BUS_US on a 400 kHz bus (9 clocks per
+// byte), and the DSP keeps producing frames while a poll reads them, so the
+// TFA9890_MODEL_HISTORY_GUARD oldest slots may be overwritten before a full
+// poll's frames are read; at most LENGTH - GUARD frames are taken.
+#define TFA9890_MODEL_POLL_MS               (TFA9890_MODEL_HISTORY_LENGTH / 2 * 1000 / TFA9890_MODEL_FRAME_RATE_HZ)
+#define TFA9890_MODEL_FRAMES_PER_POLL       (TFA9890_MODEL_FRAME_RATE_HZ * TFA9890_MODEL_POLL_MS / 1000)
+#define TFA9890_MODEL_FRAME_BUS_US          (TFA9890_MODEL_WORDS_PER_SAMPLE * TFA9890_DSP_WORD_BYTES * 9 * 10 / 4)
+#define TFA9890_MODEL_HISTORY_GUARD         ((TFA9890_MODEL_FRAMES_PER_POLL * TFA9890_MODEL_FRAME_BUS_US * \
+                                              TFA9890_MODEL_FRAME_RATE_HZ + 999999) / 1000000 + 1)
+
+// Speaker health diagnostics. Model frames are collected per amp into
+// windows of TFA9890_DIAG_WINDOW frames (a power of two) that are analyzed
+// as they fill. Windows whose excursion RMS (DSP full scale = 1.0) is below
+// TFA9890_DIAG_QUIET_RMS carry no usable spectrum. The first
+// TFA9890_DIAG_BASELINE_WINDOWS usable windows set the baseline the limits
+// are checked against.
+#define TFA9890_DIAG_WINDOW                 512
+#define TFA9890_DIAG_MIN_RESONANCE_HZ       100
+#define TFA9890_DIAG_QUIET_RMS              0.001f
+#define TFA9890_DIAG_BASELINE_WINDOWS       8
+#define TFA9890_DIAG_RE_DRIFT_LIMIT         0.10f
+#define TFA9890_DIAG_RESONANCE_SHIFT_LIMIT  0.15f
+#define TFA9890_DIAG_DISTORTION_LIMIT       0.10f
+
+// Number of amplifiers (I2C connections) a single device node can drive
+#define TFA9890_MAX_AMPS                    6
+
+// I2C error recovery. A failed transaction is re-issued up to
+// TFA9890_I2C_RETRY_COUNT times, doubling the backoff each time, but never
+// past TFA9890_RECOVERY_LATENCY_CAP_MS measured from the start of PowerOn.
+#define TFA9890_I2C_RETRY_COUNT             3
+#define TFA9890_I2C_RETRY_BACKOFF_MS        1
+#define TFA9890_RECOVERY_LATENCY_CAP_MS     50
+
+// Largest transfer issued while holding an amp's bus. Bulk transfers are
+// split at this size so urgent commands wait for at most one chunk. It is a
+// multiple of both the register and the DSP word size so no value is split.
+#define TFA9890_BULK_CHUNK_BYTES            60
+
+// Bus autotuning. Each amp is probed once with reads of increasing length
+// from the register file below the DSP window; the bulk chunk is then the
+// longest reliable transfer that fits TFA9890_TUNE_CHUNK_BUDGET_US, which
+// bounds how long an urgent command can wait behind it. If more than
+// TFA9890_TUNE_ERROR_PERMILLE of a window of TFA9890_TUNE_WINDOW
+// transactions fail, the amp falls back to TFA9890_BULK_CHUNK_BYTES and is
+// probed again on its next power-up.
+#define TFA9890_TUNE_MAX_BYTES              192
+#define TFA9890_TUNE_REPEATS                4
+#define TFA9890_TUNE_CHUNK_BUDGET_US        2000
+#define TFA9890_TUNE_WINDOW                 256
+#define TFA9890_TUNE_ERROR_PERMILLE         10
+
+// Largest read issued by a post-mortem dump. Dumps favour few long
+// transactions; an urgent command waits for at most one of them. Also a
+// multiple of both word sizes.
+#define TFA9890_DUMP_CHUNK_BYTES            510
+#define TFA9890_DUMP_MAX_REGIONS            16
+
+// Staggered power-up. At most PowerUpMaxConcurrent amps may be inside their
+// inrush window at once, and consecutive power-up steps start at least
+// PowerUpStaggerMs apart. Both can be overridden in the device hardware key.
+#define TFA9890_POWER_MAX_CONCURRENT        2
+#define TFA9890_POWER_STAGGER_MS            2
+#define TFA9890_POWER_INRUSH_WINDOW_MS      10
+
+// Register shadow and two-phase commit. Registers are addressed with one
+// byte, so the shadow covers the whole register space.
+#define TFA9890_REGISTER_COUNT              256
+#define TFA9890_MAX_STAGED                  32
+#define TFA9890_COMMIT_SKEW_BUDGET_US       200
+
+// Speaker model stream shared with user mode. The ring holds
+// TFA9890_STREAM_CAPACITY samples (a power of two) and is refilled every
+// model poll.
+#define TFA9890_STREAM_CAPACITY             4096
+#define TFA9890_STREAM_PERIOD_MS            TFA9890_MODEL_POLL_MS
+
+// I2C transaction recorder. Records collect in a buffer of this size that is
+// written out at the end of each power transition or whenever it fills.
+#define TFA9890_RECORD_BUFFER_BYTES         0x10000
+
+// Init profiles compiled from the driver's Parameters key at DriverEntry
+#define TFA9890_MAX_PROFILES                8
+#define TFA9890_MAX_INIT_STEPS              64
+#define TFA9890_PROFILE_NAME_CHARS          32
+#define TFA9890_PROFILE_TEXT_CHARS          4096    // Longest REG_MULTI_SZ accepted
+
+// Amp state kept by the driver across PnP stop/start, keyed by connection
+#define TFA9890_STORE_ENTRIES               16
+
+// Power stage gating on audio stream hints. PWDN is a numeric register
+// bit; convert with TFA9890_BUS_WORD.
+#define TFA9890_SYSTEM_CONTROL_PWDN         0x0001
+#define TFA9890_POWER_GATE_HYSTERESIS_MS    2000
+
+// The sequencer writes the power stage. Hints wait for its run, at most
+// TFA9890_MAX_PENDING_HINTS of them, and a run that finds the sequencer
+// restoring an amp is tried again TFA9890_POWER_STAGE_RETRY_MS later.
+#define TFA9890_MAX_PENDING_HINTS           8
+#define TFA9890_POWER_STAGE_RETRY_MS        10
+
+// Reset watchdog. While in D0 the signature register of every online amp is
+// read every TFA9890_WATCHDOG_INTERVAL_MS; a value other than the shadowed
+// one means a supply dip reset the amp behind the driver's back. The
+// interval can be overridden in the device hardware key; 0 disables it.
+#define TFA9890_WATCHDOG_SIGNATURE          TFA9890_SYSTEM_CONTROL
+#define TFA9890_WATCHDOG_INTERVAL_MS        500
+
+// Write verification. After a register sequence the registers it wrote are
+// read back with one burst per amp and compared with the shadow, and any
+// that differ are rewritten. VerifyWrites in the device hardware key picks
+// the policy: TFA9890_VERIFY_SAMPLED checks TFA9890_VERIFY_SAMPLE_COUNT of
+// them per sequence, rotating through the rest, plus system control.
+// Self-clearing bits are not compared; they are numeric register bits.
+#define TFA9890_VERIFY_OFF                  0
+#define TFA9890_VERIFY_SAMPLED              1
+#define TFA9890_VERIFY_FULL                 2
+#define TFA9890_VERIFY_SAMPLE_COUNT         4
+#define TFA9890_SYSTEM_CONTROL_I2CR         0x0002  // Soft reset, reads back 0
+
+// Hibernate images. On D0 exit the state of each amp is captured as the
+// bursts and power steps that rebuild it, and on D0 entry written back in
+// place of the init sequence. HibernateImage in the device hardware key
+// disables it with 0.
+#define TFA9890_HIBERNATE_MAX_BURSTS        (TFA9890_REGISTER_COUNT / 2 + TFA9890_MAX_INIT_STEPS)
+#define TFA9890_HIBERNATE_MAX_WORDS         (TFA9890_REGISTER_COUNT + TFA9890_MAX_INIT_STEPS)
+
+// DSP images uploaded after the init sequence. Image files are cached once
+// per driver and shared by every device and amp that names the same content.
+#define TFA9890_MAX_IMAGES                  8
+#define TFA9890_IMAGE_CACHE_ENTRIES         16
+#define TFA9890_IMAGE_LIST_CHARS            1024    // Longest DspImages REG_MULTI_SZ accepted
+#define TFA9890_DSP_IMAGE_MAX_BYTES         0x10000
+#define TFA9890_DSP_IMAGE_MAGIC             0x4D493954  // 'T9IM'
+#define TFA9890_DSP_IMAGE_VERSION           1
+
+// DSP image file: this header followed by WordCount packed 24-bit words,
+// most significant byte first, written from Address on in MemoryType
+#pragma pack(push, 1)
+typedef struct _TFA9890_DSP_IMAGE_HEADER
+{
+    ULONG   Magic;                          // TFA9890_DSP_IMAGE_MAGIC
+    USHORT  Version;                        // TFA9890_DSP_IMAGE_VERSION
+    BYTE    MemoryType;                     // TFA9890_DMEM_*
+    BYTE    Reserved;
+    USHORT  Address;
+    USHORT  WordCount;
+} TFA9890_DSP_IMAGE_HEADER, *PTFA9890_DSP_IMAGE_HEADER;
+#pragma pack(pop)
+
+// Telemetry. Status, battery and temperature are read in one burst. Fault
+// bits and scales apply to the numeric register value. Over-current is
+// flagged by a set bit, while the over-temperature and over/under-voltage
+// bits read 1 while their condition is fine, so a fault is
+// (Status & FAULTS_SET) | (~Status & FAULTS_CLEAR), reported as set bits.
+#define TFA9890_STATUS_FAULTS_SET           0x0020  // OCDS, over-current
+#define TFA9890_STATUS_FAULTS_CLEAR         0x001C  // OTDS, OVDS, UVDS: temperature and voltage in range
+#define TFA9890_STATUS_FAULTS               (TFA9890_STATUS_FAULTS_SET | TFA9890_STATUS_FAULTS_CLEAR)
+#define TFA9890_BATTERY_VOLTS_PER_LSB       (5.5f / 1024.0f)
+#define TFA9890_TEMPERATURE_MASK            0x01FF  // Signed 9-bit degrees C
+
+// Adaptive telemetry sampling, per amp sensor. The client's interval is the
+// shortest one used. After TFA9890_SAMPLE_STABLE_COUNT samples without a change past the
+// sensor's thresholds or a fault, the interval doubles up to TFA9890_SAMPLE_MAX_INTERVAL_MS;
+// any change or fault returns to the client's interval at once. The steps
+// are the thresholds a sensor starts with, and those of the shared sampling.
+#define TFA9890_SAMPLE_DEFAULT_INTERVAL_MS  100
+#define TFA9890_SAMPLE_MIN_INTERVAL_MS      10
+#define TFA9890_SAMPLE_MAX_INTERVAL_MS      2000
+#define TFA9890_SAMPLE_STABLE_COUNT         4
+#define TFA9890_SAMPLE_TEMPERATURE_STEP_C   1.0f
+#define TFA9890_SAMPLE_BATTERY_STEP_V       0.05f
+
+// Windowed aggregation. With AggregateWindow set in the device hardware key
+// each amp's sensor is sent window statistics once every that many
+// telemetry samples instead of every sample. Windows are capped at
+// TFA9890_AGGREGATE_MAX_WINDOW samples.
+#define TFA9890_AGGREGATE_MAX_WINDOW        64
+
+// Telemetry history, kept when HistoryFile is set. Its samples are taken
+// at TFA9890_HISTORY_INTERVAL_MS at the most, or faster while a client
+// samples faster; a partly filled block is written out at least every
+// TFA9890_HISTORY_FLUSH_MS.
+#define TFA9890_HISTORY_DEFAULT_KB          256
+#define TFA9890_HISTORY_MIN_KB              16
+#define TFA9890_HISTORY_INTERVAL_MS         1000
+#define TFA9890_HISTORY_FLUSH_MS            60000
+
+// Telemetry subscriptions served by one shared bus read
+#define TFA9890_MAX_SUBSCRIPTIONS           8
+
+// Sequence step flags
+#define TFA9890_STEP_POWER                  0x01    // Step enables the amplifier's power stage
+#define TFA9890_STEP_SETTLE                 0x02    // Nothing is written; wait Value ms before the next step
+
+const WCHAR SENSOR_PA_MANUFACTURER[] = L"NXP";
+const WCHAR SENSOR_PA_MODEL[] = L"TFA9890";
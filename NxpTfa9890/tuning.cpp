@@ -0,0 +1,166 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module autotunes each amplifier's I2C transfers. Amps and boards
+//    differ in the longest burst they carry reliably and in what a
+//    transaction costs, so every amp is probed once, the first time its
+//    connection is prepared, and the result is kept with its learned state.
+//    The batching paths size their chunks from it. An amp whose error rate
+//    rises drops back to the conservative chunk and is probed again.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Tuning.tmh"
+
+
+// Probe lengths. Multiples of both the register and the DSP word size, and
+// short enough to stay in the register file below the DSP window.
+static const ULONG ProbeBytes[] = { 6, 12, 24, 48, 96, TFA9890_TUNE_MAX_BYTES };
+
+C_ASSERT(TFA9890_TUNE_MAX_BYTES / sizeof(WORD) <= TFA9890_CF_CONTROLS);
+C_ASSERT(0 == TFA9890_TUNE_MAX_BYTES % (sizeof(WORD) * TFA9890_DSP_WORD_BYTES));
+
+// Probe the amps that need it: those never probed, or with StaleOnly only
+// those whose tuning went stale. Amps that cannot be probed keep the
+// conservative chunk.
+VOID NxpTfa9890Device::TuneBus(
+    _In_ bool StaleOnly)    // Only re-probe amps whose error rate rose
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        if (StaleOnly ? !pAmp->Tuning.Stale : pAmp->Tuning.Valid)
+        {
+            continue;
+        }
+
+        if (ProbeBus(pAmp))
+        {
+            TraceInformation("ACC %!FUNC! Amp %u max burst %u bytes%s, overhead %u us, %u ns/byte, chunk %u bytes",
+                             Amp, pAmp->Tuning.MaxBurstBytes, pAmp->Tuning.Limited ? " (limited)" : "",
+                             pAmp->Tuning.OverheadUs, pAmp->Tuning.ByteNs, pAmp->Tuning.ChunkBytes);
+        }
+        else
+        {
+            TraceWarning("ACC %!FUNC! Amp %u could not be probed, chunk stays %u bytes", Amp, TFA9890_BULK_CHUNK_BYTES);
+        }
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+// Read the register file with increasing lengths, TFA9890_TUNE_REPEATS
+// times each, until a read fails. The mean times of the shortest and the
+// longest reliable length give the fixed and the per-byte cost; the chunk is
+// the longest reliable length whose transfer fits the budget. The caller
+// holds m_I2CWaitLock.
+bool NxpTfa9890Device::ProbeBus(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier to probe
+{
+    BYTE Buffer[TFA9890_TUNE_MAX_BYTES];
+    ULONG MeanUs[_countof(ProbeBytes)] = {};
+    ULONG Reliable = 0;
+    bool Limited = false;
+
+    for (ULONG Size = 0; Size < _countof(ProbeBytes) && !Limited; Size++)
+    {
+        ULONGLONG TotalUs = 0;
+
+        pAmp->Scheduler.Acquire(TFA9890_CMD_CLASS_BULK);
+        for (ULONG Repeat = 0; Repeat < TFA9890_TUNE_REPEATS; Repeat++)
+        {
+            LONGLONG Start = QpcNow();
+            if (!NT_SUCCESS(BusRead(pAmp, TFA9890_STATUS, Buffer, ProbeBytes[Size])))
+            {
+                Limited = true;
+                break;
+            }
+            TotalUs += QpcToUs(QpcNow() - Start);
+        }
+        pAmp->Scheduler.Release();
+
+        if (!Limited)
+        {
+            MeanUs[Size] = static_cast<ULONG>(TotalUs / TFA9890_TUNE_REPEATS);
+            Reliable = Size + 1;
+        }
+    }
+
+    // The probe's own failures do not count against the new tuning
+    pAmp->Tuning.Transactions = 0;
+    pAmp->Tuning.Errors = 0;
+    pAmp->Tuning.Probes++;
+
+    if (0 == Reliable)
+    {
+        pAmp->Tuning.Valid = false;
+        pAmp->Tuning.Stale = false;
+        return false;
+    }
+
+    ULONG Last = Reliable - 1;
+    ULONG ByteNs = 0;
+    if (Last > 0 && MeanUs[Last] > MeanUs[0])
+    {
+        ByteNs = ((MeanUs[Last] - MeanUs[0]) * 1000) / (ProbeBytes[Last] - ProbeBytes[0]);
+    }
+    ULONG OverheadUs = MeanUs[0] - min(MeanUs[0], (ProbeBytes[0] * ByteNs) / 1000);
+
+    // Longest multiple of the probe granule that fits the budget
+    ULONG ChunkBytes = ProbeBytes[Last];
+    if (0 != ByteNs)
+    {
+        ULONG Budget = (TFA9890_TUNE_CHUNK_BUDGET_US > OverheadUs) ? TFA9890_TUNE_CHUNK_BUDGET_US - OverheadUs : 0;
+        ULONG Fit = ((Budget * 1000) / ByteNs) / ProbeBytes[0] * ProbeBytes[0];
+        ChunkBytes = max(ProbeBytes[0], min(Fit, ChunkBytes));
+    }
+
+    pAmp->Tuning.Valid = true;
+    pAmp->Tuning.Stale = false;
+    pAmp->Tuning.Limited = Limited;
+    pAmp->Tuning.MaxBurstBytes = ProbeBytes[Last];
+    pAmp->Tuning.OverheadUs = OverheadUs;
+    pAmp->Tuning.ByteNs = ByteNs;
+    pAmp->Tuning.ChunkBytes = ChunkBytes;
+    return true;
+}
+
+// Count one transaction against the amp's error-rate window. A window with
+// too many errors marks the tuning stale, which puts the amp back on the
+// conservative chunk until it is probed again.
+VOID NxpTfa9890Device::AccountTransaction(
+    _In_ PTFA9890_AMP pAmp,     // Amplifier the transaction went to
+    _In_ NTSTATUS Status)       // Transaction status
+{
+    PTFA9890_BUS_TUNING pTuning = &pAmp->Tuning;
+
+    pTuning->Transactions++;
+    if (!NT_SUCCESS(Status))
+    {
+        pTuning->Errors++;
+    }
+
+    if (pTuning->Transactions < TFA9890_TUNE_WINDOW)
+    {
+        return;
+    }
+
+    if (pTuning->Valid && !pTuning->Stale &&
+        pTuning->Errors * 1000 > pTuning->Transactions * TFA9890_TUNE_ERROR_PERMILLE)
+    {
+        pTuning->Stale = true;
+        TraceWarning("ACC %!FUNC! Amp 0x%I64x had %u errors in %u transactions, re-probing on the next power-up",
+                     pAmp->ConnectionId.QuadPart, pTuning->Errors, pTuning->Transactions);
+        DLog("PA: Bus error rate rose, tuning dropped\n");//DebugLog
+    }
+
+    pTuning->Transactions = 0;
+    pTuning->Errors = 0;
+}
@@ -0,0 +1,194 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the write verification. Register writes are not
+//    acknowledged beyond the I2C ACK, so a write corrupted on the bus goes
+//    unnoticed until the audio is wrong. Reading back every write would
+//    double the bus time; instead the registers a sequence wrote are read
+//    back in bursts once the sequence is done, one per amp on each side of
+//    the DSP window, compared with the shadow, and only the registers that
+//    differ are written again.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+
+#include "Verify.tmh"
+
+
+// Registers that read back what was written. Status, battery and
+// temperature are read-only, and the DSP window streams into DSP memory.
+inline bool IsVerifiable(
+    _In_ ULONG Register)
+{
+    return Register > TFA9890_TEMPERATURE &&
+           (Register < TFA9890_CF_CONTROLS || Register > TFA9890_CF_STATUS);
+}
+
+// Compare a read-back value with the written one, both in bus byte order,
+// ignoring self-clearing bits
+inline bool IsReadBackValid(
+    _In_ ULONG Register,
+    _In_ WORD Value,
+    _In_ WORD Expected)
+{
+    WORD Mask = (TFA9890_SYSTEM_CONTROL == Register) ? static_cast<WORD>(~TFA9890_BUS_WORD(TFA9890_SYSTEM_CONTROL_I2CR)) : 0xFFFF;
+    return 0 == ((Value ^ Expected) & Mask);
+}
+
+// Verify the registers of one amp set in pWritten under the configured
+// policy. The selected registers are read with one burst spanning them
+// on each side of the DSP window, which a burst must not pass through; a
+// register that differs from its shadow is rewritten and read back once
+// more. The caller holds m_I2CWaitLock.
+VOID NxpTfa9890Device::VerifyAmp(
+    _In_ PTFA9890_AMP pAmp,                                         // Amplifier the sequence went to
+    _In_ TFA9890_CMD_CLASS Class,                                   // Priority class of the sequence
+    _In_reads_(TFA9890_REGISTER_COUNT / 32) const ULONG* pWritten,  // Registers the sequence wrote
+    _In_ LONGLONG Deadline)                                         // QPC time after which no retry may be started
+{
+    BYTE Candidates[TFA9890_REGISTER_COUNT];
+    bool Selected[TFA9890_REGISTER_COUNT] = {};
+    WORD Values[TFA9890_REGISTER_COUNT];
+    ULONG CandidateCount = 0;
+    ULONG First = TFA9890_REGISTER_COUNT;
+    ULONG Last = 0;
+
+    if (TFA9890_VERIFY_OFF == m_VerifyPolicy)
+    {
+        return;
+    }
+
+    for (ULONG Register = 0; Register < TFA9890_REGISTER_COUNT; Register++)
+    {
+        if (IsVerifiable(Register) &&
+            0 != (pWritten[Register / 32] & (1UL << (Register % 32))) &&
+            IsRegisterShadowed(pAmp, Register))
+        {
+            Candidates[CandidateCount++] = static_cast<BYTE>(Register);
+        }
+    }
+
+    if (0 == CandidateCount)
+    {
+        return;
+    }
+
+    if (TFA9890_VERIFY_FULL == m_VerifyPolicy || CandidateCount <= TFA9890_VERIFY_SAMPLE_COUNT)
+    {
+        for (ULONG i = 0; i < CandidateCount; i++)
+        {
+            Selected[Candidates[i]] = true;
+        }
+    }
+    else
+    {
+        // A window rotating through the candidates, plus system control,
+        // which gates the whole amp
+        for (ULONG i = 0; i < TFA9890_VERIFY_SAMPLE_COUNT; i++)
+        {
+            Selected[Candidates[(pAmp->VerifyCursor + i) % CandidateCount]] = true;
+        }
+        pAmp->VerifyCursor = (pAmp->VerifyCursor + TFA9890_VERIFY_SAMPLE_COUNT) % CandidateCount;
+
+        if (IsRegisterShadowed(pAmp, TFA9890_SYSTEM_CONTROL) &&
+            0 != (pWritten[TFA9890_SYSTEM_CONTROL / 32] & (1UL << (TFA9890_SYSTEM_CONTROL % 32))))
+        {
+            Selected[TFA9890_SYSTEM_CONTROL] = true;
+        }
+    }
+
+    for (ULONG Register = 0; Register < TFA9890_REGISTER_COUNT; Register++)
+    {
+        if (Selected[Register])
+        {
+            First = min(First, Register);
+            Last = Register;
+        }
+    }
+
+    LONGLONG Start = QpcNow();
+    ULONG Amp = static_cast<ULONG>(pAmp - m_Amps);
+
+    pAmp->Verify.Passes++;
+
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    // Reading through the window would stream DSP memory into the burst
+    for (ULONG SpanFirst = First; SpanFirst <= Last; )
+    {
+        if (!IsRestorable(SpanFirst))
+        {
+            SpanFirst++;
+            continue;
+        }
+
+        ULONG SpanLast = SpanFirst;
+        while (SpanLast < Last && IsRestorable(SpanLast + 1))
+        {
+            SpanLast++;
+        }
+
+        Status = ReadBurst(pAmp,
+                           Class,
+                           static_cast<BYTE>(SpanFirst),
+                           reinterpret_cast<BYTE*>(&Values[SpanFirst]),
+                           (SpanLast - SpanFirst + 1) * sizeof(WORD),
+                           true,
+                           BulkChunkBytes(pAmp));
+        if (!NT_SUCCESS(Status))
+        {
+            pAmp->Verify.Failures++;
+            pAmp->Verify.BusUs += QpcToUs(QpcNow() - Start);
+            TraceError("ACC %!FUNC! Amp %u read-back of 0x%02x-0x%02x failed %!STATUS!", Amp, SpanFirst, SpanLast, Status);
+            return;
+        }
+
+        SpanFirst = SpanLast + 1;
+    }
+
+    for (ULONG Register = First; Register <= Last; Register++)
+    {
+        if (!Selected[Register])
+        {
+            continue;
+        }
+
+        WORD Expected = pAmp->Shadow[Register];
+
+        pAmp->Verify.Checked++;
+        if (IsReadBackValid(Register, Values[Register], Expected))
+        {
+            continue;
+        }
+
+        pAmp->Verify.Mismatches++;
+        TraceWarning("ACC %!FUNC! Amp %u register 0x%02x reads 0x%04x, written 0x%04x",
+                     Amp, Register, TFA9890_BUS_WORD(Values[Register]), TFA9890_BUS_WORD(Expected));
+        DLog("PA: Amp %u register 0x%02x read-back mismatch\n", Amp, Register);//DebugLog
+
+        Status = WriteRegisterWithRetry(pAmp, Class, static_cast<BYTE>(Register), Expected, Deadline);
+        if (NT_SUCCESS(Status))
+        {
+            pAmp->Scheduler.Acquire(Class);
+            Status = BusRead(pAmp, static_cast<BYTE>(Register), reinterpret_cast<BYTE*>(&Values[Register]), sizeof(WORD));
+            pAmp->Scheduler.Release();
+        }
+
+        if (NT_SUCCESS(Status) && IsReadBackValid(Register, Values[Register], Expected))
+        {
+            pAmp->Verify.Rewrites++;
+        }
+        else
+        {
+            pAmp->Verify.Failures++;
+            TraceError("ACC %!FUNC! Amp %u register 0x%02x could not be rewritten %!STATUS!", Amp, Register, Status);
+            DLog("PA: Amp %u register 0x%02x rewrite failed %d\n", Amp, Register, Status);//DebugLog
+        }
+    }
+
+    pAmp->Verify.BusUs += QpcToUs(QpcNow() - Start);
+}
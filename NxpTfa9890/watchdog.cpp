@@ -0,0 +1,308 @@
+//Copyright (C) Microsoft Corporation, All Rights Reserved.
+//
+//Abstract:
+//
+//    This module contains the reset watchdog. A supply dip can reset an
+//    amplifier while the device stays in D0, and PowerOn only runs on D0
+//    entry, so the amp would sit in its power-on defaults until the next
+//    power transition. The watchdog reads one signature register per amp
+//    and, when it no longer holds the shadowed value, takes the amp offline
+//    and has the sequencer write its whole known configuration back in the
+//    order of a hibernate image: the configuration registers as bursts,
+//    then the power steps with their settle timers. No lock is held while
+//    the amp settles. FinishRestore then verifies the restored registers
+//    like an init sequence and reloads the DSP images and the EQ bank.
+//
+//Environment:
+//
+//   Windows User-Mode Driver Framework (UMDF)
+
+#include "Device.h"
+#include "Eq.h"
+
+#include "Watchdog.tmh"
+
+
+// Create the periodic watchdog timer. It runs only while in D0.
+NTSTATUS NxpTfa9890Device::CreateWatchdogTimer()
+{
+    if (0 == m_WatchdogIntervalMs)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    WDF_TIMER_CONFIG TimerConfig;
+    WDF_TIMER_CONFIG_INIT_PERIODIC(&TimerConfig, NxpTfa9890Device::OnWatchdogTimer, m_WatchdogIntervalMs);
+    TimerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES TimerAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+    TimerAttributes.ParentObject = m_SensorInstance;
+
+    NTSTATUS Status = WdfTimerCreate(&TimerConfig, &TimerAttributes, &m_WatchdogTimer);
+    if (!NT_SUCCESS(Status))
+    {
+        TraceError("ACC %!FUNC! WdfTimerCreate failed %!STATUS!", Status);
+    }
+
+    return Status;
+}
+
+// Stop checking while leaving D0. Waits for a check or restore in progress.
+VOID NxpTfa9890Device::SuspendWatchdog()
+{
+    if (NULL != m_WatchdogTimer)
+    {
+        WdfTimerStop(m_WatchdogTimer, TRUE);
+    }
+}
+
+VOID NxpTfa9890Device::ResumeWatchdog()
+{
+    if (NULL != m_WatchdogTimer)
+    {
+        WdfTimerStart(m_WatchdogTimer, WDF_REL_TIMEOUT_IN_MS(m_WatchdogIntervalMs));
+    }
+}
+
+// Read the signature register of every online amp and start restoring the
+// amps that were reset. A check that finds the bus taken by a power
+// transition or a long transfer is skipped; the next one is one interval
+// away, and so is one that finds the sequencer busy.
+VOID NxpTfa9890Device::CheckAmpResets()
+{
+    LONGLONG Timeout = 0;
+    ULONG ResetMask = 0;
+
+    if (STATUS_SUCCESS != WdfWaitLockAcquire(m_I2CWaitLock, &Timeout))
+    {
+        return;
+    }
+
+    // Not counted against the flows timed for IOCTL_TFA9890_GET_PERF
+    m_BusBackground = true;
+
+    for (ULONG Amp = 0; m_PoweredOn && Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        WORD Value = 0;
+
+        if (!pAmp->Online || !IsRegisterShadowed(pAmp, TFA9890_WATCHDOG_SIGNATURE))
+        {
+            continue;
+        }
+
+        pAmp->Scheduler.Acquire(TFA9890_CMD_CLASS_TELEMETRY);
+        NTSTATUS Status = BusRead(pAmp, TFA9890_WATCHDOG_SIGNATURE, reinterpret_cast<BYTE*>(&Value), sizeof(Value));
+        pAmp->Scheduler.Release();
+
+        pAmp->Watchdog.Checks++;
+
+        // A failed read says nothing about the amp's state
+        if (!NT_SUCCESS(Status) || Value == pAmp->Shadow[TFA9890_WATCHDOG_SIGNATURE])
+        {
+            continue;
+        }
+
+        TraceWarning("ACC %!FUNC! Amp %u reset detected, signature 0x%04x, expected 0x%04x",
+                     Amp, TFA9890_BUS_WORD(Value), TFA9890_BUS_WORD(pAmp->Shadow[TFA9890_WATCHDOG_SIGNATURE]));
+        DLog("PA: Amp %u reset detected\n", Amp);//DebugLog
+
+        // The image is only needed until the next D0 exit captures a new one
+        if (!CaptureRestoreImage(pAmp, &pAmp->Hibernate))
+        {
+            pAmp->Watchdog.RestoreFailures++;
+            TraceError("ACC %!FUNC! Amp %u state does not fit a restore image %!STATUS!", Amp, STATUS_BUFFER_OVERFLOW);
+            continue;
+        }
+
+        // Nothing else uses the amp until FinishRestore has written it back
+        pAmp->Online = false;
+        ResetMask |= 1UL << Amp;
+    }
+
+    m_BusBackground = false;
+
+    if (0 != ResetMask)
+    {
+        RecordMarker(TFA9890_TRACE_MARKER_RESTORE);
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    if (0 == ResetMask)
+    {
+        return;
+    }
+
+    LONGLONG Detected = QpcNow();
+    bool Started = StartSequence(Tfa9890RunRestore, true, ResetMask);
+
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+
+        if (0 == (ResetMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        if (Started)
+        {
+            pAmp->Watchdog.Resets++;
+            pAmp->Watchdog.LastReset = Detected;
+        }
+        else
+        {
+            // D0 exit has begun; its image captures the amp's shadow
+            pAmp->Online = true;
+        }
+    }
+
+    WdfWaitLockRelease(m_I2CWaitLock);
+}
+
+// Complete a restore once the sequencer has written the reset amps back
+// from their restore images: verify the registers, then reload the DSP
+// images and the EQ bank, as FinishPowerUp does after a hibernate image.
+// An amp the sequencer could not write is brought back online as well, so
+// the next check finds its signature still wrong and tries again. Runs on
+// the sequence work item.
+VOID NxpTfa9890Device::FinishRestore()
+{
+    WdfWaitLockAcquire(m_I2CWaitLock, NULL);
+    m_BusBackground = true;
+
+    for (ULONG Amp = 0; Amp < m_AmpCount; Amp++)
+    {
+        PTFA9890_AMP pAmp = &m_Amps[Amp];
+        NTSTATUS Status = STATUS_SUCCESS;
+
+        if (0 == (m_SequenceAmpMask & (1UL << Amp)))
+        {
+            continue;
+        }
+
+        pAmp->Online = true;
+        pAmp->Watchdog.Registers = pAmp->Hibernate.WordCount;
+
+        if (Tfa9890SeqDone == pAmp->SeqState)
+        {
+            VerifyAmp(pAmp, TFA9890_CMD_CLASS_GAIN, pAmp->Hibernate.Written, QpcNow() + QpcFromMs(TFA9890_RECOVERY_LATENCY_CAP_MS));
+
+            // The DSP lost its memory with the reset; the model history starts over
+            pAmp->ModelPrimed = false;
+
+            Status = UploadImages(pAmp);
+            if (NT_SUCCESS(Status))
+            {
+                Status = RestoreEqBank(pAmp);
+            }
+        }
+        else
+        {
+            // Stopped by the recovery deadline if no write failed
+            Status = NT_SUCCESS(pAmp->LastStatus) ? STATUS_IO_TIMEOUT : pAmp->LastStatus;
+        }
+
+        ULONG RestoreUs = QpcToUs(QpcNow() - pAmp->Watchdog.LastReset);
+
+        if (NT_SUCCESS(Status))
+        {
+            pAmp->Watchdog.Restores++;
+            pAmp->Watchdog.LastRestoreUs = RestoreUs;
+            pAmp->Watchdog.MaxRestoreUs = max(pAmp->Watchdog.MaxRestoreUs, RestoreUs);
+            TraceInformation("ACC %!FUNC! Amp %u restored, %u registers, %u us after detection",
+                             Amp, pAmp->Watchdog.Registers, RestoreUs);
+        }
+        else
+        {
+            // The signature still differs, so the next check tries again
+            pAmp->Watchdog.RestoreFailures++;
+            TraceError("ACC %!FUNC! Amp %u restore failed after %u us %!STATUS!", Amp, RestoreUs, Status);
+            DLog("PA: Amp %u restore failed %d\n", Amp, Status);//DebugLog
+        }
+    }
+
+    m_BusBackground = false;
+    WdfWaitLockRelease(m_I2CWaitLock);
+
+    RecordMarker(TFA9890_TRACE_MARKER_RESTORE_DONE);
+
+    EndSequence();
+}
+
+// Rewrite the EQ bank the DSP was running from and select it again. A set
+// loaded into the idle bank but not yet switched to is lost with the reset,
+// and a load in progress is abandoned. The caller holds m_I2CWaitLock.
+NTSTATUS NxpTfa9890Device::RestoreEqBank(
+    _In_ PTFA9890_AMP pAmp)     // Amplifier that was reset
+{
+    ULONG Bank = pAmp->ActiveBank;
+    ULONG Valid = pAmp->EqValid[Bank];
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    pAmp->EqValid[Bank ^ 1] = 0;
+    pAmp->BankPending = false;
+    pAmp->EqLoading = false;
+
+    if (0 == Valid)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    // Nothing is known to match the DSP until it has been written
+    pAmp->EqValid[Bank] = 0;
+
+    for (ULONG First = 0; NT_SUCCESS(Status) && First < TFA9890_EQ_BANDS; )
+    {
+        if (0 == (Valid & (1UL << First)))
+        {
+            First++;
+            continue;
+        }
+
+        ULONG Last = First + 1;
+        while (Last < TFA9890_EQ_BANDS && 0 != (Valid & (1UL << Last)))
+        {
+            Last++;
+        }
+
+        BYTE Buffer[TFA9890_EQ_BANDS * TFA9890_EQ_COEFFS * TFA9890_DSP_WORD_BYTES];
+        ULONG Words = (Last - First) * TFA9890_EQ_COEFFS;
+
+        EqPackDspWords(&pAmp->EqCoeffs[Bank][First][0], Words, Buffer);
+        Status = WriteDspMemory(pAmp, TFA9890_CMD_CLASS_GAIN, TFA9890_DMEM_XMEM,
+                                static_cast<WORD>(TFA9890_XMEM_EQ_BANK(Bank) + First * TFA9890_EQ_COEFFS),
+                                Buffer, Words * TFA9890_DSP_WORD_BYTES);
+        First = Last;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Status = WriteDspWord(pAmp, TFA9890_CMD_CLASS_GAIN, TFA9890_DMEM_XMEM, TFA9890_XMEM_BANK_SELECT, static_cast<LONG>(Bank));
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        pAmp->EqValid[Bank] = Valid;
+    }
+    else
+    {
+        TraceError("ACC %!FUNC! EQ bank %u could not be restored %!STATUS!", Bank, Status);
+    }
+
+    return Status;
+}
+
+VOID NxpTfa9890Device::OnWatchdogTimer(
+    _In_ WDFTIMER Timer)    // Watchdog timer, parented to the sensor instance
+{
+    PNxpTfa9890Device pDevice = GetNxpTfa9890ContextFromSensorInstance(WdfTimerGetParentObject(Timer));
+    if (nullptr != pDevice)
+    {
+        pDevice->CheckAmpResets();
+    }
+}